@@ -48,6 +48,8 @@ static void usage(FILE *stream, const char *prog_name)
                     "                  Search file for text pattern\n"
                     "  -n, --num-matches\n"
                     "                  Maximum number of matches\n"
+                    "  -j, --threads <threads>\n"
+                    "                  Number of search threads (0 = number of CPUs)\n"
                     "  --start-offset  Starting boundary offset for search\n"
                     "  --end-offset    Ending boundary offset for search\n",
                     prog_name);
@@ -95,7 +97,8 @@ static bool search(const char *name, mb::File &file,
                    std::optional<uint64_t> start,
                    std::optional<uint64_t> end,
                    std::string_view pattern,
-                   std::optional<uint64_t> max_matches)
+                   std::optional<uint64_t> max_matches,
+                   unsigned int threads)
 {
     using namespace std::placeholders;
 
@@ -110,6 +113,7 @@ static bool search(const char *name, mb::File &file,
     }
 
     mb::FileSearcher searcher(&file, pattern.data(), pattern.size());
+    searcher.set_threads(threads);
 
     while (true) {
         if (max_matches) {
@@ -144,7 +148,8 @@ static bool search(const char *name, mb::File &file,
 static bool search_stdin(std::optional<uint64_t> start,
                          std::optional<uint64_t> end,
                          std::string_view pattern,
-                         std::optional<uint64_t> max_matches)
+                         std::optional<uint64_t> max_matches,
+                         unsigned int threads)
 {
     mb::PosixFile file;
 
@@ -155,14 +160,15 @@ static bool search_stdin(std::optional<uint64_t> start,
         return false;
     }
 
-    return search("stdin", file, start, end, pattern, max_matches);
+    return search("stdin", file, start, end, pattern, max_matches, threads);
 }
 
 static bool search_file(const char *path,
                         std::optional<uint64_t> start,
                         std::optional<uint64_t> end,
                         std::string_view pattern,
-                        std::optional<uint64_t> max_matches)
+                        std::optional<uint64_t> max_matches,
+                        unsigned int threads)
 {
     mb::StandardFile file;
 
@@ -173,7 +179,7 @@ static bool search_file(const char *path,
         return false;
     }
 
-    return search(path, file, start, end, pattern, max_matches);
+    return search(path, file, start, end, pattern, max_matches, threads);
 }
 
 int main(int argc, char *argv[])
@@ -182,6 +188,7 @@ int main(int argc, char *argv[])
     std::optional<uint64_t> end;
     std::optional<uint64_t> max_matches;
     std::optional<std::string> pattern;
+    unsigned int threads = 1;
 
     int opt;
 
@@ -192,11 +199,12 @@ int main(int argc, char *argv[])
         OPT_END_OFFSET           = CHAR_MAX + 2,
     };
 
-    static const char short_options[] = "hn:p:t:";
+    static const char short_options[] = "hj:n:p:t:";
 
     static struct option long_options[] = {
         // Arguments with short versions
         {"help",         no_argument,       nullptr, 'h'},
+        {"threads",      required_argument, nullptr, 'j'},
         {"num-matches",  required_argument, nullptr, 'n'},
         {"hex",          required_argument, nullptr, 'p'},
         {"text",         required_argument, nullptr, 't'},
@@ -211,6 +219,14 @@ int main(int argc, char *argv[])
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
         switch (opt) {
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, threads)) {
+                fprintf(stderr, "Invalid value for -j/--threads: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
         case 'n': {
             uint64_t value;
             if (!mb::str_to_num(optarg, 10, value)) {
@@ -275,10 +291,11 @@ int main(int argc, char *argv[])
     bool ret = true;
 
     if (optind == argc) {
-        ret = search_stdin(start, end, *pattern, max_matches);
+        ret = search_stdin(start, end, *pattern, max_matches, threads);
     } else {
         for (int i = optind; i < argc; ++i) {
-            bool ret2 = search_file(argv[i], start, end, *pattern, max_matches);
+            bool ret2 = search_file(argv[i], start, end, *pattern,
+                                    max_matches, threads);
             if (!ret2) {
                 ret = false;
             }
@@ -23,6 +23,7 @@
 #include <cstdlib>
 #include <cstdio>
 
+#include "mbcommon/file/buffered.h"
 #include "mbcommon/file/standard.h"
 #include "mbsparse/sparse.h"
 
@@ -38,6 +39,7 @@ int main(int argc, char *argv[])
 
     mb::StandardFile input_file;
     mb::StandardFile output_file;
+    mb::BufferedFile buffered_file;
     mb::sparse::SparseFile sparse_file;
 
     auto open_ret = input_file.open(input_path, mb::FileOpenMode::ReadOnly);
@@ -47,7 +49,14 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    open_ret = sparse_file.open(&input_file);
+    open_ret = buffered_file.open(&input_file);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = sparse_file.open(&buffered_file);
     if (!open_ret) {
         fprintf(stderr, "%s: %s\n",
                 input_path, open_ret.error().message().c_str());
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbsparse/sparse_writer.h"
+
+static bool copy_range(mb::File &input_file, mb::File &sparse_file,
+                       uint64_t offset, uint64_t size)
+{
+    char buf[65536];
+
+    if (auto r = input_file.seek(static_cast<int64_t>(offset), SEEK_SET); !r) {
+        fprintf(stderr, "Failed to seek input file: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+    if (auto r = sparse_file.seek(static_cast<int64_t>(offset), SEEK_SET); !r) {
+        fprintf(stderr, "Failed to seek sparse file: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    while (size > 0) {
+        auto to_read = static_cast<size_t>(std::min<uint64_t>(size, sizeof(buf)));
+
+        auto n_read = mb::file_read_retry(input_file, buf, to_read);
+        if (!n_read) {
+            fprintf(stderr, "Failed to read input file: %s\n",
+                    n_read.error().message().c_str());
+            return false;
+        } else if (n_read.value() == 0) {
+            break;
+        }
+
+        if (auto r = mb::file_write_exact(sparse_file, buf, n_read.value());
+                !r) {
+            fprintf(stderr, "Failed to write sparse file: %s\n",
+                    r.error().message().c_str());
+            return false;
+        }
+
+        size -= n_read.value();
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3 && argc != 4) {
+        std::fprintf(stderr, "Usage: %s <input file> <output file>"
+                     " [block size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *input_path = argv[1];
+    const char *output_path = argv[2];
+    uint32_t block_size = mb::sparse::SparseWriter::DEFAULT_BLOCK_SIZE;
+
+    if (argc == 4) {
+        char *end;
+        auto value = strtoul(argv[3], &end, 10);
+        if (*argv[3] == '\0' || *end != '\0' || value > UINT32_MAX) {
+            fprintf(stderr, "Invalid block size: %s\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+        block_size = static_cast<uint32_t>(value);
+    }
+
+    mb::StandardFile input_file;
+    mb::StandardFile output_file;
+    mb::sparse::SparseWriter sparse_file;
+
+    auto open_ret = input_file.open(input_path, mb::FileOpenMode::ReadOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto input_size = input_file.seek(0, SEEK_END);
+    if (!input_size) {
+        fprintf(stderr, "%s: Failed to get size: %s\n",
+                input_path, input_size.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = output_file.open(output_path, mb::FileOpenMode::WriteOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = sparse_file.open(&output_file, block_size);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n",
+                output_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Only copy the data regions of the input file. Holes are skipped over and
+    // become "don't care" chunks.
+    for (uint64_t offset = 0; offset < input_size.value();) {
+        auto data = input_file.next_data(offset);
+        if (!data) {
+            fprintf(stderr, "%s: Failed to find data: %s\n",
+                    input_path, data.error().message().c_str());
+            return EXIT_FAILURE;
+        } else if (!data.value()) {
+            break;
+        }
+
+        auto hole = input_file.next_hole(*data.value());
+        if (!hole) {
+            fprintf(stderr, "%s: Failed to find hole: %s\n",
+                    input_path, hole.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        offset = hole.value().value_or(input_size.value());
+
+        if (!copy_range(input_file, sparse_file, *data.value(),
+                        offset - *data.value())) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto seek_ret = sparse_file.seek(
+            static_cast<int64_t>(input_size.value()), SEEK_SET);
+    if (!seek_ret) {
+        fprintf(stderr, "%s: Failed to seek: %s\n",
+                output_path, seek_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto close_ret = sparse_file.close();
+    if (!close_ret) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                output_path, close_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    close_ret = output_file.close();
+    if (!close_ret) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                output_path, close_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include <getopt.h>
+
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/standard.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_optimizer.h"
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [option...] <input file> <output file>\n"
+                    "\n"
+                    "Rewrite a sparse image with optimal chunking.\n"
+                    "\n"
+                    "Options:\n"
+                    "  -c, --crc32     Write CRC32 checksum to output image\n"
+                    "  -d, --discard-zeros\n"
+                    "                  Store all-zero blocks as \"don't care\"\n"
+                    "                  chunks instead of fill chunks. Only use\n"
+                    "                  this if the target partition is erased\n"
+                    "                  before flashing.\n",
+                    prog_name);
+}
+
+int main(int argc, char *argv[])
+{
+    mb::sparse::OptimizeOptions options;
+
+    int opt;
+
+    static const char short_options[] = "cdh";
+
+    static struct option long_options[] = {
+        {"crc32",         no_argument, nullptr, 'c'},
+        {"discard-zeros", no_argument, nullptr, 'd'},
+        {"help",          no_argument, nullptr, 'h'},
+        {nullptr,         0,           nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'c':
+            options.write_crc32 = true;
+            break;
+
+        case 'd':
+            options.discard_zero_blocks = true;
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *input_path = argv[optind];
+    const char *output_path = argv[optind + 1];
+
+    mb::StandardFile input_file;
+    mb::StandardFile output_file;
+    mb::BufferedFile buffered_file;
+    mb::sparse::SparseFile sparse_file;
+
+    auto open_ret = input_file.open(input_path, mb::FileOpenMode::ReadOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = buffered_file.open(&input_file);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = sparse_file.open(&buffered_file);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Existing checksums are dropped, so make sure they match before the data
+    // is rewritten
+    open_ret = sparse_file.set_verify_crc32(true);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = output_file.open(output_path, mb::FileOpenMode::WriteOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto ret = mb::sparse::optimize_sparse_file(sparse_file, output_file,
+                                                options);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to optimize sparse image: %s\n",
+                input_path, ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto input_size = input_file.seek(0, SEEK_END);
+    auto output_size = output_file.seek(0, SEEK_CUR);
+    if (input_size && output_size) {
+        printf("%s: %" PRIu64 " bytes -> %" PRIu64 " bytes\n",
+               output_path, input_size.value(), output_size.value());
+    }
+
+    auto close_ret = output_file.close();
+    if (!close_ret) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                output_path, close_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
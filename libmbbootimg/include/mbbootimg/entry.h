@@ -47,6 +47,29 @@ enum class EntryType
 MB_DECLARE_FLAGS(EntryTypes, EntryType)
 MB_DECLARE_OPERATORS_FOR_FLAGS(EntryTypes)
 
+enum class CompressionHint : uint8_t
+{
+    // No known compression signature (uncompressed or unrecognized data)
+    None,
+    Gzip,
+    Lz4,
+    Lzma,
+    Xz,
+    Bzip2,
+    Lzop,
+};
+
+struct EntryInfo
+{
+    EntryType type;
+    // Offset of the entry data in the boot image
+    uint64_t offset;
+    // Size of the entry data
+    uint64_t size;
+    // Compression format guessed from the first few bytes of the entry data
+    CompressionHint compression;
+};
+
 class MB_EXPORT Entry
 {
 public:
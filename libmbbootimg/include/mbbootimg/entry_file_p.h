@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+namespace mb::bootimg::detail
+{
+
+class EntryFile : public File
+{
+public:
+    EntryFile(File *file, uint64_t offset, uint64_t size);
+    virtual ~EntryFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EntryFile)
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+
+    bool is_open() override;
+
+private:
+    File *m_file;
+    uint64_t m_offset;
+    uint64_t m_size;
+    uint64_t m_pos;
+};
+
+}
@@ -23,7 +23,7 @@
 
 #include <optional>
 
-#include <openssl/sha.h>
+#include "mbcommon/hash.h"
 
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
@@ -59,7 +59,7 @@ private:
     // Header values
     AndroidHeader m_hdr;
 
-    SHA_CTX m_sha_ctx;
+    Hasher m_hasher;
 
     std::optional<SegmentWriter> m_seg;
 };
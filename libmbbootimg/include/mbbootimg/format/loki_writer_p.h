@@ -24,7 +24,7 @@
 #include <optional>
 #include <vector>
 
-#include <openssl/sha.h>
+#include "mbcommon/hash.h"
 
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
@@ -60,7 +60,7 @@ private:
 
     std::vector<unsigned char> m_aboot;
 
-    SHA_CTX m_sha_ctx;
+    Hasher m_hasher;
 
     std::optional<SegmentWriter> m_seg;
 };
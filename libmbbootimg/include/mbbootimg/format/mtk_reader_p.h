@@ -48,6 +48,7 @@ public:
     oc::result<Entry> go_to_entry(File &file,
                                   std::optional<EntryType> entry_type) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<std::vector<EntryInfo>> entries(File &file) override;
 
 private:
     // Header values
@@ -22,6 +22,9 @@
 #include "mbbootimg/guard_p.h"
 
 #include <optional>
+#include <vector>
+
+#include "mbcommon/hash.h"
 
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/mtk_p.h"
@@ -53,10 +56,27 @@ public:
     oc::result<void> finish_entry(File &file) override;
 
 private:
+    oc::result<void> hash_mtk_header(uint32_t size);
+    oc::result<void> hash_data(const void *buf, size_t size);
+    oc::result<void> hash_deferred_entry(File &file,
+                                         const SegmentWriterEntry &swentry);
+
     // Header values
     android::AndroidHeader m_hdr;
 
     std::optional<SegmentWriter> m_seg;
+
+    // SHA1 state for the ID field
+    Hasher m_hasher;
+    // MTK header of the current kernel or ramdisk. It can't be hashed until
+    // the size of the entry that follows is known.
+    std::vector<unsigned char> m_mtk_hdr;
+    // Whether hashing the current entry is deferred until its size is known
+    bool m_hash_deferred;
+    // Deferred entry data that hasn't been hashed yet
+    std::vector<unsigned char> m_deferred_data;
+    // Whether the deferred entry has more data than `m_deferred_data` holds
+    bool m_deferred_overflow;
 };
 
 }
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+namespace mb::bootimg::detail
+{
+
+struct PrefetchData
+{
+    // Underlying file for reads outside of the prefetched windows
+    File *file;
+    // Serializes reads of the underlying file
+    std::mutex file_lock;
+    // File size
+    uint64_t size;
+    // Data at the beginning of the file
+    std::vector<unsigned char> head;
+    // Data at the end of the file and its offset
+    std::vector<unsigned char> tail;
+    uint64_t tail_offset;
+};
+
+class PrefetchFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_HEAD_SIZE = 64 * 1024;
+    static constexpr size_t DEFAULT_TAIL_SIZE = 64 * 1024;
+
+    PrefetchFile();
+    PrefetchFile(std::shared_ptr<PrefetchData> data);
+    virtual ~PrefetchFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PrefetchFile)
+
+    static oc::result<std::shared_ptr<PrefetchData>>
+    prefetch(File &file, size_t head_size = DEFAULT_HEAD_SIZE,
+             size_t tail_size = DEFAULT_TAIL_SIZE);
+
+    oc::result<void> open(std::shared_ptr<PrefetchData> data);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+private:
+    std::shared_ptr<PrefetchData> m_data;
+    uint64_t m_pos;
+};
+
+}
@@ -66,6 +66,10 @@ public:
     oc::result<Entry> go_to_entry(std::optional<EntryType> entry_type);
     oc::result<size_t> read_data(void *buf, size_t size);
 
+    // Random access
+    oc::result<std::vector<EntryInfo>> entries();
+    oc::result<std::unique_ptr<File>> open_entry(EntryType entry_type);
+
     // Format operations
     std::optional<Format> format();
     oc::result<void> enable_formats(Formats formats);
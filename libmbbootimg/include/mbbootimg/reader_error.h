@@ -39,6 +39,7 @@ enum class ReaderError
     EndOfEntries            = 40,
 
     UnsupportedGoTo         = 50,
+    UnsupportedEntries      = 51,
 };
 
 MB_EXPORT std::error_code make_error_code(ReaderError e);
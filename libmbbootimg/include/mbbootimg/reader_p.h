@@ -21,6 +21,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <cstddef>
 
@@ -62,6 +63,8 @@ public:
     go_to_entry(File &file, std::optional<EntryType> entry_type);
     virtual oc::result<size_t>
     read_data(File &file, void *buf, size_t buf_size) = 0;
+    virtual oc::result<std::vector<EntryInfo>>
+    entries(File &file);
 };
 
 enum class ReaderState : uint8_t
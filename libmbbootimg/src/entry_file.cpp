@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/entry_file_p.h"
+
+#include <algorithm>
+
+#include "mbcommon/file_error.h"
+
+namespace mb::bootimg::detail
+{
+
+/*!
+ * \class EntryFile
+ *
+ * \brief Read-only view of a boot image entry
+ *
+ * The view exposes the byte range of an entry as a separate file starting at
+ * offset 0. It has its own file position and all reads are done with
+ * File::read_at() on the underlying file, so the underlying file position is
+ * not affected. Multiple views can be used concurrently if the underlying
+ * file's read_at() implementation is thread safe (eg. FdFile or MemoryFile).
+ *
+ * If the boot image is truncated, reads will return end-of-file at the point
+ * where the image ends.
+ */
+
+/*!
+ * \brief Construct view of a range of a file
+ *
+ * \note The EntryFile does not take ownership of \p file. It must remain open
+ *       for as long as the view is used.
+ *
+ * \param file Underlying file
+ * \param offset Offset of the entry in \p file
+ * \param size Size of the entry
+ */
+EntryFile::EntryFile(File *file, uint64_t offset, uint64_t size)
+    : File()
+    , m_file(file)
+    , m_offset(offset)
+    , m_size(size)
+    , m_pos(0)
+{
+}
+
+EntryFile::~EntryFile() = default;
+
+oc::result<void> EntryFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    m_file = nullptr;
+
+    return oc::success();
+}
+
+oc::result<size_t> EntryFile::read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, read_at(m_pos, buf, size));
+
+    m_pos += n;
+    return n;
+}
+
+oc::result<size_t> EntryFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> EntryFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        base = m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid seek whence: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos = base + static_cast<uint64_t>(offset);
+    }
+
+    return m_pos;
+}
+
+oc::result<void> EntryFile::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+oc::result<size_t> EntryFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset >= m_size) {
+        return 0;
+    }
+
+    auto to_read = static_cast<size_t>(
+            std::min<uint64_t>(size, m_size - offset));
+
+    return m_file->read_at(m_offset + offset, buf, to_read);
+}
+
+bool EntryFile::is_open()
+{
+    return m_file;
+}
+
+}
@@ -189,6 +189,14 @@ AndroidFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryInfo>>
+AndroidFormatReader::entries(File &file)
+{
+    (void) file;
+
+    return m_seg->entry_infos();
+}
+
 /*!
  * \brief Find and read Android boot image header
  *
@@ -26,8 +26,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -48,7 +46,7 @@ AndroidFormatWriter::AndroidFormatWriter(bool is_bump) noexcept
     : FormatWriter()
     , m_is_bump(is_bump)
     , m_hdr()
-    , m_sha_ctx()
+    , m_hasher()
 {
 }
 
@@ -67,7 +65,7 @@ oc::result<void> AndroidFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
+    if (!m_hasher.init(HashAlgorithm::Sha1)) {
         return AndroidError::Sha1InitError;
     }
 
@@ -80,7 +78,7 @@ oc::result<void> AndroidFormatWriter::close(File &file)
 {
     auto reset_state = finally([&] {
         m_hdr = {};
-        m_sha_ctx = {};
+        m_hasher = Hasher();
         m_seg = {};
     });
 
@@ -99,11 +97,11 @@ oc::result<void> AndroidFormatWriter::close(File &file)
             OUTCOME_TRYV(file_write_exact(file, magic, magic_size));
 
             // Set ID
-            unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
+            auto digest = m_hasher.finish();
+            if (!digest) {
                 return AndroidError::Sha1UpdateError;
             }
-            memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
+            memcpy(m_hdr.id, digest.value().data(), digest.value().size());
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -222,7 +220,7 @@ AndroidFormatWriter::write_data(File &file, const void *buf, size_t buf_size)
 
     // We always include the image in the hash. The size is sometimes included
     // and is handled in finish_entry().
-    if (!SHA1_Update(&m_sha_ctx, buf, n)) {
+    if (!m_hasher.update(buf, n)) {
         return AndroidError::Sha1UpdateError;
     }
 
@@ -240,7 +238,7 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
 
     // Include size for everything except empty DT images
     if ((swentry->type != EntryType::DeviceTree || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
+            && !m_hasher.update(&le32_size, sizeof(le32_size))) {
         return AndroidError::Sha1UpdateError;
     }
 
@@ -173,6 +173,14 @@ LokiFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryInfo>>
+LokiFormatReader::entries(File &file)
+{
+    (void) file;
+
+    return m_seg->entry_infos();
+}
+
 /*!
  * \brief Find and read Loki boot image header
  *
@@ -246,6 +254,7 @@ LokiFormatReader::find_ramdisk_address(File &file,
         OUTCOME_TRYV(file.seek(0, SEEK_SET));
 
         FileSearcher searcher(&file, LOKI_SHELLCODE, LOKI_SHELLCODE_SIZE - 9);
+        searcher.set_threads(0);
 
         OUTCOME_TRY(offset, searcher.next());
         if (!offset) {
@@ -306,53 +315,34 @@ LokiFormatReader::find_gzip_offset_old(File &file, uint32_t start_offset)
     // byte 8   : compression flags
     // byte 9   : operating system
 
-    static constexpr unsigned char gzip_deflate_magic[] = { 0x1f, 0x8b, 0x08 };
+    // Search for both flag values in a single pass instead of checking the
+    // flags byte of every deflate header
+    static constexpr size_t FLAG0_PATTERN = 0;
+    static constexpr size_t FLAG8_PATTERN = 1;
 
     OUTCOME_TRYV(file.seek(static_cast<int64_t>(start_offset), SEEK_SET));
 
-    FileSearcher searcher(&file, gzip_deflate_magic,
-                          sizeof(gzip_deflate_magic));
+    MultiFileSearcher searcher(&file, {
+        {"\x1f\x8b\x08\x00", 4},
+        {"\x1f\x8b\x08\x08", 4},
+    });
     std::optional<uint64_t> flag0_offset;
     std::optional<uint64_t> flag8_offset;
 
     // Find first result with flags == 0x00 and flags == 0x08
-    while (true) {
-        OUTCOME_TRY(offset, searcher.next());
-        if (!offset) {
+    while (!flag0_offset || !flag8_offset) {
+        OUTCOME_TRY(match, searcher.next());
+        if (!match) {
             break;
         }
 
         // Offset is relative to starting position
-        *offset += start_offset;
-
-        // Save original position
-        OUTCOME_TRY(orig_offset, file.seek(0, SEEK_CUR));
+        auto offset = start_offset + match->offset;
 
-        // Seek to flags byte
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(*offset + 3), SEEK_SET));
-
-        // Read next bytes for flags
-        unsigned char flags;
-        if (auto r = file_read_exact(file, &flags, sizeof(flags)); !r) {
-            if (r.error() == FileError::UnexpectedEof) {
-                break;
-            } else {
-                return r.as_failure();
-            }
-        }
-
-        if (!flag0_offset && flags == 0x00) {
-            flag0_offset = *offset;
-        } else if (!flag8_offset && flags == 0x08) {
-            flag8_offset = *offset;
-        }
-
-        // Restore original position as per contract
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(orig_offset), SEEK_SET));
-
-        // Stop early if possible
-        if (flag0_offset && flag8_offset) {
-            break;
+        if (match->pattern == FLAG0_PATTERN && !flag0_offset) {
+            flag0_offset = offset;
+        } else if (match->pattern == FLAG8_PATTERN && !flag8_offset) {
+            flag8_offset = offset;
         }
     }
 
@@ -26,8 +26,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -50,7 +48,7 @@ constexpr size_t MAX_ABOOT_SIZE = 2 * 1024 * 1024;
 LokiFormatWriter::LokiFormatWriter() noexcept
     : FormatWriter()
     , m_hdr()
-    , m_sha_ctx()
+    , m_hasher()
 {
 }
 
@@ -65,7 +63,7 @@ oc::result<void> LokiFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
+    if (!m_hasher.init(HashAlgorithm::Sha1)) {
         return android::AndroidError::Sha1InitError;
     }
 
@@ -79,7 +77,7 @@ oc::result<void> LokiFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_aboot.clear();
-        m_sha_ctx = {};
+        m_hasher = Hasher();
         m_seg = {};
     });
 
@@ -94,11 +92,11 @@ oc::result<void> LokiFormatWriter::close(File &file)
             OUTCOME_TRYV(file.truncate(file_size));
 
             // Set ID
-            unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
+            auto digest = m_hasher.finish();
+            if (!digest) {
                 return android::AndroidError::Sha1UpdateError;
             }
-            memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
+            memcpy(m_hdr.id, digest.value().data(), digest.value().size());
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -234,7 +232,7 @@ LokiFormatWriter::write_data(File &file, const void *buf, size_t buf_size)
 
         // We always include the image in the hash. The size is sometimes
         // included and is handled in finish_entry().
-        if (!SHA1_Update(&m_sha_ctx, buf, n)) {
+        if (!m_hasher.update(buf, n)) {
             return android::AndroidError::Sha1UpdateError;
         }
 
@@ -253,14 +251,14 @@ oc::result<void> LokiFormatWriter::finish_entry(File &file)
 
     // Include fake 0 size for unsupported secondboot image
     if (swentry->type == EntryType::DeviceTree
-            && !SHA1_Update(&m_sha_ctx, "\x00\x00\x00\x00", 4)) {
+            && !m_hasher.update("\x00\x00\x00\x00", 4)) {
         return android::AndroidError::Sha1UpdateError;
     }
 
     // Include size for everything except empty DT images
     if (swentry->type != EntryType::Aboot
             && (swentry->type != EntryType::DeviceTree || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
+            && !m_hasher.update(&le32_size, sizeof(le32_size))) {
         return android::AndroidError::Sha1UpdateError;
     }
 
@@ -310,4 +310,12 @@ MtkFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryInfo>>
+MtkFormatReader::entries(File &file)
+{
+    (void) file;
+
+    return m_seg->entry_infos();
+}
+
 }
@@ -26,8 +26,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -60,82 +58,16 @@ _mtk_header_update_size(File &file, uint64_t offset, uint32_t size)
     return oc::success();
 }
 
-static oc::result<void>
-_mtk_compute_sha1(SegmentWriter &seg, File &file,
-                  unsigned char digest[SHA_DIGEST_LENGTH])
-{
-    SHA_CTX sha_ctx;
-    char buf[10240];
-
-    uint32_t kernel_mtkhdr_size = 0;
-    uint32_t ramdisk_mtkhdr_size = 0;
-
-    if (!SHA1_Init(&sha_ctx)) {
-        return android::AndroidError::Sha1InitError;
-    }
-
-    for (auto const &entry : seg.entries()) {
-        uint64_t remain = *entry.size;
-
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(entry.offset), SEEK_SET));
-
-        // Update checksum with data
-        while (remain > 0) {
-            auto to_read = std::min<uint64_t>(remain, sizeof(buf));
-
-            OUTCOME_TRYV(file_read_exact(file, buf, static_cast<size_t>(to_read)));
-
-            if (!SHA1_Update(&sha_ctx, buf, static_cast<size_t>(to_read))) {
-                return android::AndroidError::Sha1UpdateError;
-            }
-
-            remain -= to_read;
-        }
-
-        uint32_t le32_size;
-
-        // Update checksum with size
-        switch (entry.type) {
-        case EntryType::MtkKernelHeader:
-            kernel_mtkhdr_size = *entry.size;
-            continue;
-        case EntryType::MtkRamdiskHeader:
-            ramdisk_mtkhdr_size = *entry.size;
-            continue;
-        case EntryType::Kernel:
-            le32_size = mb_htole32(*entry.size + kernel_mtkhdr_size);
-            break;
-        case EntryType::Ramdisk:
-            le32_size = mb_htole32(*entry.size + ramdisk_mtkhdr_size);
-            break;
-        case EntryType::SecondBoot:
-            le32_size = mb_htole32(*entry.size);
-            break;
-        case EntryType::DeviceTree:
-            if (*entry.size == 0) {
-                continue;
-            }
-            le32_size = mb_htole32(*entry.size);
-            break;
-        default:
-            continue;
-        }
-
-        if (!SHA1_Update(&sha_ctx, &le32_size, sizeof(le32_size))) {
-            return android::AndroidError::Sha1UpdateError;
-        }
-    }
-
-    if (!SHA1_Final(digest, &sha_ctx)) {
-        return android::AndroidError::Sha1UpdateError;
-    }
-
-    return oc::success();
-}
+// Maximum amount of kernel or ramdisk data to keep in memory while waiting for
+// the entry size. Anything past this is read back from the output file.
+static constexpr size_t MAX_DEFERRED_HASH_SIZE = 16 * 1024 * 1024;
 
 MtkFormatWriter::MtkFormatWriter() noexcept
     : FormatWriter()
     , m_hdr()
+    , m_hasher()
+    , m_hash_deferred(false)
+    , m_deferred_overflow(false)
 {
 }
 
@@ -152,6 +84,15 @@ oc::result<void> MtkFormatWriter::open(File &file)
 
     m_seg = SegmentWriter();
 
+    if (!m_hasher.init(HashAlgorithm::Sha1)) {
+        return android::AndroidError::Sha1InitError;
+    }
+
+    m_mtk_hdr.clear();
+    m_hash_deferred = false;
+    m_deferred_data.clear();
+    m_deferred_overflow = false;
+
     return oc::success();
 }
 
@@ -160,6 +101,11 @@ oc::result<void> MtkFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_seg = {};
+        m_hasher = Hasher();
+        m_mtk_hdr = {};
+        m_hash_deferred = false;
+        m_deferred_data = {};
+        m_deferred_overflow = false;
     });
 
     if (m_seg) {
@@ -187,13 +133,13 @@ oc::result<void> MtkFormatWriter::close(File &file)
                 }
             }
 
-            // We need to take the performance hit and compute the SHA1 here.
-            // We can't fill in the sizes in the MTK headers when we're writing
-            // them. Thus, if we calculated the SHA1sum during write, it would
-            // be incorrect.
-            OUTCOME_TRYV(_mtk_compute_sha1(
-                    *m_seg, file,
-                    reinterpret_cast<unsigned char *>(m_hdr.id)));
+            // The data was hashed as it was written
+            auto digest = m_hasher.finish();
+            if (!digest) {
+                return android::AndroidError::Sha1UpdateError;
+            }
+
+            memcpy(m_hdr.id, digest.value().data(), digest.value().size());
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -302,13 +248,43 @@ oc::result<Entry> MtkFormatWriter::get_entry(File &file)
 
 oc::result<void> MtkFormatWriter::write_entry(File &file, const Entry &entry)
 {
-    return m_seg->write_entry(file, entry);
+    OUTCOME_TRYV(m_seg->write_entry(file, entry));
+
+    auto swentry = m_seg->entry();
+
+    switch (swentry->type) {
+    case EntryType::MtkKernelHeader:
+    case EntryType::MtkRamdiskHeader:
+        m_mtk_hdr.clear();
+        break;
+    case EntryType::Kernel:
+    case EntryType::Ramdisk:
+        // If the size is known up front, the MTK header can be hashed now and
+        // the data can be hashed as it is written
+        if (swentry->size) {
+            OUTCOME_TRYV(hash_mtk_header(*swentry->size));
+            m_hash_deferred = false;
+        } else {
+            m_hash_deferred = true;
+            m_deferred_data.clear();
+            m_deferred_overflow = false;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return oc::success();
 }
 
 oc::result<size_t>
 MtkFormatWriter::write_data(File &file, const void *buf, size_t buf_size)
 {
-    return m_seg->write_data(file, buf, buf_size);
+    OUTCOME_TRY(n, m_seg->write_data(file, buf, buf_size));
+
+    OUTCOME_TRYV(hash_data(buf, n));
+
+    return n;
 }
 
 oc::result<void> MtkFormatWriter::finish_entry(File &file)
@@ -346,6 +322,149 @@ oc::result<void> MtkFormatWriter::finish_entry(File &file)
         break;
     }
 
+    uint32_t le32_size;
+
+    // Update checksum with size
+    switch (swentry->type) {
+    case EntryType::Kernel:
+    case EntryType::Ramdisk:
+        if (m_hash_deferred) {
+            OUTCOME_TRYV(hash_deferred_entry(file, *swentry));
+        }
+        le32_size = mb_htole32(static_cast<uint32_t>(
+                *swentry->size + sizeof(MtkHeader)));
+        break;
+    case EntryType::SecondBoot:
+        le32_size = mb_htole32(*swentry->size);
+        break;
+    case EntryType::DeviceTree:
+        if (*swentry->size == 0) {
+            return oc::success();
+        }
+        le32_size = mb_htole32(*swentry->size);
+        break;
+    default:
+        return oc::success();
+    }
+
+    if (!m_hasher.update(&le32_size, sizeof(le32_size))) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Hash buffered MTK header with its size field filled in
+ *
+ * \param size Size of the kernel or ramdisk following the MTK header
+ */
+oc::result<void> MtkFormatWriter::hash_mtk_header(uint32_t size)
+{
+    if (m_mtk_hdr.size() != sizeof(MtkHeader)) {
+        return MtkError::InvalidEntrySizeForMtkHeader;
+    }
+
+    uint32_t le32_size = mb_htole32(size);
+    memcpy(m_mtk_hdr.data() + offsetof(MtkHeader, size), &le32_size,
+           sizeof(le32_size));
+
+    if (!m_hasher.update(m_mtk_hdr.data(), m_mtk_hdr.size())) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Hash or buffer data written to the current entry
+ *
+ * MTK headers are buffered until the size of the following entry is known. If
+ * that entry's size was not known when it was started, its data is also
+ * buffered, up to MAX_DEFERRED_HASH_SIZE bytes.
+ */
+oc::result<void> MtkFormatWriter::hash_data(const void *buf, size_t size)
+{
+    auto data = static_cast<const unsigned char *>(buf);
+    auto swentry = m_seg->entry();
+
+    switch (swentry->type) {
+    case EntryType::MtkKernelHeader:
+    case EntryType::MtkRamdiskHeader: {
+        // Oversized headers are rejected in finish_entry()
+        size_t n = std::min(size, sizeof(MtkHeader)
+                - std::min(m_mtk_hdr.size(), sizeof(MtkHeader)));
+        m_mtk_hdr.insert(m_mtk_hdr.end(), data, data + n);
+        return oc::success();
+    }
+    case EntryType::Kernel:
+    case EntryType::Ramdisk:
+        if (m_hash_deferred) {
+            if (!m_deferred_overflow) {
+                if (size <= MAX_DEFERRED_HASH_SIZE - m_deferred_data.size()) {
+                    m_deferred_data.insert(m_deferred_data.end(),
+                                           data, data + size);
+                } else {
+                    m_deferred_overflow = true;
+                }
+            }
+            return oc::success();
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!m_hasher.update(data, size)) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Hash deferred MTK header and entry data now that the size is known
+ *
+ * Data that did not fit in memory is read back from \p file.
+ */
+oc::result<void>
+MtkFormatWriter::hash_deferred_entry(File &file,
+                                     const SegmentWriterEntry &swentry)
+{
+    OUTCOME_TRYV(hash_mtk_header(*swentry.size));
+
+    if (!m_hasher.update(m_deferred_data.data(), m_deferred_data.size())) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    if (m_deferred_overflow) {
+        char buf[10240];
+        uint64_t remain = *swentry.size - m_deferred_data.size();
+
+        OUTCOME_TRY(pos, file.seek(0, SEEK_CUR));
+
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(
+                swentry.offset + m_deferred_data.size()), SEEK_SET));
+
+        while (remain > 0) {
+            auto to_read = std::min<uint64_t>(remain, sizeof(buf));
+
+            OUTCOME_TRYV(file_read_exact(file, buf, static_cast<size_t>(to_read)));
+
+            if (!m_hasher.update(buf, static_cast<size_t>(to_read))) {
+                return android::AndroidError::Sha1UpdateError;
+            }
+
+            remain -= to_read;
+        }
+
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(pos), SEEK_SET));
+    }
+
+    m_hash_deferred = false;
+    m_deferred_data.clear();
+    m_deferred_overflow = false;
+
     return oc::success();
 }
 
@@ -52,6 +52,20 @@ const std::vector<SegmentReaderEntry> & SegmentReader::entries() const
     return m_entries;
 }
 
+std::vector<EntryInfo> SegmentReader::entry_infos() const
+{
+    std::vector<EntryInfo> infos;
+    infos.reserve(m_entries.size());
+
+    for (auto const &srentry : m_entries) {
+        infos.push_back({
+            srentry.type, srentry.offset, srentry.size, CompressionHint::None,
+        });
+    }
+
+    return infos;
+}
+
 oc::result<void> SegmentReader::set_entries(std::vector<SegmentReaderEntry> entries)
 {
     if (m_state != SegmentReaderState::Begin) {
@@ -221,6 +221,14 @@ SonyElfFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryInfo>>
+SonyElfFormatReader::entries(File &file)
+{
+    (void) file;
+
+    return m_seg->entry_infos();
+}
+
 /*!
  * \brief Find and read Sony ELF boot image header
  *
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/prefetch_file_p.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+namespace mb::bootimg::detail
+{
+
+/*!
+ * \class PrefetchFile
+ *
+ * \brief Read-only view of a file with the beginning and end cached in memory
+ *
+ * All of the format readers look for their headers near the beginning of the
+ * file, and some also look for trailing magic near the end of the file. During
+ * format detection, the windows are read once with prefetch() and each bidder
+ * is given its own PrefetchFile view, so the bidders do not need to perform any
+ * I/O unless they look outside of the windows.
+ *
+ * Each view has its own file position and the shared data is never modified,
+ * so views may be used from different threads. Reads outside of the windows
+ * are passed through to the underlying file and are serialized.
+ */
+
+PrefetchFile::PrefetchFile()
+    : File()
+    , m_pos(0)
+{
+}
+
+PrefetchFile::PrefetchFile(std::shared_ptr<PrefetchData> data)
+    : PrefetchFile()
+{
+    (void) open(std::move(data));
+}
+
+PrefetchFile::~PrefetchFile() = default;
+
+/*!
+ * \brief Read the beginning and end of a file
+ *
+ * \param file File to read. The file position is undefined after this function
+ *             returns.
+ * \param head_size Number of bytes to read from the beginning of the file
+ * \param tail_size Number of bytes to read from the end of the file. If this
+ *                  overlaps the head window, only the remaining bytes are read.
+ *
+ * \return Prefetched data that can be shared between PrefetchFile instances if
+ *         the file is successfully read. Otherwise, the error code.
+ */
+oc::result<std::shared_ptr<PrefetchData>>
+PrefetchFile::prefetch(File &file, size_t head_size, size_t tail_size)
+{
+    auto data = std::make_shared<PrefetchData>();
+    data->file = &file;
+
+    OUTCOME_TRY(size, file.seek(0, SEEK_END));
+    data->size = size;
+
+    auto head_end = std::min<uint64_t>(size, head_size);
+    auto tail_begin = std::max<uint64_t>(
+            head_end, size > tail_size ? size - tail_size : 0);
+
+    data->head.resize(static_cast<size_t>(head_end));
+    data->tail.resize(static_cast<size_t>(size - tail_begin));
+    data->tail_offset = tail_begin;
+
+    if (!data->tail.empty()) {
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(tail_begin), SEEK_SET));
+        OUTCOME_TRYV(file_read_exact(file, data->tail.data(),
+                                     data->tail.size()));
+    }
+
+    OUTCOME_TRYV(file.seek(0, SEEK_SET));
+    OUTCOME_TRYV(file_read_exact(file, data->head.data(), data->head.size()));
+
+    return std::move(data);
+}
+
+/*!
+ * \brief Open view of prefetched data
+ *
+ * \param data Data returned by prefetch()
+ *
+ * \return Nothing if the view is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> PrefetchFile::open(std::shared_ptr<PrefetchData> data)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    m_data = std::move(data);
+    m_pos = 0;
+
+    return oc::success();
+}
+
+oc::result<void> PrefetchFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    m_data.reset();
+    m_pos = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read data
+ *
+ * If the file position is inside one of the windows, the data is copied from
+ * memory and the read stops at the end of the window. Otherwise, the data is
+ * read from the underlying file up to the start of the next window.
+ */
+oc::result<size_t> PrefetchFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_pos >= m_data->size) {
+        return 0;
+    }
+
+    const auto &head = m_data->head;
+    const auto &tail = m_data->tail;
+    auto tail_end = m_data->tail_offset + tail.size();
+    size_t n;
+
+    if (m_pos < head.size()) {
+        n = std::min(size, static_cast<size_t>(head.size() - m_pos));
+        memcpy(buf, head.data() + m_pos, n);
+    } else if (m_pos >= m_data->tail_offset && m_pos < tail_end) {
+        n = static_cast<size_t>(std::min<uint64_t>(size, tail_end - m_pos));
+        memcpy(buf, tail.data() + (m_pos - m_data->tail_offset), n);
+    } else {
+        // The tail window is always at the end of the file (if non-empty)
+        auto limit = tail.empty() ? m_data->size : m_data->tail_offset;
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(size, limit - m_pos));
+
+        std::lock_guard<std::mutex> lock(m_data->file_lock);
+        OUTCOME_TRY(n_read, m_data->file->read_at(m_pos, buf, to_read));
+        n = n_read;
+    }
+
+    m_pos += n;
+    return n;
+}
+
+oc::result<size_t> PrefetchFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> PrefetchFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        base = m_data->size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid seek whence: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos = base + static_cast<uint64_t>(offset);
+    }
+
+    return m_pos;
+}
+
+oc::result<void> PrefetchFile::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+bool PrefetchFile::is_open()
+{
+    return !!m_data;
+}
+
+}
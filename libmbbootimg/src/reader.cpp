@@ -19,6 +19,8 @@
 
 #include "mbbootimg/reader.h"
 
+#include <algorithm>
+
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
@@ -31,11 +33,13 @@
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/entry_file_p.h"
 #include "mbbootimg/format/android_reader_p.h"
 #include "mbbootimg/format/loki_reader_p.h"
 #include "mbbootimg/format/mtk_reader_p.h"
 #include "mbbootimg/format/sony_elf_reader_p.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/prefetch_file_p.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -85,6 +89,9 @@
  * file position is set to the beginning of the file before this function is
  * called and also after.
  *
+ * \p file is a read-only PrefetchFile view of the boot image, not the file
+ * passed to Reader::open(). The bidder must not keep a reference to it.
+ *
  * If this function returns an error code or if the bid is lost, close() will be
  * called in Reader::open() to clean up any state. Otherwise, close() will be
  * called in Reader::close() when the user closes the Reader.
@@ -176,6 +183,23 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::entries
+ *
+ * \brief Format reader callback to list the entries
+ *
+ * This function is only called after read_header(). It must not change the
+ * file position. The compression hints in the returned entries are ignored.
+ *
+ * \param file Reference to file handle
+ *
+ * \return
+ *   * Return the offset and size of every entry in the boot image
+ *   * Return ReaderError::UnsupportedEntries if the format does not store
+ *     entries as byte ranges of the file
+ *   * Return a specific error code if an error occurs
+ */
+
 ///
 
 namespace mb::bootimg
@@ -208,6 +232,12 @@ oc::result<Entry> FormatReader::go_to_entry(File &file,
     return ReaderError::UnsupportedGoTo;
 }
 
+oc::result<std::vector<EntryInfo>> FormatReader::entries(File &file)
+{
+    (void) file;
+    return ReaderError::UnsupportedEntries;
+}
+
 /*!
  * \brief Construct new Reader.
  */
@@ -336,6 +366,10 @@ oc::result<void> Reader::open(File *file)
         return ReaderError::NoFormatsRegistered;
     }
 
+    // Read the regions that the bidders look at once instead of having each
+    // bidder seek around the file
+    OUTCOME_TRY(prefetched, PrefetchFile::prefetch(*file));
+
     int best_bid = 0;
     FormatReader *format = nullptr;
 
@@ -347,15 +381,15 @@ oc::result<void> Reader::open(File *file)
 
     // Perform bid for autodetection
     for (auto &f : m_formats) {
-        // Seek to beginning
-        OUTCOME_TRYV(file->seek(0, SEEK_SET));
+        // Each bidder gets a separate view that starts at the beginning
+        PrefetchFile view(prefetched);
 
         auto close_f = finally([&] {
             (void) f->close(*file);
         });
 
         // Call bidder
-        OUTCOME_TRY(bid, f->open(*file, best_bid));
+        OUTCOME_TRY(bid, f->open(view, best_bid));
 
         if (bid > best_bid) {
             // Close previous best format
@@ -499,6 +533,104 @@ oc::result<size_t> Reader::read_data(void *buf, size_t size)
     return m_format->read_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Guess the compression format of entry data from its first bytes
+ */
+static CompressionHint detect_compression(const unsigned char *data,
+                                          size_t size)
+{
+    static constexpr struct {
+        const char *magic;
+        size_t size;
+        CompressionHint compression;
+    } signatures[] = {
+        { "\x1f\x8b", 2, CompressionHint::Gzip },
+        { "\x02\x21\x4c\x18", 4, CompressionHint::Lz4 },
+        { "\x04\x22\x4d\x18", 4, CompressionHint::Lz4 },
+        { "\xfd" "7zXZ\x00", 6, CompressionHint::Xz },
+        { "\x5d\x00\x00", 3, CompressionHint::Lzma },
+        { "BZh", 3, CompressionHint::Bzip2 },
+        { "\x89LZO\x00\x0d\x0a\x1a\x0a", 9, CompressionHint::Lzop },
+    };
+
+    for (auto const &sig : signatures) {
+        if (size >= sig.size && memcmp(data, sig.magic, sig.size) == 0) {
+            return sig.compression;
+        }
+    }
+
+    return CompressionHint::None;
+}
+
+/*!
+ * \brief Get the list of boot image entries.
+ *
+ * This returns the type, location, and size of all entries, along with a guess
+ * of the compression format of each entry's data. Unlike read_entry() and
+ * go_to_entry(), this does not change the current entry or the file position.
+ *
+ * \pre read_header() must have been called.
+ *
+ * \return
+ *   * List of entries if the entry table is successfully read
+ *   * ReaderError::UnsupportedEntries if the format does not support this
+ *   * Otherwise, a specific error code
+ */
+oc::result<std::vector<EntryInfo>> Reader::entries()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    OUTCOME_TRY(infos, m_format->entries(*m_file));
+
+    for (auto &info : infos) {
+        unsigned char buf[16];
+
+        OUTCOME_TRY(n, m_file->read_at(
+                info.offset, buf, static_cast<size_t>(
+                        std::min<uint64_t>(info.size, sizeof(buf)))));
+
+        info.compression = detect_compression(buf, n);
+    }
+
+    return std::move(infos);
+}
+
+/*!
+ * \brief Open a boot image entry as a separate file.
+ *
+ * The returned file is a read-only view of the entry's data with its own file
+ * position. It does not affect the Reader's state, so multiple entries can be
+ * opened and read independently, including from different threads if the
+ * underlying file supports concurrent File::read_at() calls.
+ *
+ * \note The view reads from the Reader's file handle. It must not be used after
+ *       the Reader is closed.
+ *
+ * \pre read_header() must have been called.
+ *
+ * \param entry_type Entry type to open
+ *
+ * \return
+ *   * File handle for the entry data if the entry exists
+ *   * ReaderError::EndOfEntries if the entry is not found
+ *   * ReaderError::UnsupportedEntries if the format does not support this
+ *   * Otherwise, a specific error code
+ */
+oc::result<std::unique_ptr<File>> Reader::open_entry(EntryType entry_type)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    OUTCOME_TRY(infos, m_format->entries(*m_file));
+
+    for (auto const &info : infos) {
+        if (info.type == entry_type) {
+            return std::make_unique<EntryFile>(m_file, info.offset, info.size);
+        }
+    }
+
+    return ReaderError::EndOfEntries;
+}
+
 /*!
  * \brief Get detected boot image format code.
  *
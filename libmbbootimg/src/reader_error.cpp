@@ -62,6 +62,8 @@ std::string ReaderErrorCategory::message(int ev) const
         return "end of entries";
     case ReaderError::UnsupportedGoTo:
         return "go to entry not supported";
+    case ReaderError::UnsupportedEntries:
+        return "entry index not supported";
     default:
         return "(unknown reader error)";
     }
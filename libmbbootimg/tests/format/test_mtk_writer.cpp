@@ -17,4 +17,205 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+
 #include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstring>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::mtk;
+
+class CountingFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read(buf, size);
+    }
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read_at(offset, buf, size);
+    }
+
+    unsigned int reads = 0;
+};
+
+struct MtkWriterSHA1Test : public ::testing::Test
+{
+protected:
+    void *_buf;
+    size_t _buf_size;
+    CountingFile _file;
+    Writer _writer;
+
+    MtkWriterSHA1Test()
+        : _buf(nullptr)
+        , _buf_size(0)
+        , _file(&_buf, &_buf_size)
+        , _writer()
+    {
+    }
+
+    virtual ~MtkWriterSHA1Test()
+    {
+        free(_buf);
+    }
+
+    virtual void SetUp()
+    {
+        ASSERT_TRUE(_file.is_open());
+
+        ASSERT_TRUE(_writer.set_format(Format::Mtk));
+        ASSERT_TRUE(_writer.open(&_file));
+    }
+
+    static std::string MakeMtkHeader(const char *type, uint32_t size)
+    {
+        MtkHeader hdr;
+        memcpy(hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+        hdr.size = mb_htole32(size);
+        memset(hdr.type, 0, sizeof(hdr.type));
+        strncpy(hdr.type, type, sizeof(hdr.type));
+        memset(hdr.unused, 0xff, sizeof(hdr.unused));
+
+        return {reinterpret_cast<char *>(&hdr), sizeof(hdr)};
+    }
+
+    static void HashSize(SHA_CTX &ctx, size_t size)
+    {
+        uint32_t le32_size = mb_htole32(static_cast<uint32_t>(size));
+        SHA1_Update(&ctx, &le32_size, sizeof(le32_size));
+    }
+
+    void TestChecksum(const std::string &kernel, const std::string &ramdisk,
+                      bool sizes_known)
+    {
+        // Write dummy header
+        auto header = _writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(_writer.write_header(header.value()));
+
+        // The size fields are filled in by the writer
+        auto kernel_hdr = MakeMtkHeader("KERNEL", 0);
+        auto ramdisk_hdr = MakeMtkHeader("ROOTFS", 0);
+
+        while (true) {
+            auto entry = _writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            const std::string *data = nullptr;
+
+            switch (entry.value().type()) {
+            case EntryType::MtkKernelHeader:
+                data = &kernel_hdr;
+                break;
+            case EntryType::Kernel:
+                data = &kernel;
+                break;
+            case EntryType::MtkRamdiskHeader:
+                data = &ramdisk_hdr;
+                break;
+            case EntryType::Ramdisk:
+                data = &ramdisk;
+                break;
+            default:
+                break;
+            }
+
+            if (data && sizes_known) {
+                entry.value().set_size(data->size());
+            }
+
+            ASSERT_TRUE(_writer.write_entry(entry.value()));
+
+            if (data) {
+                // Write in chunks to exercise buffering
+                for (size_t i = 0; i < data->size(); i += 100000) {
+                    auto to_write = std::min<size_t>(data->size() - i, 100000);
+                    ASSERT_EQ(_writer.write_data(data->data() + i, to_write),
+                              oc::success(to_write));
+                }
+            }
+        }
+
+        // Close to write header
+        ASSERT_TRUE(_writer.close());
+
+        // Compute the expected SHA1 from the inputs
+        SHA_CTX ctx;
+        unsigned char expected[SHA_DIGEST_LENGTH];
+        SHA1_Init(&ctx);
+
+        kernel_hdr = MakeMtkHeader(
+                "KERNEL", static_cast<uint32_t>(kernel.size()));
+        SHA1_Update(&ctx, kernel_hdr.data(), kernel_hdr.size());
+        SHA1_Update(&ctx, kernel.data(), kernel.size());
+        HashSize(ctx, kernel.size() + sizeof(MtkHeader));
+
+        ramdisk_hdr = MakeMtkHeader(
+                "ROOTFS", static_cast<uint32_t>(ramdisk.size()));
+        SHA1_Update(&ctx, ramdisk_hdr.data(), ramdisk_hdr.size());
+        SHA1_Update(&ctx, ramdisk.data(), ramdisk.size());
+        HashSize(ctx, ramdisk.size() + sizeof(MtkHeader));
+
+        // Empty second bootloader
+        HashSize(ctx, 0);
+
+        SHA1_Final(expected, &ctx);
+
+        // Check SHA1
+        ASSERT_EQ(memcmp(static_cast<unsigned char *>(_buf) + 576,
+                         expected, sizeof(expected)), 0);
+
+        // Check that the MTK headers were updated
+        ASSERT_EQ(memcmp(static_cast<unsigned char *>(_buf) + 2048,
+                         kernel_hdr.data(), kernel_hdr.size()), 0);
+    }
+};
+
+TEST_F(MtkWriterSHA1Test, HashWithKnownSizes)
+{
+    TestChecksum("hello", "world!", true);
+
+    // Nothing should have been read back from the output file
+    ASSERT_EQ(_file.reads, 0u);
+}
+
+TEST_F(MtkWriterSHA1Test, HashWithUnknownSizes)
+{
+    TestChecksum(std::string(300000, 'k'), std::string(1000, 'r'), false);
+
+    // Deferred data fits in memory, so nothing should have been read back
+    ASSERT_EQ(_file.reads, 0u);
+}
+
+TEST_F(MtkWriterSHA1Test, HashWithUnknownSizeLargerThanBuffer)
+{
+    // Only the data past the in-memory limit is read back
+    TestChecksum(std::string(17 * 1024 * 1024, 'k'), "world!", false);
+
+    ASSERT_GT(_file.reads, 0u);
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/prefetch_file_p.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::detail;
+
+// MemoryFile that counts the number of reads
+class CountingFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read(buf, size);
+    }
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read_at(offset, buf, size);
+    }
+
+    unsigned int reads = 0;
+};
+
+struct PrefetchFileTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+
+    PrefetchFileTest()
+    {
+        _data.resize(100);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i);
+        }
+    }
+};
+
+TEST_F(PrefetchFileTest, ReadWindowsAndPassthrough)
+{
+    CountingFile file(_data.data(), _data.size());
+
+    auto data = PrefetchFile::prefetch(file, 10, 20);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value()->head.size(), 10u);
+    ASSERT_EQ(data.value()->tail.size(), 20u);
+    ASSERT_EQ(data.value()->tail_offset, 80u);
+
+    auto prefetch_reads = file.reads;
+
+    PrefetchFile view(data.value());
+    unsigned char buf[100];
+
+    // Reads stop at the end of the head window
+    ASSERT_EQ(view.read(buf, sizeof(buf)), oc::success(10u));
+    ASSERT_EQ(memcmp(buf, _data.data(), 10), 0);
+    ASSERT_EQ(file.reads, prefetch_reads);
+
+    // Reads between the windows go to the underlying file and stop at the
+    // beginning of the tail window
+    ASSERT_EQ(view.read(buf, sizeof(buf)), oc::success(70u));
+    ASSERT_EQ(memcmp(buf, _data.data() + 10, 70), 0);
+    ASSERT_GT(file.reads, prefetch_reads);
+    prefetch_reads = file.reads;
+
+    ASSERT_EQ(view.read(buf, sizeof(buf)), oc::success(20u));
+    ASSERT_EQ(memcmp(buf, _data.data() + 80, 20), 0);
+    ASSERT_EQ(view.read(buf, sizeof(buf)), oc::success(0u));
+
+    ASSERT_EQ(view.seek(-5, SEEK_END), oc::success(95u));
+    ASSERT_EQ(view.read(buf, sizeof(buf)), oc::success(5u));
+    ASSERT_EQ(memcmp(buf, _data.data() + 95, 5), 0);
+    ASSERT_EQ(file.reads, prefetch_reads);
+}
+
+TEST_F(PrefetchFileTest, OverlappingWindows)
+{
+    CountingFile file(_data.data(), _data.size());
+
+    auto data = PrefetchFile::prefetch(file, 80, 40);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value()->head.size(), 80u);
+    ASSERT_EQ(data.value()->tail.size(), 20u);
+    ASSERT_EQ(data.value()->tail_offset, 80u);
+
+    auto prefetch_reads = file.reads;
+
+    PrefetchFile view(data.value());
+    std::vector<unsigned char> buf(_data.size());
+
+    ASSERT_TRUE(file_read_exact(view, buf.data(), buf.size()));
+    ASSERT_EQ(buf, _data);
+    ASSERT_EQ(file.reads, prefetch_reads);
+}
+
+TEST_F(PrefetchFileTest, IndependentViews)
+{
+    MemoryFile file(_data.data(), _data.size());
+
+    auto data = PrefetchFile::prefetch(file);
+    ASSERT_TRUE(data);
+    ASSERT_EQ(data.value()->head.size(), 100u);
+    ASSERT_TRUE(data.value()->tail.empty());
+
+    PrefetchFile view1(data.value());
+    PrefetchFile view2(data.value());
+    unsigned char c;
+
+    ASSERT_EQ(view1.seek(50, SEEK_SET), oc::success(50u));
+    ASSERT_EQ(view2.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, 0);
+    ASSERT_EQ(view1.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, 50);
+
+    ASSERT_EQ(view1.seek(-1, SEEK_SET),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_EQ(view1.write(&c, 1), oc::failure(FileError::UnsupportedWrite));
+}
+
+TEST(ReaderPrefetchTest, DetectFormatFromPrefetchedData)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    auto free_buf = finally([&] {
+        free(buf);
+    });
+
+    // Write an Android boot image that is larger than the prefetch windows
+    {
+        MemoryFile file(&buf, &buf_size);
+        Writer writer;
+        std::vector<unsigned char> kernel(256 * 1024, 'k');
+
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            if (entry.value().type() == EntryType::Kernel) {
+                ASSERT_TRUE(writer.write_data(kernel.data(), kernel.size()));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    CountingFile file(buf, buf_size);
+    Reader reader;
+
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_EQ(reader.format(), Format::Android);
+
+    // One read for each window
+    ASSERT_EQ(file.reads, 2u);
+
+    auto header = reader.read_header();
+    ASSERT_TRUE(header);
+    ASSERT_EQ(header.value().page_size(), 2048u);
+
+    auto entry = reader.read_entry();
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry.value().type(), EntryType::Kernel);
+    ASSERT_EQ(entry.value().size(), 256u * 1024u);
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct ReaderTest : testing::Test
+{
+    void *_buf = nullptr;
+    size_t _buf_size = 0;
+
+    std::string _kernel = std::string("\x1f\x8b\x08\x00", 4) + "kernel";
+    std::string _ramdisk = std::string("\x02\x21\x4c\x18", 4) + "ramdisk";
+    std::string _second = "second";
+
+    virtual ~ReaderTest()
+    {
+        free(_buf);
+    }
+
+    void SetUp() override
+    {
+        MemoryFile file(&_buf, &_buf_size);
+        Writer writer;
+
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            const std::string *data = nullptr;
+
+            switch (entry.value().type()) {
+            case EntryType::Kernel:
+                data = &_kernel;
+                break;
+            case EntryType::Ramdisk:
+                data = &_ramdisk;
+                break;
+            case EntryType::SecondBoot:
+                data = &_second;
+                break;
+            default:
+                break;
+            }
+
+            if (data) {
+                ASSERT_TRUE(writer.write_data(data->data(), data->size()));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+};
+
+TEST_F(ReaderTest, EntriesRequireHeader)
+{
+    MemoryFile file(_buf, _buf_size);
+    Reader reader;
+
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+
+    ASSERT_EQ(reader.entries(), oc::failure(ReaderError::InvalidState));
+    ASSERT_EQ(reader.open_entry(EntryType::Kernel),
+              oc::failure(ReaderError::InvalidState));
+}
+
+TEST_F(ReaderTest, ListEntries)
+{
+    MemoryFile file(_buf, _buf_size);
+    Reader reader;
+
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_TRUE(reader.read_header());
+
+    auto entries = reader.entries();
+    ASSERT_TRUE(entries);
+    ASSERT_EQ(entries.value().size(), 3u);
+
+    auto const &kernel = entries.value()[0];
+    ASSERT_EQ(kernel.type, EntryType::Kernel);
+    ASSERT_EQ(kernel.offset, 2048u);
+    ASSERT_EQ(kernel.size, _kernel.size());
+    ASSERT_EQ(kernel.compression, CompressionHint::Gzip);
+
+    auto const &ramdisk = entries.value()[1];
+    ASSERT_EQ(ramdisk.type, EntryType::Ramdisk);
+    ASSERT_EQ(ramdisk.offset, 4096u);
+    ASSERT_EQ(ramdisk.size, _ramdisk.size());
+    ASSERT_EQ(ramdisk.compression, CompressionHint::Lz4);
+
+    auto const &second = entries.value()[2];
+    ASSERT_EQ(second.type, EntryType::SecondBoot);
+    ASSERT_EQ(second.offset, 6144u);
+    ASSERT_EQ(second.size, _second.size());
+    ASSERT_EQ(second.compression, CompressionHint::None);
+}
+
+TEST_F(ReaderTest, OpenEntriesIndependently)
+{
+    MemoryFile file(_buf, _buf_size);
+    Reader reader;
+
+    ASSERT_TRUE(reader.enable_formats_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_TRUE(reader.read_header());
+
+    auto kernel = reader.open_entry(EntryType::Kernel);
+    ASSERT_TRUE(kernel);
+    auto ramdisk = reader.open_entry(EntryType::Ramdisk);
+    ASSERT_TRUE(ramdisk);
+
+    char buf[64];
+
+    // Interleave reads from both entries
+    ASSERT_EQ(kernel.value()->read(buf, 4), oc::success(4u));
+    ASSERT_EQ(ramdisk.value()->read(buf, sizeof(buf)),
+              oc::success(_ramdisk.size()));
+    ASSERT_EQ(std::string(buf, _ramdisk.size()), _ramdisk);
+    ASSERT_EQ(kernel.value()->read(buf, sizeof(buf)),
+              oc::success(_kernel.size() - 4));
+    ASSERT_EQ(std::string(buf, _kernel.size() - 4), _kernel.substr(4));
+    ASSERT_EQ(kernel.value()->read(buf, sizeof(buf)), oc::success(0u));
+
+    ASSERT_EQ(kernel.value()->seek(-6, SEEK_END),
+              oc::success(_kernel.size() - 6));
+    ASSERT_EQ(kernel.value()->read(buf, sizeof(buf)), oc::success(6u));
+    ASSERT_EQ(std::string(buf, 6), "kernel");
+
+    // The sequential API is unaffected
+    auto entry = reader.go_to_entry(EntryType::SecondBoot);
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(reader.read_data(buf, sizeof(buf)), oc::success(_second.size()));
+    ASSERT_EQ(std::string(buf, _second.size()), _second);
+
+    ASSERT_EQ(reader.open_entry(EntryType::DeviceTree),
+              oc::failure(ReaderError::EndOfEntries));
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb
+{
+
+MB_EXPORT uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+MB_EXPORT uint32_t crc32_update_repeat(uint32_t crc, const void *data,
+                                       size_t size, uint64_t count);
+MB_EXPORT uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
+
+}
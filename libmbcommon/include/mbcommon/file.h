@@ -21,6 +21,8 @@
 
 #include "mbcommon/common.h"
 
+#include <optional>
+
 #include <cstddef>
 #include <cstdint>
 
@@ -29,6 +31,12 @@
 namespace mb
 {
 
+struct IoVec
+{
+    void *base;
+    size_t size;
+};
+
 class MB_EXPORT File
 {
 public:
@@ -46,6 +54,25 @@ public:
     virtual oc::result<uint64_t> seek(int64_t offset, int whence) = 0;
     virtual oc::result<void> truncate(uint64_t size) = 0;
 
+    // Positional and vectored file operations
+    virtual oc::result<size_t> read_at(uint64_t offset,
+                                       void *buf, size_t size);
+    virtual oc::result<size_t> write_at(uint64_t offset,
+                                        const void *buf, size_t size);
+    virtual oc::result<size_t> readv(const IoVec *iov, size_t count);
+    virtual oc::result<size_t> writev(const IoVec *iov, size_t count);
+
+    // Space allocation and sparse file operations
+    virtual oc::result<void> allocate(uint64_t offset, uint64_t size);
+    virtual oc::result<void> punch_hole(uint64_t offset, uint64_t size);
+    virtual oc::result<void> zero_range(uint64_t offset, uint64_t size);
+    virtual oc::result<std::optional<uint64_t>> next_data(uint64_t offset);
+    virtual oc::result<std::optional<uint64_t>> next_hole(uint64_t offset);
+
+    // Direct access to file contents
+    virtual const void * mapped_data(uint64_t &size);
+    virtual int native_fd();
+
     // File state
     virtual bool is_open() = 0;
 };
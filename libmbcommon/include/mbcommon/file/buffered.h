@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT BufferedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUF_SIZE = 64 * 1024;
+
+    BufferedFile();
+    BufferedFile(File *file, size_t buf_size = DEFAULT_BUF_SIZE);
+    virtual ~BufferedFile();
+
+    BufferedFile(BufferedFile &&other) noexcept;
+    BufferedFile & operator=(BufferedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferedFile)
+
+    oc::result<void> open(File *file, size_t buf_size = DEFAULT_BUF_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<void> allocate(uint64_t offset, uint64_t size) override;
+    oc::result<void> punch_hole(uint64_t offset, uint64_t size) override;
+    oc::result<void> zero_range(uint64_t offset, uint64_t size) override;
+    oc::result<std::optional<uint64_t>> next_data(uint64_t offset) override;
+    oc::result<std::optional<uint64_t>> next_hole(uint64_t offset) override;
+
+    bool is_open() override;
+
+    oc::result<void> flush();
+
+private:
+    /*! \cond INTERNAL */
+    oc::result<void> sync();
+    oc::result<uint64_t> buffer_offset();
+
+    void clear() noexcept;
+
+    File *m_file;
+
+    std::vector<unsigned char> m_buf;
+    // Read-ahead region is [m_read_pos, m_read_end). The underlying file
+    // position is at m_read_end.
+    size_t m_read_pos;
+    size_t m_read_end;
+    // Number of buffered bytes that have not been written yet. The underlying
+    // file position is at byte 0 of the buffer.
+    size_t m_write_size;
+    // Offset of byte 0 of the read-ahead buffer, if known
+    std::optional<uint64_t> m_buf_offset;
+    /*! \endcond */
+};
+
+}
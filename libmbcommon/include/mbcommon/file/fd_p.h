@@ -22,6 +22,9 @@
 #include <cstddef>
 
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 
 /*! \cond INTERNAL */
 namespace mb
@@ -49,6 +52,20 @@ struct FdFileFuncs
     virtual off64_t fn_lseek64(int fd, off64_t offset, int whence) = 0;
     virtual ssize_t fn_read(int fd, void *buf, size_t count) = 0;
     virtual ssize_t fn_write(int fd, const void *buf, size_t count) = 0;
+#ifndef _WIN32
+    virtual ssize_t fn_pread64(int fd, void *buf, size_t count,
+                               off64_t offset) = 0;
+    virtual ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                                off64_t offset) = 0;
+
+    // fcntl.h
+    virtual int fn_fallocate64(int fd, int mode, off64_t offset,
+                               off64_t len) = 0;
+
+    // sys/uio.h
+    virtual ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) = 0;
+    virtual ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) = 0;
+#endif
 };
 
 }
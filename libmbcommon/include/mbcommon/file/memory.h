@@ -47,10 +47,21 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+    oc::result<size_t> readv(const IoVec *iov, size_t count) override;
+    oc::result<size_t> writev(const IoVec *iov, size_t count) override;
+
     bool is_open() override;
 
 private:
     /*! \cond INTERNAL */
+    size_t read_at_pos(size_t pos, void *buf, size_t size);
+    oc::result<size_t> write_at_pos(size_t pos, const void *buf, size_t size);
+    oc::result<void> resize(size_t size);
+
     void clear() noexcept;
 
     bool m_is_open;
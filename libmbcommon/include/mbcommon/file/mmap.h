@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include "mbcommon/file/mmap_p.h"
+#include "mbcommon/file/open_mode.h"
+
+namespace mb
+{
+
+struct MmapSpan
+{
+    const unsigned char *data;
+    size_t size;
+};
+
+class MB_EXPORT MmapFile : public File
+{
+public:
+    MmapFile();
+    MmapFile(int fd, bool owned);
+    MmapFile(const std::string &filename, FileOpenMode mode);
+    MmapFile(const std::wstring &filename, FileOpenMode mode);
+    virtual ~MmapFile();
+
+    MmapFile(MmapFile &&other) noexcept;
+    MmapFile & operator=(MmapFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MmapFile)
+
+    oc::result<void> open(int fd, bool owned);
+    oc::result<void> open(const std::string &filename, FileOpenMode mode);
+    oc::result<void> open(const std::wstring &filename, FileOpenMode mode);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+    oc::result<size_t> readv(const IoVec *iov, size_t count) override;
+    oc::result<size_t> writev(const IoVec *iov, size_t count) override;
+
+    const void * mapped_data(uint64_t &size) override;
+
+    bool is_open() override;
+
+    oc::result<MmapSpan> map_region(uint64_t offset, size_t size);
+
+protected:
+    /*! \cond INTERNAL */
+    MmapFile(detail::MmapFileFuncs *funcs);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             int fd, bool owned);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             const std::string &filename, FileOpenMode mode);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             const std::wstring &filename, FileOpenMode mode);
+
+    void set_max_map_size(uint64_t size);
+    /*! \endcond */
+
+private:
+    /*! \cond INTERNAL */
+    oc::result<void> open();
+
+    oc::result<size_t> read_at_pos(uint64_t pos, void *buf, size_t size);
+    oc::result<size_t> write_at_pos(uint64_t pos, const void *buf, size_t size);
+
+    oc::result<void> map_window(uint64_t offset);
+    oc::result<void> unmap();
+    oc::result<void> resize(uint64_t size);
+
+    void clear() noexcept;
+
+    detail::MmapFileFuncs *m_funcs;
+
+    int m_fd;
+    bool m_owned;
+    std::string m_filename;
+    int m_flags;
+
+    bool m_writable;
+    bool m_append;
+
+    // Currently mapped window of the file
+    unsigned char *m_map;
+    uint64_t m_map_offset;
+    size_t m_map_size;
+    uint64_t m_max_map_size;
+
+    uint64_t m_size;
+    uint64_t m_pos;
+    /*! \endcond */
+};
+
+}
@@ -54,6 +54,19 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+#ifndef _WIN32
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<void> allocate(uint64_t offset, uint64_t size) override;
+    oc::result<void> punch_hole(uint64_t offset, uint64_t size) override;
+    oc::result<void> zero_range(uint64_t offset, uint64_t size) override;
+    oc::result<std::optional<uint64_t>> next_data(uint64_t offset) override;
+    oc::result<std::optional<uint64_t>> next_hole(uint64_t offset) override;
+#endif
+
     bool is_open() override;
 
 protected:
@@ -71,6 +84,12 @@ private:
     /*! \cond INTERNAL */
     oc::result<void> open();
 
+#ifndef _WIN32
+    oc::result<void> fallocate(int mode, uint64_t offset, uint64_t size);
+    oc::result<std::optional<uint64_t>> seek_data_hole(uint64_t offset,
+                                                       int whence);
+#endif
+
     void clear() noexcept;
 
     detail::PosixFileFuncs *m_funcs;
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT TracingFile : public File
+{
+public:
+    static constexpr size_t HISTOGRAM_BUCKETS = 24;
+
+    struct OpStats
+    {
+        // Number of calls
+        uint64_t calls = 0;
+        // Number of calls that returned an error
+        uint64_t errors = 0;
+        // Bytes transferred (reads and writes only)
+        uint64_t bytes = 0;
+        // Total time spent in the underlying file
+        std::chrono::nanoseconds time{0};
+        // Bucket 0 counts calls that took less than 1us. Bucket i counts calls
+        // that took [2^(i-1), 2^i) us. The last bucket has no upper bound.
+        std::array<uint64_t, HISTOGRAM_BUCKETS> histogram{};
+    };
+
+    struct Stats
+    {
+        OpStats read;
+        OpStats write;
+        OpStats seek;
+        OpStats truncate;
+        // Total distance moved by seeks, if the position was known
+        uint64_t seek_distance = 0;
+    };
+
+    using ReportCallback = std::function<void(const TracingFile &file)>;
+
+    TracingFile();
+    TracingFile(File *file, std::string name);
+    virtual ~TracingFile();
+
+    TracingFile(TracingFile &&other) noexcept;
+    TracingFile & operator=(TracingFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TracingFile)
+
+    oc::result<void> open(File *file, std::string name);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+    oc::result<size_t> readv(const IoVec *iov, size_t count) override;
+    oc::result<size_t> writev(const IoVec *iov, size_t count) override;
+
+    oc::result<void> allocate(uint64_t offset, uint64_t size) override;
+    oc::result<void> punch_hole(uint64_t offset, uint64_t size) override;
+    oc::result<void> zero_range(uint64_t offset, uint64_t size) override;
+    oc::result<std::optional<uint64_t>> next_data(uint64_t offset) override;
+    oc::result<std::optional<uint64_t>> next_hole(uint64_t offset) override;
+
+    bool is_open() override;
+
+    const std::string & name() const;
+    const Stats & stats() const;
+
+    void set_report_callback(ReportCallback callback);
+
+    std::string summary() const;
+    std::string summary_json() const;
+
+private:
+    /*! \cond INTERNAL */
+    void clear() noexcept;
+
+    File *m_file;
+    std::string m_name;
+    Stats m_stats;
+    // Current position of the underlying file, if known
+    std::optional<uint64_t> m_pos;
+    ReportCallback m_callback;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+
+#include "mbcommon/file/fd.h"
+
+namespace mb
+{
+
+namespace detail
+{
+
+class AsyncIoBackend;
+
+}
+
+class MB_EXPORT UringFile : public FdFile
+{
+public:
+    using Callback = std::function<void(oc::result<size_t>)>;
+
+    static constexpr unsigned int DEFAULT_QUEUE_DEPTH = 32;
+
+    UringFile();
+    UringFile(int fd, bool owned);
+    UringFile(const std::string &filename, FileOpenMode mode);
+    UringFile(const std::wstring &filename, FileOpenMode mode);
+    virtual ~UringFile();
+
+    UringFile(UringFile &&other) noexcept;
+    UringFile & operator=(UringFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(UringFile)
+
+    oc::result<void> close() override;
+
+    // Asynchronous operations
+    oc::result<void> read_async(uint64_t offset, void *buf, size_t size,
+                                Callback callback);
+    oc::result<void> write_async(uint64_t offset, const void *buf, size_t size,
+                                 Callback callback);
+    std::future<oc::result<size_t>>
+    read_async(uint64_t offset, void *buf, size_t size);
+    std::future<oc::result<size_t>>
+    write_async(uint64_t offset, const void *buf, size_t size);
+
+    oc::result<void> submit();
+    oc::result<void> wait();
+
+    // Asynchronous I/O configuration
+    unsigned int queue_depth() const;
+    oc::result<void> set_queue_depth(unsigned int depth);
+
+    bool uses_io_uring();
+
+private:
+    /*! \cond INTERNAL */
+    detail::AsyncIoBackend * backend();
+
+    unsigned int m_queue_depth;
+    std::unique_ptr<detail::AsyncIoBackend> m_backend;
+    /*! \endcond */
+};
+
+}
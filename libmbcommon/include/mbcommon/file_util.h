@@ -19,8 +19,11 @@
 
 #pragma once
 
+#include <array>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <string>
 #include <vector>
 #ifdef __ANDROID__
 #  include <experimental/functional>
@@ -42,6 +45,8 @@ namespace std2 = std;
 
 constexpr size_t DEFAULT_BUFFER_SIZE = 8 * 1024 * 1024;
 
+class SearchWorkerPool;
+
 }
 
 MB_EXPORT oc::result<size_t> file_read_retry(File &file,
@@ -56,6 +61,9 @@ MB_EXPORT oc::result<void> file_write_exact(File &file,
 
 MB_EXPORT oc::result<uint64_t> file_read_discard(File &file, uint64_t size);
 
+MB_EXPORT oc::result<uint64_t> file_copy_range(File &src, File &dst,
+                                               uint64_t size);
+
 MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
                                          uint64_t dest, uint64_t size);
 
@@ -63,15 +71,20 @@ class MB_EXPORT FileSearcher final
 {
 public:
     FileSearcher(File *file, const void *pattern, size_t pattern_size);
+    ~FileSearcher();
 
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FileSearcher)
 
     FileSearcher(FileSearcher &&other) noexcept;
     FileSearcher & operator=(FileSearcher &&rhs) noexcept;
 
+    void set_threads(unsigned int threads);
+
     oc::result<std::optional<uint64_t>> next();
 
 private:
+    void search_parallel();
+
     void clear() noexcept;
 
     // File to search
@@ -84,10 +97,74 @@ private:
             const unsigned char *>> m_searcher;
     // Search buffer
     std::vector<unsigned char> m_buf;
+    // Data being searched (either `m_buf` or the file's mapped data)
+    const unsigned char *m_data;
+    bool m_mapped;
+    // Boundaries of current search area within buffer
+    size_t m_region_begin;
+    size_t m_region_end;
+    // File offset of byte 0 of `m_data`, relative to the starting point
+    uint64_t m_offset;
+    // Number of threads for parallel searches
+    unsigned int m_threads;
+    // Worker threads for parallel searches (started on first use)
+    std::unique_ptr<detail::SearchWorkerPool> m_pool;
+    // Matches (indexes into `m_data`) found by the last parallel search
+    std::vector<size_t> m_pending;
+    size_t m_pending_index;
+};
+
+class MB_EXPORT MultiFileSearcher final
+{
+public:
+    struct Match
+    {
+        // Index of the pattern in the list passed to the constructor
+        size_t pattern;
+        // Offset relative to the starting file position
+        uint64_t offset;
+
+        bool operator==(const Match &other) const
+        {
+            return pattern == other.pattern && offset == other.offset;
+        }
+    };
+
+    MultiFileSearcher(File *file, std::vector<std::string> patterns);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MultiFileSearcher)
+
+    MultiFileSearcher(MultiFileSearcher &&other) noexcept;
+    MultiFileSearcher & operator=(MultiFileSearcher &&rhs) noexcept;
+
+    oc::result<std::optional<Match>> next();
+
+private:
+    const unsigned char * find_candidate(const unsigned char *begin,
+                                         const unsigned char *end) const;
+
+    void clear() noexcept;
+
+    // File to search
+    File *m_file;
+    // Patterns to search for
+    std::vector<std::string> m_patterns;
+    size_t m_max_size;
+    // Distinct first bytes of all patterns (for the prefilter)
+    std::vector<unsigned char> m_first_bytes;
+    // Indexes of the patterns that start with each byte
+    std::array<std::vector<size_t>, 256> m_buckets;
+    // Search buffer
+    std::vector<unsigned char> m_buf;
+    // Data being searched (either `m_buf` or the file's mapped data)
+    const unsigned char *m_data;
+    bool m_mapped;
+    // Whether `m_data` contains the rest of the file
+    bool m_eof;
     // Boundaries of current search area within buffer
     size_t m_region_begin;
     size_t m_region_end;
-    // File offset of byte 0 of `m_buf`, relative to the starting point
+    // File offset of byte 0 of `m_data`, relative to the starting point
     uint64_t m_offset;
 };
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <optional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+class File;
+
+enum class HashAlgorithm : uint8_t
+{
+    Crc32,
+    Md5,
+    Sha1,
+    Sha256,
+    Sha512,
+};
+
+using HashDigest = std::vector<unsigned char>;
+
+MB_EXPORT size_t hash_digest_size(HashAlgorithm algorithm);
+
+class MB_EXPORT Hasher final
+{
+public:
+    Hasher() noexcept;
+    ~Hasher() noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Hasher)
+
+    Hasher(Hasher &&other) noexcept;
+    Hasher & operator=(Hasher &&rhs) noexcept;
+
+    oc::result<void> init(HashAlgorithm algorithm);
+    oc::result<void> update(const void *data, size_t size);
+    oc::result<HashDigest> finish();
+
+    std::optional<HashAlgorithm> algorithm() const;
+
+private:
+    void clear() noexcept;
+
+    // Algorithm being computed (if initialized)
+    std::optional<HashAlgorithm> m_algorithm;
+    // EVP_MD_CTX for digest algorithms (opaque to keep OpenSSL out of the
+    // public headers)
+    void *m_ctx;
+    // Running checksum for CRC32
+    uint32_t m_crc32;
+};
+
+class MB_EXPORT MultiHasher final
+{
+public:
+    MultiHasher() noexcept;
+    ~MultiHasher() noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MultiHasher)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(MultiHasher)
+
+    oc::result<void> init(const std::vector<HashAlgorithm> &algorithms);
+    oc::result<void> update(const void *data, size_t size);
+    oc::result<std::vector<HashDigest>> finish();
+
+private:
+    std::vector<Hasher> m_hashers;
+};
+
+MB_EXPORT oc::result<std::vector<HashDigest>>
+file_hash(File &file, const std::vector<HashAlgorithm> &algorithms);
+
+}
@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/crc32.h"
+
+#include <array>
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <immintrin.h>
+#  define MB_HAVE_PCLMUL_CRC32
+#elif defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define MB_HAVE_ARMV8_CRC32
+#endif
+
+#include "mbcommon/endian.h"
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+
+using Crc32Func = uint32_t (*)(uint32_t, const unsigned char *, size_t);
+
+// Reversed representation of the IEEE 802.3 polynomial
+constexpr uint32_t CRC32_POLYNOMIAL = 0xedb88320;
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr Crc32Tables make_crc32_tables()
+{
+    Crc32Tables tables{};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        tables[0][i] = crc;
+    }
+
+    for (size_t t = 1; t < tables.size(); ++t) {
+        for (size_t i = 0; i < 256; ++i) {
+            auto prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+
+    return tables;
+}
+
+static constexpr Crc32Tables CRC32_TABLES = make_crc32_tables();
+
+/*!
+ * \brief Multiply two polynomials modulo the CRC32 polynomial
+ *
+ * Both polynomials use the reversed bit order, so `1 << 31` represents 1.
+ */
+static constexpr uint32_t multiply_mod_poly(uint32_t a, uint32_t b)
+{
+    uint32_t result = 0;
+
+    for (uint32_t m = UINT32_C(1) << 31; m != 0; m >>= 1) {
+        if (a & m) {
+            result ^= b;
+        }
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLYNOMIAL : b >> 1;
+    }
+
+    return result;
+}
+
+using Crc32PowerTable = std::array<uint32_t, 64>;
+
+// x^(2^n) modulo the CRC32 polynomial
+static constexpr Crc32PowerTable make_crc32_power_table()
+{
+    Crc32PowerTable table{};
+
+    // x^1
+    table[0] = UINT32_C(1) << 30;
+
+    for (size_t n = 1; n < table.size(); ++n) {
+        table[n] = multiply_mod_poly(table[n - 1], table[n - 1]);
+    }
+
+    return table;
+}
+
+static constexpr Crc32PowerTable CRC32_POWER_TABLE = make_crc32_power_table();
+
+/*!
+ * \brief Compute x^(8 * \p size) modulo the CRC32 polynomial
+ *
+ * Multiplying a CRC by this value has the same effect as feeding \p size zero
+ * bytes through the raw CRC register.
+ */
+static uint32_t crc32_shift_operator(uint64_t size)
+{
+    // x^0
+    uint32_t result = UINT32_C(1) << 31;
+
+    // Each byte is 8 = 2^3 bits
+    for (size_t n = 3; size != 0 && n < CRC32_POWER_TABLE.size();
+            ++n, size >>= 1) {
+        if (size & 1) {
+            result = multiply_mod_poly(CRC32_POWER_TABLE[n], result);
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Portable slice-by-8 kernel
+ *
+ * \note \p crc is the raw CRC register (ie. not inverted)
+ */
+static uint32_t crc32_sliced(uint32_t crc, const unsigned char *data,
+                             size_t size)
+{
+    auto &t = CRC32_TABLES;
+
+#if MB_BYTE_ORDER == MB_LITTLE_ENDIAN
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        std::memcpy(&lo, data, sizeof(lo));
+        std::memcpy(&hi, data + 4, sizeof(hi));
+        lo ^= crc;
+
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+                ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+                ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+                ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+#endif
+
+    for (; size > 0; ++data, --size) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+    }
+
+    return crc;
+}
+
+#ifdef MB_HAVE_PCLMUL_CRC32
+
+// Unaligned load of 128 bits
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i pclmul_load(const unsigned char *data)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+}
+
+// Fold 128 bits of state forward and add the next 128 bits
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i pclmul_fold(__m128i x, __m128i k, __m128i next)
+{
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+                                       _mm_clmulepi64_si128(x, k, 0x11)),
+                         next);
+}
+
+/*!
+ * \brief Carry-less multiplication folding kernel
+ *
+ * This is based on Intel's "Fast CRC Computation for Generic Polynomials Using
+ * PCLMULQDQ Instruction" paper. Four 128-bit lanes are folded in parallel, then
+ * reduced to 32 bits with a Barrett reduction.
+ *
+ * \pre \p size must be a multiple of 16 and at least 64
+ *
+ * \note \p crc is the raw CRC register (ie. not inverted)
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_blocks(uint32_t crc, const unsigned char *data,
+                                    size_t size)
+{
+    alignas(16) static constexpr uint64_t k1k2[] = {
+        0x0154442bd4, 0x01c6e41596,
+    };
+    alignas(16) static constexpr uint64_t k3k4[] = {
+        0x01751997d0, 0x00ccaa009e,
+    };
+    alignas(16) static constexpr uint64_t k5k0[] = {
+        0x0163cd6124, 0x0000000000,
+    };
+    alignas(16) static constexpr uint64_t poly[] = {
+        0x01db710641, 0x01f7011641,
+    };
+
+    auto x1 = _mm_xor_si128(pclmul_load(data),
+                            _mm_cvtsi32_si128(static_cast<int>(crc)));
+    auto x2 = pclmul_load(data + 16);
+    auto x3 = pclmul_load(data + 32);
+    auto x4 = pclmul_load(data + 48);
+    data += 64;
+    size -= 64;
+
+    // Fold 64 bytes at a time
+    auto k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+
+    for (; size >= 64; data += 64, size -= 64) {
+        x1 = pclmul_fold(x1, k, pclmul_load(data));
+        x2 = pclmul_fold(x2, k, pclmul_load(data + 16));
+        x3 = pclmul_fold(x3, k, pclmul_load(data + 32));
+        x4 = pclmul_fold(x4, k, pclmul_load(data + 48));
+    }
+
+    // Fold the four lanes into one
+    k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+
+    x1 = pclmul_fold(x1, k, x2);
+    x1 = pclmul_fold(x1, k, x3);
+    x1 = pclmul_fold(x1, k, x4);
+
+    // Fold remaining 16-byte blocks
+    for (; size >= 16; data += 16, size -= 16) {
+        x1 = pclmul_fold(x1, k, pclmul_load(data));
+    }
+
+    // Fold 128 bits to 64 bits
+    auto mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *data,
+                             size_t size)
+{
+    if (size >= 64) {
+        auto n = size & ~static_cast<size_t>(15);
+        crc = crc32_pclmul_blocks(crc, data, n);
+        data += n;
+        size -= n;
+    }
+
+    return crc32_sliced(crc, data, size);
+}
+
+#endif
+
+#ifdef MB_HAVE_ARMV8_CRC32
+
+/*!
+ * \brief ARMv8 CRC32 instruction kernel
+ *
+ * \note \p crc is the raw CRC register (ie. not inverted)
+ */
+static uint32_t crc32_armv8(uint32_t crc, const unsigned char *data,
+                            size_t size)
+{
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        crc = __crc32d(crc, mb_htole64(value));
+    }
+
+    for (; size > 0; ++data, --size) {
+        crc = __crc32b(crc, *data);
+    }
+
+    return crc;
+}
+
+#endif
+
+static Crc32Func select_crc32_func()
+{
+#if defined(MB_HAVE_PCLMUL_CRC32)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        return crc32_pclmul;
+    }
+#elif defined(MB_HAVE_ARMV8_CRC32)
+    return crc32_armv8;
+#endif
+
+    return crc32_sliced;
+}
+
+/*! \endcond */
+
+/*!
+ * \brief Update a CRC32 checksum
+ *
+ * This computes the standard CRC-32 (IEEE 802.3) checksum, the same as zlib's
+ * `crc32()`. To compute the checksum of some data, start with a \p crc value of
+ * 0 and pass the return value of the previous call for subsequent blocks of
+ * data.
+ *
+ * The fastest implementation supported by the CPU is selected at runtime:
+ * PCLMULQDQ folding on x86, the CRC32 instructions on ARMv8 (if enabled at
+ * compile time), or a portable slice-by-8 table implementation otherwise.
+ *
+ * \param crc Checksum of the previous data
+ * \param data Data to add to the checksum
+ * \param size Size of \p data
+ *
+ * \return Checksum of the previous data followed by \p data
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    static const Crc32Func func = select_crc32_func();
+
+    return ~func(~crc, static_cast<const unsigned char *>(data), size);
+}
+
+/*!
+ * \brief Update CRC32 checksum with repeated data
+ *
+ * This is equivalent to calling crc32_update() \p count times with the same
+ * data, but only takes O(log(\p count)) time. This is useful for computing the
+ * checksum of large regions that are filled with a pattern, like zeros.
+ *
+ * \param crc Checksum of the previous data
+ * \param data Data to add to the checksum
+ * \param size Size of \p data
+ * \param count Number of times \p data is repeated
+ *
+ * \return Checksum of the previous data followed by \p count copies of \p data
+ */
+uint32_t crc32_update_repeat(uint32_t crc, const void *data, size_t size,
+                             uint64_t count)
+{
+    if (size == 0 || count == 0) {
+        return crc;
+    }
+
+    // Checksum and size of 2^n copies of the data
+    uint32_t block_crc = crc32_update(0, data, size);
+    uint64_t block_size = size;
+
+    while (true) {
+        if (count & 1) {
+            crc = crc32_combine(crc, block_crc, block_size);
+        }
+
+        count >>= 1;
+        if (count == 0) {
+            break;
+        }
+
+        block_crc = crc32_combine(block_crc, block_crc, block_size);
+        block_size *= 2;
+    }
+
+    return crc;
+}
+
+/*!
+ * \brief Combine the CRC32 checksums of two pieces of data
+ *
+ * \param crc1 Checksum of the first piece of data
+ * \param crc2 Checksum of the second piece of data
+ * \param size2 Size of the second piece of data
+ *
+ * \return Checksum of the first piece of data followed by the second piece of
+ *         data
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2)
+{
+    return multiply_mod_poly(crc32_shift_operator(size2), crc1) ^ crc2;
+}
+
+}
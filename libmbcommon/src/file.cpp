@@ -19,6 +19,12 @@
 
 #include "mbcommon/file.h"
 
+#include <algorithm>
+
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+
 // File documentation
 
 /*!
@@ -169,4 +175,389 @@ File::~File() = default;
  * \return Whether file is opened
  */
 
+/*!
+ * \struct IoVec
+ *
+ * \brief Buffer descriptor for File::readv() and File::writev().
+ *
+ * This is equivalent to `struct iovec` from `sys/uio.h`.
+ */
+
+/*!
+ * \brief Read from a File handle at the specified offset.
+ *
+ * This function behaves like File::read(), except that the data is read from
+ * \p offset and the file position is left unchanged.
+ *
+ * The default implementation saves the file position, seeks to \p offset,
+ * calls File::read(), and then restores the file position. It is not safe to
+ * call concurrently on the same handle. Subclasses that can read at an offset
+ * without changing the file position (eg. with `pread()`) should override this
+ * function.
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return
+ *   * Number of bytes read if some bytes are successfully read or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedRead if the file does not support reading
+ *   * FileError::UnsupportedSeek if the file does not support seeking
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = read(buf, size);
+
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    return n;
+}
+
+/*!
+ * \brief Write to a File handle at the specified offset.
+ *
+ * This function behaves like File::write(), except that the data is written to
+ * \p offset and the file position is left unchanged.
+ *
+ * The default implementation saves the file position, seeks to \p offset,
+ * calls File::write(), and then restores the file position. It is not safe to
+ * call concurrently on the same handle. Subclasses that can write at an offset
+ * without changing the file position (eg. with `pwrite()`) should override this
+ * function.
+ *
+ * \note If the file was opened in one of the append modes, the behavior is
+ *       platform-dependent. On Linux, the data is always appended.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return
+ *   * Number of bytes written if some bytes are successfully written or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedWrite if the file does not support writing
+ *   * FileError::UnsupportedSeek if the file does not support seeking
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::write_at(uint64_t offset,
+                                  const void *buf, size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = write(buf, size);
+
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    return n;
+}
+
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * The buffers are filled in order. Like File::read(), fewer bytes than the
+ * total size of the buffers may be read.
+ *
+ * The default implementation calls File::read() for each buffer and stops at
+ * the first short read. If an error occurs after some data has already been
+ * read, the number of bytes read so far is returned and the error is dropped.
+ * Subclasses that support vectored I/O (eg. with `readv()`) should override
+ * this function.
+ *
+ * \param iov Array of buffers
+ * \param count Number of buffers in \p iov
+ *
+ * \return
+ *   * Number of bytes read if some bytes are successfully read or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedRead if the file does not support reading
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::readv(const IoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = read(iov[i].base, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * The buffers are written in order. Like File::write(), fewer bytes than the
+ * total size of the buffers may be written.
+ *
+ * The default implementation calls File::write() for each buffer and stops at
+ * the first short write. If an error occurs after some data has already been
+ * written, the number of bytes written so far is returned and the error is
+ * dropped. Subclasses that support vectored I/O (eg. with `writev()`) should
+ * override this function.
+ *
+ * \param iov Array of buffers
+ * \param count Number of buffers in \p iov
+ *
+ * \return
+ *   * Number of bytes written if some bytes are successfully written or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedWrite if the file does not support writing
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::writev(const IoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = write(iov[i].base, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Allocate disk space for a range of the file.
+ *
+ * After this function returns successfully, writes to the range
+ * [\p offset, \p offset + \p size) are guaranteed not to fail due to a lack of
+ * disk space. If the range extends past the end of the file, the file size is
+ * increased. The contents of the file are not changed. New space reads back as
+ * zeros.
+ *
+ * The default implementation returns FileError::UnsupportedAllocate.
+ *
+ * \param offset Starting offset of range
+ * \param size Size of range
+ *
+ * \return
+ *   * Nothing if the space is successfully allocated
+ *   * FileError::UnsupportedAllocate if the file or the underlying filesystem
+ *     does not support preallocation
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> File::allocate(uint64_t offset, uint64_t size)
+{
+    (void) offset;
+    (void) size;
+    return FileError::UnsupportedAllocate;
+}
+
+/*!
+ * \brief Deallocate a range of the file.
+ *
+ * After this function returns successfully, the range
+ * [\p offset, \p offset + \p size) reads back as zeros and the disk space that
+ * backed it is released. The file size is never changed.
+ *
+ * The default implementation returns FileError::UnsupportedAllocate. Use
+ * File::zero_range() if only the contents matter.
+ *
+ * \param offset Starting offset of range
+ * \param size Size of range
+ *
+ * \return
+ *   * Nothing if the range is successfully deallocated
+ *   * FileError::UnsupportedAllocate if the file or the underlying filesystem
+ *     does not support deallocating ranges
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> File::punch_hole(uint64_t offset, uint64_t size)
+{
+    (void) offset;
+    (void) size;
+    return FileError::UnsupportedAllocate;
+}
+
+/*!
+ * \brief Set a range of the file to zeros.
+ *
+ * After this function returns successfully, the range
+ * [\p offset, \p offset + \p size) reads back as zeros. If the range extends
+ * past the end of the file, the file size is increased. The file position is
+ * not changed.
+ *
+ * The default implementation writes zeros with File::write_at(). Subclasses
+ * that can zero a range without writing the data (eg. with `fallocate()`)
+ * should override this function.
+ *
+ * \param offset Starting offset of range
+ * \param size Size of range
+ *
+ * \return
+ *   * Nothing if the range is successfully zeroed
+ *   * FileError::ArgumentOutOfRange if the range overflows
+ *   * FileError::UnexpectedEof if the zeros could not be fully written
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> File::zero_range(uint64_t offset, uint64_t size)
+{
+    static constexpr unsigned char zeros[64 * 1024] = {};
+
+    if (offset > INT64_MAX || size > INT64_MAX - offset) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    while (size > 0) {
+        auto to_write = static_cast<size_t>(
+                std::min<uint64_t>(size, sizeof(zeros)));
+
+        auto n = write_at(offset, zeros, to_write);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        offset += n.value();
+        size -= n.value();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Find the next offset that contains data.
+ *
+ * This is equivalent to `lseek(fd, offset, SEEK_DATA)`, except that the file
+ * position is not changed. Any offset that is not in a hole is considered to
+ * contain data, even if the data is all zeros.
+ *
+ * The default implementation treats the entire file as data. The file size is
+ * determined by seeking and the file position is restored afterwards.
+ *
+ * \param offset Offset to start searching from
+ *
+ * \return
+ *   * The first offset >= \p offset that contains data
+ *   * std::nullopt if there is no more data after \p offset
+ *   * Otherwise, a specific error code
+ */
+oc::result<std::optional<uint64_t>> File::next_data(uint64_t offset)
+{
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRY(size, seek(0, SEEK_END));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    if (offset >= size) {
+        return std::nullopt;
+    }
+
+    return offset;
+}
+
+/*!
+ * \brief Find the next offset that is in a hole.
+ *
+ * This is equivalent to `lseek(fd, offset, SEEK_HOLE)`, except that the file
+ * position is not changed. The end of the file is considered to be a hole.
+ *
+ * The default implementation treats the entire file as data, so the file size
+ * is returned for any offset within the file. The file position is restored
+ * after the file size is determined.
+ *
+ * \param offset Offset to start searching from
+ *
+ * \return
+ *   * The first offset >= \p offset that is in a hole
+ *   * std::nullopt if \p offset is at or after the end of the file
+ *   * Otherwise, a specific error code
+ */
+oc::result<std::optional<uint64_t>> File::next_hole(uint64_t offset)
+{
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRY(size, seek(0, SEEK_END));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    if (offset >= size) {
+        return std::nullopt;
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Get pointer to the file contents if they are entirely in memory.
+ *
+ * This allows callers that only need to inspect the data, such as
+ * FileSearcher, to avoid copying it through a buffer. The pointer is only valid
+ * until the next operation that modifies the file and must not be written to.
+ *
+ * The default implementation returns nullptr, which means that the contents
+ * must be accessed with read() or read_at().
+ *
+ * \param[out] size Size of the file contents. Only set if the return value is
+ *                  not nullptr.
+ *
+ * \return Pointer to the beginning of the file contents or nullptr if the
+ *         contents are not available in memory
+ */
+const void * File::mapped_data(uint64_t &size)
+{
+    (void) size;
+    return nullptr;
+}
+
+/*!
+ * \brief Get the file descriptor backing this handle.
+ *
+ * This allows operations like file_copy_range() to hand the I/O off to the
+ * kernel. A file descriptor must only be returned if its file position is
+ * always the same as the handle's file position and no data is buffered in
+ * userspace.
+ *
+ * The default implementation returns -1.
+ *
+ * \return File descriptor or -1 if the handle is not backed by a file
+ *         descriptor that can be used directly
+ */
+int File::native_fd()
+{
+    return -1;
+}
+
 }
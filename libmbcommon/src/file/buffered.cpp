@@ -0,0 +1,541 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Buffer reads and writes of another File handle
+ */
+
+namespace mb
+{
+
+/*!
+ * \class BufferedFile
+ *
+ * \brief Read-ahead and write-coalescing wrapper for a File handle.
+ *
+ * Small reads are served from a buffer that is filled with one large read of
+ * the underlying file and small writes are collected in the buffer until it is
+ * full. Reads and writes that are at least as large as the buffer bypass it.
+ *
+ * The logical file position is always maintained. Seeking within the read-ahead
+ * buffer does not touch the underlying file. Pending writes are flushed before
+ * any operation that needs the underlying file to be up to date and when the
+ * handle is closed.
+ *
+ * The underlying file is not owned by the BufferedFile instance and will not be
+ * closed when the BufferedFile is closed. When closed, the underlying file's
+ * position will equal the logical position of the BufferedFile. While the
+ * BufferedFile is open, the underlying file must not be used directly.
+ *
+ * \note Files opened in append mode are not supported because the position of
+ *       each write cannot be predicted.
+ */
+
+/*!
+ * \var BufferedFile::DEFAULT_BUF_SIZE
+ *
+ * \brief Default size of the read/write buffer.
+ */
+
+/*!
+ * \brief Construct unbound BufferedFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to wrap a file.
+ */
+BufferedFile::BufferedFile()
+    : m_file(nullptr)
+    , m_read_pos(0)
+    , m_read_end(0)
+    , m_write_size(0)
+{
+}
+
+/*!
+ * \brief Open File handle that wraps another File handle.
+ *
+ * Construct the file handle and wrap \p file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t)
+ *
+ * \param file File to wrap
+ * \param buf_size Size of read/write buffer
+ */
+BufferedFile::BufferedFile(File *file, size_t buf_size)
+    : BufferedFile()
+{
+    (void) open(file, buf_size);
+}
+
+/*!
+ * \brief Destroy BufferedFile.
+ *
+ * Any pending writes will be flushed. Errors are ignored. Call close() or
+ * flush() beforehand to check for errors.
+ */
+BufferedFile::~BufferedFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+BufferedFile::BufferedFile(BufferedFile &&other) noexcept
+    : BufferedFile()
+{
+    std::swap(m_file, other.m_file);
+    std::swap(m_buf, other.m_buf);
+    std::swap(m_read_pos, other.m_read_pos);
+    std::swap(m_read_end, other.m_read_end);
+    std::swap(m_write_size, other.m_write_size);
+    std::swap(m_buf_offset, other.m_buf_offset);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object.
+ *
+ * \param rhs File handle to move from
+ */
+BufferedFile & BufferedFile::operator=(BufferedFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_buf, rhs.m_buf);
+        std::swap(m_read_pos, rhs.m_read_pos);
+        std::swap(m_read_end, rhs.m_read_end);
+        std::swap(m_write_size, rhs.m_write_size);
+        std::swap(m_buf_offset, rhs.m_buf_offset);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * \param file File to wrap. The file's current position becomes the initial
+ *             position of this handle.
+ * \param buf_size Size of read/write buffer
+ *
+ * \return
+ *   * Nothing if the file is successfully opened
+ *   * FileError::InvalidState if the file is already open
+ *   * FileError::ArgumentOutOfRange if \p file is null or \p buf_size is 0
+ */
+oc::result<void> BufferedFile::open(File *file, size_t buf_size)
+{
+    if (is_open()) {
+        return FileError::InvalidState;
+    } else if (!file || buf_size == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    m_buf.resize(buf_size);
+    m_file = file;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Close the file handle.
+ *
+ * Pending writes are flushed and the underlying file is seeked back to the
+ * logical file position if data was read ahead. The underlying file is not
+ * closed. Regardless of the return value, the handle is closed.
+ *
+ * \return Nothing if the pending data is successfully flushed. Otherwise, the
+ *         error code.
+ */
+oc::result<void> BufferedFile::close()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto reset = finally([&] {
+        clear();
+    });
+
+    return sync();
+}
+
+oc::result<size_t> BufferedFile::read(void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(flush());
+
+    auto *out = static_cast<unsigned char *>(buf);
+    size_t n = std::min(m_read_end - m_read_pos, size);
+
+    // Serve as much as possible from the read-ahead buffer
+    memcpy(out, m_buf.data() + m_read_pos, n);
+    m_read_pos += n;
+
+    if (n == size) {
+        return n;
+    }
+
+    // Buffer is now empty
+    if (m_buf_offset) {
+        *m_buf_offset += m_read_end;
+    }
+    m_read_pos = 0;
+    m_read_end = 0;
+
+    auto remaining = size - n;
+
+    if (remaining >= m_buf.size()) {
+        // Large reads go straight to the underlying file
+        auto n_read = m_file->read(out + n, remaining);
+        if (!n_read) {
+            if (n > 0) {
+                return n;
+            }
+            return n_read.as_failure();
+        }
+
+        if (m_buf_offset) {
+            *m_buf_offset += n_read.value();
+        }
+
+        return n + n_read.value();
+    }
+
+    auto n_read = m_file->read(m_buf.data(), m_buf.size());
+    if (!n_read) {
+        if (n > 0) {
+            return n;
+        }
+        return n_read.as_failure();
+    }
+
+    m_read_end = n_read.value();
+    m_read_pos = std::min(m_read_end, remaining);
+    memcpy(out + n, m_buf.data(), m_read_pos);
+
+    return n + m_read_pos;
+}
+
+oc::result<size_t> BufferedFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (m_read_end > 0) {
+        // Drop read-ahead data so the underlying file is at the right position
+        OUTCOME_TRYV(sync());
+    }
+
+    if (m_write_size + size > m_buf.size()) {
+        OUTCOME_TRYV(flush());
+    }
+
+    if (size >= m_buf.size()) {
+        // Large writes go straight to the underlying file
+        OUTCOME_TRY(n, m_file->write(buf, size));
+
+        if (m_buf_offset) {
+            *m_buf_offset += n;
+        }
+
+        return n;
+    }
+
+    memcpy(m_buf.data() + m_write_size, buf, size);
+    m_write_size += size;
+
+    return size;
+}
+
+oc::result<uint64_t> BufferedFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(flush());
+
+    // Try to seek within the read-ahead buffer
+    if ((m_read_end > 0 || m_buf_offset)
+            && (whence == SEEK_SET || whence == SEEK_CUR)) {
+        OUTCOME_TRY(base, buffer_offset());
+
+        uint64_t cur = base + m_read_pos;
+        std::optional<uint64_t> target;
+
+        if (whence == SEEK_SET) {
+            if (offset >= 0) {
+                target = static_cast<uint64_t>(offset);
+            }
+        } else if (offset >= 0) {
+            if (cur <= UINT64_MAX - static_cast<uint64_t>(offset)) {
+                target = cur + static_cast<uint64_t>(offset);
+            }
+        } else {
+            auto diff = static_cast<uint64_t>(-(offset + 1)) + 1;
+            if (diff <= cur) {
+                target = cur - diff;
+            }
+        }
+
+        if (target && *target >= base && *target - base <= m_read_end) {
+            m_read_pos = static_cast<size_t>(*target - base);
+            return *target;
+        }
+    }
+
+    if (whence == SEEK_CUR) {
+        // Account for the data that was read ahead
+        auto ahead = static_cast<int64_t>(m_read_end - m_read_pos);
+        if (offset < INT64_MIN + ahead) {
+            return FileError::ArgumentOutOfRange;
+        }
+        offset -= ahead;
+    }
+
+    OUTCOME_TRY(pos, m_file->seek(offset, whence));
+
+    m_read_pos = 0;
+    m_read_end = 0;
+    m_buf_offset = pos;
+
+    return pos;
+}
+
+oc::result<void> BufferedFile::truncate(uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(sync());
+
+    return m_file->truncate(size);
+}
+
+oc::result<size_t> BufferedFile::read_at(uint64_t offset,
+                                         void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(flush());
+
+    return m_file->read_at(offset, buf, size);
+}
+
+oc::result<size_t> BufferedFile::write_at(uint64_t offset,
+                                          const void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    // The read-ahead data may be overwritten
+    OUTCOME_TRYV(sync());
+
+    return m_file->write_at(offset, buf, size);
+}
+
+oc::result<void> BufferedFile::allocate(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    // The read-ahead data may be changed
+    OUTCOME_TRYV(sync());
+
+    return m_file->allocate(offset, size);
+}
+
+oc::result<void> BufferedFile::punch_hole(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    // The read-ahead data may be changed
+    OUTCOME_TRYV(sync());
+
+    return m_file->punch_hole(offset, size);
+}
+
+oc::result<void> BufferedFile::zero_range(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    // The read-ahead data may be changed
+    OUTCOME_TRYV(sync());
+
+    return m_file->zero_range(offset, size);
+}
+
+oc::result<std::optional<uint64_t>> BufferedFile::next_data(uint64_t offset)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(flush());
+
+    return m_file->next_data(offset);
+}
+
+oc::result<std::optional<uint64_t>> BufferedFile::next_hole(uint64_t offset)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(flush());
+
+    return m_file->next_hole(offset);
+}
+
+bool BufferedFile::is_open()
+{
+    return m_file != nullptr;
+}
+
+/*!
+ * \brief Write pending data to the underlying file.
+ *
+ * If this function fails, the data that was not written remains buffered and
+ * will be written during the next flush.
+ *
+ * \return Nothing if all pending data is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> BufferedFile::flush()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    size_t written = 0;
+
+    auto discard_written = finally([&] {
+        memmove(m_buf.data(), m_buf.data() + written, m_write_size - written);
+        m_write_size -= written;
+
+        if (m_buf_offset) {
+            *m_buf_offset += written;
+        }
+    });
+
+    while (written < m_write_size) {
+        auto n = m_file->write(m_buf.data() + written, m_write_size - written);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        written += n.value();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Make underlying file's position match the logical file position.
+ *
+ * This flushes pending writes and discards read-ahead data.
+ */
+oc::result<void> BufferedFile::sync()
+{
+    OUTCOME_TRYV(flush());
+
+    if (m_read_end > 0) {
+        if (auto ahead = m_read_end - m_read_pos; ahead > 0) {
+            OUTCOME_TRY(pos, m_file->seek(-static_cast<int64_t>(ahead),
+                                          SEEK_CUR));
+            m_buf_offset = pos;
+        } else if (m_buf_offset) {
+            *m_buf_offset += m_read_end;
+        }
+
+        m_read_pos = 0;
+        m_read_end = 0;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Get file offset of byte 0 of the buffer.
+ *
+ * The underlying file is only queried if the offset is not yet known.
+ */
+oc::result<uint64_t> BufferedFile::buffer_offset()
+{
+    if (!m_buf_offset) {
+        OUTCOME_TRY(pos, m_file->seek(0, SEEK_CUR));
+        m_buf_offset = pos - m_read_end;
+    }
+
+    return *m_buf_offset;
+}
+
+void BufferedFile::clear() noexcept
+{
+    m_file = nullptr;
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_read_pos = 0;
+    m_read_end = 0;
+    m_write_size = 0;
+    m_buf_offset = std::nullopt;
+}
+
+}
@@ -19,13 +19,22 @@
 
 #include "mbcommon/file/fd.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 
 #include <fcntl.h>
+#ifdef __linux__
+#  include <linux/falloc.h>
+#endif
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
@@ -90,6 +99,53 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return write(fd, buf, count);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return ::readv(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return ::writev(fd, iov, iovcnt);
+    }
+
+    int fn_fallocate64(int fd, int mode, off64_t offset,
+                       off64_t len) override
+    {
+#if defined(__ANDROID__) && __ANDROID_API__ < 21
+        // fallocate64() is only available in bionic for API 21+
+        (void) fd;
+        (void) mode;
+        (void) offset;
+        (void) len;
+        errno = ENOSYS;
+        return -1;
+#elif defined(__linux__)
+        return fallocate64(fd, mode, offset, len);
+#else
+        (void) fd;
+        (void) mode;
+        (void) offset;
+        (void) len;
+        errno = EOPNOTSUPP;
+        return -1;
+#endif
+    }
+#endif
 };
 /*! \endcond */
 
@@ -99,6 +155,30 @@ static RealFdFileFuncs g_default_funcs;
 
 FdFileFuncs::~FdFileFuncs() = default;
 
+#ifndef _WIN32
+// IoVec is passed directly to readv() and writev()
+static_assert(sizeof(IoVec) == sizeof(iovec)
+        && offsetof(IoVec, base) == offsetof(iovec, iov_base)
+        && offsetof(IoVec, size) == offsetof(iovec, iov_len),
+        "IoVec is not layout compatible with struct iovec");
+
+static int clamp_iovcnt(size_t count)
+{
+    return static_cast<int>(std::min<size_t>(count, IOV_MAX));
+}
+
+// Only Linux supports anything other than plain preallocation
+#ifndef FALLOC_FL_KEEP_SIZE
+#  define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#  define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+#ifndef FALLOC_FL_ZERO_RANGE
+#  define FALLOC_FL_ZERO_RANGE 0x10
+#endif
+#endif
+
 static int convert_mode(FileOpenMode mode)
 {
     int ret = 0;
@@ -483,11 +563,233 @@ oc::result<void> FdFile::truncate(uint64_t size)
     return oc::success();
 }
 
+#ifndef _WIN32
+
+oc::result<size_t> FdFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(m_fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::write_at(uint64_t offset,
+                                    const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(m_fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    ssize_t n = m_funcs->fn_readv(m_fd, reinterpret_cast<const iovec *>(iov),
+                                  clamp_iovcnt(count));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+oc::result<size_t> FdFile::writev(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    ssize_t n = m_funcs->fn_writev(m_fd, reinterpret_cast<const iovec *>(iov),
+                                   clamp_iovcnt(count));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+/*!
+ * \brief Allocate disk space for a range of the file.
+ *
+ * This uses `fallocate()`. See File::allocate() for details.
+ */
+oc::result<void> FdFile::allocate(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return fallocate(0, offset, size);
+}
+
+/*!
+ * \brief Deallocate a range of the file.
+ *
+ * This uses `fallocate()` with `FALLOC_FL_PUNCH_HOLE`. See File::punch_hole()
+ * for details.
+ */
+oc::result<void> FdFile::punch_hole(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return fallocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+}
+
+/*!
+ * \brief Set a range of the file to zeros.
+ *
+ * This uses `fallocate()` with `FALLOC_FL_ZERO_RANGE`. If that is not supported
+ * by the filesystem, this falls back to File::zero_range(), which writes the
+ * zeros.
+ */
+oc::result<void> FdFile::zero_range(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto ret = fallocate(FALLOC_FL_ZERO_RANGE, offset, size);
+    if (!ret && ret.error() == FileError::UnsupportedAllocate) {
+        return File::zero_range(offset, size);
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Find the next offset that contains data.
+ *
+ * This uses `lseek()` with `SEEK_DATA` and then restores the file position. If
+ * `SEEK_DATA` is not supported, this falls back to File::next_data().
+ */
+oc::result<std::optional<uint64_t>> FdFile::next_data(uint64_t offset)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef SEEK_DATA
+    return seek_data_hole(offset, SEEK_DATA);
+#else
+    return File::next_data(offset);
+#endif
+}
+
+/*!
+ * \brief Find the next offset that is in a hole.
+ *
+ * This uses `lseek()` with `SEEK_HOLE` and then restores the file position. If
+ * `SEEK_HOLE` is not supported, this falls back to File::next_hole().
+ */
+oc::result<std::optional<uint64_t>> FdFile::next_hole(uint64_t offset)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef SEEK_HOLE
+    return seek_data_hole(offset, SEEK_HOLE);
+#else
+    return File::next_hole(offset);
+#endif
+}
+
+oc::result<void> FdFile::fallocate(int mode, uint64_t offset, uint64_t size)
+{
+    if (offset > INT64_MAX || size > INT64_MAX - offset) {
+        return FileError::ArgumentOutOfRange;
+    } else if (size == 0) {
+        // fallocate() rejects empty ranges
+        return oc::success();
+    }
+
+    if (m_funcs->fn_fallocate64(m_fd, mode, static_cast<off64_t>(offset),
+                                static_cast<off64_t>(size)) < 0) {
+        if (errno == EOPNOTSUPP || errno == ENOSYS) {
+            return FileError::UnsupportedAllocate;
+        }
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+#ifdef SEEK_DATA
+oc::result<std::optional<uint64_t>>
+FdFile::seek_data_hole(uint64_t offset, int whence)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    off64_t orig_pos = m_funcs->fn_lseek64(m_fd, 0, SEEK_CUR);
+    if (orig_pos < 0) {
+        return ec_from_errno();
+    }
+
+    off64_t ret = m_funcs->fn_lseek64(m_fd, static_cast<off64_t>(offset),
+                                      whence);
+    int saved_errno = errno;
+
+    if (m_funcs->fn_lseek64(m_fd, orig_pos, SEEK_SET) < 0) {
+        return ec_from_errno();
+    }
+
+    if (ret < 0) {
+        if (saved_errno == ENXIO) {
+            // No data or hole after offset
+            return std::nullopt;
+        } else if (saved_errno == EINVAL) {
+            // Not supported by the kernel
+            return whence == SEEK_DATA
+                    ? File::next_data(offset)
+                    : File::next_hole(offset);
+        }
+        return ec_from_errno(saved_errno);
+    }
+
+    return static_cast<uint64_t>(ret);
+}
+#endif
+
+#endif
+
 bool FdFile::is_open()
 {
     return m_fd >= 0;
 }
 
+/*!
+ * \brief Get underlying file descriptor
+ *
+ * The file descriptor is still owned by this File handle (if it was opened as
+ * owned) and must not be closed by the caller.
+ *
+ * \return File descriptor or -1 if the file is not open
+ */
+int FdFile::native_fd()
+{
+    return m_fd;
+}
+
 void FdFile::clear() noexcept
 {
     m_fd = -1;
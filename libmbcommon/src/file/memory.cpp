@@ -205,57 +205,20 @@ oc::result<size_t> MemoryFile::read(void *buf, size_t size)
 {
     if (!is_open()) return FileError::InvalidState;
 
-    size_t to_read = 0;
-    if (m_pos < m_size) {
-        to_read = std::min(m_size - m_pos, size);
-    }
+    auto n = read_at_pos(m_pos, buf, size);
+    m_pos += n;
 
-    memcpy(buf, static_cast<char *>(m_data) + m_pos, to_read);
-    m_pos += to_read;
-
-    return to_read;
+    return n;
 }
 
 oc::result<size_t> MemoryFile::write(const void *buf, size_t size)
 {
     if (!is_open()) return FileError::InvalidState;
 
-    if (m_pos > SIZE_MAX - size) {
-        return FileError::ArgumentOutOfRange;
-    }
-
-    size_t desired_size = m_pos + size;
-    size_t to_write = size;
-
-    if (desired_size > m_size) {
-        if (m_fixed_size) {
-            to_write = m_pos <= m_size ? m_size - m_pos : 0;
-        } else {
-            // Enlarge buffer
-            void *new_data = realloc(m_data, desired_size);
-            if (!new_data) {
-                return ec_from_errno();
-            }
+    OUTCOME_TRY(n, write_at_pos(m_pos, buf, size));
+    m_pos += n;
 
-            // Zero-initialize new space
-            std::fill_n(static_cast<char *>(new_data) + m_size,
-                        desired_size - m_size, 0);
-
-            m_data = new_data;
-            m_size = desired_size;
-            if (m_data_ptr) {
-                *m_data_ptr = m_data;
-            }
-            if (m_size_ptr) {
-                *m_size_ptr = m_size;
-            }
-        }
-    }
-
-    memcpy(static_cast<char *>(m_data) + m_pos, buf, to_write);
-    m_pos += to_write;
-
-    return to_write;
+    return n;
 }
 
 oc::result<uint64_t> MemoryFile::seek(int64_t offset, int whence)
@@ -304,29 +267,89 @@ oc::result<void> MemoryFile::truncate(uint64_t size)
     if (m_fixed_size) {
         // Cannot truncate fixed buffer
         return FileError::UnsupportedTruncate;
-    } else {
-        void *new_data = realloc(m_data, static_cast<size_t>(size));
-        if (!new_data) {
-            return ec_from_errno();
-        }
+    }
+
+    return resize(static_cast<size_t>(size));
+}
 
-        // Zero-initialize new space
-        if (size > m_size) {
-            std::fill_n(static_cast<char *>(new_data) + m_size,
-                        static_cast<size_t>(size) - m_size, 0);
+oc::result<size_t> MemoryFile::read_at(uint64_t offset,
+                                       void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset >= m_size) {
+        return 0;
+    }
+
+    return read_at_pos(static_cast<size_t>(offset), buf, size);
+}
+
+oc::result<size_t> MemoryFile::write_at(uint64_t offset,
+                                        const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return write_at_pos(static_cast<size_t>(offset), buf, size);
+}
+
+oc::result<size_t> MemoryFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = read_at_pos(m_pos, iov[i].base, iov[i].size);
+        m_pos += n;
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
         }
+    }
+
+    return total;
+}
 
-        m_data = new_data;
-        m_size = static_cast<size_t>(size);
-        if (m_data_ptr) {
-            *m_data_ptr = m_data;
+oc::result<size_t> MemoryFile::writev(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t total_size = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (iov[i].size > SIZE_MAX - total_size) {
+            return FileError::ArgumentOutOfRange;
         }
-        if (m_size_ptr) {
-            *m_size_ptr = m_size;
+        total_size += iov[i].size;
+    }
+
+    if (m_pos > SIZE_MAX - total_size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Enlarge the buffer once instead of once per IoVec
+    if (!m_fixed_size && m_pos + total_size > m_size) {
+        OUTCOME_TRYV(resize(m_pos + total_size));
+    }
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRY(n, write_at_pos(m_pos, iov[i].base, iov[i].size));
+        m_pos += n;
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
         }
     }
 
-    return oc::success();
+    return total;
 }
 
 bool MemoryFile::is_open()
@@ -334,6 +357,66 @@ bool MemoryFile::is_open()
     return m_is_open;
 }
 
+size_t MemoryFile::read_at_pos(size_t pos, void *buf, size_t size)
+{
+    size_t to_read = 0;
+    if (pos < m_size) {
+        to_read = std::min(m_size - pos, size);
+        memcpy(buf, static_cast<char *>(m_data) + pos, to_read);
+    }
+
+    return to_read;
+}
+
+oc::result<size_t> MemoryFile::write_at_pos(size_t pos,
+                                            const void *buf, size_t size)
+{
+    if (pos > SIZE_MAX - size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    size_t desired_size = pos + size;
+    size_t to_write = size;
+
+    if (desired_size > m_size) {
+        if (m_fixed_size) {
+            to_write = pos <= m_size ? m_size - pos : 0;
+        } else {
+            OUTCOME_TRYV(resize(desired_size));
+        }
+    }
+
+    if (to_write > 0) {
+        memcpy(static_cast<char *>(m_data) + pos, buf, to_write);
+    }
+
+    return to_write;
+}
+
+oc::result<void> MemoryFile::resize(size_t size)
+{
+    void *new_data = realloc(m_data, size);
+    if (!new_data) {
+        return ec_from_errno();
+    }
+
+    // Zero-initialize new space
+    if (size > m_size) {
+        std::fill_n(static_cast<char *>(new_data) + m_size, size - m_size, 0);
+    }
+
+    m_data = new_data;
+    m_size = size;
+    if (m_data_ptr) {
+        *m_data_ptr = m_data;
+    }
+    if (m_size_ptr) {
+        *m_size_ptr = m_size;
+    }
+
+    return oc::success();
+}
+
 void MemoryFile::clear() noexcept
 {
     m_is_open = false;
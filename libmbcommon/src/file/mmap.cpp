@@ -0,0 +1,853 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/mmap.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__ANDROID__) && __ANDROID_API__ < 21
+#  include <sys/syscall.h>
+#endif
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/locale.h"
+
+/*!
+ * \file mbcommon/file/mmap.h
+ * \brief Open file with memory-mapped I/O
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+static constexpr mode_t DEFAULT_MODE =
+        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+
+// Largest region that is mapped at once. Larger files are accessed through
+// windows of this size so that multi-GB images do not exhaust the address space
+// on 32-bit devices.
+#if SIZE_MAX > UINT32_MAX
+static constexpr uint64_t MAX_MAP_SIZE = UINT64_C(1) << 40;
+#else
+static constexpr uint64_t MAX_MAP_SIZE = UINT64_C(128) << 20;
+#endif
+
+/*! \cond INTERNAL */
+struct RealMmapFileFuncs : public MmapFileFuncs
+{
+    int fn_open(const char *path, int flags, mode_t mode) override
+    {
+        return open(path, flags, mode);
+    }
+
+    int fn_fcntl(int fd, int cmd) override
+    {
+        return fcntl(fd, cmd);
+    }
+
+    void * fn_mmap(void *addr, size_t length, int prot, int flags,
+                   int fd, off64_t offset) override
+    {
+#if defined(__ANDROID__) && __ANDROID_API__ < 21
+        // mmap64() is only available in API 21+. Do what bionic does and call
+        // mmap2 directly, which takes the offset in units of 4096 bytes.
+        if (offset < 0 || (offset & 4095) != 0) {
+            errno = EINVAL;
+            return MAP_FAILED;
+        }
+        return reinterpret_cast<void *>(syscall(
+                __NR_mmap2, addr, length, prot, flags, fd,
+                static_cast<size_t>(offset >> 12)));
+#else
+        return mmap64(addr, length, prot, flags, fd, offset);
+#endif
+    }
+
+    int fn_munmap(void *addr, size_t length) override
+    {
+        return munmap(addr, length);
+    }
+
+    int fn_fstat(int fildes, struct stat *buf) override
+    {
+        return fstat(fildes, buf);
+    }
+
+    int fn_close(int fd) override
+    {
+        return close(fd);
+    }
+
+    int fn_ftruncate64(int fd, off64_t length) override
+    {
+        return ftruncate64(fd, length);
+    }
+
+    off64_t fn_lseek64(int fd, off64_t offset, int whence) override
+    {
+        return lseek64(fd, offset, whence);
+    }
+};
+/*! \endcond */
+
+static RealMmapFileFuncs g_default_funcs;
+
+/*! \cond INTERNAL */
+
+MmapFileFuncs::~MmapFileFuncs() = default;
+
+static int convert_mode(FileOpenMode mode)
+{
+    // Mappings always require the file to be readable
+    int ret = O_CLOEXEC;
+
+    switch (mode) {
+    case FileOpenMode::ReadOnly:
+        ret |= O_RDONLY;
+        break;
+    case FileOpenMode::ReadWrite:
+        ret |= O_RDWR;
+        break;
+    case FileOpenMode::WriteOnly:
+    case FileOpenMode::ReadWriteTrunc:
+        ret |= O_RDWR | O_CREAT | O_TRUNC;
+        break;
+    case FileOpenMode::Append:
+    case FileOpenMode::ReadAppend:
+        ret |= O_RDWR | O_CREAT | O_APPEND;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid mode: %d", static_cast<int>(mode));
+    }
+
+    return ret;
+}
+
+/*! \endcond */
+
+/*!
+ * \struct MmapSpan
+ *
+ * \brief Read-only view of a region of a memory-mapped file.
+ *
+ * The view points directly into the mapping and is only valid until the next
+ * operation on the file that produced it.
+ */
+
+/*!
+ * \class MmapFile
+ *
+ * \brief Open file using memory-mapped I/O on Unix-like systems.
+ *
+ * The file is mapped into memory when it is opened. Reads and writes are served
+ * by copying to or from the mapping, which avoids a system call per operation.
+ * Callers that only need to inspect the data can use map_region() or
+ * mapped_data() to access the file contents directly from the page cache
+ * without any copying.
+ *
+ * Files larger than 1 TiB (128 MiB on 32-bit systems) are not mapped in one
+ * piece. Instead, fixed-size windows of the file are mapped on demand. Block
+ * devices are supported and their size is determined by seeking to the end.
+ *
+ * Writing past the end of the file or truncating the file will cause it to be
+ * remapped.
+ *
+ * \warning If the underlying file is truncated by another process while it is
+ *          mapped, accessing the truncated portion will raise `SIGBUS`.
+ */
+
+/*!
+ * \brief Construct unbound MmapFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+MmapFile::MmapFile()
+    : MmapFile(&g_default_funcs)
+{
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int, bool)
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ */
+MmapFile::MmapFile(int fd, bool owned)
+    : MmapFile(&g_default_funcs, fd, owned)
+{
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::string &, FileOpenMode)
+ *
+ * \param filename MBS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ */
+MmapFile::MmapFile(const std::string &filename, FileOpenMode mode)
+    : MmapFile(&g_default_funcs, filename, mode)
+{
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::wstring &, FileOpenMode)
+ *
+ * \param filename WCS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ */
+MmapFile::MmapFile(const std::wstring &filename, FileOpenMode mode)
+    : MmapFile(&g_default_funcs, filename, mode)
+{
+}
+
+/*! \cond INTERNAL */
+
+MmapFile::MmapFile(MmapFileFuncs *funcs)
+    : File(), m_funcs(funcs)
+{
+    clear();
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   int fd, bool owned)
+    : MmapFile(funcs)
+{
+    (void) open(fd, owned);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   const std::string &filename, FileOpenMode mode)
+    : MmapFile(funcs)
+{
+    (void) open(filename, mode);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs,
+                   const std::wstring &filename, FileOpenMode mode)
+    : MmapFile(funcs)
+{
+    (void) open(filename, mode);
+}
+
+void MmapFile::set_max_map_size(uint64_t size)
+{
+    m_max_map_size = size;
+}
+
+/*! \endcond */
+
+MmapFile::~MmapFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+MmapFile::MmapFile(MmapFile &&other) noexcept
+{
+    clear();
+
+    std::swap(m_funcs, other.m_funcs);
+    std::swap(m_fd, other.m_fd);
+    std::swap(m_owned, other.m_owned);
+    std::swap(m_filename, other.m_filename);
+    std::swap(m_flags, other.m_flags);
+    std::swap(m_writable, other.m_writable);
+    std::swap(m_append, other.m_append);
+    std::swap(m_map, other.m_map);
+    std::swap(m_map_offset, other.m_map_offset);
+    std::swap(m_map_size, other.m_map_size);
+    std::swap(m_max_map_size, other.m_max_map_size);
+    std::swap(m_size, other.m_size);
+    std::swap(m_pos, other.m_pos);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+MmapFile & MmapFile::operator=(MmapFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_funcs, rhs.m_funcs);
+        std::swap(m_fd, rhs.m_fd);
+        std::swap(m_owned, rhs.m_owned);
+        std::swap(m_filename, rhs.m_filename);
+        std::swap(m_flags, rhs.m_flags);
+        std::swap(m_writable, rhs.m_writable);
+        std::swap(m_append, rhs.m_append);
+        std::swap(m_map, rhs.m_map);
+        std::swap(m_map_offset, rhs.m_map_offset);
+        std::swap(m_map_size, rhs.m_map_size);
+        std::swap(m_max_map_size, rhs.m_max_map_size);
+        std::swap(m_size, rhs.m_size);
+        std::swap(m_pos, rhs.m_pos);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Open from file descriptor.
+ *
+ * If \p owned is true, then the File handle will take ownership of the file
+ * descriptor. In other words, the file descriptor will be closed when the
+ * File handle is closed.
+ *
+ * The mapping will be writable if the file descriptor was opened with
+ * `O_RDWR`. File descriptors opened with `O_WRONLY` cannot be mapped.
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(int fd, bool owned)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    m_fd = fd;
+    m_owned = owned;
+
+    return open();
+}
+
+/*!
+ * \brief Open from a multi-byte filename.
+ *
+ * \p filename is directly passed to `open()`. Files opened with
+ * FileOpenMode::WriteOnly are opened for reading as well because the mapping
+ * requires read access.
+ *
+ * \param filename MBS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::string &filename, FileOpenMode mode)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    m_fd = -1;
+    m_owned = true;
+    m_filename = filename;
+    m_flags = convert_mode(mode);
+
+    return open();
+}
+
+/*!
+ * \brief Open from a wide-character filename.
+ *
+ * \p filename is converted to MBS using wcs_to_mbs() before being passed to
+ * `open()`.
+ *
+ * \param filename WCS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::wstring &filename, FileOpenMode mode)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    auto converted = wcs_to_mbs(filename);
+    if (!converted) {
+        return FileError::CannotConvertEncoding;
+    }
+
+    m_fd = -1;
+    m_owned = true;
+    m_filename = std::move(converted.value());
+    m_flags = convert_mode(mode);
+
+    return open();
+}
+
+oc::result<void> MmapFile::open()
+{
+    auto reset = finally([&] {
+        (void) close();
+    });
+
+    if (!m_filename.empty()) {
+        m_fd = m_funcs->fn_open(m_filename.c_str(), m_flags, DEFAULT_MODE);
+        if (m_fd < 0) {
+            return ec_from_errno();
+        }
+    } else {
+        m_flags = m_funcs->fn_fcntl(m_fd, F_GETFL);
+        if (m_flags < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    m_writable = (m_flags & O_ACCMODE) == O_RDWR;
+    m_append = m_flags & O_APPEND;
+
+    if ((m_flags & O_ACCMODE) == O_WRONLY) {
+        return std::make_error_code(std::errc::permission_denied);
+    }
+
+    struct stat sb;
+
+    if (m_funcs->fn_fstat(m_fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (S_ISDIR(sb.st_mode)) {
+        return std::make_error_code(std::errc::is_a_directory);
+    } else if (S_ISBLK(sb.st_mode)) {
+        // st_size is always 0 for block devices
+        off64_t orig_pos = m_funcs->fn_lseek64(m_fd, 0, SEEK_CUR);
+        if (orig_pos < 0) {
+            return ec_from_errno();
+        }
+
+        off64_t size = m_funcs->fn_lseek64(m_fd, 0, SEEK_END);
+        if (size < 0) {
+            return ec_from_errno();
+        }
+
+        if (m_funcs->fn_lseek64(m_fd, orig_pos, SEEK_SET) < 0) {
+            return ec_from_errno();
+        }
+
+        m_size = static_cast<uint64_t>(size);
+    } else {
+        m_size = static_cast<uint64_t>(sb.st_size);
+    }
+
+    if (m_size > 0) {
+        OUTCOME_TRYV(map_window(0));
+    }
+
+    reset.dismiss();
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    auto unmap_ret = unmap();
+
+    if (m_owned && m_fd >= 0 && m_funcs->fn_close(m_fd) < 0) {
+        return ec_from_errno();
+    }
+
+    return unmap_ret;
+}
+
+oc::result<size_t> MmapFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRY(n, read_at_pos(m_pos, buf, size));
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> MmapFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_writable) {
+        return FileError::UnsupportedWrite;
+    }
+
+    if (m_append) {
+        m_pos = m_size;
+    }
+
+    OUTCOME_TRY(n, write_at_pos(m_pos, buf, size));
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> MmapFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        base = m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base + static_cast<uint64_t>(offset);
+    }
+}
+
+oc::result<void> MmapFile::truncate(uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_writable) {
+        return FileError::UnsupportedTruncate;
+    }
+
+    return resize(size);
+}
+
+oc::result<size_t> MmapFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return read_at_pos(offset, buf, size);
+}
+
+oc::result<size_t> MmapFile::write_at(uint64_t offset,
+                                      const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_writable) {
+        return FileError::UnsupportedWrite;
+    }
+
+    return write_at_pos(offset, buf, size);
+}
+
+oc::result<size_t> MmapFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRY(n, read_at_pos(m_pos, iov[i].base, iov[i].size));
+        m_pos += n;
+        total += n;
+
+        if (n < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+oc::result<size_t> MmapFile::writev(const IoVec *iov, size_t count)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_writable) {
+        return FileError::UnsupportedWrite;
+    }
+
+    if (m_append) {
+        m_pos = m_size;
+    }
+
+    uint64_t total_size = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        total_size += iov[i].size;
+    }
+
+    if (m_pos > UINT64_MAX - total_size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Remap once instead of once per IoVec
+    if (m_pos + total_size > m_size) {
+        OUTCOME_TRYV(resize(m_pos + total_size));
+    }
+
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        OUTCOME_TRY(n, write_at_pos(m_pos, iov[i].base, iov[i].size));
+        m_pos += n;
+        total += n;
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Get pointer to the file contents.
+ *
+ * The contents are only available if the entire file fits in a single mapping
+ * window. The pointer is invalidated by any subsequent call to write(),
+ * truncate(), close(), or any operation that maps a different window.
+ *
+ * \param[out] size Size of the file
+ *
+ * \return Pointer to the mapping or nullptr if the file is empty, does not fit
+ *         in a single mapping window, or could not be mapped
+ */
+const void * MmapFile::mapped_data(uint64_t &size)
+{
+    if (!is_open() || m_size == 0 || m_size > m_max_map_size
+            || !map_window(0)) {
+        return nullptr;
+    }
+
+    size = m_size;
+    return m_map;
+}
+
+bool MmapFile::is_open()
+{
+    return m_fd >= 0;
+}
+
+/*!
+ * \brief Get read-only view of a region of the file without copying.
+ *
+ * The returned span points directly into the mapping. It is truncated if the
+ * region extends past the end of the file or past the end of the mapping
+ * window containing \p offset. Callers that need more data should call this
+ * function again with the offset following the span. The file position is not
+ * changed.
+ *
+ * \note The span is invalidated by any subsequent call to write(), truncate(),
+ *       close(), or any operation that maps a different window.
+ *
+ * \param offset Starting offset of the region
+ * \param size Maximum size of the region
+ *
+ * \return
+ *   * The span if the region is successfully mapped
+ *   * FileError::ArgumentOutOfRange if \p offset is past the end of the file
+ *   * Otherwise, a specific error code
+ */
+oc::result<MmapSpan> MmapFile::map_region(uint64_t offset, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > m_size) {
+        return FileError::ArgumentOutOfRange;
+    } else if (offset == m_size || size == 0) {
+        return MmapSpan{nullptr, 0};
+    }
+
+    OUTCOME_TRYV(map_window(offset));
+
+    auto window_pos = static_cast<size_t>(offset - m_map_offset);
+
+    return MmapSpan{m_map + window_pos, std::min(m_map_size - window_pos, size)};
+}
+
+oc::result<size_t> MmapFile::read_at_pos(uint64_t pos, void *buf, size_t size)
+{
+    auto out = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size && pos < m_size) {
+        OUTCOME_TRYV(map_window(pos));
+
+        auto window_pos = static_cast<size_t>(pos - m_map_offset);
+        auto n = std::min(m_map_size - window_pos, size - total);
+
+        memcpy(out + total, m_map + window_pos, n);
+        total += n;
+        pos += n;
+    }
+
+    return total;
+}
+
+oc::result<size_t> MmapFile::write_at_pos(uint64_t pos,
+                                          const void *buf, size_t size)
+{
+    if (pos > UINT64_MAX - size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size == 0) {
+        return 0;
+    } else if (pos + size > m_size) {
+        OUTCOME_TRYV(resize(pos + size));
+    }
+
+    auto in = static_cast<const unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        OUTCOME_TRYV(map_window(pos));
+
+        auto window_pos = static_cast<size_t>(pos - m_map_offset);
+        auto n = std::min(m_map_size - window_pos, size - total);
+
+        memcpy(m_map + window_pos, in + total, n);
+        total += n;
+        pos += n;
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Map the window containing \p offset if it is not already mapped
+ *
+ * \pre \p offset must be less than the file size
+ */
+oc::result<void> MmapFile::map_window(uint64_t offset)
+{
+    if (m_map && offset >= m_map_offset && offset - m_map_offset < m_map_size) {
+        return oc::success();
+    }
+
+    OUTCOME_TRYV(unmap());
+
+    // Windows are aligned to the window size, which is a multiple of the page
+    // size as required by mmap()
+    auto begin = offset / m_max_map_size * m_max_map_size;
+    auto size = static_cast<size_t>(std::min(m_size - begin, m_max_map_size));
+
+    int prot = PROT_READ;
+    if (m_writable) {
+        prot |= PROT_WRITE;
+    }
+
+    void *ptr = m_funcs->fn_mmap(nullptr, size, prot, MAP_SHARED, m_fd,
+                                 static_cast<off64_t>(begin));
+    if (ptr == MAP_FAILED) {
+        return ec_from_errno();
+    }
+
+    m_map = static_cast<unsigned char *>(ptr);
+    m_map_offset = begin;
+    m_map_size = size;
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::unmap()
+{
+    auto reset = finally([&] {
+        m_map = nullptr;
+        m_map_offset = 0;
+        m_map_size = 0;
+    });
+
+    if (m_map && m_funcs->fn_munmap(m_map, m_map_size) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::resize(uint64_t size)
+{
+    if (size > static_cast<uint64_t>(INT64_MAX)) {
+        return std::make_error_code(std::errc::file_too_large);
+    }
+
+    if (m_funcs->fn_ftruncate64(m_fd, static_cast<off64_t>(size)) < 0) {
+        return ec_from_errno();
+    }
+
+    // The next access maps whichever window it needs
+    OUTCOME_TRYV(unmap());
+    m_size = size;
+
+    return oc::success();
+}
+
+void MmapFile::clear() noexcept
+{
+    m_fd = -1;
+    m_owned = false;
+    m_filename.clear();
+    m_flags = 0;
+    m_writable = false;
+    m_append = false;
+    m_map = nullptr;
+    m_map_offset = 0;
+    m_map_size = 0;
+    m_max_map_size = MAX_MAP_SIZE;
+    m_size = 0;
+    m_pos = 0;
+}
+
+}
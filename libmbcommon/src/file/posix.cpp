@@ -20,10 +20,15 @@
 #include "mbcommon/file/posix.h"
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#ifdef __linux__
+#  include <linux/falloc.h>
+#endif
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -64,6 +69,11 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return ferror(stream);
     }
 
+    int fn_fflush(FILE *stream) override
+    {
+        return fflush(stream);
+    }
+
     int fn_fileno(FILE *stream) override
     {
         return fileno(stream);
@@ -106,11 +116,66 @@ struct RealPosixFileFuncs : public PosixFileFuncs
     {
         return ftruncate64(fd, length);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    off64_t fn_lseek64(int fd, off64_t offset, int whence) override
+    {
+        return lseek64(fd, offset, whence);
+    }
+
+    int fn_fallocate64(int fd, int mode, off64_t offset,
+                       off64_t len) override
+    {
+#if defined(__ANDROID__) && __ANDROID_API__ < 21
+        // fallocate64() is only available in bionic for API 21+
+        (void) fd;
+        (void) mode;
+        (void) offset;
+        (void) len;
+        errno = ENOSYS;
+        return -1;
+#elif defined(__linux__)
+        return fallocate64(fd, mode, offset, len);
+#else
+        (void) fd;
+        (void) mode;
+        (void) offset;
+        (void) len;
+        errno = EOPNOTSUPP;
+        return -1;
+#endif
+    }
+#endif
 };
 /*! \endcond */
 
 static RealPosixFileFuncs g_default_funcs;
 
+#ifndef _WIN32
+// Only Linux supports anything other than plain preallocation
+#  ifndef FALLOC_FL_KEEP_SIZE
+#    define FALLOC_FL_KEEP_SIZE 0x01
+#  endif
+#  ifndef FALLOC_FL_PUNCH_HOLE
+#    define FALLOC_FL_PUNCH_HOLE 0x02
+#  endif
+#  ifndef FALLOC_FL_ZERO_RANGE
+#    define FALLOC_FL_ZERO_RANGE 0x10
+#  endif
+#endif
+
 /*! \cond INTERNAL */
 
 PosixFileFuncs::~PosixFileFuncs() = default;
@@ -535,6 +600,262 @@ oc::result<void> PosixFile::truncate(uint64_t size)
     return oc::success();
 }
 
+#ifndef _WIN32
+
+/*!
+ * \brief Read from the file at the specified offset.
+ *
+ * The stream is flushed before the data is read from the underlying file
+ * descriptor with `pread()`. The file position is not changed.
+ *
+ * If the stream does not have a file descriptor, this falls back to
+ * File::read_at().
+ */
+oc::result<size_t> PosixFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    } else if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        return File::read_at(offset, buf, size);
+    }
+
+    if (m_funcs->fn_fflush(m_fp) != 0) {
+        return ec_from_errno();
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+/*!
+ * \brief Write to the file at the specified offset.
+ *
+ * The stream is flushed before the data is written to the underlying file
+ * descriptor with `pwrite()`. This ensures that the stream's buffer does not
+ * contain stale data. The file position is not changed.
+ *
+ * If the stream does not have a file descriptor, this falls back to
+ * File::write_at().
+ */
+oc::result<size_t> PosixFile::write_at(uint64_t offset,
+                                       const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    } else if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        return File::write_at(offset, buf, size);
+    }
+
+    if (m_funcs->fn_fflush(m_fp) != 0) {
+        return ec_from_errno();
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+}
+
+/*!
+ * \brief Allocate disk space for a range of the file.
+ *
+ * The stream is flushed and then `fallocate()` is called on the underlying file
+ * descriptor. See File::allocate() for details.
+ */
+oc::result<void> PosixFile::allocate(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return fallocate(0, offset, size);
+}
+
+/*!
+ * \brief Deallocate a range of the file.
+ *
+ * The stream is flushed and then `fallocate()` is called on the underlying file
+ * descriptor with `FALLOC_FL_PUNCH_HOLE`. See File::punch_hole() for details.
+ */
+oc::result<void> PosixFile::punch_hole(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return fallocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+}
+
+/*!
+ * \brief Set a range of the file to zeros.
+ *
+ * The stream is flushed and then `fallocate()` is called on the underlying file
+ * descriptor with `FALLOC_FL_ZERO_RANGE`. If that is not supported, this falls
+ * back to File::zero_range(), which writes the zeros.
+ */
+oc::result<void> PosixFile::zero_range(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto ret = fallocate(FALLOC_FL_ZERO_RANGE, offset, size);
+    if (!ret && ret.error() == FileError::UnsupportedAllocate) {
+        return File::zero_range(offset, size);
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Find the next offset that contains data.
+ *
+ * The stream is flushed and then `lseek()` is called on the underlying file
+ * descriptor with `SEEK_DATA`. The file position is restored afterwards. If
+ * the stream does not have a file descriptor or `SEEK_DATA` is not supported,
+ * this falls back to File::next_data().
+ */
+oc::result<std::optional<uint64_t>> PosixFile::next_data(uint64_t offset)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef SEEK_DATA
+    return seek_data_hole(offset, SEEK_DATA);
+#else
+    return File::next_data(offset);
+#endif
+}
+
+/*!
+ * \brief Find the next offset that is in a hole.
+ *
+ * The stream is flushed and then `lseek()` is called on the underlying file
+ * descriptor with `SEEK_HOLE`. The file position is restored afterwards. If
+ * the stream does not have a file descriptor or `SEEK_HOLE` is not supported,
+ * this falls back to File::next_hole().
+ */
+oc::result<std::optional<uint64_t>> PosixFile::next_hole(uint64_t offset)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifdef SEEK_HOLE
+    return seek_data_hole(offset, SEEK_HOLE);
+#else
+    return File::next_hole(offset);
+#endif
+}
+
+oc::result<void> PosixFile::fallocate(int mode, uint64_t offset,
+                                      uint64_t size)
+{
+    if (offset > INT64_MAX || size > INT64_MAX - offset) {
+        return FileError::ArgumentOutOfRange;
+    } else if (size == 0) {
+        // fallocate() rejects empty ranges
+        return oc::success();
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        return FileError::UnsupportedAllocate;
+    }
+
+    // Make sure buffered writes don't land on top of the range afterwards
+    if (m_funcs->fn_fflush(m_fp) != 0) {
+        return ec_from_errno();
+    }
+
+    if (m_funcs->fn_fallocate64(fd, mode, static_cast<off64_t>(offset),
+                                static_cast<off64_t>(size)) < 0) {
+        if (errno == EOPNOTSUPP || errno == ENOSYS) {
+            return FileError::UnsupportedAllocate;
+        }
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+#ifdef SEEK_DATA
+oc::result<std::optional<uint64_t>>
+PosixFile::seek_data_hole(uint64_t offset, int whence)
+{
+    auto fallback = [&]() {
+        return whence == SEEK_DATA
+                ? File::next_data(offset)
+                : File::next_hole(offset);
+    };
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    } else if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd < 0) {
+        return fallback();
+    }
+
+    // Sync the file descriptor's position with the stream's position
+    if (m_funcs->fn_fflush(m_fp) != 0) {
+        return ec_from_errno();
+    }
+
+    off64_t orig_pos = m_funcs->fn_lseek64(fd, 0, SEEK_CUR);
+    if (orig_pos < 0) {
+        return ec_from_errno();
+    }
+
+    off64_t ret = m_funcs->fn_lseek64(fd, static_cast<off64_t>(offset),
+                                      whence);
+    int saved_errno = errno;
+
+    if (m_funcs->fn_lseek64(fd, orig_pos, SEEK_SET) < 0) {
+        return ec_from_errno();
+    }
+
+    if (ret < 0) {
+        if (saved_errno == ENXIO) {
+            // No data or hole after offset
+            return std::nullopt;
+        } else if (saved_errno == EINVAL) {
+            // Not supported by the kernel
+            return fallback();
+        }
+        return ec_from_errno(saved_errno);
+    }
+
+    return static_cast<uint64_t>(ret);
+}
+#endif
+
+#endif
+
 bool PosixFile::is_open()
 {
     return m_fp;
@@ -0,0 +1,578 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/tracing.h"
+
+#include <algorithm>
+
+#include <cinttypes>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbcommon/file/tracing.h
+ * \brief Collect I/O statistics for another File handle
+ */
+
+namespace mb
+{
+
+using Clock = std::chrono::steady_clock;
+
+static void record(TracingFile::OpStats &stats, Clock::duration elapsed,
+                   bool success, uint64_t bytes)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    auto us = static_cast<uint64_t>(ns.count()) / 1000;
+
+    // Bucket index is the bit width of the latency in microseconds
+    size_t bucket = 0;
+    while (us > 0 && bucket < TracingFile::HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+
+    ++stats.calls;
+    if (!success) {
+        ++stats.errors;
+    }
+    stats.bytes += bytes;
+    stats.time += ns;
+    ++stats.histogram[bucket];
+}
+
+template<typename T>
+static uint64_t result_bytes(const oc::result<T> &result)
+{
+    return result ? result.value() : 0;
+}
+
+static std::string json_escape(const std::string &str)
+{
+    std::string result;
+    result.reserve(str.size());
+
+    for (char c : str) {
+        switch (c) {
+        case '"':
+            result += "\\\"";
+            break;
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                result += format("\\u%04x", static_cast<unsigned int>(c));
+            } else {
+                result += c;
+            }
+            break;
+        }
+    }
+
+    return result;
+}
+
+static std::string bucket_label(size_t bucket)
+{
+    if (bucket == TracingFile::HISTOGRAM_BUCKETS - 1) {
+        return format(">=%" PRIu64 "us", uint64_t(1) << (bucket - 1));
+    } else {
+        return format("<%" PRIu64 "us", uint64_t(1) << bucket);
+    }
+}
+
+static std::string op_summary(const char *name,
+                              const TracingFile::OpStats &stats)
+{
+    auto result = format("  %s: %" PRIu64 " calls, %" PRIu64 " errors, %"
+                         PRIu64 " bytes, %.3f ms\n",
+                         name, stats.calls, stats.errors, stats.bytes,
+                         static_cast<double>(stats.time.count()) / 1000000.0);
+
+    if (stats.calls > 0) {
+        result += "   ";
+
+        for (size_t i = 0; i < stats.histogram.size(); ++i) {
+            if (stats.histogram[i] > 0) {
+                result += format(" %s: %" PRIu64, bucket_label(i).c_str(),
+                                 stats.histogram[i]);
+            }
+        }
+
+        result += '\n';
+    }
+
+    return result;
+}
+
+static std::string op_summary_json(const TracingFile::OpStats &stats)
+{
+    auto result = format("{\"calls\":%" PRIu64 ",\"errors\":%" PRIu64
+                         ",\"bytes\":%" PRIu64 ",\"time_ns\":%" PRId64
+                         ",\"histogram\":[",
+                         stats.calls, stats.errors, stats.bytes,
+                         static_cast<int64_t>(stats.time.count()));
+
+    for (size_t i = 0; i < stats.histogram.size(); ++i) {
+        if (i > 0) {
+            result += ',';
+        }
+        result += format("%" PRIu64, stats.histogram[i]);
+    }
+
+    result += "]}";
+
+    return result;
+}
+
+/*!
+ * \class TracingFile
+ *
+ * \brief Instrumentation wrapper for a File handle.
+ *
+ * All operations are forwarded to the underlying file. For reads, writes,
+ * seeks, and truncations, the number of calls, number of errors, number of
+ * bytes transferred, total latency, and a latency histogram are recorded.
+ * Positional and vectored reads and writes are counted as reads and writes.
+ * The total distance moved by seeks is recorded as well. Space allocation
+ * functions and hole queries are forwarded, but not recorded.
+ *
+ * When the handle is closed, the report callback (if any) is invoked so that
+ * the statistics can be logged with summary() or summary_json().
+ *
+ * The underlying file is not owned by the TracingFile instance and will not be
+ * closed when the TracingFile is closed.
+ */
+
+/*!
+ * \var TracingFile::HISTOGRAM_BUCKETS
+ *
+ * \brief Number of buckets in the latency histograms.
+ */
+
+/*!
+ * \brief Construct unbound TracingFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to wrap a file.
+ */
+TracingFile::TracingFile()
+    : m_file(nullptr)
+{
+}
+
+/*!
+ * \brief Open File handle that wraps another File handle.
+ *
+ * Construct the file handle and wrap \p file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, std::string)
+ *
+ * \param file File to wrap
+ * \param name Name to use in the summary
+ */
+TracingFile::TracingFile(File *file, std::string name)
+    : TracingFile()
+{
+    (void) open(file, std::move(name));
+}
+
+/*!
+ * \brief Destroy TracingFile.
+ *
+ * If the handle is open, it is closed and the report callback is invoked.
+ */
+TracingFile::~TracingFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+TracingFile::TracingFile(TracingFile &&other) noexcept
+    : TracingFile()
+{
+    std::swap(m_file, other.m_file);
+    std::swap(m_name, other.m_name);
+    std::swap(m_stats, other.m_stats);
+    std::swap(m_pos, other.m_pos);
+    std::swap(m_callback, other.m_callback);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object.
+ *
+ * \param rhs File handle to move from
+ */
+TracingFile & TracingFile::operator=(TracingFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_name, rhs.m_name);
+        std::swap(m_stats, rhs.m_stats);
+        std::swap(m_pos, rhs.m_pos);
+        std::swap(m_callback, rhs.m_callback);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Wrap File handle.
+ *
+ * The statistics are reset. The report callback is kept.
+ *
+ * \param file File to wrap
+ * \param name Name to use in the summary
+ *
+ * \return
+ *   * Nothing if the file is successfully opened
+ *   * FileError::InvalidState if the file is already open
+ *   * FileError::ArgumentOutOfRange if \p file is null
+ */
+oc::result<void> TracingFile::open(File *file, std::string name)
+{
+    if (is_open()) {
+        return FileError::InvalidState;
+    } else if (!file) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    m_file = file;
+    m_name = std::move(name);
+    m_stats = {};
+
+    // This is not counted. It is only used to track the seek distance.
+    if (auto pos = m_file->seek(0, SEEK_CUR)) {
+        m_pos = pos.value();
+    } else {
+        m_pos = std::nullopt;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Close the file handle.
+ *
+ * The report callback is invoked before the handle is closed. The underlying
+ * file is not closed.
+ *
+ * \return
+ *   * Nothing if the handle was open
+ *   * FileError::InvalidState if the handle was not open
+ */
+oc::result<void> TracingFile::close()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_callback) {
+        m_callback(*this);
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> TracingFile::read(void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->read(buf, size);
+    record(m_stats.read, Clock::now() - start, !!result, result_bytes(result));
+
+    if (m_pos && result) {
+        *m_pos += result.value();
+    }
+
+    return result;
+}
+
+oc::result<size_t> TracingFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->write(buf, size);
+    record(m_stats.write, Clock::now() - start, !!result, result_bytes(result));
+
+    if (m_pos && result) {
+        *m_pos += result.value();
+    }
+
+    return result;
+}
+
+oc::result<uint64_t> TracingFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->seek(offset, whence);
+    record(m_stats.seek, Clock::now() - start, !!result, 0);
+
+    if (result) {
+        if (m_pos) {
+            auto pos = result.value();
+            m_stats.seek_distance += pos > *m_pos ? pos - *m_pos : *m_pos - pos;
+        }
+        m_pos = result.value();
+    }
+
+    return result;
+}
+
+oc::result<void> TracingFile::truncate(uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->truncate(size);
+    record(m_stats.truncate, Clock::now() - start, !!result, 0);
+
+    return result;
+}
+
+oc::result<size_t> TracingFile::read_at(uint64_t offset,
+                                        void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->read_at(offset, buf, size);
+    record(m_stats.read, Clock::now() - start, !!result, result_bytes(result));
+
+    return result;
+}
+
+oc::result<size_t> TracingFile::write_at(uint64_t offset,
+                                         const void *buf, size_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->write_at(offset, buf, size);
+    record(m_stats.write, Clock::now() - start, !!result, result_bytes(result));
+
+    return result;
+}
+
+oc::result<size_t> TracingFile::readv(const IoVec *iov, size_t count)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->readv(iov, count);
+    record(m_stats.read, Clock::now() - start, !!result, result_bytes(result));
+
+    if (m_pos && result) {
+        *m_pos += result.value();
+    }
+
+    return result;
+}
+
+oc::result<size_t> TracingFile::writev(const IoVec *iov, size_t count)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    auto start = Clock::now();
+    auto result = m_file->writev(iov, count);
+    record(m_stats.write, Clock::now() - start, !!result, result_bytes(result));
+
+    if (m_pos && result) {
+        *m_pos += result.value();
+    }
+
+    return result;
+}
+
+oc::result<void> TracingFile::allocate(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return m_file->allocate(offset, size);
+}
+
+oc::result<void> TracingFile::punch_hole(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return m_file->punch_hole(offset, size);
+}
+
+oc::result<void> TracingFile::zero_range(uint64_t offset, uint64_t size)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return m_file->zero_range(offset, size);
+}
+
+oc::result<std::optional<uint64_t>> TracingFile::next_data(uint64_t offset)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return m_file->next_data(offset);
+}
+
+oc::result<std::optional<uint64_t>> TracingFile::next_hole(uint64_t offset)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return m_file->next_hole(offset);
+}
+
+bool TracingFile::is_open()
+{
+    return m_file != nullptr;
+}
+
+/*!
+ * \brief Name of the file used in the summary.
+ */
+const std::string & TracingFile::name() const
+{
+    return m_name;
+}
+
+/*!
+ * \brief Statistics collected since the file was opened.
+ */
+const TracingFile::Stats & TracingFile::stats() const
+{
+    return m_stats;
+}
+
+/*!
+ * \brief Set function to call when the handle is closed.
+ *
+ * \param callback Function to call with this handle. The statistics are still
+ *                 available when it is called.
+ */
+void TracingFile::set_report_callback(ReportCallback callback)
+{
+    m_callback = std::move(callback);
+}
+
+/*!
+ * \brief Get human-readable summary of the statistics.
+ *
+ * \return Multi-line summary with a trailing newline
+ */
+std::string TracingFile::summary() const
+{
+    auto result = format("%s:\n", m_name.c_str());
+
+    result += op_summary("read", m_stats.read);
+    result += op_summary("write", m_stats.write);
+    result += op_summary("seek", m_stats.seek);
+    result += op_summary("truncate", m_stats.truncate);
+    result += format("  seek distance: %" PRIu64 " bytes\n",
+                     m_stats.seek_distance);
+
+    return result;
+}
+
+/*!
+ * \brief Get summary of the statistics as a JSON object.
+ *
+ * Each operation has the keys `calls`, `errors`, `bytes`, `time_ns`, and
+ * `histogram`. The histogram is an array of #HISTOGRAM_BUCKETS counts.
+ *
+ * \return Single-line JSON object
+ */
+std::string TracingFile::summary_json() const
+{
+    auto result = format("{\"name\":\"%s\"", json_escape(m_name).c_str());
+
+    result += ",\"read\":";
+    result += op_summary_json(m_stats.read);
+    result += ",\"write\":";
+    result += op_summary_json(m_stats.write);
+    result += ",\"seek\":";
+    result += op_summary_json(m_stats.seek);
+    result += ",\"truncate\":";
+    result += op_summary_json(m_stats.truncate);
+    result += format(",\"seek_distance\":%" PRIu64 "}",
+                     m_stats.seek_distance);
+
+    return result;
+}
+
+void TracingFile::clear() noexcept
+{
+    // The statistics remain available until the handle is reopened
+    m_file = nullptr;
+    m_pos = std::nullopt;
+}
+
+}
@@ -0,0 +1,949 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/uring.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef MBCOMMON_HAVE_IO_URING
+#  include <linux/io_uring.h>
+#  include <poll.h>
+#  include <sys/eventfd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbcommon/file/uring.h
+ * \brief File with asynchronous I/O support
+ */
+
+namespace mb
+{
+
+namespace detail
+{
+
+// Linux transfers at most ~2 GiB per syscall and io_uring reports the result
+// as an int
+static constexpr size_t MAX_ASYNC_IO_SIZE = 1024 * 1024 * 1024;
+
+// Upper bound on the number of threads used by the fallback implementation
+static constexpr unsigned int MAX_WORKER_THREADS = 4;
+
+enum class AsyncIoOp
+{
+    Read,
+    Write,
+};
+
+struct AsyncIoRequest
+{
+    AsyncIoOp op;
+    int fd;
+    uint64_t offset;
+    iovec iov;
+    UringFile::Callback callback;
+};
+
+class AsyncIoBackend
+{
+public:
+    virtual ~AsyncIoBackend() = default;
+
+    virtual oc::result<void> queue(std::unique_ptr<AsyncIoRequest> req) = 0;
+    virtual oc::result<void> submit() = 0;
+    virtual oc::result<void> wait() = 0;
+
+    virtual bool is_io_uring() const = 0;
+};
+
+/*!
+ * \brief Fallback backend that performs the I/O on a small pool of threads
+ *        using `pread64()` and `pwrite64()`.
+ */
+class ThreadAsyncIoBackend : public AsyncIoBackend
+{
+public:
+    ThreadAsyncIoBackend(unsigned int queue_depth)
+        : m_queue_depth(queue_depth)
+        , m_active(0)
+        , m_stop(false)
+    {
+        auto n_threads = std::min(queue_depth, MAX_WORKER_THREADS);
+
+        for (unsigned int i = 0; i < n_threads; ++i) {
+            m_threads.emplace_back(&ThreadAsyncIoBackend::worker, this);
+        }
+    }
+
+    ~ThreadAsyncIoBackend() override
+    {
+        (void) wait();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work_cv.notify_all();
+
+        for (auto &t : m_threads) {
+            t.join();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ThreadAsyncIoBackend)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ThreadAsyncIoBackend)
+
+    oc::result<void> queue(std::unique_ptr<AsyncIoRequest> req) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (m_pending.size() + m_work.size() + m_active >= m_queue_depth) {
+            if (!m_pending.empty()) {
+                submit_locked();
+            }
+            m_done_cv.wait(lock);
+        }
+
+        m_pending.push_back(std::move(req));
+
+        return oc::success();
+    }
+
+    oc::result<void> submit() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        submit_locked();
+        return oc::success();
+    }
+
+    oc::result<void> wait() override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        submit_locked();
+
+        m_done_cv.wait(lock, [&] {
+            return m_work.empty() && m_active == 0;
+        });
+
+        return oc::success();
+    }
+
+    bool is_io_uring() const override
+    {
+        return false;
+    }
+
+private:
+    void submit_locked()
+    {
+        if (m_pending.empty()) {
+            return;
+        }
+
+        for (auto &req : m_pending) {
+            m_work.push_back(std::move(req));
+        }
+        m_pending.clear();
+
+        m_work_cv.notify_all();
+    }
+
+    static oc::result<size_t> perform(const AsyncIoRequest &req)
+    {
+        while (true) {
+            ssize_t n;
+
+            if (req.op == AsyncIoOp::Read) {
+                n = pread64(req.fd, req.iov.iov_base, req.iov.iov_len,
+                            static_cast<off64_t>(req.offset));
+            } else {
+                n = pwrite64(req.fd, req.iov.iov_base, req.iov.iov_len,
+                             static_cast<off64_t>(req.offset));
+            }
+
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            }
+
+            return static_cast<size_t>(n);
+        }
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            m_work_cv.wait(lock, [&] {
+                return m_stop || !m_work.empty();
+            });
+
+            if (m_work.empty()) {
+                return;
+            }
+
+            auto req = std::move(m_work.front());
+            m_work.pop_front();
+            ++m_active;
+
+            lock.unlock();
+            req->callback(perform(*req));
+            req.reset();
+            lock.lock();
+
+            --m_active;
+            m_done_cv.notify_all();
+        }
+    }
+
+    unsigned int m_queue_depth;
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+
+    // Queued, but not yet submitted
+    std::vector<std::unique_ptr<AsyncIoRequest>> m_pending;
+    // Submitted, but not yet picked up by a worker
+    std::deque<std::unique_ptr<AsyncIoRequest>> m_work;
+    // Number of requests being processed by workers
+    size_t m_active;
+    bool m_stop;
+
+    std::vector<std::thread> m_threads;
+};
+
+#ifdef MBCOMMON_HAVE_IO_URING
+
+/*!
+ * \brief Backend that submits requests to an io_uring instance.
+ *
+ * The rings are driven directly with the io_uring syscalls. Submissions are
+ * serialized with a mutex and completions are reaped by a dedicated thread,
+ * which also invokes the callbacks. The reaper thread polls the ring and an
+ * eventfd, so it can be stopped without submitting anything to the ring.
+ */
+class UringAsyncIoBackend : public AsyncIoBackend
+{
+public:
+    static oc::result<std::unique_ptr<AsyncIoBackend>>
+    create(unsigned int queue_depth)
+    {
+        std::unique_ptr<UringAsyncIoBackend> backend(new UringAsyncIoBackend());
+        OUTCOME_TRYV(backend->init(queue_depth));
+        return std::move(backend);
+    }
+
+    ~UringAsyncIoBackend() override
+    {
+        if (m_reaper.joinable()) {
+            (void) wait();
+
+            // Wake up the reaper thread. A single write to an eventfd can only
+            // fail if it is interrupted.
+            uint64_t value = 1;
+            while (write(m_stop_fd, &value, sizeof(value)) < 0
+                    && errno == EINTR) {
+            }
+
+            m_reaper.join();
+        }
+
+        if (m_stop_fd >= 0) {
+            close(m_stop_fd);
+        }
+
+        if (m_sqes != MAP_FAILED) {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) {
+            munmap(m_cq_ptr, m_cq_size);
+        }
+        if (m_sq_ptr != MAP_FAILED) {
+            munmap(m_sq_ptr, m_sq_size);
+        }
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(UringAsyncIoBackend)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(UringAsyncIoBackend)
+
+    oc::result<void> queue(std::unique_ptr<AsyncIoRequest> req) override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (m_queued + m_in_flight >= m_queue_depth) {
+            if (m_queued > 0) {
+                OUTCOME_TRYV(submit_locked());
+            }
+            m_cv.wait(lock);
+        }
+
+        auto *sqe = next_sqe();
+        if (!sqe) {
+            return std::errc::resource_unavailable_try_again;
+        }
+
+        sqe->opcode = req->op == AsyncIoOp::Read
+                ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->fd = req->fd;
+        sqe->off = req->offset;
+        sqe->addr = reinterpret_cast<uintptr_t>(&req->iov);
+        sqe->len = 1;
+        sqe->user_data = reinterpret_cast<uintptr_t>(req.release());
+        commit_sqe();
+
+        return oc::success();
+    }
+
+    oc::result<void> submit() override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return submit_locked();
+    }
+
+    oc::result<void> wait() override
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        OUTCOME_TRYV(submit_locked());
+
+        m_cv.wait(lock, [&] {
+            return m_in_flight == 0;
+        });
+
+        return oc::success();
+    }
+
+    bool is_io_uring() const override
+    {
+        return true;
+    }
+
+private:
+    UringAsyncIoBackend()
+        : m_fd(-1)
+        , m_stop_fd(-1)
+        , m_sq_ptr(MAP_FAILED)
+        , m_sq_size(0)
+        , m_cq_ptr(MAP_FAILED)
+        , m_cq_size(0)
+        , m_sqes(static_cast<io_uring_sqe *>(MAP_FAILED))
+        , m_sqes_size(0)
+        , m_sq_head(nullptr)
+        , m_sq_tail(nullptr)
+        , m_sq_mask(nullptr)
+        , m_sq_array(nullptr)
+        , m_cq_head(nullptr)
+        , m_cq_tail(nullptr)
+        , m_cq_mask(nullptr)
+        , m_cqes(nullptr)
+        , m_queue_depth(0)
+        , m_queued(0)
+        , m_in_flight(0)
+    {
+    }
+
+    oc::result<void> init(unsigned int queue_depth)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        m_fd = static_cast<int>(
+                syscall(__NR_io_uring_setup, queue_depth, &params));
+        if (m_fd < 0) {
+            return ec_from_errno();
+        }
+
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_size = params.cq_off.cqes
+                + params.cq_entries * sizeof(io_uring_cqe);
+
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+        }
+
+        m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ptr == MAP_FAILED) {
+            return ec_from_errno();
+        }
+
+        if (single_mmap) {
+            m_cq_ptr = m_sq_ptr;
+        } else {
+            m_cq_ptr = mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, m_fd,
+                            IORING_OFF_CQ_RING);
+            if (m_cq_ptr == MAP_FAILED) {
+                return ec_from_errno();
+            }
+        }
+
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe *>(
+                mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+        if (m_sqes == MAP_FAILED) {
+            return ec_from_errno();
+        }
+
+        auto *sq = static_cast<unsigned char *>(m_sq_ptr);
+        m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        auto *cq = static_cast<unsigned char *>(m_cq_ptr);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        // The kernel may round the number of entries up. The completion queue
+        // is twice as large, so it can never overflow if the number of
+        // requests in flight is limited to the submission queue size.
+        m_queue_depth = std::min(queue_depth, params.sq_entries);
+
+        m_stop_fd = eventfd(0, EFD_CLOEXEC);
+        if (m_stop_fd < 0) {
+            return ec_from_errno();
+        }
+
+        m_reaper = std::thread(&UringAsyncIoBackend::reap, this);
+
+        return oc::success();
+    }
+
+    // Must be called with m_mutex held. There should always be a free entry
+    // because the number of queued and in-flight requests is limited to the
+    // submission queue size and the kernel consumes all entries during
+    // io_uring_enter(). Returns nullptr if the submission queue is full.
+    io_uring_sqe * next_sqe()
+    {
+        if (*m_sq_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)
+                > *m_sq_mask) {
+            return nullptr;
+        }
+
+        auto index = *m_sq_tail & *m_sq_mask;
+        auto *sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        return sqe;
+    }
+
+    void commit_sqe()
+    {
+        __atomic_store_n(m_sq_tail, *m_sq_tail + 1, __ATOMIC_RELEASE);
+        ++m_queued;
+    }
+
+    oc::result<void> submit_locked()
+    {
+        while (m_queued > 0) {
+            auto n = syscall(__NR_io_uring_enter, m_fd, m_queued, 0, 0,
+                             nullptr, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            } else if (n == 0) {
+                return std::errc::resource_unavailable_try_again;
+            }
+
+            m_queued -= static_cast<unsigned int>(n);
+            m_in_flight += static_cast<unsigned int>(n);
+        }
+
+        return oc::success();
+    }
+
+    void reap()
+    {
+        while (true) {
+            auto head = *m_cq_head;
+
+            if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+                // The ring fd is readable when the completion queue is not
+                // empty and the eventfd is readable when shutting down
+                pollfd fds[2] = {
+                    { m_fd, POLLIN, 0 },
+                    { m_stop_fd, POLLIN, 0 },
+                };
+
+                // Errors (eg. EINTR) are not fatal; just try again
+                if (poll(fds, 2, -1) > 0 && (fds[1].revents & POLLIN)) {
+                    return;
+                }
+                continue;
+            }
+
+            auto &cqe = m_cqes[head & *m_cq_mask];
+            std::unique_ptr<AsyncIoRequest> req(
+                    reinterpret_cast<AsyncIoRequest *>(cqe.user_data));
+            auto res = cqe.res;
+
+            __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+            if (res < 0) {
+                req->callback(ec_from_errno(-res));
+            } else {
+                req->callback(static_cast<size_t>(res));
+            }
+            req.reset();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_in_flight;
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    int m_fd;
+    // eventfd for stopping the reaper thread
+    int m_stop_fd;
+
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    unsigned int m_queue_depth;
+    // Requests in the submission queue that the kernel has not consumed yet
+    unsigned int m_queued;
+    // Requests consumed by the kernel that have not completed yet
+    unsigned int m_in_flight;
+
+    std::thread m_reaper;
+};
+
+#endif
+
+}
+
+using namespace detail;
+
+/*!
+ * \class UringFile
+ *
+ * \brief FdFile with support for asynchronous reads and writes.
+ *
+ * In addition to the synchronous File API provided by FdFile, UringFile can
+ * queue positional reads and writes that complete in the background. This
+ * allows pipelines to overlap reading the input with writing the output. Up to
+ * queue_depth() requests can be outstanding at the same time. Queuing more
+ * requests blocks until an earlier one completes.
+ *
+ * Queued requests are not started until submit() or wait() is called, so
+ * multiple requests can be batched into a single submission.
+ *
+ * If the library was built with `MBP_ENABLE_IO_URING` and the kernel supports
+ * io_uring, the requests are submitted to an io_uring instance. Otherwise (eg.
+ * on older kernels or when io_uring is blocked by seccomp), they are executed
+ * by a small pool of threads.
+ *
+ * Callbacks are invoked from a background thread. A request may transfer fewer
+ * bytes than requested, just like File::read_at() and File::write_at().
+ *
+ * \note The buffers must remain valid until the request completes. The
+ *       synchronous File API does not wait for outstanding requests.
+ */
+
+/*!
+ * \typedef UringFile::Callback
+ *
+ * \brief Completion callback
+ *
+ * The callback receives the number of bytes transferred or the error code.
+ */
+
+/*!
+ * \var UringFile::DEFAULT_QUEUE_DEPTH
+ *
+ * \brief Default maximum number of outstanding asynchronous requests.
+ */
+
+/*!
+ * \brief Construct unbound UringFile.
+ *
+ * \sa FdFile::FdFile()
+ */
+UringFile::UringFile()
+    : FdFile()
+    , m_queue_depth(DEFAULT_QUEUE_DEPTH)
+{
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * \sa FdFile::FdFile(int, bool)
+ */
+UringFile::UringFile(int fd, bool owned)
+    : FdFile(fd, owned)
+    , m_queue_depth(DEFAULT_QUEUE_DEPTH)
+{
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * \sa FdFile::FdFile(const std::string &, FileOpenMode)
+ */
+UringFile::UringFile(const std::string &filename, FileOpenMode mode)
+    : FdFile(filename, mode)
+    , m_queue_depth(DEFAULT_QUEUE_DEPTH)
+{
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * \sa FdFile::FdFile(const std::wstring &, FileOpenMode)
+ */
+UringFile::UringFile(const std::wstring &filename, FileOpenMode mode)
+    : FdFile(filename, mode)
+    , m_queue_depth(DEFAULT_QUEUE_DEPTH)
+{
+}
+
+/*!
+ * \brief Destroy UringFile.
+ *
+ * Outstanding asynchronous requests are waited for before the file is closed.
+ */
+UringFile::~UringFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * Outstanding asynchronous requests are moved along with the handle.
+ *
+ * \param other File handle to move from
+ */
+UringFile::UringFile(UringFile &&other) noexcept
+    : FdFile(std::move(other))
+    , m_queue_depth(other.m_queue_depth)
+    , m_backend(std::move(other.m_backend))
+{
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object.
+ *
+ * \param rhs File handle to move from
+ */
+UringFile & UringFile::operator=(UringFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        FdFile::operator=(std::move(rhs));
+        m_queue_depth = rhs.m_queue_depth;
+        m_backend = std::move(rhs.m_backend);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Close the file handle.
+ *
+ * Queued requests are submitted and all outstanding requests are waited for
+ * before the file descriptor is closed.
+ *
+ * \return Nothing if the file is successfully closed. Otherwise, the error
+ *         code.
+ */
+oc::result<void> UringFile::close()
+{
+    oc::result<void> ret = oc::success();
+
+    if (m_backend) {
+        ret = m_backend->wait();
+        m_backend.reset();
+    }
+
+    auto close_ret = FdFile::close();
+    if (ret && !close_ret) {
+        ret = std::move(close_ret);
+    }
+
+    return ret;
+}
+
+static std::unique_ptr<AsyncIoRequest>
+make_request(AsyncIoOp op, int fd, uint64_t offset, const void *buf,
+             size_t size, UringFile::Callback &&callback)
+{
+    auto req = std::make_unique<AsyncIoRequest>();
+    req->op = op;
+    req->fd = fd;
+    req->offset = offset;
+    req->iov.iov_base = const_cast<void *>(buf);
+    req->iov.iov_len = std::min(size, MAX_ASYNC_IO_SIZE);
+    req->callback = std::move(callback);
+    return req;
+}
+
+/*!
+ * \brief Queue asynchronous read.
+ *
+ * \param offset File offset to read from
+ * \param buf Buffer to read into. Must remain valid until \p callback is called.
+ * \param size Number of bytes to read
+ * \param callback Function to call with the number of bytes read or an error
+ *
+ * \return
+ *   * Nothing if the request is successfully queued
+ *   * FileError::InvalidState if the file is not open
+ *   * FileError::ArgumentOutOfRange if \p offset exceeds INT64_MAX
+ *   * Otherwise, the error code if a previously queued batch could not be
+ *     submitted to make room for this request
+ */
+oc::result<void> UringFile::read_async(uint64_t offset, void *buf, size_t size,
+                                       Callback callback)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return backend()->queue(make_request(AsyncIoOp::Read, native_fd(), offset,
+                                         buf, size, std::move(callback)));
+}
+
+/*!
+ * \brief Queue asynchronous write.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from. Must remain valid until \p callback is
+ *            called.
+ * \param size Number of bytes to write
+ * \param callback Function to call with the number of bytes written or an
+ *                 error
+ *
+ * \return Same as read_async(uint64_t, void *, size_t, Callback)
+ */
+oc::result<void> UringFile::write_async(uint64_t offset, const void *buf,
+                                        size_t size, Callback callback)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return backend()->queue(make_request(AsyncIoOp::Write, native_fd(), offset,
+                                         buf, size, std::move(callback)));
+}
+
+/*!
+ * \brief Queue asynchronous read.
+ *
+ * Same as read_async(uint64_t, void *, size_t, Callback), except the result is
+ * delivered through a future. If the request cannot be queued, the future will
+ * be ready immediately with the error.
+ *
+ * \note The request must be submitted before the future can become ready.
+ */
+std::future<oc::result<size_t>>
+UringFile::read_async(uint64_t offset, void *buf, size_t size)
+{
+    auto promise = std::make_shared<std::promise<oc::result<size_t>>>();
+    auto future = promise->get_future();
+
+    auto ret = read_async(offset, buf, size,
+                          [promise](oc::result<size_t> result) {
+        promise->set_value(std::move(result));
+    });
+    if (!ret) {
+        promise->set_value(ret.as_failure());
+    }
+
+    return future;
+}
+
+/*!
+ * \brief Queue asynchronous write.
+ *
+ * Same as write_async(uint64_t, const void *, size_t, Callback), except the
+ * result is delivered through a future. If the request cannot be queued, the
+ * future will be ready immediately with the error.
+ *
+ * \note The request must be submitted before the future can become ready.
+ */
+std::future<oc::result<size_t>>
+UringFile::write_async(uint64_t offset, const void *buf, size_t size)
+{
+    auto promise = std::make_shared<std::promise<oc::result<size_t>>>();
+    auto future = promise->get_future();
+
+    auto ret = write_async(offset, buf, size,
+                           [promise](oc::result<size_t> result) {
+        promise->set_value(std::move(result));
+    });
+    if (!ret) {
+        promise->set_value(ret.as_failure());
+    }
+
+    return future;
+}
+
+/*!
+ * \brief Submit all queued asynchronous requests.
+ *
+ * \return Nothing if the requests are successfully submitted. Otherwise, the
+ *         error code.
+ */
+oc::result<void> UringFile::submit()
+{
+    if (!m_backend) {
+        return oc::success();
+    }
+
+    return m_backend->submit();
+}
+
+/*!
+ * \brief Submit queued requests and wait for all outstanding requests.
+ *
+ * When this function returns successfully, all callbacks have been called.
+ *
+ * \return Nothing if the requests are successfully submitted. Otherwise, the
+ *         error code.
+ */
+oc::result<void> UringFile::wait()
+{
+    if (!m_backend) {
+        return oc::success();
+    }
+
+    return m_backend->wait();
+}
+
+/*!
+ * \brief Get maximum number of outstanding asynchronous requests.
+ */
+unsigned int UringFile::queue_depth() const
+{
+    return m_queue_depth;
+}
+
+/*!
+ * \brief Set maximum number of outstanding asynchronous requests.
+ *
+ * If there are outstanding requests, they are waited for first.
+ *
+ * \param depth Queue depth
+ *
+ * \return
+ *   * Nothing if the queue depth is successfully changed
+ *   * FileError::ArgumentOutOfRange if \p depth is 0
+ *   * Otherwise, the error code if the outstanding requests fail to submit
+ */
+oc::result<void> UringFile::set_queue_depth(unsigned int depth)
+{
+    if (depth == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (m_backend) {
+        OUTCOME_TRYV(m_backend->wait());
+        m_backend.reset();
+    }
+
+    m_queue_depth = depth;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Check whether asynchronous requests are submitted via io_uring.
+ *
+ * \return Whether io_uring is used. If false, requests are executed by the
+ *         fallback thread pool.
+ */
+bool UringFile::uses_io_uring()
+{
+    return backend()->is_io_uring();
+}
+
+AsyncIoBackend * UringFile::backend()
+{
+    if (!m_backend) {
+#ifdef MBCOMMON_HAVE_IO_URING
+        if (auto backend = UringAsyncIoBackend::create(m_queue_depth)) {
+            m_backend = std::move(backend.value());
+        } else
+#endif
+        {
+            m_backend = std::make_unique<ThreadAsyncIoBackend>(m_queue_depth);
+        }
+    }
+
+    return m_backend.get();
+}
+
+}
@@ -64,6 +64,8 @@ std::string FileErrorCategory::message(int ev) const
         return "seek not supported";
     case FileError::UnsupportedTruncate:
         return "truncate not supported";
+    case FileError::UnsupportedAllocate:
+        return "space allocation not supported";
     case FileError::UnexpectedEof:
         return "unexpected end of file";
     case FileError::IntegerOverflow:
@@ -86,6 +88,7 @@ FileErrorCategory::default_error_condition(int code) const noexcept
     case FileError::UnsupportedWrite:
     case FileError::UnsupportedSeek:
     case FileError::UnsupportedTruncate:
+    case FileError::UnsupportedAllocate:
         return FileErrorC::Unsupported;
     default:
         return FileErrorC::InternalError;
@@ -20,7 +20,10 @@
 #include "mbcommon/file_util.h"
 
 #include <algorithm>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <thread>
 #include <vector>
 #ifdef __ANDROID__
 #  include <experimental/algorithm>
@@ -31,6 +34,20 @@
 #include <cstdio>
 #include <cstring>
 
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define MB_HAVE_NEON_PREFILTER
+#endif
+
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 #include "mbcommon/error_code.h"
 #include "mbcommon/file_error.h"
 
@@ -44,6 +61,131 @@ namespace mb
 
 using namespace detail;
 
+// Smallest chunk size that is worth searching on a separate thread
+static constexpr size_t PARALLEL_SEARCH_MIN_CHUNK_SIZE = 256 * 1024;
+
+namespace detail
+{
+
+/*!
+ * \brief Worker threads that run the chunk searches for a FileSearcher.
+ *
+ * The threads are started once and reused for every window. The calling thread
+ * also runs tasks, so a pool with `n` workers runs up to `n + 1` tasks at once.
+ */
+class SearchWorkerPool
+{
+public:
+    SearchWorkerPool(unsigned int n_workers)
+        : m_task(nullptr)
+        , m_n_tasks(0)
+        , m_next(0)
+        , m_remaining(0)
+        , m_stop(false)
+    {
+        for (unsigned int i = 0; i < n_workers; ++i) {
+            m_threads.emplace_back(&SearchWorkerPool::worker, this);
+        }
+    }
+
+    ~SearchWorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work_cv.notify_all();
+
+        for (auto &t : m_threads) {
+            t.join();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SearchWorkerPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(SearchWorkerPool)
+
+    size_t workers() const
+    {
+        return m_threads.size();
+    }
+
+    // Run task(0) through task(n_tasks - 1) and wait for them to complete
+    void run(size_t n_tasks, const std::function<void(size_t)> &task)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_task = &task;
+        m_n_tasks = n_tasks;
+        m_next = 0;
+        m_remaining = n_tasks;
+        m_work_cv.notify_all();
+
+        run_tasks(lock);
+
+        m_done_cv.wait(lock, [&] {
+            return m_remaining == 0;
+        });
+
+        m_task = nullptr;
+        m_n_tasks = 0;
+        m_next = 0;
+    }
+
+private:
+    // Must be called with m_mutex held
+    void run_tasks(std::unique_lock<std::mutex> &lock)
+    {
+        while (m_next < m_n_tasks) {
+            auto i = m_next++;
+
+            lock.unlock();
+            (*m_task)(i);
+            lock.lock();
+
+            if (--m_remaining == 0) {
+                m_done_cv.notify_all();
+            }
+        }
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            m_work_cv.wait(lock, [&] {
+                return m_stop || m_next < m_n_tasks;
+            });
+
+            if (m_stop) {
+                return;
+            }
+
+            run_tasks(lock);
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_work_cv;
+    std::condition_variable m_done_cv;
+
+    // Current batch of tasks
+    const std::function<void(size_t)> *m_task;
+    size_t m_n_tasks;
+    // Index of the next task to pick up
+    size_t m_next;
+    // Number of tasks that have not completed yet
+    size_t m_remaining;
+    bool m_stop;
+
+    std::vector<std::thread> m_threads;
+};
+
+}
+
+// Maximum number of distinct first bytes handled by the vectorized prefilter
+static constexpr size_t MAX_PREFILTER_BYTES = 4;
+
 /*!
  * \brief Read from a File handle.
  *
@@ -222,10 +364,191 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
     return bytes_discarded;
 }
 
+#ifdef __linux__
+// Maximum number of bytes to hand to the kernel in a single call. The syscalls
+// return ssize_t and Linux caps each transfer at a little under 2 GiB anyway.
+static constexpr size_t MAX_KERNEL_COPY_SIZE = 1024 * 1024 * 1024;
+
+static ssize_t copy_file_range_fd(int fd_in, int fd_out, size_t size)
+{
+#ifdef __NR_copy_file_range
+    // Called via syscall() because older glibc and bionic versions do not
+    // provide a wrapper
+    return syscall(__NR_copy_file_range, fd_in, nullptr, fd_out, nullptr,
+                   size, 0u);
+#else
+    (void) fd_in;
+    (void) fd_out;
+    (void) size;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static ssize_t sendfile_fd(int fd_in, int fd_out, size_t size)
+{
+    return sendfile(fd_out, fd_in, nullptr, size);
+}
+
+static ssize_t splice_fd(int fd_in, int fd_out, size_t size)
+{
+    // Only works if one of the file descriptors refers to a pipe
+#if defined(__ANDROID__) && __ANDROID_API__ < 21
+    // splice() is only available in bionic for API 21+
+    return syscall(__NR_splice, fd_in, nullptr, fd_out, nullptr, size,
+                   static_cast<unsigned int>(SPLICE_F_MOVE));
+#else
+    return splice(fd_in, nullptr, fd_out, nullptr, size, SPLICE_F_MOVE);
+#endif
+}
+
+static bool is_kernel_copy_unsupported(int error)
+{
+    switch (error) {
+    case ENOSYS:
+    case EINVAL:
+    case EXDEV:
+    case EOPNOTSUPP:
+    case EBADF:
+    case ESPIPE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \brief Copy data between file descriptors without going through userspace
+ *
+ * The data is copied from the current file position of \p fd_in to the current
+ * file position of \p fd_out. `copy_file_range()` is attempted first, followed
+ * by `sendfile()` and `splice()`.
+ *
+ * \return
+ *   * Number of bytes copied if one of the mechanisms worked
+ *   * std::nullopt if no mechanism is supported for this pair of file
+ *     descriptors. No data will have been copied.
+ *   * Otherwise, the error code
+ */
+static oc::result<std::optional<uint64_t>>
+kernel_copy(int fd_in, int fd_out, uint64_t size)
+{
+    for (auto fn : {copy_file_range_fd, sendfile_fd, splice_fd}) {
+        uint64_t copied = 0;
+        bool unsupported = false;
+
+        while (copied < size) {
+            auto to_copy = static_cast<size_t>(std::min<uint64_t>(
+                    size - copied, MAX_KERNEL_COPY_SIZE));
+
+            auto n = fn(fd_in, fd_out, to_copy);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (copied == 0 && is_kernel_copy_unsupported(errno)) {
+                    unsupported = true;
+                    break;
+                }
+                return ec_from_errno();
+            } else if (n == 0) {
+                // Some filesystems report 0 for copy_file_range() instead of
+                // failing. If nothing was copied yet, let the next mechanism
+                // decide whether we're really at EOF.
+                unsupported = copied == 0;
+                break;
+            }
+
+            copied += static_cast<uint64_t>(n);
+        }
+
+        if (!unsupported) {
+            return copied;
+        }
+    }
+
+    return std::nullopt;
+}
+#endif
+
+/*!
+ * \brief Copy data from one File handle to another.
+ *
+ * Data is copied from the current file position of \p src to the current file
+ * position of \p dst until \p size bytes have been copied or EOF is reached on
+ * \p src. Pass `UINT64_MAX` as \p size to copy until EOF.
+ *
+ * On Linux, if both handles are backed by file descriptors (see
+ * File::native_fd()), such as with FdFile, the copy is offloaded to the kernel
+ * with `copy_file_range()`, `sendfile()`, or `splice()`, whichever is
+ * supported for the pair of file descriptors. `copy_file_range()` allows
+ * filesystems to create reflinks or perform server-side copies. Otherwise, the
+ * data is copied with File::read() and File::write() through a large buffer.
+ *
+ * If this function fails, it is unspecified how many bytes were copied and the
+ * file positions of both handles are unspecified.
+ *
+ * \param src Source file handle
+ * \param dst Destination file handle
+ * \param size Maximum number of bytes to copy
+ *
+ * \return Number of bytes copied if the data is successfully copied or EOF is
+ *         reached. Otherwise, the error code.
+ */
+oc::result<uint64_t> file_copy_range(File &src, File &dst, uint64_t size)
+{
+    if (size == 0) {
+        return 0u;
+    }
+
+#ifdef __linux__
+    if (int src_fd = src.native_fd(), dst_fd = dst.native_fd();
+            src_fd >= 0 && dst_fd >= 0) {
+        OUTCOME_TRY(n, kernel_copy(src_fd, dst_fd, size));
+        if (n) {
+            return *n;
+        }
+    }
+#endif
+
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(size, DEFAULT_BUFFER_SIZE)));
+    uint64_t copied = 0;
+
+    while (copied < size) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(size - copied, buf.size()));
+
+        OUTCOME_TRY(n, file_read_retry(src, buf.data(), to_read));
+        if (n == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(file_write_exact(dst, buf.data(), n));
+
+        copied += n;
+
+        if (n < to_read) {
+            break;
+        }
+    }
+
+    return copied;
+}
+
 /*!
  * \class FileSearcher
  *
  * \brief Search file for binary sequence
+ *
+ * If the file contents are available in memory (see File::mapped_data()), such
+ * as with an MmapFile, the memory is searched directly and no data is copied
+ * into the search buffer.
+ *
+ * The search can optionally be spread across multiple threads with
+ * set_threads(). In that case, each window of data is split into chunks that
+ * overlap by `pattern_size - 1` bytes so matches spanning chunk boundaries are
+ * still found. The matches are merged in offset order so that the results are
+ * identical to a single-threaded search.
  */
 
 /*!
@@ -241,21 +564,18 @@ FileSearcher::FileSearcher(File *file, const void *pattern, size_t pattern_size)
     , m_pattern_size(pattern_size)
     , m_searcher({static_cast<const unsigned char *>(pattern),
                   static_cast<const unsigned char *>(pattern) + pattern_size})
+    , m_data(nullptr)
+    , m_mapped(false)
     , m_region_begin(0)
     , m_region_end(0)
     , m_offset(0)
+    , m_threads(1)
+    , m_pending_index(0)
 {
-    auto buf_size = DEFAULT_BUFFER_SIZE;
-
-    if (pattern_size > SIZE_MAX / 2) {
-        buf_size = SIZE_MAX;
-    } else {
-        buf_size = std::max(buf_size, pattern_size * 2);
-    }
-
-    m_buf.resize(buf_size);
 }
 
+FileSearcher::~FileSearcher() = default;
+
 /*!
  * \brief Move constructor
  *
@@ -273,9 +593,15 @@ FileSearcher::FileSearcher(FileSearcher &&other) noexcept
     std::swap(m_pattern_size, other.m_pattern_size);
     std::swap(m_searcher, other.m_searcher);
     std::swap(m_buf, other.m_buf);
+    std::swap(m_data, other.m_data);
+    std::swap(m_mapped, other.m_mapped);
     std::swap(m_region_begin, other.m_region_begin);
     std::swap(m_region_end, other.m_region_end);
     std::swap(m_offset, other.m_offset);
+    std::swap(m_threads, other.m_threads);
+    std::swap(m_pool, other.m_pool);
+    std::swap(m_pending, other.m_pending);
+    std::swap(m_pending_index, other.m_pending_index);
 }
 
 /*!
@@ -296,14 +622,46 @@ FileSearcher & FileSearcher::operator=(FileSearcher &&rhs) noexcept
         std::swap(m_pattern_size, rhs.m_pattern_size);
         std::swap(m_searcher, rhs.m_searcher);
         std::swap(m_buf, rhs.m_buf);
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_mapped, rhs.m_mapped);
         std::swap(m_region_begin, rhs.m_region_begin);
         std::swap(m_region_end, rhs.m_region_end);
         std::swap(m_offset, rhs.m_offset);
+        std::swap(m_threads, rhs.m_threads);
+        std::swap(m_pool, rhs.m_pool);
+        std::swap(m_pending, rhs.m_pending);
+        std::swap(m_pending_index, rhs.m_pending_index);
     }
 
     return *this;
 }
 
+/*!
+ * \brief Set number of threads to use for searching
+ *
+ * By default, the search runs on the calling thread only. If more than one
+ * thread is used, each window of up to #DEFAULT_BUFFER_SIZE bytes is divided
+ * into chunks that are searched concurrently. Windows that are too small to be
+ * worth splitting are still searched on the calling thread. The file itself is
+ * still only read from the calling thread.
+ *
+ * The worker threads are started when the first window is searched and are
+ * reused for the rest of the search. No more workers are started than there
+ * are chunks in the first (and largest) window.
+ *
+ * \param threads Number of threads. If 0, the number of hardware threads
+ *                reported by `std::thread::hardware_concurrency()` is used.
+ */
+void FileSearcher::set_threads(unsigned int threads)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    m_threads = threads;
+    m_pool.reset();
+}
+
 /*!
  * \brief Find next match in the file
  *
@@ -324,6 +682,9 @@ FileSearcher & FileSearcher::operator=(FileSearcher &&rhs) noexcept
  *       to seek to a known location before attempting further read or write
  *       operations.
  *
+ * \note If the file contents are searched in memory, the file must not be
+ *       written to or truncated until the search is complete.
+ *
  * \return
  *   * The match offset if the pattern is found
  *   * std::nullopt if there are no more matches
@@ -339,26 +700,63 @@ oc::result<std::optional<uint64_t>> FileSearcher::next()
         return std::nullopt;
     }
 
+    if (!m_mapped && m_buf.empty()) {
+        uint64_t size;
+
+        if (auto data = m_file->mapped_data(size)) {
+            // Search the remainder of the file in one go
+            OUTCOME_TRY(pos, m_file->seek(0, SEEK_CUR));
+            pos = std::min(pos, size);
+
+            m_data = static_cast<const unsigned char *>(data) + pos;
+            m_mapped = true;
+            m_region_begin = 0;
+            m_region_end = static_cast<size_t>(size - pos);
+        } else if (m_pattern_size > SIZE_MAX / 2) {
+            m_buf.resize(SIZE_MAX);
+        } else {
+            m_buf.resize(std::max(DEFAULT_BUFFER_SIZE, m_pattern_size * 2));
+        }
+    }
+
     while (true) {
+        // Return results from previous parallel search
+        if (m_pending_index < m_pending.size()) {
+            return m_offset + m_pending[m_pending_index++];
+        }
+
+        if (m_threads > 1 && m_region_end - m_region_begin
+                >= PARALLEL_SEARCH_MIN_CHUNK_SIZE * 2) {
+            search_parallel();
+            continue;
+        }
+
         // Find pattern in current buffer
-        if (auto it = std2::search(m_buf.data() + m_region_begin,
-                                   m_buf.data() + m_region_end, *m_searcher);
-                it != m_buf.data() + m_region_end) {
-            auto match_index = static_cast<size_t>(it - m_buf.data());
+        if (auto it = std2::search(m_data + m_region_begin,
+                                   m_data + m_region_end, *m_searcher);
+                it != m_data + m_region_end) {
+            auto match_index = static_cast<size_t>(it - m_data);
             auto match_offset = m_offset + match_index;
 
             // We don't do overlapping searches
-            m_region_begin += match_index + m_pattern_size;
+            m_region_begin = match_index + m_pattern_size;
 
             return match_offset;
         }
 
+        if (m_mapped) {
+            // The mapped data covers the whole file
+            m_pool.reset();
+            return std::nullopt;
+        }
+
         // If the pattern is not found, up to pattern_size - 1 bytes may still
         // match, so move those to the beginning. We will move fewer than
         // pattern_size - 1 bytes if there was a match close to the end.
         auto to_move = std::min(m_region_end - m_region_begin,
                                 m_pattern_size - 1);
         m_offset += m_region_end - to_move;
+        m_data = m_buf.data();
         memmove(m_buf.data(), m_buf.data() + m_region_end - to_move, to_move);
         m_region_begin = 0;
         m_region_end = to_move;
@@ -372,6 +770,7 @@ oc::result<std::optional<uint64_t>> FileSearcher::next()
 
         if (m_region_end < m_pattern_size) {
             // Reached EOF
+            m_pool.reset();
             return std::nullopt;
         }
 
@@ -382,6 +781,127 @@ oc::result<std::optional<uint64_t>> FileSearcher::next()
     }
 }
 
+/*!
+ * \brief Search the next window of the current region using multiple threads
+ *
+ * All non-overlapping matches that begin in the window are stored in
+ * `m_pending` and `m_region_begin` is advanced past the window. If the window
+ * extends to the end of the region, the last `pattern_size - 1` bytes are left
+ * in the region so that they are carried over to the next buffer.
+ */
+void FileSearcher::search_parallel()
+{
+    auto window_begin = m_region_begin;
+    auto window_end = m_region_begin
+            + std::min(m_region_end - m_region_begin, DEFAULT_BUFFER_SIZE);
+    auto window_size = window_end - window_begin;
+
+    auto n_chunks = std::min<size_t>(
+            m_threads, window_size / PARALLEL_SEARCH_MIN_CHUNK_SIZE);
+
+    // Later windows are never larger than the first one, so sizing the pool
+    // for the first window ensures that no worker is left without a chunk
+    if (!m_pool) {
+        m_pool = std::make_unique<SearchWorkerPool>(
+                static_cast<unsigned int>(n_chunks - 1));
+    }
+    n_chunks = std::min(n_chunks, m_pool->workers() + 1);
+
+    auto chunk_size = window_size / n_chunks;
+
+    // Every chunk searches for matches that *begin* within the chunk, but may
+    // read up to pattern_size - 1 bytes past the end of the chunk
+    auto chunk_end = [&](size_t i) {
+        return i == n_chunks - 1
+                ? window_end
+                : window_begin + (i + 1) * chunk_size;
+    };
+    auto data_end = [&](size_t i) {
+        auto end = chunk_end(i);
+        return end + std::min(m_region_end - end, m_pattern_size - 1);
+    };
+
+    std::vector<std::vector<size_t>> results(n_chunks);
+
+    std::function<void(size_t)> search_chunk = [&](size_t i) {
+        auto begin = m_data + window_begin + i * chunk_size;
+        auto end = m_data + data_end(i);
+
+        while (true) {
+            auto it = std2::search(begin, end, *m_searcher);
+            if (it == end) {
+                break;
+            }
+
+            results[i].push_back(static_cast<size_t>(it - m_data));
+            begin = it + m_pattern_size;
+        }
+    };
+
+    m_pool->run(n_chunks, search_chunk);
+
+    m_pending.clear();
+    m_pending_index = 0;
+
+    // Merge the results. Each chunk's matches are only valid on their own if
+    // the first one doesn't overlap the last match of the previous chunk. This
+    // can only happen if the end of the pattern is also a prefix of the
+    // pattern. If it does happen, search sequentially from the end of the last
+    // match until we land on one of the chunk's matches again, after which the
+    // remaining matches are the same as what a sequential search would find.
+    auto last_end = window_begin;
+
+    for (size_t i = 0; i < n_chunks; ++i) {
+        auto const &found = results[i];
+        size_t j = 0;
+
+        while (j < found.size()) {
+            if (found[j] >= last_end) {
+                m_pending.push_back(found[j]);
+                last_end = found[j] + m_pattern_size;
+                ++j;
+                continue;
+            }
+
+            bool synced = false;
+            auto end = m_data + data_end(i);
+
+            for (auto begin = m_data + last_end; begin < end;) {
+                auto it = std2::search(begin, end, *m_searcher);
+                if (it == end) {
+                    break;
+                }
+
+                auto index = static_cast<size_t>(it - m_data);
+                m_pending.push_back(index);
+                last_end = index + m_pattern_size;
+                begin = it + m_pattern_size;
+
+                while (j < found.size() && found[j] < index) {
+                    ++j;
+                }
+                if (j < found.size() && found[j] == index) {
+                    ++j;
+                    synced = true;
+                    break;
+                }
+            }
+
+            if (!synced) {
+                j = found.size();
+            }
+        }
+    }
+
+    if (window_end == m_region_end) {
+        // Leave the tail for the sequential search, which will move it to the
+        // beginning of the buffer for the next read
+        window_end -= std::min(window_size, m_pattern_size - 1);
+    }
+
+    m_region_begin = std::max(last_end, window_end);
+}
+
 void FileSearcher::clear() noexcept
 {
     m_file = nullptr;
@@ -389,11 +909,366 @@ void FileSearcher::clear() noexcept
     m_pattern_size = 0;
     m_searcher = std::nullopt;
     m_buf.clear();
+    m_data = nullptr;
+    m_mapped = false;
+    m_region_begin = 0;
+    m_region_end = 0;
+    m_offset = 0;
+    m_threads = 1;
+    m_pool.reset();
+    m_pending.clear();
+    m_pending_index = 0;
+}
+
+/*!
+ * \class MultiFileSearcher
+ *
+ * \brief Search file for any of several binary sequences in a single pass
+ *
+ * Candidate positions are found with a prefilter that looks for the first byte
+ * of any pattern (using `memchr()` if there is only one distinct first byte and
+ * SSE2 or NEON if there are only a few). Only the patterns that start with the
+ * byte at a candidate position are compared.
+ *
+ * Like FileSearcher, the file is read exactly once and if the file contents are
+ * available in memory (see File::mapped_data()), they are searched directly.
+ */
+
+/*!
+ * \brief Construct with search patterns
+ *
+ * \param file File to search
+ * \param patterns Patterns to search for. Empty patterns never match.
+ */
+MultiFileSearcher::MultiFileSearcher(File *file,
+                                     std::vector<std::string> patterns)
+    : m_file(file)
+    , m_patterns(std::move(patterns))
+    , m_max_size(0)
+    , m_data(nullptr)
+    , m_mapped(false)
+    , m_eof(false)
+    , m_region_begin(0)
+    , m_region_end(0)
+    , m_offset(0)
+{
+    for (size_t i = 0; i < m_patterns.size(); ++i) {
+        auto const &pattern = m_patterns[i];
+        if (pattern.empty()) {
+            continue;
+        }
+
+        auto first = static_cast<unsigned char>(pattern[0]);
+        if (m_buckets[first].empty()) {
+            m_first_bytes.push_back(first);
+        }
+        m_buckets[first].push_back(i);
+
+        m_max_size = std::max(m_max_size, pattern.size());
+    }
+}
+
+/*!
+ * \brief Move constructor
+ *
+ * \p other will be placed in an unusable state. It can be reused by assigning
+ * it to a new MultiFileSearcher instance.
+ *
+ * \param other File searcher to move from
+ */
+MultiFileSearcher::MultiFileSearcher(MultiFileSearcher &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_patterns, other.m_patterns);
+    std::swap(m_max_size, other.m_max_size);
+    std::swap(m_first_bytes, other.m_first_bytes);
+    std::swap(m_buckets, other.m_buckets);
+    std::swap(m_buf, other.m_buf);
+    std::swap(m_data, other.m_data);
+    std::swap(m_mapped, other.m_mapped);
+    std::swap(m_eof, other.m_eof);
+    std::swap(m_region_begin, other.m_region_begin);
+    std::swap(m_region_end, other.m_region_end);
+    std::swap(m_offset, other.m_offset);
+}
+
+/*!
+ * \brief Move assignment operator
+ *
+ * \p rhs will be placed in an unusable state. It can be reused by assigning it
+ * to a new MultiFileSearcher instance.
+ *
+ * \param rhs File searcher to move from
+ */
+MultiFileSearcher & MultiFileSearcher::operator=(MultiFileSearcher &&rhs) noexcept
+{
+    if (this != &rhs) {
+        clear();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_patterns, rhs.m_patterns);
+        std::swap(m_max_size, rhs.m_max_size);
+        std::swap(m_first_bytes, rhs.m_first_bytes);
+        std::swap(m_buckets, rhs.m_buckets);
+        std::swap(m_buf, rhs.m_buf);
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_mapped, rhs.m_mapped);
+        std::swap(m_eof, rhs.m_eof);
+        std::swap(m_region_begin, rhs.m_region_begin);
+        std::swap(m_region_end, rhs.m_region_end);
+        std::swap(m_offset, rhs.m_offset);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Find next match in the file
+ *
+ * The offset returned is relative to the file position when the
+ * MultiFileSearcher was constructed. Matches are returned in offset order. If
+ * multiple patterns match at the same offset, the one that comes first in the
+ * pattern list is returned.
+ *
+ * The same restrictions as FileSearcher::next() apply regarding the file
+ * position and overlapping matches. The next search begins at the end of the
+ * current match, regardless of which pattern matched.
+ *
+ * \return
+ *   * The pattern index and match offset if a pattern is found
+ *   * std::nullopt if there are no more matches
+ *   * Otherwise, an appropriate error code
+ */
+oc::result<std::optional<MultiFileSearcher::Match>> MultiFileSearcher::next()
+{
+    if (!m_file) {
+        return FileError::InvalidState;
+    }
+
+    if (m_max_size == 0) {
+        return std::nullopt;
+    }
+
+    if (!m_mapped && m_buf.empty()) {
+        uint64_t size;
+
+        if (auto data = m_file->mapped_data(size)) {
+            // Search the remainder of the file in one go
+            OUTCOME_TRY(pos, m_file->seek(0, SEEK_CUR));
+            pos = std::min(pos, size);
+
+            m_data = static_cast<const unsigned char *>(data) + pos;
+            m_mapped = true;
+            m_eof = true;
+            m_region_begin = 0;
+            m_region_end = static_cast<size_t>(size - pos);
+        } else if (m_max_size > SIZE_MAX / 2) {
+            m_buf.resize(SIZE_MAX);
+        } else {
+            m_buf.resize(std::max(DEFAULT_BUFFER_SIZE, m_max_size * 2));
+        }
+    }
+
+    while (true) {
+        // Don't check positions where the longest pattern could extend past
+        // the end of the buffer unless there's no more data to read
+        size_t limit;
+        if (m_eof) {
+            limit = m_region_end;
+        } else if (m_region_end >= m_max_size - 1) {
+            limit = m_region_end - (m_max_size - 1);
+        } else {
+            limit = 0;
+        }
+
+        while (m_region_begin < limit) {
+            auto *ptr = find_candidate(m_data + m_region_begin, m_data + limit);
+            if (ptr == m_data + limit) {
+                m_region_begin = limit;
+                break;
+            }
+
+            auto index = static_cast<size_t>(ptr - m_data);
+
+            for (auto id : m_buckets[*ptr]) {
+                auto const &pattern = m_patterns[id];
+
+                if (pattern.size() <= m_region_end - index
+                        && memcmp(ptr, pattern.data(), pattern.size()) == 0) {
+                    // We don't do overlapping searches
+                    m_region_begin = index + pattern.size();
+
+                    return Match{id, m_offset + index};
+                }
+            }
+
+            m_region_begin = index + 1;
+        }
+
+        if (m_eof) {
+            return std::nullopt;
+        }
+
+        // Up to max_size - 1 bytes at the end may still be the beginning of a
+        // match, so move those to the beginning of the buffer
+        auto to_move = m_region_end - m_region_begin;
+        m_offset += m_region_begin;
+        m_data = m_buf.data();
+        memmove(m_buf.data(), m_buf.data() + m_region_begin, to_move);
+        m_region_begin = 0;
+        m_region_end = to_move;
+
+        auto to_read = m_buf.size() - m_region_end;
+        OUTCOME_TRY(n, file_read_retry(*m_file, m_buf.data() + m_region_end,
+                                       to_read));
+
+        m_region_end += n;
+        m_eof = n < to_read;
+
+        // Ensure match offset cannot overflow
+        if (m_offset > UINT64_MAX - m_region_end) {
+            return std::errc::result_out_of_range;
+        }
+    }
+}
+
+/*!
+ * \brief Find the first position in [\p begin, \p end) that contains the first
+ *        byte of any pattern.
+ */
+const unsigned char *
+MultiFileSearcher::find_candidate(const unsigned char *begin,
+                                  const unsigned char *end) const
+{
+    if (m_first_bytes.size() == 1) {
+        auto *ptr = memchr(begin, m_first_bytes[0],
+                           static_cast<size_t>(end - begin));
+        return ptr ? static_cast<const unsigned char *>(ptr) : end;
+    }
+
+    auto *ptr = begin;
+
+#if defined(__SSE2__) || defined(MB_HAVE_NEON_PREFILTER)
+    if (m_first_bytes.size() <= MAX_PREFILTER_BYTES) {
+        auto n = m_first_bytes.size();
+
+        // Skip 16-byte blocks that contain none of the bytes. The exact
+        // position within the block is found by the scalar loop below.
+#  if defined(__SSE2__)
+        __m128i needles[MAX_PREFILTER_BYTES];
+        for (size_t i = 0; i < n; ++i) {
+            needles[i] = _mm_set1_epi8(static_cast<char>(m_first_bytes[i]));
+        }
+
+        for (; end - ptr >= 16; ptr += 16) {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+            auto eq = _mm_cmpeq_epi8(block, needles[0]);
+            for (size_t i = 1; i < n; ++i) {
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi8(block, needles[i]));
+            }
+            if (_mm_movemask_epi8(eq) != 0) {
+                break;
+            }
+        }
+#  else
+        uint8x16_t needles[MAX_PREFILTER_BYTES];
+        for (size_t i = 0; i < n; ++i) {
+            needles[i] = vdupq_n_u8(m_first_bytes[i]);
+        }
+
+        for (; end - ptr >= 16; ptr += 16) {
+            auto block = vld1q_u8(ptr);
+            auto eq = vceqq_u8(block, needles[0]);
+            for (size_t i = 1; i < n; ++i) {
+                eq = vorrq_u8(eq, vceqq_u8(block, needles[i]));
+            }
+            if (vmaxvq_u8(eq) != 0) {
+                break;
+            }
+        }
+#  endif
+    }
+#endif
+
+    for (; ptr != end; ++ptr) {
+        if (!m_buckets[*ptr].empty()) {
+            return ptr;
+        }
+    }
+
+    return end;
+}
+
+void MultiFileSearcher::clear() noexcept
+{
+    m_file = nullptr;
+    m_patterns.clear();
+    m_max_size = 0;
+    m_first_bytes.clear();
+    for (auto &bucket : m_buckets) {
+        bucket.clear();
+    }
+    m_buf.clear();
+    m_data = nullptr;
+    m_mapped = false;
+    m_eof = false;
     m_region_begin = 0;
     m_region_end = 0;
     m_offset = 0;
 }
 
+static oc::result<size_t> read_at_retry(File &file, uint64_t offset,
+                                        void *buf, size_t size)
+{
+    size_t bytes_read = 0;
+
+    while (bytes_read < size) {
+        auto n = file.read_at(offset + bytes_read,
+                              static_cast<char *>(buf) + bytes_read,
+                              size - bytes_read);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_read += n.value();
+    }
+
+    return bytes_read;
+}
+
+static oc::result<size_t> write_at_retry(File &file, uint64_t offset,
+                                         const void *buf, size_t size)
+{
+    size_t bytes_written = 0;
+
+    while (bytes_written < size) {
+        auto n = file.write_at(offset + bytes_written,
+                               static_cast<const char *>(buf) + bytes_written,
+                               size - bytes_written);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_written += n.value();
+    }
+
+    return bytes_written;
+}
+
 /*!
  * \brief Move data in file
  *
@@ -402,9 +1277,10 @@ void FileSearcher::clear() noexcept
  * case where \p src == \p dest or \p size == 0, no operation will be performed,
  * but the function will return \p size accordingly.
  *
- * \note This function is very seek-heavy and may be slow if the handle cannot
- *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
+ * \note This function uses File::read_at() and File::write_at(), so it is
+ *       efficient for handles that implement positional I/O natively. For
+ *       other handles, it will perform up to four seeks per loop iteration.
+ *       Each iteration moves up to 8 MiB.
  *
  * \note If the return value, \p r, is less than \p size, then the *first* \p r
  *       bytes have been copied from offset \p src to offset \p dest. This is
@@ -431,32 +1307,42 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
         return FileError::ArgumentOutOfRange;
     }
 
-    char buf[10240];
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(size, DEFAULT_BUFFER_SIZE)));
     uint64_t size_moved = 0;
     const bool copy_forwards = dest < src;
 
     while (size_moved < size) {
-        auto to_read = std::min<uint64_t>(sizeof(buf), size - size_moved);
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(buf.size(), size - size_moved));
+        auto read_offset = copy_forwards
+                ? src + size_moved
+                : src + size - size_moved - to_read;
 
-        // Seek to source offset
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(
-                copy_forwards ? src + size_moved
-                        : src + size - size_moved - to_read), SEEK_SET));
+        // If the source chunk is entirely within a hole that is followed by
+        // more data, just zero the destination instead of copying the zeros
+        if (auto data = file.next_data(read_offset); data && data.value()
+                && *data.value() - read_offset >= to_read) {
+            OUTCOME_TRYV(file.zero_range(copy_forwards
+                    ? dest + size_moved
+                    : dest + size - size_moved - to_read, to_read));
+
+            size_moved += to_read;
+            continue;
+        }
 
         // Read data from source
-        OUTCOME_TRY(n_read, file_read_retry(
-                file, buf, static_cast<size_t>(to_read)));
+        OUTCOME_TRY(n_read, read_at_retry(file, read_offset,
+                                          buf.data(), to_read));
         if (n_read == 0) {
             break;
         }
 
-        // Seek to destination offset
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(
-                copy_forwards ? dest + size_moved
-                        : dest + size - size_moved - n_read), SEEK_SET));
-
         // Write data to destination
-        OUTCOME_TRY(n_written, file_write_retry(file, buf, n_read));
+        OUTCOME_TRY(n_written, write_at_retry(
+                file, copy_forwards ? dest + size_moved
+                        : dest + size - size_moved - n_read,
+                buf.data(), n_read));
 
         size_moved += n_written;
 
@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/hash.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include <openssl/evp.h>
+
+#include "mbcommon/crc32.h"
+#include "mbcommon/endian.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/hash_error.h"
+
+/*!
+ * \file mbcommon/hash.h
+ * \brief Streaming checksums and message digests
+ *
+ * The digest algorithms are backed by libcrypto (OpenSSL or BoringSSL), which
+ * detects CPU features at runtime and uses the SHA extensions on x86
+ * (SHA-NI), the ARMv8 cryptography extensions, or AVX2/SSSE3 code paths when
+ * available. CRC32 uses crc32_update(), which is dispatched the same way.
+ */
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+
+// Amount of data fed to each hasher at a time by MultiHasher. This is small
+// enough that the chunk is still in cache when the next hasher reads it.
+constexpr size_t MULTI_HASH_CHUNK_SIZE = 64 * 1024;
+
+constexpr size_t FILE_HASH_BUF_SIZE = 256 * 1024;
+
+static const EVP_MD * evp_md(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::Md5:
+        return EVP_md5();
+    case HashAlgorithm::Sha1:
+        return EVP_sha1();
+    case HashAlgorithm::Sha256:
+        return EVP_sha256();
+    case HashAlgorithm::Sha512:
+        return EVP_sha512();
+    default:
+        return nullptr;
+    }
+}
+
+/*! \endcond */
+
+/*!
+ * \brief Get digest size of a hash algorithm
+ *
+ * \param algorithm Hash algorithm
+ *
+ * \return Size of the digest in bytes
+ */
+size_t hash_digest_size(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::Crc32:
+        return sizeof(uint32_t);
+    case HashAlgorithm::Md5:
+        return 16;
+    case HashAlgorithm::Sha1:
+        return 20;
+    case HashAlgorithm::Sha256:
+        return 32;
+    case HashAlgorithm::Sha512:
+        return 64;
+    default:
+        MB_UNREACHABLE("Invalid hash algorithm: %d",
+                       static_cast<int>(algorithm));
+    }
+}
+
+/*!
+ * \class Hasher
+ *
+ * \brief Incrementally compute a checksum or message digest
+ *
+ * Call init() to select the algorithm, update() for each block of data, and
+ * finish() to get the digest. The instance can be reused by calling init()
+ * again. CRC32 digests are returned in big-endian byte order so that they read
+ * the same as the usual hex representation.
+ */
+
+Hasher::Hasher() noexcept
+    : m_algorithm()
+    , m_ctx(nullptr)
+    , m_crc32(0)
+{
+}
+
+Hasher::~Hasher() noexcept
+{
+    clear();
+}
+
+/*!
+ * \brief Move constructor
+ *
+ * \p other will be left in the uninitialized state.
+ */
+Hasher::Hasher(Hasher &&other) noexcept
+    : m_ctx(nullptr)
+{
+    clear();
+
+    std::swap(m_algorithm, other.m_algorithm);
+    std::swap(m_ctx, other.m_ctx);
+    std::swap(m_crc32, other.m_crc32);
+}
+
+/*!
+ * \brief Move assignment operator
+ *
+ * \p rhs will be left in the uninitialized state.
+ */
+Hasher & Hasher::operator=(Hasher &&rhs) noexcept
+{
+    if (this != &rhs) {
+        clear();
+
+        std::swap(m_algorithm, rhs.m_algorithm);
+        std::swap(m_ctx, rhs.m_ctx);
+        std::swap(m_crc32, rhs.m_crc32);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Start computing a new digest
+ *
+ * Any digest in progress is discarded.
+ *
+ * \param algorithm Hash algorithm
+ *
+ * \return Nothing on success or the error code on failure. If libcrypto does
+ *         not provide \p algorithm, HashError::UnsupportedAlgorithm is
+ *         returned.
+ */
+oc::result<void> Hasher::init(HashAlgorithm algorithm)
+{
+    m_algorithm = std::nullopt;
+
+    if (algorithm == HashAlgorithm::Crc32) {
+        m_crc32 = 0;
+    } else {
+        auto md = evp_md(algorithm);
+        if (!md) {
+            return HashError::UnsupportedAlgorithm;
+        }
+
+        if (!m_ctx) {
+            m_ctx = EVP_MD_CTX_new();
+            if (!m_ctx) {
+                return std::errc::not_enough_memory;
+            }
+        }
+
+        if (!EVP_DigestInit_ex(static_cast<EVP_MD_CTX *>(m_ctx), md,
+                               nullptr)) {
+            return HashError::DigestFailed;
+        }
+    }
+
+    m_algorithm = algorithm;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add data to the digest
+ *
+ * \param data Data buffer
+ * \param size Size of \p data
+ *
+ * \return Nothing on success or the error code on failure. If init() has not
+ *         been called, HashError::InvalidState is returned.
+ */
+oc::result<void> Hasher::update(const void *data, size_t size)
+{
+    if (!m_algorithm) {
+        return HashError::InvalidState;
+    }
+
+    if (*m_algorithm == HashAlgorithm::Crc32) {
+        m_crc32 = crc32_update(m_crc32, data, size);
+    } else if (!EVP_DigestUpdate(static_cast<EVP_MD_CTX *>(m_ctx),
+                                 data, size)) {
+        return HashError::DigestFailed;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish computing the digest
+ *
+ * The hasher must be reinitialized with init() before it can be used again.
+ *
+ * \return Digest on success or the error code on failure. If init() has not
+ *         been called, HashError::InvalidState is returned.
+ */
+oc::result<HashDigest> Hasher::finish()
+{
+    if (!m_algorithm) {
+        return HashError::InvalidState;
+    }
+
+    auto algorithm = *m_algorithm;
+    m_algorithm = std::nullopt;
+
+    HashDigest digest(hash_digest_size(algorithm));
+
+    if (algorithm == HashAlgorithm::Crc32) {
+        uint32_t be32_crc32 = mb_htobe32(m_crc32);
+        memcpy(digest.data(), &be32_crc32, sizeof(be32_crc32));
+    } else {
+        unsigned int size;
+
+        if (!EVP_DigestFinal_ex(static_cast<EVP_MD_CTX *>(m_ctx),
+                                digest.data(), &size)) {
+            return HashError::DigestFailed;
+        }
+
+        digest.resize(size);
+    }
+
+    return std::move(digest);
+}
+
+/*!
+ * \brief Get algorithm of the digest in progress
+ *
+ * \return Algorithm passed to init() or std::nullopt if the hasher is not
+ *         initialized
+ */
+std::optional<HashAlgorithm> Hasher::algorithm() const
+{
+    return m_algorithm;
+}
+
+void Hasher::clear() noexcept
+{
+    m_algorithm = std::nullopt;
+    if (m_ctx) {
+        EVP_MD_CTX_free(static_cast<EVP_MD_CTX *>(m_ctx));
+        m_ctx = nullptr;
+    }
+    m_crc32 = 0;
+}
+
+/*!
+ * \class MultiHasher
+ *
+ * \brief Compute several digests in a single pass over the data
+ *
+ * Data passed to update() is fed to each hasher in small chunks so that every
+ * algorithm reads it from cache instead of memory.
+ */
+
+MultiHasher::MultiHasher() noexcept = default;
+
+MultiHasher::~MultiHasher() noexcept = default;
+
+/*!
+ * \brief Start computing new digests
+ *
+ * \param algorithms Hash algorithms. Duplicates are allowed.
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> MultiHasher::init(const std::vector<HashAlgorithm> &algorithms)
+{
+    m_hashers.resize(algorithms.size());
+
+    for (size_t i = 0; i < algorithms.size(); ++i) {
+        OUTCOME_TRYV(m_hashers[i].init(algorithms[i]));
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add data to all digests
+ *
+ * \param data Data buffer
+ * \param size Size of \p data
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> MultiHasher::update(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        auto n = std::min(size, MULTI_HASH_CHUNK_SIZE);
+
+        for (auto &hasher : m_hashers) {
+            OUTCOME_TRYV(hasher.update(ptr, n));
+        }
+
+        ptr += n;
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish computing all digests
+ *
+ * \return Digests in the order the algorithms were passed to init() or the
+ *         error code on failure
+ */
+oc::result<std::vector<HashDigest>> MultiHasher::finish()
+{
+    std::vector<HashDigest> digests;
+    digests.reserve(m_hashers.size());
+
+    for (auto &hasher : m_hashers) {
+        OUTCOME_TRY(digest, hasher.finish());
+        digests.push_back(std::move(digest));
+    }
+
+    return std::move(digests);
+}
+
+/*!
+ * \brief Compute digests of the rest of a file
+ *
+ * The file is read once from the current position until EOF and all of the
+ * digests are computed in the same pass.
+ *
+ * \param file File to read
+ * \param algorithms Hash algorithms
+ *
+ * \return Digests in the order of \p algorithms or the error code on failure
+ */
+oc::result<std::vector<HashDigest>>
+file_hash(File &file, const std::vector<HashAlgorithm> &algorithms)
+{
+    MultiHasher hasher;
+    std::vector<unsigned char> buf(FILE_HASH_BUF_SIZE);
+
+    OUTCOME_TRYV(hasher.init(algorithms));
+
+    while (true) {
+        OUTCOME_TRY(n, file_read_retry(file, buf.data(), buf.size()));
+        if (n == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(hasher.update(buf.data(), n));
+    }
+
+    return hasher.finish();
+}
+
+}
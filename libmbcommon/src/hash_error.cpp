@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/hash_error.h"
+
+#include <string>
+
+namespace mb
+{
+
+struct HashErrorCategory : std::error_category
+{
+    const char * name() const noexcept override;
+
+    std::string message(int ev) const override;
+};
+
+const char * HashErrorCategory::name() const noexcept
+{
+    return "hash_error";
+}
+
+std::string HashErrorCategory::message(int ev) const
+{
+    switch (static_cast<HashError>(ev)) {
+    case HashError::UnsupportedAlgorithm:
+        return "unsupported hash algorithm";
+    case HashError::InvalidState:
+        return "hasher not initialized";
+    case HashError::DigestFailed:
+        return "digest computation failed";
+    default:
+        return "(unknown hash error)";
+    }
+}
+
+const std::error_category & hash_error_category()
+{
+    static HashErrorCategory c;
+    return c;
+}
+
+std::error_code make_error_code(HashError e)
+{
+    return {static_cast<int>(e), hash_error_category()};
+}
+
+}
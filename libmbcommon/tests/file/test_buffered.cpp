@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+class CountingMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read(buf, size);
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        ++writes;
+        return MemoryFile::write(buf, size);
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        ++seeks;
+        return MemoryFile::seek(offset, whence);
+    }
+
+    unsigned int reads = 0;
+    unsigned int writes = 0;
+    unsigned int seeks = 0;
+};
+
+struct FileBufferedTest : testing::Test
+{
+    char _data[33] = "0123456789abcdefghijklmnopqrstuv";
+    CountingMemoryFile _file{_data, sizeof(_data) - 1};
+};
+
+TEST_F(FileBufferedTest, CheckInvalidStates)
+{
+    BufferedFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.flush(), error);
+
+    ASSERT_EQ(file.open(nullptr), oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_EQ(file.open(&_file, 0), oc::failure(FileError::ArgumentOutOfRange));
+
+    ASSERT_TRUE(file.open(&_file));
+    ASSERT_EQ(file.open(&_file), error);
+}
+
+TEST_F(FileBufferedTest, SmallReadsShouldBeCoalesced)
+{
+    BufferedFile file(&_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+        ASSERT_EQ(memcmp(buf, _data + i * 4, sizeof(buf)), 0);
+    }
+    ASSERT_EQ(_file.reads, 1u);
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "ghij", sizeof(buf)), 0);
+    ASSERT_EQ(_file.reads, 2u);
+}
+
+TEST_F(FileBufferedTest, LargeReadsShouldBypassBuffer)
+{
+    BufferedFile file(&_file, 8);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[20];
+
+    ASSERT_TRUE(file_read_exact(file, buf, 2));
+    ASSERT_EQ(_file.reads, 1u);
+
+    // 6 bytes from the buffer and 14 bytes directly from the file
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _data + 2, sizeof(buf)), 0);
+    ASSERT_EQ(_file.reads, 2u);
+}
+
+TEST_F(FileBufferedTest, SeekWithinBufferShouldNotTouchFile)
+{
+    BufferedFile file(&_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+
+    // Only the first seek should query the underlying file position
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(4u));
+    ASSERT_EQ(_file.seeks, 1u);
+    ASSERT_EQ(file.seek(10, SEEK_SET), oc::success(10u));
+    ASSERT_EQ(file.seek(-8, SEEK_CUR), oc::success(2u));
+    ASSERT_EQ(file.seek(14, SEEK_CUR), oc::success(16u));
+    ASSERT_EQ(file.seek(1, SEEK_SET), oc::success(1u));
+    ASSERT_EQ(_file.seeks, 1u);
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "1234", sizeof(buf)), 0);
+    ASSERT_EQ(_file.reads, 1u);
+}
+
+TEST_F(FileBufferedTest, SeekOutsideBufferShouldAccountForReadAhead)
+{
+    BufferedFile file(&_file, 8);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(file.seek(10, SEEK_CUR), oc::success(14u));
+    ASSERT_EQ(_file.seek(0, SEEK_CUR), oc::success(14u));
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "efgh", sizeof(buf)), 0);
+
+    ASSERT_EQ(file.seek(-2, SEEK_END), oc::success(30u));
+    ASSERT_TRUE(file_read_exact(file, buf, 2));
+    ASSERT_EQ(memcmp(buf, "uv", 2), 0);
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(FileBufferedTest, SmallWritesShouldBeCoalesced)
+{
+    BufferedFile file(&_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_TRUE(file_write_exact(file, "ABCD", 4));
+    }
+    ASSERT_EQ(_file.writes, 0u);
+    ASSERT_EQ(memcmp(_data, "0123", 4), 0);
+
+    ASSERT_TRUE(file_write_exact(file, "EF", 2));
+    ASSERT_EQ(_file.writes, 1u);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(18u));
+
+    ASSERT_TRUE(file.flush());
+    ASSERT_EQ(_file.writes, 2u);
+    ASSERT_EQ(memcmp(_data, "ABCDABCDABCDABCDEFij", 20), 0);
+}
+
+TEST_F(FileBufferedTest, ReadAfterWriteShouldSeeData)
+{
+    BufferedFile file(&_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[6];
+
+    ASSERT_TRUE(file.seek(2, SEEK_SET));
+    ASSERT_TRUE(file_write_exact(file, "XY", 2));
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "01XY45", sizeof(buf)), 0);
+
+    // Writing after reading must happen at the logical position
+    ASSERT_TRUE(file_write_exact(file, "Z", 1));
+    ASSERT_TRUE(file.flush());
+    ASSERT_EQ(memcmp(_data, "01XY45Z7", 8), 0);
+    ASSERT_EQ(_file.seek(0, SEEK_CUR), oc::success(7u));
+}
+
+TEST_F(FileBufferedTest, WriteAtShouldInvalidateReadAhead)
+{
+    BufferedFile file(&_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[2];
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(file.write_at(2, "XY", 2), oc::success(2u));
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "XY", sizeof(buf)), 0);
+}
+
+TEST_F(FileBufferedTest, CloseShouldFlushAndRestorePosition)
+{
+    BufferedFile file(&_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[3];
+
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_TRUE(file_write_exact(file, "XYZ", 3));
+    ASSERT_EQ(memcmp(_data + 3, "345", 3), 0);
+
+    ASSERT_TRUE(file.close());
+    ASSERT_FALSE(file.is_open());
+    ASSERT_EQ(memcmp(_data + 3, "XYZ", 3), 0);
+    ASSERT_EQ(_file.seek(0, SEEK_CUR), oc::success(6u));
+}
+
+TEST_F(FileBufferedTest, TruncateShouldFlush)
+{
+    void *data = nullptr;
+    size_t size = 0;
+
+    CountingMemoryFile dynamic_file(&data, &size);
+    ASSERT_TRUE(dynamic_file.is_open());
+
+    auto free_data = std::unique_ptr<void, decltype(free) *>(nullptr, free);
+
+    {
+        BufferedFile file(&dynamic_file, 16);
+        ASSERT_TRUE(file.is_open());
+
+        ASSERT_TRUE(file_write_exact(file, "abcdef", 6));
+        ASSERT_TRUE(file.truncate(4));
+        ASSERT_EQ(size, 4u);
+        ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(6u));
+    }
+
+    free_data.reset(data);
+    ASSERT_EQ(memcmp(data, "abcd", 4), 0);
+}
@@ -49,6 +49,22 @@ struct MockFdFileFuncs : public FdFileFuncs
     MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
     MOCK_METHOD3(fn_read, ssize_t(int fd, void *buf, size_t count));
     MOCK_METHOD3(fn_write, ssize_t(int fd, const void *buf, size_t count));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+
+    // sys/uio.h
+    MOCK_METHOD3(fn_readv, ssize_t(int fd, const struct iovec *iov,
+                                   int iovcnt));
+    MOCK_METHOD3(fn_writev, ssize_t(int fd, const struct iovec *iov,
+                                    int iovcnt));
+
+    // fcntl.h
+    MOCK_METHOD4(fn_fallocate64, int(int fd, int mode, off64_t offset,
+                                     off64_t len));
+#endif
 
     struct stat _sb_regfile{};
 
@@ -76,6 +92,18 @@ struct MockFdFileFuncs : public FdFileFuncs
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_write(_, _, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_readv(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_writev(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fallocate64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void report_as_regular_file()
@@ -283,6 +311,20 @@ TEST_F(FileFdTest, OpenFile)
     ASSERT_TRUE(file.open(0, false));
 }
 
+TEST_F(FileFdTest, NativeFd)
+{
+    _funcs.report_as_regular_file();
+
+    TestableFdFile file(&_funcs);
+    ASSERT_EQ(file.native_fd(), -1);
+
+    ASSERT_TRUE(file.open(5, false));
+    ASSERT_EQ(file.native_fd(), 5);
+
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(file.native_fd(), -1);
+}
+
 TEST_F(FileFdTest, CloseUnownedFile)
 {
     _funcs.report_as_regular_file();
@@ -551,3 +593,212 @@ TEST_F(FileFdTest, TruncateFailed)
 
     ASSERT_EQ(file.truncate(1024), oc::failure(std::errc::io_error));
 }
+
+#ifndef _WIN32
+TEST_F(FileFdTest, ReadAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(_, _, 1, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::success(1u));
+}
+
+TEST_F(FileFdTest, ReadAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, ReadAtOutOfRange)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(static_cast<uint64_t>(INT64_MAX) + 1, &c, 1),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileFdTest, WriteAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, 1, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::success(1u));
+}
+
+TEST_F(FileFdTest, WriteAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, ReadvSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    char a[2];
+    char b[3];
+    IoVec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}};
+
+    EXPECT_CALL(_funcs, fn_readv(_, reinterpret_cast<const iovec *>(iov), 2))
+            .Times(1)
+            .WillOnce(Return(5));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.readv(iov, 2), oc::success(5u));
+}
+
+TEST_F(FileFdTest, WritevFailure)
+{
+    _funcs.report_as_regular_file();
+
+    char a[2] = {};
+    IoVec iov[] = {{a, sizeof(a)}};
+
+    EXPECT_CALL(_funcs, fn_writev(_, _, 1))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.writev(iov, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, AllocateSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_fallocate64(_, 0, 10, 20))
+            .Times(1)
+            .WillOnce(Return(0));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.allocate(10, 20));
+}
+
+TEST_F(FileFdTest, AllocateUnsupported)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_fallocate64(_, _, _, _))
+            .Times(1)
+            .WillOnce(SetErrnoAndReturn(EOPNOTSUPP, -1));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.punch_hole(10, 20),
+              oc::failure(FileError::UnsupportedAllocate));
+}
+
+TEST_F(FileFdTest, AllocateOutOfRange)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_fallocate64(_, _, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.allocate(INT64_MAX, 1),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileFdTest, ZeroRangeFallsBackToWriting)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_fallocate64(_, _, 10, 5))
+            .Times(1)
+            .WillOnce(SetErrnoAndReturn(EOPNOTSUPP, -1));
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, 5, 10))
+            .Times(1)
+            .WillOnce(ReturnArg<2>());
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.zero_range(10, 5));
+}
+
+#ifdef SEEK_DATA
+TEST_F(FileFdTest, NextDataRestoresPosition)
+{
+    _funcs.report_as_regular_file();
+
+    InSequence seq;
+
+    EXPECT_CALL(_funcs, fn_lseek64(_, 0, SEEK_CUR))
+            .WillOnce(Return(5));
+    EXPECT_CALL(_funcs, fn_lseek64(_, 10, SEEK_DATA))
+            .WillOnce(Return(4096));
+    EXPECT_CALL(_funcs, fn_lseek64(_, 5, SEEK_SET))
+            .WillOnce(Return(5));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.next_data(10) == oc::success(4096u));
+}
+
+TEST_F(FileFdTest, NextHoleAtEndOfFile)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_lseek64(_, 0, SEEK_CUR))
+            .WillOnce(Return(0));
+    EXPECT_CALL(_funcs, fn_lseek64(_, 10, SEEK_HOLE))
+            .WillOnce(SetErrnoAndReturn(ENXIO, -1));
+    EXPECT_CALL(_funcs, fn_lseek64(_, 0, SEEK_SET))
+            .WillOnce(Return(0));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.next_hole(10) == oc::success(std::nullopt));
+}
+#endif
+#endif
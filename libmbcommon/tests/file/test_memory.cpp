@@ -21,6 +21,8 @@
 
 #include <memory>
 
+#include <cstring>
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
@@ -479,3 +481,86 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileStaticMemoryTest, ReadAtDoesNotMovePosition)
+{
+    char in[] = "abcdef";
+    constexpr size_t in_size = 6;
+    char out[4];
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.read_at(2, out, sizeof(out)), oc::success(4u));
+    ASSERT_EQ(memcmp(out, "cdef", 4), 0);
+    ASSERT_EQ(file.read_at(5, out, sizeof(out)), oc::success(1u));
+    ASSERT_EQ(file.read_at(100, out, sizeof(out)), oc::success(0u));
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST(FileStaticMemoryTest, WriteAtOutOfBounds)
+{
+    char in[] = "abc";
+    constexpr size_t in_size = 3;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(2, "xy", 2), oc::success(1u));
+    ASSERT_EQ(in[2], 'x');
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST(FileStaticMemoryTest, ReadvStopsAtEof)
+{
+    char in[] = "abcde";
+    constexpr size_t in_size = 5;
+    char a[2];
+    char b[2];
+    char c[2];
+    IoVec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}, {c, sizeof(c)}};
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.readv(iov, 3), oc::success(5u));
+    ASSERT_EQ(memcmp(a, "ab", 2), 0);
+    ASSERT_EQ(memcmp(b, "cd", 2), 0);
+    ASSERT_EQ(c[0], 'e');
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(5u));
+}
+
+TEST(FileDynamicMemoryTest, WriteAtExtends)
+{
+    void *in = nullptr;
+    size_t in_size = 0;
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(2, "x", 1), oc::success(1u));
+    ASSERT_EQ(in_size, 3u);
+    ASSERT_EQ(memcmp(in, "\0\0x", 3), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+
+    free(in);
+}
+
+TEST(FileDynamicMemoryTest, Writev)
+{
+    void *in = nullptr;
+    size_t in_size = 0;
+    char a[] = "ab";
+    char b[] = "cde";
+    IoVec iov[] = {{a, 2}, {b, 3}};
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.writev(iov, 2), oc::success(5u));
+    ASSERT_EQ(in_size, 5u);
+    ASSERT_EQ(memcmp(in, "abcde", 5), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(5u));
+
+    free(in);
+}
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+using namespace mb::detail;
+using namespace testing;
+
+struct MockMmapFileFuncs : public MmapFileFuncs
+{
+    // fcntl.h
+    MOCK_METHOD3(fn_open, int(const char *path, int flags, mode_t mode));
+    MOCK_METHOD2(fn_fcntl, int(int fd, int cmd));
+
+    // sys/mman.h
+    MOCK_METHOD6(fn_mmap, void *(void *addr, size_t length, int prot,
+                                 int flags, int fd, off64_t offset));
+    MOCK_METHOD2(fn_munmap, int(void *addr, size_t length));
+
+    // sys/stat.h
+    MOCK_METHOD2(fn_fstat, int(int fildes, struct stat *buf));
+
+    // unistd.h
+    MOCK_METHOD1(fn_close, int(int fd));
+    MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
+    MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
+
+    // Contents of the fake file
+    std::string _contents;
+
+    MockMmapFileFuncs()
+    {
+        // Fail everything by default
+        ON_CALL(*this, fn_open(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fcntl(_, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_mmap(_, _, _, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, MAP_FAILED));
+        ON_CALL(*this, fn_munmap(_, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fstat(_, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_close(_))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_ftruncate64(_, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_lseek64(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+    }
+
+    void report_as_regular_file(std::string contents, int flags = O_RDWR)
+    {
+        _contents = std::move(contents);
+
+        ON_CALL(*this, fn_fcntl(_, F_GETFL))
+                .WillByDefault(Return(flags));
+        ON_CALL(*this, fn_fstat(_, _))
+                .WillByDefault(Invoke([this](int, struct stat *sb) {
+                    *sb = {};
+                    sb->st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+                    sb->st_size = static_cast<off_t>(_contents.size());
+                    return 0;
+                }));
+        ON_CALL(*this, fn_mmap(_, _, _, _, _, _))
+                .WillByDefault(Invoke([this](void *, size_t length, int, int,
+                                             int, off64_t offset) -> void * {
+                    EXPECT_LE(static_cast<size_t>(offset) + length,
+                              _contents.size());
+                    return _contents.data() + offset;
+                }));
+        ON_CALL(*this, fn_munmap(_, _))
+                .WillByDefault(Return(0));
+        ON_CALL(*this, fn_ftruncate64(_, _))
+                .WillByDefault(Invoke([this](int, off64_t length) {
+                    _contents.resize(static_cast<size_t>(length));
+                    return 0;
+                }));
+    }
+
+    void report_as_block_device(std::string contents)
+    {
+        report_as_regular_file(std::move(contents), O_RDONLY);
+
+        ON_CALL(*this, fn_fstat(_, _))
+                .WillByDefault(Invoke([](int, struct stat *sb) {
+                    *sb = {};
+                    sb->st_mode = S_IFBLK | S_IRWXU | S_IRWXG | S_IRWXO;
+                    return 0;
+                }));
+        ON_CALL(*this, fn_lseek64(_, _, _))
+                .WillByDefault(Invoke([this](int, off64_t offset, int whence) {
+                    return whence == SEEK_END
+                            ? static_cast<off64_t>(_contents.size()) + offset
+                            : offset;
+                }));
+    }
+};
+
+class TestableMmapFile : public MmapFile
+{
+public:
+    TestableMmapFile(MmapFileFuncs *funcs)
+        : MmapFile(funcs)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, int fd, bool owned)
+        : MmapFile(funcs, fd, owned)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs,
+                     const std::string &filename, FileOpenMode mode)
+        : MmapFile(funcs, filename, mode)
+    {
+    }
+
+    using MmapFile::set_max_map_size;
+
+    ~TestableMmapFile()
+    {
+    }
+};
+
+struct FileMmapTest : Test
+{
+    NiceMock<MockMmapFileFuncs> _funcs;
+};
+
+TEST_F(FileMmapTest, CheckInvalidStates)
+{
+    TestableMmapFile file(&_funcs);
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.map_region(0, 0), error);
+
+    _funcs.report_as_regular_file("");
+
+    ASSERT_TRUE(file.open(0, false));
+    ASSERT_EQ(file.open(0, false), error);
+    ASSERT_EQ(file.open("x", FileOpenMode::ReadOnly), error);
+}
+
+TEST_F(FileMmapTest, OpenFilenameFailure)
+{
+    EXPECT_CALL(_funcs, fn_open(_, _, _))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open("x", FileOpenMode::ReadOnly),
+              oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileMmapTest, OpenWriteOnlyMapsReadWrite)
+{
+    _funcs.report_as_regular_file("");
+
+    EXPECT_CALL(_funcs, fn_open(_, O_CLOEXEC | O_RDWR | O_CREAT | O_TRUNC, _))
+            .Times(1)
+            .WillOnce(Return(0));
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open("x", FileOpenMode::WriteOnly));
+}
+
+TEST_F(FileMmapTest, OpenWriteOnlyFdFailure)
+{
+    _funcs.report_as_regular_file("", O_WRONLY);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open(0, false), oc::failure(std::errc::permission_denied));
+}
+
+TEST_F(FileMmapTest, OpenDirectory)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fcntl(_, _))
+            .WillByDefault(Return(O_RDONLY));
+    EXPECT_CALL(_funcs, fn_fstat(_, _))
+            .Times(1)
+            .WillOnce(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open(0, false), oc::failure(std::errc::is_a_directory));
+}
+
+TEST_F(FileMmapTest, OpenMmapFailure)
+{
+    _funcs.report_as_regular_file("abc");
+
+    EXPECT_CALL(_funcs, fn_mmap(_, _, _, _, _, _))
+            .Times(1)
+            .WillOnce(SetErrnoAndReturn(ENOMEM, MAP_FAILED));
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open(0, false),
+              oc::failure(std::errc::not_enough_memory));
+}
+
+TEST_F(FileMmapTest, OpenEmptyFileDoesNotMap)
+{
+    _funcs.report_as_regular_file("");
+
+    EXPECT_CALL(_funcs, fn_mmap(_, _, _, _, _, _))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, OpenBlockDeviceUsesSeekSize)
+{
+    _funcs.report_as_block_device("abcdef");
+
+    EXPECT_CALL(_funcs, fn_mmap(_, 6, _, _, _, 0))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::success(6u));
+    ASSERT_EQ(file.seek(0, SEEK_SET), oc::success(0u));
+
+    char buf[6];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(6u));
+    ASSERT_EQ(memcmp(buf, "abcdef", 6), 0);
+}
+
+TEST_F(FileMmapTest, CloseOwnedFile)
+{
+    _funcs.report_as_regular_file("abc");
+
+    EXPECT_CALL(_funcs, fn_munmap(_, 3))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(_))
+            .Times(1)
+            .WillOnce(Return(0));
+
+    TestableMmapFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileMmapTest, CloseUnownedFile)
+{
+    _funcs.report_as_regular_file("abc");
+
+    EXPECT_CALL(_funcs, fn_close(_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileMmapTest, ReadAndSeek)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+
+    ASSERT_EQ(file.read(buf, 4), oc::success(4u));
+    ASSERT_EQ(memcmp(buf, "abcd", 4), 0);
+    ASSERT_EQ(file.read(buf, 4), oc::success(2u));
+    ASSERT_EQ(memcmp(buf, "ef", 2), 0);
+    ASSERT_EQ(file.read(buf, 4), oc::success(0u));
+
+    ASSERT_EQ(file.seek(-3, SEEK_END), oc::success(3u));
+    ASSERT_EQ(file.read(buf, 1), oc::success(1u));
+    ASSERT_EQ(buf[0], 'd');
+
+    ASSERT_EQ(file.seek(-1, SEEK_CUR), oc::success(3u));
+    ASSERT_EQ(file.seek(-4, SEEK_CUR),
+              oc::failure(FileError::ArgumentOutOfRange));
+
+    ASSERT_EQ(file.seek(100, SEEK_SET), oc::success(100u));
+    ASSERT_EQ(file.read(buf, 4), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, WriteInBounds)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    EXPECT_CALL(_funcs, fn_ftruncate64(_, _))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(2, SEEK_SET));
+    ASSERT_EQ(file.write("xy", 2), oc::success(2u));
+    ASSERT_EQ(_funcs._contents, "abxyef");
+}
+
+TEST_F(FileMmapTest, WriteOutOfBoundsRemaps)
+{
+    _funcs.report_as_regular_file("abc");
+
+    EXPECT_CALL(_funcs, fn_ftruncate64(_, 6))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_mmap(_, _, _, _, _, _))
+            .Times(2);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(4, SEEK_SET));
+    ASSERT_EQ(file.write("xy", 2), oc::success(2u));
+    ASSERT_EQ(_funcs._contents, std::string("abc\0xy", 6));
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::success(6u));
+}
+
+TEST_F(FileMmapTest, WriteAppend)
+{
+    _funcs.report_as_regular_file("abc", O_RDWR | O_APPEND);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("d", 1), oc::success(1u));
+    ASSERT_EQ(_funcs._contents, "abcd");
+}
+
+TEST_F(FileMmapTest, WriteReadOnly)
+{
+    _funcs.report_as_regular_file("abc", O_RDONLY);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("d", 1), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(file.truncate(0), oc::failure(FileError::UnsupportedTruncate));
+}
+
+TEST_F(FileMmapTest, TruncateDoesNotMovePosition)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(4, SEEK_SET));
+    ASSERT_TRUE(file.truncate(2));
+    ASSERT_EQ(_funcs._contents, "ab");
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(4u));
+}
+
+TEST_F(FileMmapTest, TruncateFailure)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    EXPECT_CALL(_funcs, fn_ftruncate64(_, _))
+            .Times(1)
+            .WillOnce(SetErrnoAndReturn(EIO, -1));
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.truncate(2), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileMmapTest, PositionalReadAndWrite)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+
+    ASSERT_EQ(file.read_at(4, buf, sizeof(buf)), oc::success(2u));
+    ASSERT_EQ(memcmp(buf, "ef", 2), 0);
+    ASSERT_EQ(file.write_at(5, "xyz", 3), oc::success(3u));
+    ASSERT_EQ(_funcs._contents, "abcdexyz");
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, Writev)
+{
+    _funcs.report_as_regular_file("ab");
+
+    // Remapped once for all buffers
+    EXPECT_CALL(_funcs, fn_ftruncate64(_, 6))
+            .Times(1);
+
+    char a[] = "cd";
+    char b[] = "ef";
+    IoVec iov[] = {{a, 2}, {b, 2}};
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(2, SEEK_SET));
+    ASSERT_EQ(file.writev(iov, 2), oc::success(4u));
+    ASSERT_EQ(_funcs._contents, "abcdef");
+}
+
+TEST_F(FileMmapTest, MapRegion)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto span = file.map_region(2, 3);
+    ASSERT_TRUE(span);
+    ASSERT_EQ(span.value().data,
+              reinterpret_cast<const unsigned char *>(
+                      _funcs._contents.data() + 2));
+    ASSERT_EQ(span.value().size, 3u);
+
+    // Truncated to end of file
+    span = file.map_region(4, 100);
+    ASSERT_TRUE(span);
+    ASSERT_EQ(span.value().size, 2u);
+
+    span = file.map_region(6, 100);
+    ASSERT_TRUE(span);
+    ASSERT_EQ(span.value().size, 0u);
+
+    ASSERT_EQ(file.map_region(7, 1),
+              oc::failure(FileError::ArgumentOutOfRange));
+
+    // File position is unchanged
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, LargeFileUsesWindows)
+{
+    _funcs.report_as_regular_file("abcdefghij");
+
+    TestableMmapFile file(&_funcs);
+    file.set_max_map_size(4);
+    ASSERT_TRUE(file.open(0, false));
+
+    // Whole file does not fit in a window
+    uint64_t size;
+    ASSERT_EQ(file.mapped_data(size), nullptr);
+
+    // Reads cross window boundaries
+    char buf[10];
+    ASSERT_TRUE(file.seek(2, SEEK_SET));
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(8u));
+    ASSERT_EQ(memcmp(buf, "cdefghij", 8), 0);
+
+    // Spans stop at window boundaries
+    auto span = file.map_region(5, 100);
+    ASSERT_TRUE(span);
+    ASSERT_EQ(span.value().data,
+              reinterpret_cast<const unsigned char *>(
+                      _funcs._contents.data() + 5));
+    ASSERT_EQ(span.value().size, 3u);
+
+    span = file.map_region(8, 100);
+    ASSERT_TRUE(span);
+    ASSERT_EQ(span.value().size, 2u);
+
+    // Writes cross window boundaries
+    ASSERT_EQ(file.write_at(3, "XYZ", 3), oc::success(3u));
+    ASSERT_EQ(_funcs._contents, "abcXYZghij");
+}
+
+TEST_F(FileMmapTest, MappedData)
+{
+    _funcs.report_as_regular_file("abcdef");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    uint64_t size = 0;
+    ASSERT_EQ(file.mapped_data(size), _funcs._contents.data());
+    ASSERT_EQ(size, 6u);
+}
+
+TEST_F(FileMmapTest, SearchMapping)
+{
+    _funcs.report_as_regular_file("xxabcdabcdxabcd");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.seek(1, SEEK_SET));
+
+    FileSearcher searcher(&file, "abcd", 4);
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(1));
+    ASSERT_TRUE(searcher.next() == oc::success(5));
+    ASSERT_TRUE(searcher.next() == oc::success(10));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST_F(FileMmapTest, MultiSearchMapping)
+{
+    _funcs.report_as_regular_file("xxabcdxyzabcd");
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.seek(1, SEEK_SET));
+
+    MultiFileSearcher searcher(&file, {"abcd", "xyz"});
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{0, 1}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{1, 5}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{0, 8}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
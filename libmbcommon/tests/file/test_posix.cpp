@@ -38,6 +38,7 @@ struct MockPosixFileFuncs : public PosixFileFuncs
     // stdio.h
     MOCK_METHOD1(fn_fclose, int(FILE *stream));
     MOCK_METHOD1(fn_ferror, int(FILE *stream));
+    MOCK_METHOD1(fn_fflush, int(FILE *stream));
     MOCK_METHOD1(fn_fileno, int(FILE *stream));
 #ifdef _WIN32
     MOCK_METHOD2(fn_wfopen, FILE *(const wchar_t *filename,
@@ -54,6 +55,17 @@ struct MockPosixFileFuncs : public PosixFileFuncs
 
     // unistd.h
     MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+    MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
+
+    // fcntl.h
+    MOCK_METHOD4(fn_fallocate64, int(int fd, int mode, off64_t offset,
+                                     off64_t len));
+#endif
 
     bool stream_error = false;
 
@@ -73,6 +85,8 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_ferror(_))
                 .WillByDefault(ReturnPointee(&stream_error));
+        ON_CALL(*this, fn_fflush(_))
+                .WillByDefault(SetErrnoAndReturn(EIO, EOF));
         ON_CALL(*this, fn_fileno(_))
                 .WillByDefault(Return(-1));
         ON_CALL(*this, fn_fread(_, _, _, _))
@@ -91,6 +105,16 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                         SetErrnoAndReturn(EIO, 0)));
         ON_CALL(*this, fn_ftruncate64(_, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_lseek64(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fallocate64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void set_ferror_fail()
@@ -98,6 +122,17 @@ struct MockPosixFileFuncs : public PosixFileFuncs
         stream_error = true;
     }
 
+    void report_as_seekable()
+    {
+        struct stat sb{};
+        sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+        ON_CALL(*this, fn_fileno(_))
+                .WillByDefault(Return(0));
+        ON_CALL(*this, fn_fstat(_, _))
+                .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+    }
+
     void open_with_success()
     {
 #ifdef _WIN32
@@ -607,3 +642,151 @@ TEST_F(FilePosixTest, TruncateFailed)
 
     ASSERT_EQ(file.truncate(1024), oc::failure(std::errc::io_error));
 }
+
+#ifndef _WIN32
+TEST_F(FilePosixTest, ReadAtSuccess)
+{
+    _funcs.report_as_seekable();
+
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_funcs, fn_fflush(_))
+                .Times(1)
+                .WillOnce(Return(0));
+        EXPECT_CALL(_funcs, fn_pread64(_, _, 1, 10))
+                .Times(1)
+                .WillOnce(ReturnArg<2>());
+    }
+
+    // The stream position must not be touched
+    EXPECT_CALL(_funcs, fn_fseeko(_, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::success(1u));
+}
+
+TEST_F(FilePosixTest, ReadAtFlushFailed)
+{
+    _funcs.report_as_seekable();
+
+    EXPECT_CALL(_funcs, fn_fflush(_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FilePosixTest, ReadAtUnsupported)
+{
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(10, &c, 1),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(FilePosixTest, WriteAtSuccess)
+{
+    _funcs.report_as_seekable();
+
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_funcs, fn_fflush(_))
+                .Times(1)
+                .WillOnce(Return(0));
+        EXPECT_CALL(_funcs, fn_pwrite64(_, _, 1, 10))
+                .Times(1)
+                .WillOnce(ReturnArg<2>());
+    }
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::success(1u));
+}
+
+TEST_F(FilePosixTest, WriteAtFailure)
+{
+    _funcs.report_as_seekable();
+
+    ON_CALL(_funcs, fn_fflush(_))
+            .WillByDefault(Return(0));
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, _, _))
+            .Times(1);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(10, "x", 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FilePosixTest, PunchHoleSuccess)
+{
+    _funcs.report_as_seekable();
+
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_funcs, fn_fflush(_))
+                .Times(1)
+                .WillOnce(Return(0));
+        EXPECT_CALL(_funcs, fn_fallocate64(_, _, 10, 20))
+                .Times(1)
+                .WillOnce(Return(0));
+    }
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.punch_hole(10, 20));
+}
+
+TEST_F(FilePosixTest, AllocateWithoutFd)
+{
+    EXPECT_CALL(_funcs, fn_fallocate64(_, _, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.allocate(10, 20),
+              oc::failure(FileError::UnsupportedAllocate));
+}
+
+#ifdef SEEK_HOLE
+TEST_F(FilePosixTest, NextHoleRestoresPosition)
+{
+    _funcs.report_as_seekable();
+
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_funcs, fn_fflush(_))
+                .WillOnce(Return(0));
+        EXPECT_CALL(_funcs, fn_lseek64(_, 0, SEEK_CUR))
+                .WillOnce(Return(5));
+        EXPECT_CALL(_funcs, fn_lseek64(_, 10, SEEK_HOLE))
+                .WillOnce(Return(8192));
+        EXPECT_CALL(_funcs, fn_lseek64(_, 5, SEEK_SET))
+                .WillOnce(Return(5));
+    }
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.next_hole(10) == oc::success(8192u));
+}
+#endif
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/tracing.h"
+#include "mbcommon/file_error.h"
+
+using namespace mb;
+
+struct FileTracingTest : testing::Test
+{
+    char _data[33] = "0123456789abcdefghijklmnopqrstuv";
+    MemoryFile _file{_data, sizeof(_data) - 1};
+};
+
+static uint64_t histogram_total(const TracingFile::OpStats &stats)
+{
+    uint64_t total = 0;
+    for (auto count : stats.histogram) {
+        total += count;
+    }
+    return total;
+}
+
+TEST_F(FileTracingTest, CheckInvalidStates)
+{
+    TracingFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+
+    ASSERT_EQ(file.open(nullptr, "test"),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_TRUE(file.open(&_file, "test"));
+    ASSERT_EQ(file.open(&_file, "test"), error);
+}
+
+TEST_F(FileTracingTest, RecordOperations)
+{
+    TracingFile file(&_file, "test");
+    ASSERT_TRUE(file.is_open());
+
+    char buf[8];
+
+    ASSERT_EQ(file.read(buf, 4), oc::success(4u));
+    ASSERT_EQ(file.read(buf, 8), oc::success(8u));
+    ASSERT_EQ(file.seek(20, SEEK_SET), oc::success(20u));
+    ASSERT_EQ(file.seek(2, SEEK_SET), oc::success(2u));
+    ASSERT_EQ(file.write("xyz", 3), oc::success(3u));
+    ASSERT_EQ(file.read_at(30, buf, 8), oc::success(2u));
+    ASSERT_EQ(file.write_at(0, "a", 1), oc::success(1u));
+    // Fixed-size memory files cannot be truncated
+    ASSERT_FALSE(file.truncate(16));
+    ASSERT_TRUE(file.seek(-1, SEEK_SET).has_error());
+
+    auto const &stats = file.stats();
+
+    ASSERT_EQ(stats.read.calls, 3u);
+    ASSERT_EQ(stats.read.errors, 0u);
+    ASSERT_EQ(stats.read.bytes, 14u);
+    ASSERT_EQ(histogram_total(stats.read), 3u);
+
+    ASSERT_EQ(stats.write.calls, 2u);
+    ASSERT_EQ(stats.write.bytes, 4u);
+
+    ASSERT_EQ(stats.seek.calls, 3u);
+    ASSERT_EQ(stats.seek.errors, 1u);
+    ASSERT_EQ(stats.seek.bytes, 0u);
+    ASSERT_EQ(histogram_total(stats.seek), 3u);
+
+    ASSERT_EQ(stats.truncate.calls, 1u);
+    ASSERT_EQ(stats.truncate.errors, 1u);
+
+    // 12 -> 20 -> 2
+    ASSERT_EQ(stats.seek_distance, 26u);
+
+    ASSERT_EQ(memcmp(_data, "a1xyz", 5), 0);
+}
+
+TEST_F(FileTracingTest, ReportOnClose)
+{
+    std::string text;
+    std::string json;
+
+    TracingFile file(&_file, "my \"file\"");
+    file.set_report_callback([&](const TracingFile &f) {
+        text = f.summary();
+        json = f.summary_json();
+    });
+
+    char buf[4];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(4u));
+
+    ASSERT_TRUE(text.empty());
+    ASSERT_TRUE(file.close());
+    ASSERT_FALSE(file.is_open());
+
+    // Underlying file is not closed
+    ASSERT_TRUE(_file.is_open());
+
+    ASSERT_EQ(text.rfind("my \"file\":\n", 0), 0u);
+    ASSERT_NE(text.find("  read: 1 calls, 0 errors, 4 bytes"),
+              std::string::npos);
+    ASSERT_NE(text.find("  seek distance: 0 bytes\n"), std::string::npos);
+
+    ASSERT_EQ(json.rfind("{\"name\":\"my \\\"file\\\"\",\"read\":{\"calls\":1,"
+                         "\"errors\":0,\"bytes\":4,", 0), 0u);
+    ASSERT_NE(json.find("\"seek_distance\":0}"), std::string::npos);
+
+    // Statistics are kept after closing
+    ASSERT_EQ(file.stats().read.calls, 1u);
+}
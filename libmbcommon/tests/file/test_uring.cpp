@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file/uring.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+struct FileUringTest : testing::Test
+{
+    std::unique_ptr<FILE, decltype(fclose) *> _fp{tmpfile(), fclose};
+    UringFile _file;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_fp);
+        ASSERT_TRUE(_file.open(fileno(_fp.get()), false));
+    }
+};
+
+TEST_F(FileUringTest, CheckInvalidStates)
+{
+    UringFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.read_async(0, nullptr, 0, [](auto) {}), error);
+    ASSERT_EQ(file.write_async(0, nullptr, 0, [](auto) {}), error);
+    ASSERT_EQ(file.read_async(0, nullptr, 0).get(), error);
+    ASSERT_EQ(file.write_async(0, nullptr, 0).get(), error);
+    ASSERT_TRUE(file.submit());
+    ASSERT_TRUE(file.wait());
+
+    ASSERT_EQ(file.set_queue_depth(0),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_EQ(_file.write_async(static_cast<uint64_t>(INT64_MAX) + 1,
+                                "x", 1).get(),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileUringTest, WriteThenReadWithFutures)
+{
+    auto write_a = _file.write_async(0, "abcd", 4);
+    auto write_b = _file.write_async(4, "efgh", 4);
+    ASSERT_TRUE(_file.submit());
+    ASSERT_EQ(write_a.get(), oc::success(4u));
+    ASSERT_EQ(write_b.get(), oc::success(4u));
+
+    char buf[8];
+    auto read = _file.read_async(2, buf, 6);
+    ASSERT_TRUE(_file.submit());
+    ASSERT_EQ(read.get(), oc::success(6u));
+    ASSERT_EQ(memcmp(buf, "cdefgh", 6), 0);
+
+    // Short read at EOF
+    read = _file.read_async(6, buf, sizeof(buf));
+    ASSERT_TRUE(_file.submit());
+    ASSERT_EQ(read.get(), oc::success(2u));
+
+    // Synchronous API should see the data
+    ASSERT_EQ(_file.read_at(0, buf, sizeof(buf)), oc::success(8u));
+    ASSERT_EQ(memcmp(buf, "abcdefgh", 8), 0);
+}
+
+TEST_F(FileUringTest, CallbacksShouldRunBeforeWaitReturns)
+{
+    ASSERT_TRUE(_file.set_queue_depth(2));
+    ASSERT_EQ(_file.queue_depth(), 2u);
+
+    // More requests than the queue depth
+    constexpr size_t n_requests = 16;
+    std::vector<unsigned char> data(n_requests * 512);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i / 512);
+    }
+
+    std::atomic<size_t> completed(0);
+    std::atomic<size_t> bytes(0);
+
+    for (size_t i = 0; i < n_requests; ++i) {
+        ASSERT_TRUE(_file.write_async(i * 512, data.data() + i * 512, 512,
+                                      [&](oc::result<size_t> r) {
+            ASSERT_TRUE(r);
+            bytes += r.value();
+            ++completed;
+        }));
+    }
+
+    ASSERT_TRUE(_file.wait());
+    ASSERT_EQ(completed, n_requests);
+    ASSERT_EQ(bytes, data.size());
+
+    std::vector<unsigned char> result(data.size());
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(file_read_exact(_file, result.data(), result.size()));
+    ASSERT_EQ(result, data);
+}
+
+TEST_F(FileUringTest, ErrorsShouldBeReported)
+{
+    // Read-only file descriptor
+    UringFile file;
+    std::string path = "/proc/self/fd/" + std::to_string(fileno(_fp.get()));
+    ASSERT_TRUE(file.open(path, FileOpenMode::ReadOnly));
+
+    auto write = file.write_async(0, "x", 1);
+    ASSERT_TRUE(file.submit());
+    ASSERT_EQ(write.get(), oc::failure(std::errc::bad_file_descriptor));
+}
+
+TEST_F(FileUringTest, CloseShouldWaitForRequests)
+{
+    size_t completed = 0;
+
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_TRUE(_file.write_async(i, "x", 1, [&](oc::result<size_t> r) {
+            ASSERT_EQ(r, oc::success(1u));
+            ++completed;
+        }));
+    }
+
+    ASSERT_TRUE(_file.close());
+    ASSERT_EQ(completed, 4u);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "mbcommon/crc32.h"
+
+using namespace mb;
+
+static uint32_t crc32_bitwise(const unsigned char *data, size_t size)
+{
+    uint32_t crc = ~0u;
+
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+    }
+
+    return ~crc;
+}
+
+TEST(Crc32Test, CheckKnownValues)
+{
+    ASSERT_EQ(crc32_update(0, "", 0), 0u);
+    ASSERT_EQ(crc32_update(0, "123456789", 9), 0xcbf43926u);
+    ASSERT_EQ(crc32_update(0, "The quick brown fox jumps over the lazy dog",
+                           43), 0x414fa339u);
+}
+
+TEST(Crc32Test, MatchesBitwiseImplementation)
+{
+    std::vector<unsigned char> data(4096 + 64);
+    std::mt19937 gen(1234);
+    for (auto &b : data) {
+        b = static_cast<unsigned char>(gen());
+    }
+
+    // Cover unaligned starting points and every tail length for both the
+    // table-driven and SIMD paths
+    const size_t sizes[] = {
+        0, 1, 7, 8, 15, 16, 63, 64, 65, 79, 80, 127, 128, 200, 1000, 4096,
+    };
+
+    for (size_t offset = 0; offset < 16; ++offset) {
+        for (size_t size : sizes) {
+            ASSERT_EQ(crc32_update(0, data.data() + offset, size),
+                      crc32_bitwise(data.data() + offset, size))
+                    << "Offset: " << offset << ", size: " << size;
+        }
+    }
+}
+
+TEST(Crc32Test, IncrementalUpdateMatchesSingleUpdate)
+{
+    std::vector<unsigned char> data(100000);
+    std::mt19937 gen(5678);
+    for (auto &b : data) {
+        b = static_cast<unsigned char>(gen());
+    }
+
+    auto expected = crc32_update(0, data.data(), data.size());
+
+    uint32_t crc = 0;
+    size_t pos = 0;
+    for (size_t size = 1; pos < data.size(); size = size * 3 + 1) {
+        auto n = std::min(size, data.size() - pos);
+        crc = crc32_update(crc, data.data() + pos, n);
+        pos += n;
+    }
+
+    ASSERT_EQ(crc, expected);
+}
+
+TEST(Crc32Test, CombineMatchesSingleUpdate)
+{
+    std::vector<unsigned char> data(10000);
+    std::mt19937 gen(9012);
+    for (auto &b : data) {
+        b = static_cast<unsigned char>(gen());
+    }
+
+    auto expected = crc32_update(0, data.data(), data.size());
+
+    const size_t splits[] = {0, 1, 3, 4, 999, 5000, 9999, 10000};
+
+    for (size_t split : splits) {
+        auto crc1 = crc32_update(0, data.data(), split);
+        auto crc2 = crc32_update(0, data.data() + split, data.size() - split);
+
+        ASSERT_EQ(crc32_combine(crc1, crc2, data.size() - split), expected)
+                << "Split: " << split;
+    }
+}
+
+TEST(Crc32Test, UpdateRepeatMatchesLoop)
+{
+    const unsigned char pattern[] = {0xde, 0xad, 0xbe, 0xef};
+    const unsigned char zeros[4] = {};
+
+    const uint64_t counts[] = {0, 1, 2, 3, 7, 8, 1000, 4097};
+
+    for (uint64_t count : counts) {
+        uint32_t expected = crc32_update(0, "abc", 3);
+        uint32_t expected_zeros = expected;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            expected = crc32_update(expected, pattern, sizeof(pattern));
+            expected_zeros = crc32_update(expected_zeros, zeros, sizeof(zeros));
+        }
+
+        auto crc = crc32_update(0, "abc", 3);
+
+        ASSERT_EQ(crc32_update_repeat(crc, pattern, sizeof(pattern), count),
+                  expected) << "Count: " << count;
+        ASSERT_EQ(crc32_update_repeat(crc, zeros, sizeof(zeros), count),
+                  expected_zeros) << "Count: " << count;
+    }
+}
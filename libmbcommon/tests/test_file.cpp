@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_error.h"
+
+#include "file/mock_test_file.h"
+
+using namespace mb;
+using namespace testing;
+
+struct FileTest : Test
+{
+    NiceMock<MockFile> _file;
+};
+
+TEST_F(FileTest, ReadAtFallbackRestoresPosition)
+{
+    InSequence seq;
+
+    EXPECT_CALL(_file, seek(0, SEEK_CUR))
+            .WillOnce(Return(5u));
+    EXPECT_CALL(_file, seek(10, SEEK_SET))
+            .WillOnce(Return(10u));
+    EXPECT_CALL(_file, read(_, 4))
+            .WillOnce(Return(4u));
+    EXPECT_CALL(_file, seek(5, SEEK_SET))
+            .WillOnce(Return(5u));
+
+    char buf[4];
+    ASSERT_EQ(_file.read_at(10, buf, sizeof(buf)), oc::success(4u));
+}
+
+TEST_F(FileTest, ReadAtFallbackRestoresPositionOnFailure)
+{
+    InSequence seq;
+
+    EXPECT_CALL(_file, seek(0, SEEK_CUR))
+            .WillOnce(Return(5u));
+    EXPECT_CALL(_file, seek(10, SEEK_SET))
+            .WillOnce(Return(10u));
+    EXPECT_CALL(_file, read(_, _))
+            .WillOnce(Return(std::errc::io_error));
+    EXPECT_CALL(_file, seek(5, SEEK_SET))
+            .WillOnce(Return(5u));
+
+    char buf[4];
+    ASSERT_EQ(_file.read_at(10, buf, sizeof(buf)),
+              oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileTest, ReadAtFallbackSeekUnsupported)
+{
+    EXPECT_CALL(_file, seek(_, _))
+            .WillOnce(Return(FileError::UnsupportedSeek));
+    EXPECT_CALL(_file, read(_, _))
+            .Times(0);
+
+    char buf[4];
+    ASSERT_EQ(_file.read_at(10, buf, sizeof(buf)),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(FileTest, WriteAtFallbackRestoresPosition)
+{
+    InSequence seq;
+
+    EXPECT_CALL(_file, seek(0, SEEK_CUR))
+            .WillOnce(Return(5u));
+    EXPECT_CALL(_file, seek(10, SEEK_SET))
+            .WillOnce(Return(10u));
+    EXPECT_CALL(_file, write(_, 4))
+            .WillOnce(Return(4u));
+    EXPECT_CALL(_file, seek(5, SEEK_SET))
+            .WillOnce(Return(5u));
+
+    ASSERT_EQ(_file.write_at(10, "abcd", 4), oc::success(4u));
+}
+
+TEST_F(FileTest, ReadvFallbackStopsAtShortRead)
+{
+    char a[4];
+    char b[4];
+    char c[4];
+    IoVec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}, {c, sizeof(c)}};
+
+    EXPECT_CALL(_file, read(_, 4))
+            .Times(2)
+            .WillOnce(Return(4u))
+            .WillOnce(Return(2u));
+
+    ASSERT_EQ(_file.readv(iov, 3), oc::success(6u));
+}
+
+TEST_F(FileTest, ReadvFallbackReturnsPartialDataOnFailure)
+{
+    char a[4];
+    char b[4];
+    IoVec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}};
+
+    EXPECT_CALL(_file, read(_, 4))
+            .Times(2)
+            .WillOnce(Return(4u))
+            .WillOnce(Return(std::errc::io_error));
+
+    ASSERT_EQ(_file.readv(iov, 2), oc::success(4u));
+}
+
+TEST_F(FileTest, WritevFallbackFailure)
+{
+    char a[4] = {};
+    IoVec iov[] = {{a, sizeof(a)}};
+
+    EXPECT_CALL(_file, write(_, 4))
+            .WillOnce(Return(std::errc::io_error));
+
+    ASSERT_EQ(_file.writev(iov, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileTest, AllocateFallbackUnsupported)
+{
+    ASSERT_EQ(_file.allocate(0, 10),
+              oc::failure(FileError::UnsupportedAllocate));
+    ASSERT_EQ(_file.punch_hole(0, 10),
+              oc::failure(FileError::UnsupportedAllocate));
+}
+
+TEST_F(FileTest, ZeroRangeFallbackWritesZeros)
+{
+    InSequence seq;
+
+    // Split into 64 KiB writes
+    EXPECT_CALL(_file, seek(0, SEEK_CUR))
+            .WillOnce(Return(5u));
+    EXPECT_CALL(_file, seek(10, SEEK_SET))
+            .WillOnce(Return(10u));
+    EXPECT_CALL(_file, write(_, 65536))
+            .WillOnce(Return(65536u));
+    EXPECT_CALL(_file, seek(5, SEEK_SET))
+            .WillOnce(Return(5u));
+    EXPECT_CALL(_file, seek(0, SEEK_CUR))
+            .WillOnce(Return(5u));
+    EXPECT_CALL(_file, seek(65546, SEEK_SET))
+            .WillOnce(Return(65546u));
+    EXPECT_CALL(_file, write(_, 4))
+            .WillOnce(Return(4u));
+    EXPECT_CALL(_file, seek(5, SEEK_SET))
+            .WillOnce(Return(5u));
+
+    ASSERT_TRUE(_file.zero_range(10, 65540));
+}
+
+TEST_F(FileTest, HoleQueryFallbackTreatsFileAsData)
+{
+    ON_CALL(_file, seek(0, SEEK_CUR))
+            .WillByDefault(Return(5u));
+    ON_CALL(_file, seek(0, SEEK_END))
+            .WillByDefault(Return(100u));
+    ON_CALL(_file, seek(5, SEEK_SET))
+            .WillByDefault(Return(5u));
+
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(_file.next_data(10) == oc::success(10u));
+    ASSERT_TRUE(_file.next_hole(10) == oc::success(100u));
+    ASSERT_TRUE(_file.next_data(100) == oc::success(std::nullopt));
+    ASSERT_TRUE(_file.next_hole(100) == oc::success(std::nullopt));
+}
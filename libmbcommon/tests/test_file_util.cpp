@@ -21,10 +21,16 @@
 
 #include <algorithm>
 #include <memory>
+#include <string_view>
 #include <vector>
 
 #include <cinttypes>
+#include <cstdio>
+#include <cstring>
 
+#ifdef __linux__
+#  include "mbcommon/file/fd.h"
+#endif
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
 #include "mbcommon/file_util.h"
@@ -351,6 +357,184 @@ TEST(FileSearchTest, FindNonMatchingAtBoundary)
     ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
 }
 
+TEST(FileSearchTest, FindMultipleNonOverlapping)
+{
+    std::string buf = "ababababab";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, "abab", 4);
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(0));
+    ASSERT_TRUE(searcher.next() == oc::success(4));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+static std::vector<uint64_t> search_all(std::string &buf,
+                                        std::string_view pattern,
+                                        unsigned int threads)
+{
+    std::vector<uint64_t> offsets;
+
+    MemoryFile file(buf.data(), buf.size());
+    EXPECT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, pattern.data(), pattern.size());
+    searcher.set_threads(threads);
+
+    while (true) {
+        auto result = searcher.next();
+        EXPECT_TRUE(result);
+        if (!result || !result.value()) {
+            break;
+        }
+        offsets.push_back(*result.value());
+    }
+
+    return offsets;
+}
+
+TEST(FileSearchTest, ParallelFindsSameMatchesAsSequential)
+{
+    // Spread matches across chunk and buffer boundaries
+    std::string buf(DEFAULT_BUFFER_SIZE * 2 + 12345, 'x');
+    for (size_t i = 3; i + 4 <= buf.size(); i += 65533) {
+        buf.replace(i, 4, "abcd");
+    }
+    buf.replace(buf.size() - 4, 4, "abcd");
+
+    auto expected = search_all(buf, "abcd", 1);
+    ASSERT_GT(expected.size(), 256u);
+    ASSERT_EQ(expected.back(), buf.size() - 4);
+
+    ASSERT_EQ(search_all(buf, "abcd", 2), expected);
+    ASSERT_EQ(search_all(buf, "abcd", 7), expected);
+    ASSERT_EQ(search_all(buf, "abcd", 8), expected);
+}
+
+TEST(FileSearchTest, ParallelFindsSameMatchesWithSelfOverlappingPattern)
+{
+    // Every position is a potential match, so matches found by each chunk
+    // independently will overlap those of the previous chunk
+    std::string buf(DEFAULT_BUFFER_SIZE + 1000, 'a');
+    buf[1234567] = 'b';
+
+    auto expected = search_all(buf, "aaa", 1);
+    ASSERT_GT(expected.size(), 0u);
+
+    ASSERT_EQ(search_all(buf, "aaa", 3), expected);
+    ASSERT_EQ(search_all(buf, "aaa", 8), expected);
+}
+
+TEST(MultiFileSearchTest, CheckNoUsablePatterns)
+{
+    std::string buf = "abcd";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"", ""});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(MultiFileSearchTest, FindInOffsetOrder)
+{
+    std::string buf = "xxxxefghxxabcdxxxxijkl";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"abcd", "efgh", "ijkl"});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{1, 4}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{0, 10}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{2, 18}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(MultiFileSearchTest, FindSharedFirstByte)
+{
+    std::string buf = "xxab1xxab2xxab3";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"ab2", "ab1"});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{1, 2}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{0, 7}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(MultiFileSearchTest, FindPrefersEarlierPattern)
+{
+    std::string buf = "xxabcdxx";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"ab", "abcd"});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{0, 2}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(MultiFileSearchTest, FindManyDistinctFirstBytes)
+{
+    // More distinct first bytes than the vectorized prefilter handles
+    std::string buf(100, 'x');
+    buf.replace(20, 2, "a1");
+    buf.replace(40, 2, "e5");
+    buf.replace(97, 2, "c3");
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"a1", "b2", "c3", "d4", "e5"});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{0, 20}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{4, 40}));
+    ASSERT_TRUE(searcher.next() == oc::success(MultiFileSearcher::Match{2, 97}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(MultiFileSearchTest, FindOnBoundaryOfBuffer)
+{
+    std::string buf;
+    buf.resize(DEFAULT_BUFFER_SIZE - 1);
+    buf += "abcd";
+    buf += "xyz";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"xyz", "abcd"});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(
+            MultiFileSearcher::Match{1, DEFAULT_BUFFER_SIZE - 1}));
+    ASSERT_TRUE(searcher.next() == oc::success(
+            MultiFileSearcher::Match{0, DEFAULT_BUFFER_SIZE + 3}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(MultiFileSearchTest, FindShortPatternAtEndOfFile)
+{
+    std::string buf;
+    buf.resize(DEFAULT_BUFFER_SIZE);
+    buf += "xy";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    MultiFileSearcher searcher(&file, {"xy", "abcdefgh"});
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(
+            MultiFileSearcher::Match{0, DEFAULT_BUFFER_SIZE}));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     char buf[] = "abcdef";
@@ -447,4 +631,122 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     }
 }
 
+TEST(FileCopyRangeTest, CopyUntilEofShouldSucceed)
+{
+    char src_buf[] = "abcdef";
+    char dst_buf[] = "zzzzzzzz";
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf, sizeof(dst_buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy_range(src, dst, UINT64_MAX), oc::success(6u));
+    ASSERT_STREQ(dst_buf, "abcdefzz");
+}
+
+TEST(FileCopyRangeTest, CopyFromCurrentPositionsShouldSucceed)
+{
+    char src_buf[] = "abcdef";
+    char dst_buf[] = "zzzzzzzz";
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf, sizeof(dst_buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_TRUE(src.seek(1, SEEK_SET));
+    ASSERT_TRUE(dst.seek(2, SEEK_SET));
+
+    ASSERT_EQ(file_copy_range(src, dst, 3), oc::success(3u));
+    ASSERT_STREQ(dst_buf, "zzbcdzzz");
+    ASSERT_EQ(src.seek(0, SEEK_CUR), oc::success(4u));
+    ASSERT_EQ(dst.seek(0, SEEK_CUR), oc::success(5u));
+}
+
+TEST(FileCopyRangeTest, CopyZeroBytesShouldSucceed)
+{
+    char buf[] = "abcdef";
+
+    MemoryFile src(buf, sizeof(buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(buf, sizeof(buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy_range(src, dst, 0), oc::success(0u));
+}
+
+TEST(FileCopyRangeTest, CopyToFullFileShouldFail)
+{
+    char src_buf[] = "abcdef";
+    char dst_buf[] = "zzz";
+
+    MemoryFile src(src_buf, sizeof(src_buf) - 1);
+    ASSERT_TRUE(src.is_open());
+    MemoryFile dst(dst_buf, sizeof(dst_buf) - 1);
+    ASSERT_TRUE(dst.is_open());
+
+    ASSERT_EQ(file_copy_range(src, dst, UINT64_MAX),
+              oc::failure(FileError::UnexpectedEof));
+}
+
+#ifdef __linux__
+TEST(FileCopyRangeTest, CopyBetweenFdsShouldSucceed)
+{
+    std::unique_ptr<FILE, decltype(fclose) *> src_fp(tmpfile(), fclose);
+    ASSERT_TRUE(src_fp);
+    std::unique_ptr<FILE, decltype(fclose) *> dst_fp(tmpfile(), fclose);
+    ASSERT_TRUE(dst_fp);
+
+    FdFile src(fileno(src_fp.get()), false);
+    ASSERT_TRUE(src.is_open());
+    FdFile dst(fileno(dst_fp.get()), false);
+    ASSERT_TRUE(dst.is_open());
+
+    std::vector<unsigned char> data(100000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i % 251);
+    }
+
+    ASSERT_TRUE(file_write_exact(src, data.data(), data.size()));
+    ASSERT_TRUE(src.seek(0, SEEK_SET));
+
+    ASSERT_EQ(file_copy_range(src, dst, UINT64_MAX),
+              oc::success(data.size()));
+
+    std::vector<unsigned char> result(data.size());
+    ASSERT_TRUE(dst.seek(0, SEEK_SET));
+    ASSERT_TRUE(file_read_exact(dst, result.data(), result.size()));
+    ASSERT_EQ(result, data);
+}
+
+TEST(FileMoveTest, MoveHoleShouldZeroDestination)
+{
+    std::unique_ptr<FILE, decltype(fclose) *> fp(tmpfile(), fclose);
+    ASSERT_TRUE(fp);
+
+    FdFile file(fileno(fp.get()), false);
+    ASSERT_TRUE(file.is_open());
+
+    // [0, 1 MiB) is a hole (if supported by the filesystem), followed by
+    // 1 MiB of data
+    std::vector<unsigned char> data(1024 * 1024, 'x');
+    ASSERT_TRUE(file.seek(static_cast<int64_t>(data.size()), SEEK_SET));
+    ASSERT_TRUE(file_write_exact(file, data.data(), data.size()));
+
+    ASSERT_EQ(file_move(file, 0, data.size() / 2, data.size()),
+              oc::success(data.size()));
+
+    std::vector<unsigned char> result(data.size() * 2);
+    ASSERT_EQ(file.read_at(0, result.data(), result.size()),
+              oc::success(result.size()));
+
+    auto middle = result.begin() + static_cast<ptrdiff_t>(data.size() * 3 / 2);
+    ASSERT_TRUE(std::all_of(result.begin(), middle,
+                            [](unsigned char c) { return c == 0; }));
+    ASSERT_TRUE(std::all_of(middle, result.end(),
+                            [](unsigned char c) { return c == 'x'; }));
+}
+#endif
+
 // TODO: Add more tests after integrating gmock
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/hash.h"
+#include "mbcommon/hash_error.h"
+
+using namespace mb;
+
+static std::string to_hex(const HashDigest &digest)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+
+    for (auto byte : digest) {
+        result += digits[byte >> 4];
+        result += digits[byte & 0xf];
+    }
+
+    return result;
+}
+
+static std::string hash_string(HashAlgorithm algorithm, const std::string &data)
+{
+    Hasher hasher;
+    EXPECT_TRUE(hasher.init(algorithm));
+    EXPECT_TRUE(hasher.update(data.data(), data.size()));
+
+    auto digest = hasher.finish();
+    EXPECT_TRUE(digest);
+    if (!digest) {
+        return {};
+    }
+
+    EXPECT_EQ(digest.value().size(), hash_digest_size(algorithm));
+    return to_hex(digest.value());
+}
+
+TEST(HashTest, CheckKnownValues)
+{
+    const std::string data = "The quick brown fox jumps over the lazy dog";
+
+    ASSERT_EQ(hash_string(HashAlgorithm::Crc32, data), "414fa339");
+    ASSERT_EQ(hash_string(HashAlgorithm::Md5, data),
+              "9e107d9d372bb6826bd81d3542a419d6");
+    ASSERT_EQ(hash_string(HashAlgorithm::Sha1, data),
+              "2fd4e1c67a2d28fced849ee1bb76e7391b93eb12");
+    ASSERT_EQ(hash_string(HashAlgorithm::Sha256, data),
+              "d7a8fbb307d7809469ca9abcb0082e4f"
+              "8d5651e46d3cdb762d02d0bf37c9e592");
+    ASSERT_EQ(hash_string(HashAlgorithm::Sha512, data),
+              "07e547d9586f6a73f73fbac0435ed76951218fb7d0c8d788a309d785436bbb64"
+              "2e93a252a954f23912547d1e8a3b5ed6e1bfd7097821233fa0538f3db854fee6");
+
+    ASSERT_EQ(hash_string(HashAlgorithm::Sha1, ""),
+              "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+}
+
+TEST(HashTest, CheckUninitializedFailure)
+{
+    Hasher hasher;
+
+    ASSERT_EQ(hasher.update("a", 1), oc::failure(HashError::InvalidState));
+    ASSERT_EQ(hasher.finish(), oc::failure(HashError::InvalidState));
+
+    // Hasher must be reinitialized after finishing
+    ASSERT_TRUE(hasher.init(HashAlgorithm::Sha256));
+    ASSERT_TRUE(hasher.finish());
+    ASSERT_FALSE(hasher.algorithm());
+    ASSERT_EQ(hasher.update("a", 1), oc::failure(HashError::InvalidState));
+}
+
+TEST(HashTest, CheckUnsupportedAlgorithmFailure)
+{
+    Hasher hasher;
+
+    ASSERT_EQ(hasher.init(static_cast<HashAlgorithm>(100)),
+              oc::failure(HashError::UnsupportedAlgorithm));
+    ASSERT_FALSE(hasher.algorithm());
+}
+
+TEST(HashTest, MultiHasherMatchesIndividualHashers)
+{
+    const std::vector<HashAlgorithm> algorithms{
+        HashAlgorithm::Crc32,
+        HashAlgorithm::Md5,
+        HashAlgorithm::Sha1,
+        HashAlgorithm::Sha256,
+        HashAlgorithm::Sha512,
+    };
+
+    // Larger than the chunk size to check that chunks are fed in order
+    std::string data(300000, '\0');
+    std::mt19937 gen(1234);
+    for (auto &c : data) {
+        c = static_cast<char>(gen());
+    }
+
+    MultiHasher hasher;
+    ASSERT_TRUE(hasher.init(algorithms));
+    ASSERT_TRUE(hasher.update(data.data(), 1000));
+    ASSERT_TRUE(hasher.update(data.data() + 1000, data.size() - 1000));
+
+    auto digests = hasher.finish();
+    ASSERT_TRUE(digests);
+    ASSERT_EQ(digests.value().size(), algorithms.size());
+
+    for (size_t i = 0; i < algorithms.size(); ++i) {
+        ASSERT_EQ(to_hex(digests.value()[i]),
+                  hash_string(algorithms[i], data));
+    }
+}
+
+TEST(HashTest, HashFile)
+{
+    std::string data(1000000, 'x');
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    auto digests = file_hash(file, {HashAlgorithm::Sha1, HashAlgorithm::Crc32});
+    ASSERT_TRUE(digests);
+    ASSERT_EQ(digests.value().size(), 2u);
+    ASSERT_EQ(to_hex(digests.value()[0]),
+              hash_string(HashAlgorithm::Sha1, data));
+    ASSERT_EQ(to_hex(digests.value()[1]),
+              hash_string(HashAlgorithm::Crc32, data));
+}
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <unordered_set>
+#include <vector>
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -73,7 +74,7 @@ private:
 
     ErrorCode m_error;
 
-    unsigned char m_la_buf[10240];
+    std::vector<unsigned char> m_la_buf;
 #ifdef __ANDROID__
     FdFile m_la_file;
     int m_fd;
@@ -32,6 +32,7 @@
 #  include <cerrno>
 #endif
 
+#include "mbcommon/file_util.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/locale.h"
 #include "mbcommon/string.h"
@@ -65,7 +66,8 @@ OdinPatcher::OdinPatcher(PatcherConfig &pc)
     , m_max_bytes(0)
     , m_cancelled(0)
     , m_error()
-    , m_la_buf()
+    // Large enough that libarchive rarely needs to call la_read_cb()
+    , m_la_buf(1024 * 1024)
     , m_la_file()
 #ifdef __ANDROID__
     , m_fd(-1)
@@ -644,9 +646,10 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
 {
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
-    *buffer = p->m_la_buf;
+    *buffer = p->m_la_buf.data();
 
-    auto bytes_read = p->m_la_file.read(p->m_la_buf, sizeof(p->m_la_buf));
+    auto bytes_read = file_read_retry(p->m_la_file, p->m_la_buf.data(),
+                                      p->m_la_buf.size());
     if (!bytes_read) {
         LOGE("%s: Failed to read: %s", p->m_info->input_path().c_str(),
              bytes_read.error().message().c_str());
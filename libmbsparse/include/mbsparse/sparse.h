@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <optional>
 #include <vector>
 
 #include "mbcommon/file.h"
@@ -29,6 +30,30 @@
 namespace mb::sparse
 {
 
+enum class ExtentType : uint8_t
+{
+    // Raw data
+    Data,
+    // Repeated 32-bit value
+    Fill,
+    // Unspecified ("don't care") data
+    Hole,
+};
+
+struct Extent
+{
+    ExtentType type;
+    // Byte range in the output file
+    uint64_t begin;
+    uint64_t end;
+    // [ExtentType::Data only] Offset of the raw data in the source file,
+    // relative to the beginning of the sparse file
+    uint64_t src_offset;
+    // [ExtentType::Fill only] Value that is repeated (in little-endian byte
+    // order) to fill the extent
+    uint32_t fill_val;
+};
+
 class MB_EXPORT SparseFile : public File
 {
 public:
@@ -55,6 +80,14 @@ public:
 
     // File size
     uint64_t size() noexcept;
+    uint32_t block_size() noexcept;
+
+    // Chunk map
+    oc::result<std::optional<Extent>> extent_at(uint64_t offset);
+    oc::result<std::vector<Extent>> extents();
+
+    // Checksum verification
+    oc::result<void> set_verify_crc32(bool verify);
 
 private:
     void clear() noexcept;
@@ -88,9 +121,12 @@ private:
     File *m_file;
     detail::Seekability m_seekability;
 
-    // Expected CRC32 checksum. We currently do *not* validate this. It would
-    // only work if the entire file was read sequentially anyway.
+    // Expected CRC32 checksum from the last CRC32 chunk
     uint32_t m_expected_crc32;
+    // Whether to verify checksums (only possible for sequential reads)
+    bool m_verify_crc32;
+    // CRC32 checksum of the data read so far
+    uint32_t m_crc32;
     // Relative offset in input file
     uint64_t m_cur_src_offset;
     // Absolute offset in output file
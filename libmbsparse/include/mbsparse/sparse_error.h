@@ -42,6 +42,7 @@ enum class SparseFileError
     InvalidFillChunk            = 34,
     InvalidSkipChunk            = 35,
     InvalidCrc32Chunk           = 36,
+    Crc32Mismatch               = 37,
 
     InternalError               = 40,
 };
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include "mbsparse/sparse.h"
+
+namespace mb::sparse
+{
+
+struct OptimizeOptions
+{
+    // Store all-zero blocks as "don't care" chunks instead of fill chunks. This
+    // changes what is flashed: the blocks keep their old contents on
+    // partitions that are not erased beforehand.
+    bool discard_zero_blocks = false;
+    // Append a CRC32 chunk and store the image checksum in the sparse header
+    bool write_crc32 = false;
+};
+
+MB_EXPORT oc::result<void> optimize_sparse_file(SparseFile &input,
+                                                File &output,
+                                                const OptimizeOptions &options
+                                                        = {});
+
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+#include "mbsparse/sparse_p.h"
+
+namespace mb::sparse
+{
+
+class MB_EXPORT SparseWriter : public File
+{
+public:
+    static constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+
+    SparseWriter();
+    SparseWriter(File *file, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~SparseWriter();
+
+    SparseWriter(SparseWriter &&other) noexcept;
+    SparseWriter & operator=(SparseWriter &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseWriter)
+
+    // File open
+    oc::result<void> open(File *file, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+    // Encoder state
+    uint32_t block_size() noexcept;
+    uint32_t chunk_count() noexcept;
+
+    // Encoder options
+    oc::result<void> set_discard_zero_blocks(bool discard);
+    oc::result<void> set_write_crc32(bool write);
+
+private:
+    void clear() noexcept;
+
+    oc::result<void> skip_bytes(uint64_t bytes) noexcept;
+
+    oc::result<void> process_block(const unsigned char *data) noexcept;
+    oc::result<void> add_blocks(uint16_t type, uint32_t fill_val,
+                                const unsigned char *data, uint64_t count)
+        noexcept;
+    oc::result<void> flush_chunk() noexcept;
+
+    void update_crc32_zeros(uint64_t size) noexcept;
+    oc::result<void> write_crc32_chunk() noexcept;
+
+    File *m_file;
+
+    // Offset of the sparse header in the output file
+    uint64_t m_header_offset;
+    uint32_t m_block_size;
+
+    // Partially written block
+    std::vector<unsigned char> m_block;
+    size_t m_block_used;
+
+    // Number of blocks in the output image so far (including the pending
+    // chunk) and number of chunks already written
+    uint64_t m_blocks;
+    uint32_t m_chunks;
+
+    // Pending chunk
+    uint16_t m_chunk_type;
+    uint32_t m_chunk_blocks;
+    uint32_t m_chunk_fill_val;
+    std::vector<unsigned char> m_chunk_data;
+
+    // Whether all-zero blocks are stored as "don't care" chunks
+    bool m_discard_zero_blocks;
+    // Whether to write a CRC32 chunk and image checksum
+    bool m_write_crc32;
+    // CRC32 checksum of the data written so far
+    uint32_t m_crc32;
+};
+
+}
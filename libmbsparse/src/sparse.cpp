@@ -31,6 +31,7 @@
 #include <cstring>
 
 #include "mbcommon/algorithm.h"
+#include "mbcommon/crc32.h"
 #include "mbcommon/endian.h"
 #include "mbcommon/file_error.h"
 #include "mbcommon/file_util.h"
@@ -191,6 +192,8 @@ SparseFile::SparseFile(SparseFile &&other) noexcept
     std::swap(m_file, other.m_file);
     std::swap(m_seekability, other.m_seekability);
     std::swap(m_expected_crc32, other.m_expected_crc32);
+    std::swap(m_verify_crc32, other.m_verify_crc32);
+    std::swap(m_crc32, other.m_crc32);
     std::swap(m_cur_src_offset, other.m_cur_src_offset);
     std::swap(m_cur_tgt_offset, other.m_cur_tgt_offset);
     std::swap(m_file_size, other.m_file_size);
@@ -207,6 +210,8 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
         std::swap(m_file, rhs.m_file);
         std::swap(m_seekability, rhs.m_seekability);
         std::swap(m_expected_crc32, rhs.m_expected_crc32);
+        std::swap(m_verify_crc32, rhs.m_verify_crc32);
+        std::swap(m_crc32, rhs.m_crc32);
         std::swap(m_cur_src_offset, rhs.m_cur_src_offset);
         std::swap(m_cur_tgt_offset, rhs.m_cur_tgt_offset);
         std::swap(m_file_size, rhs.m_file_size);
@@ -323,6 +328,27 @@ oc::result<void> SparseFile::close()
     return oc::success();
 }
 
+/*!
+ * \brief Get the 4-byte pattern of a fill or hole chunk starting at \p offset
+ *
+ * Hole chunks are treated as being filled with zeros.
+ */
+static void fill_pattern(const ChunkInfo &chunk, uint64_t offset,
+                         unsigned char (&pattern)[4]) noexcept
+{
+    static_assert(sizeof(chunk.fill_val) == sizeof(pattern),
+                  "Mismatched fill_val size");
+
+    uint32_t fill_val = chunk.type == CHUNK_TYPE_FILL
+            ? mb_htole32(chunk.fill_val) : 0;
+    auto shift = (offset - chunk.begin) % sizeof(pattern);
+
+    for (size_t i = 0; i < sizeof(pattern); ++i) {
+        pattern[i] = reinterpret_cast<unsigned char *>(&fill_val)
+                [(i + shift) % sizeof(pattern)];
+    }
+}
+
 /*!
  * \brief Read sparse file
  *
@@ -358,6 +384,14 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
 
         if (m_chunk == m_chunks.end()) {
             OPER("Reached EOF");
+
+            if (m_verify_crc32 && m_shdr.image_checksum != 0
+                    && m_crc32 != m_shdr.image_checksum) {
+                DEBUG("Expected image checksum to be %08" PRIx32
+                      ", but have %08" PRIx32, m_shdr.image_checksum, m_crc32);
+                return SparseFileError::Crc32Mismatch;
+            }
+
             break;
         }
 
@@ -379,19 +413,18 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
             OPER("Raw data is %" PRIu64 " bytes into the raw chunk", diff);
 
             uint64_t raw_src_offset = m_chunk->raw_begin + diff;
-            if (raw_src_offset != m_cur_src_offset) {
-                assert(m_seekability == Seekability::CanSeek);
-
-                int64_t seek_offset;
-                if (raw_src_offset < m_cur_src_offset) {
-                    seek_offset = -static_cast<int64_t>(
-                            m_cur_src_offset - raw_src_offset);
-                } else {
-                    seek_offset = static_cast<int64_t>(
-                            raw_src_offset - m_cur_src_offset);
+            if (raw_src_offset > m_cur_src_offset) {
+                OUTCOME_TRYV(skip_bytes(raw_src_offset - m_cur_src_offset));
+            } else if (raw_src_offset < m_cur_src_offset) {
+                // Only possible if chunks past the current position were
+                // processed by extent_at()
+                if (m_seekability != Seekability::CanSeek) {
+                    DEBUG("Raw data is before the current source offset");
+                    return FileError::UnsupportedSeek;
                 }
 
-                OUTCOME_TRYV(wseek(seek_offset));
+                OUTCOME_TRYV(wseek(-static_cast<int64_t>(
+                        m_cur_src_offset - raw_src_offset)));
             }
 
             OUTCOME_TRYV(wread(buf, static_cast<size_t>(to_read)));
@@ -400,15 +433,8 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
             break;
         }
         case CHUNK_TYPE_FILL: {
-            static_assert(sizeof(m_chunk->fill_val) == sizeof(uint32_t),
-                          "Mismatched fill_val size");
-            auto shift = (m_cur_tgt_offset - m_chunk->begin) % sizeof(uint32_t);
-            uint32_t fill_val = mb_htole32(m_chunk->fill_val);
             unsigned char shifted[4];
-            for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-                shifted[i] = reinterpret_cast<unsigned char *>(&fill_val)
-                        [(i + shift) % sizeof(uint32_t)];
-            }
+            fill_pattern(*m_chunk, m_cur_tgt_offset, shifted);
             unsigned char *temp_buf = reinterpret_cast<unsigned char *>(buf);
             while (to_read > 0) {
                 size_t to_write = std::min<size_t>(
@@ -429,6 +455,11 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
         }
 
         OPER("Read %" PRIu64 " bytes", n_read);
+
+        if (m_verify_crc32) {
+            m_crc32 = crc32_update(m_crc32, buf, static_cast<size_t>(n_read));
+        }
+
         total_read += n_read;
         m_cur_tgt_offset += n_read;
         size -= static_cast<size_t>(n_read);
@@ -459,7 +490,13 @@ oc::result<size_t> SparseFile::write(const void *buf, size_t size)
  * \p whence takes the same \a SEEK_SET, \a SEEK_CUR, and \a SEEK_END values as
  * \a lseek() in `\<stdio.h\>`.
  *
- * \note Seeking will only work if the underlying file handle supports seeking.
+ * Seeking forward is always supported. Seeking backwards will only work if the
+ * underlying file handle supports random seeking.
+ *
+ * If checksum verification is enabled, the data between the current position
+ * and the new offset is included in the checksum. Raw data is read, but the
+ * checksums of fill and hole chunks are computed in O(log n) time without
+ * generating the data.
  *
  * \param offset Offset to seek
  * \param whence \a SEEK_SET, \a SEEK_CUR, or \a SEEK_END
@@ -473,11 +510,6 @@ oc::result<uint64_t> SparseFile::seek(int64_t offset, int whence)
 
     OPER("seek(%" PRId64 ", %d)", offset, whence);
 
-    if (m_seekability != Seekability::CanSeek) {
-        DEBUG("Underlying file does not support seeking");
-        return FileError::UnsupportedSeek;
-    }
-
     uint64_t new_offset;
     switch (whence) {
     case SEEK_SET:
@@ -509,6 +541,49 @@ oc::result<uint64_t> SparseFile::seek(int64_t offset, int whence)
         MB_UNREACHABLE("Invalid seek whence: %d", whence);
     }
 
+    if (new_offset < m_cur_tgt_offset
+            && (m_seekability != Seekability::CanSeek || m_verify_crc32)) {
+        DEBUG("Cannot seek backwards");
+        return FileError::UnsupportedSeek;
+    }
+
+    if (m_verify_crc32) {
+        // The skipped data still needs to be included in the checksum
+        unsigned char buf[16384];
+
+        while (m_cur_tgt_offset < new_offset) {
+            OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+            auto end = new_offset;
+            if (m_chunk != m_chunks.end()) {
+                end = std::min(end, m_chunk->end);
+            }
+
+            if (m_chunk != m_chunks.end()
+                    && (m_chunk->type == CHUNK_TYPE_FILL
+                            || m_chunk->type == CHUNK_TYPE_DONT_CARE)) {
+                unsigned char pattern[4];
+                fill_pattern(*m_chunk, m_cur_tgt_offset, pattern);
+
+                auto to_skip = end - m_cur_tgt_offset;
+
+                m_crc32 = crc32_update_repeat(m_crc32, pattern, sizeof(pattern),
+                                              to_skip / sizeof(pattern));
+                m_crc32 = crc32_update(m_crc32, pattern, static_cast<size_t>(
+                        to_skip % sizeof(pattern)));
+                m_cur_tgt_offset = end;
+                continue;
+            }
+
+            // Raw data or EOF, where read() verifies the image checksum
+            OUTCOME_TRY(n, read(buf, static_cast<size_t>(std::min<uint64_t>(
+                    sizeof(buf), end - m_cur_tgt_offset))));
+            if (n == 0) {
+                break;
+            }
+        }
+    }
+
     OUTCOME_TRYV(move_to_chunk(new_offset));
 
     // May move past EOF, which is okay (mimics lseek behavior), but read()
@@ -546,10 +621,158 @@ uint64_t SparseFile::size() noexcept
     return m_file_size;
 }
 
+/*!
+ * \brief Get the block size of the sparse image
+ *
+ * \return Block size. The return value is undefined if the sparse file is not
+ *         opened.
+ */
+uint32_t SparseFile::block_size() noexcept
+{
+    return m_shdr.blk_sz;
+}
+
+static Extent to_extent(const ChunkInfo &chunk) noexcept
+{
+    Extent extent = {};
+    extent.begin = chunk.begin;
+    extent.end = chunk.end;
+
+    switch (chunk.type) {
+    case CHUNK_TYPE_RAW:
+        extent.type = ExtentType::Data;
+        extent.src_offset = chunk.raw_begin;
+        break;
+    case CHUNK_TYPE_FILL:
+        extent.type = ExtentType::Fill;
+        extent.fill_val = chunk.fill_val;
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        extent.type = ExtentType::Hole;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %" PRIu16, chunk.type);
+    }
+
+    return extent;
+}
+
+/*!
+ * \brief Get the extent that contains an offset
+ *
+ * Chunk headers are processed, if needed, until the chunk containing \p offset
+ * is found. This does not change the file position.
+ *
+ * \note If the underlying file does not support random seeking, then the raw
+ *       data before the chunk containing \p offset will no longer be readable.
+ *       For these files, this function should only be called with the current
+ *       file position when reading sequentially.
+ *
+ * \param offset Offset in the output file
+ *
+ * \return
+ *   * The extent if \p offset is within the file
+ *   * std::nullopt if \p offset is at or past EOF
+ *   * FileError::InvalidState if checksum verification is enabled and
+ *     \p offset is past the current file position
+ *   * Otherwise, the error code
+ */
+oc::result<std::optional<Extent>> SparseFile::extent_at(uint64_t offset)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // CRC32 chunks must not be processed before the data they cover is read
+    if (m_verify_crc32 && offset > m_cur_tgt_offset) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(move_to_chunk(offset));
+
+    if (m_chunk == m_chunks.end()) {
+        return std::nullopt;
+    }
+
+    return to_extent(*m_chunk);
+}
+
+/*!
+ * \brief Get all extents in the sparse file
+ *
+ * All chunk headers are processed and returned as a list of contiguous extents
+ * covering the entire output file. Each extent corresponds to one chunk. CRC32
+ * chunks and empty chunks are omitted. This does not change the file position.
+ *
+ * \return
+ *   * List of extents if all chunk headers are successfully processed
+ *   * FileError::UnsupportedSeek if the underlying file does not support random
+ *     seeking
+ *   * FileError::InvalidState if checksum verification is enabled
+ *   * Otherwise, the error code
+ */
+oc::result<std::vector<Extent>> SparseFile::extents()
+{
+    if (!is_open() || m_verify_crc32) return FileError::InvalidState;
+
+    if (m_seekability != Seekability::CanSeek) {
+        DEBUG("Underlying file does not support seeking");
+        return FileError::UnsupportedSeek;
+    }
+
+    // There is no chunk at EOF, so all chunks will be processed
+    OUTCOME_TRYV(move_to_chunk(m_file_size));
+
+    std::vector<Extent> result;
+
+    for (auto const &chunk : m_chunks) {
+        if (chunk.begin != chunk.end) {
+            result.push_back(to_extent(chunk));
+        }
+    }
+
+    return std::move(result);
+}
+
+/*!
+ * \brief Enable or disable CRC32 checksum verification
+ *
+ * When verification is enabled, a CRC32 checksum of the data is computed as it
+ * is read. Fill and "don't care" chunks are included in the checksum (the
+ * latter as zeros). read() will fail with SparseFileError::Crc32Mismatch if:
+ *
+ * * a CRC32 chunk is reached and its value does not match the checksum of the
+ *   data before it
+ * * EOF is reached and the sparse header's image checksum, if non-zero, does
+ *   not match the checksum of the entire file
+ *
+ * Verification is only possible if the file is read sequentially, so seek()
+ * will fail with FileError::UnsupportedSeek if seeking backwards. Seeking
+ * forwards will read the skipped data to update the checksum.
+ *
+ * \pre This must be called after open() and before the first read.
+ *
+ * \param verify Whether to verify checksums
+ *
+ * \return Nothing if verification is successfully enabled or disabled.
+ *         Otherwise, FileError::InvalidState if the file is not open or has
+ *         already been read.
+ */
+oc::result<void> SparseFile::set_verify_crc32(bool verify)
+{
+    if (!is_open() || !m_chunks.empty()) {
+        return FileError::InvalidState;
+    }
+
+    m_verify_crc32 = verify;
+
+    return oc::success();
+}
+
 void SparseFile::clear() noexcept
 {
     m_file = nullptr;
     m_expected_crc32 = 0;
+    m_verify_crc32 = false;
+    m_crc32 = 0;
     m_cur_src_offset = 0;
     m_cur_tgt_offset = 0;
     m_file_size = 0;
@@ -830,17 +1053,27 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidCrc32Chunk;
     }
 
+    uint64_t src_begin = m_cur_src_offset - m_shdr.chunk_hdr_sz;
+
     OUTCOME_TRYV(wread(&crc32, sizeof(crc32)));
 
     m_expected_crc32 = mb_le32toh(crc32);
 
+    // The checksum covers all data before this chunk, which has already been
+    // read if verification is enabled since only sequential reads are allowed
+    if (m_verify_crc32 && m_crc32 != m_expected_crc32) {
+        DEBUG("Expected CRC32 checksum to be %08" PRIx32 ", but have %08" PRIx32,
+              m_expected_crc32, m_crc32);
+        return SparseFileError::Crc32Mismatch;
+    }
+
     ChunkInfo ci;
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
     ci.end = tgt_offset;
-    ci.src_begin = tgt_offset - m_shdr.chunk_hdr_sz;
-    ci.src_end = tgt_offset + data_size;
+    ci.src_begin = src_begin;
+    ci.src_end = m_cur_src_offset;
 
     return std::move(ci);
 }
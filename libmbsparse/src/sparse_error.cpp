@@ -61,6 +61,8 @@ std::string SparseFileErrorCategory::message(int ev) const
         return "invalid 'skip' chunk";
     case SparseFileError::InvalidCrc32Chunk:
         return "invalid 'crc32' chunk";
+    case SparseFileError::Crc32Mismatch:
+        return "CRC32 checksum mismatch";
     case SparseFileError::InternalError:
         return "(internal error)";
     default:
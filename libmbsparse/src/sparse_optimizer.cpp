@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_optimizer.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse_writer.h"
+
+namespace mb::sparse
+{
+
+/*! \brief Size of the buffer used for copying data and fill extents */
+constexpr size_t OPTIMIZE_BUFFER_SIZE = 1024 * 1024;
+
+/*!
+ * \brief Rewrite a sparse image with optimal chunking
+ *
+ * The data in \p input is re-encoded with SparseWriter using the same block
+ * size. As a result:
+ *
+ * * Adjacent raw chunks are merged
+ * * Raw blocks consisting of a single repeated 32-bit word are converted to
+ *   fill chunks
+ * * All-zero blocks are converted to "don't care" chunks (if
+ *   OptimizeOptions::discard_zero_blocks is set)
+ * * "Don't care" chunks are preserved without reading any data and existing
+ *   CRC32 chunks are dropped
+ *
+ * Only sequential reads and forward seeks are performed on \p input, so this
+ * works with unseekable files and with CRC32 verification enabled.
+ *
+ * \pre \p input must be opened and positioned at the beginning of the file.
+ * \pre \p output must be opened and positioned at the location where the sparse
+ *      image should be written. It must support seeking.
+ *
+ * \param input Sparse file to read
+ * \param output File to write the optimized sparse image to
+ * \param options Encoder options
+ *
+ * \return Nothing if the image is successfully rewritten. Otherwise, the error
+ *         code.
+ */
+oc::result<void> optimize_sparse_file(SparseFile &input, File &output,
+                                      const OptimizeOptions &options)
+{
+    SparseWriter writer;
+
+    OUTCOME_TRYV(writer.open(&output, input.block_size()));
+    OUTCOME_TRYV(writer.set_discard_zero_blocks(options.discard_zero_blocks));
+    OUTCOME_TRYV(writer.set_write_crc32(options.write_crc32));
+
+    std::vector<unsigned char> buf(OPTIMIZE_BUFFER_SIZE);
+    uint64_t offset = 0;
+
+    while (true) {
+        OUTCOME_TRY(extent, input.extent_at(offset));
+        if (!extent) {
+            break;
+        }
+
+        switch (extent->type) {
+        case ExtentType::Data:
+            while (offset < extent->end) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(extent->end - offset, buf.size()));
+                OUTCOME_TRYV(file_read_exact(input, buf.data(), n));
+                OUTCOME_TRYV(file_write_exact(writer, buf.data(), n));
+                offset += n;
+            }
+            break;
+
+        case ExtentType::Fill: {
+            // Chunks are a multiple of the block size, so the pattern is
+            // always aligned to the buffer
+            uint32_t fill_val = mb_htole32(extent->fill_val);
+            for (size_t i = 0; i < buf.size(); i += sizeof(fill_val)) {
+                std::memcpy(buf.data() + i, &fill_val, sizeof(fill_val));
+            }
+
+            OUTCOME_TRYV(input.seek(static_cast<int64_t>(extent->end),
+                                    SEEK_SET));
+
+            while (offset < extent->end) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(extent->end - offset, buf.size()));
+                OUTCOME_TRYV(file_write_exact(writer, buf.data(), n));
+                offset += n;
+            }
+            break;
+        }
+
+        case ExtentType::Hole:
+            OUTCOME_TRYV(input.seek(static_cast<int64_t>(extent->end),
+                                    SEEK_SET));
+            OUTCOME_TRYV(writer.seek(static_cast<int64_t>(extent->end),
+                                     SEEK_SET));
+            offset = extent->end;
+            break;
+        }
+    }
+
+    return writer.close();
+}
+
+}
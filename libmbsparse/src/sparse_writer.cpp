@@ -0,0 +1,770 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_writer.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define MB_HAVE_NEON_DETECTOR
+#endif
+
+#include "mbcommon/crc32.h"
+#include "mbcommon/endian.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+namespace mb::sparse
+{
+using namespace detail;
+
+/*!
+ * \brief Maximum number of data bytes in a raw chunk
+ *
+ * Raw blocks are buffered until the chunk is complete because the chunk header,
+ * which precedes the data, contains the number of blocks.
+ */
+constexpr size_t MAX_RAW_CHUNK_SIZE = 4 * 1024 * 1024;
+
+static SparseHeader make_sparse_header(uint32_t blk_sz, uint32_t total_blks,
+                                       uint32_t total_chunks,
+                                       uint32_t image_checksum) noexcept
+{
+    SparseHeader header = {};
+    header.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+    header.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+    header.minor_version = mb_htole16(0);
+    header.file_hdr_sz = mb_htole16(sizeof(SparseHeader));
+    header.chunk_hdr_sz = mb_htole16(sizeof(ChunkHeader));
+    header.blk_sz = mb_htole32(blk_sz);
+    header.total_blks = mb_htole32(total_blks);
+    header.total_chunks = mb_htole32(total_chunks);
+    header.image_checksum = mb_htole32(image_checksum);
+    return header;
+}
+
+/*!
+ * \brief Check if a block consists of a single repeated 32-bit word
+ *
+ * \param[in] data Block data
+ * \param[in] size Block size (must be a non-zero multiple of 4)
+ * \param[out] value Repeated word (in the block's byte order) if the block is
+ *                   uniform
+ *
+ * \return Whether the block is uniform
+ */
+static bool is_uniform_block(const unsigned char *data, size_t size,
+                             uint32_t &value) noexcept
+{
+    uint32_t word;
+    std::memcpy(&word, data, sizeof(word));
+
+    size_t i = 0;
+
+    // Compare 64 bytes at a time. The differences are accumulated so that there
+    // is only one branch per iteration. Data blocks almost always differ within
+    // the first iteration, so this is only costly for uniform blocks, which are
+    // cheap to store.
+#if defined(__SSE2__)
+    const auto pattern = _mm_set1_epi32(static_cast<int>(word));
+    const auto zero = _mm_setzero_si128();
+
+    for (; i + 64 <= size; i += 64) {
+        auto ptr = reinterpret_cast<const __m128i *>(data + i);
+        auto diff = _mm_or_si128(
+                _mm_or_si128(_mm_xor_si128(_mm_loadu_si128(ptr), pattern),
+                             _mm_xor_si128(_mm_loadu_si128(ptr + 1), pattern)),
+                _mm_or_si128(_mm_xor_si128(_mm_loadu_si128(ptr + 2), pattern),
+                             _mm_xor_si128(_mm_loadu_si128(ptr + 3), pattern)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xffff) {
+            return false;
+        }
+    }
+#elif defined(MB_HAVE_NEON_DETECTOR)
+    const auto pattern = vdupq_n_u32(word);
+
+    for (; i + 64 <= size; i += 64) {
+        auto ptr = data + i;
+        auto diff = vorrq_u32(
+                vorrq_u32(veorq_u32(vreinterpretq_u32_u8(vld1q_u8(ptr)),
+                                    pattern),
+                          veorq_u32(vreinterpretq_u32_u8(vld1q_u8(ptr + 16)),
+                                    pattern)),
+                vorrq_u32(veorq_u32(vreinterpretq_u32_u8(vld1q_u8(ptr + 32)),
+                                    pattern),
+                          veorq_u32(vreinterpretq_u32_u8(vld1q_u8(ptr + 48)),
+                                    pattern)));
+        if (vmaxvq_u32(diff) != 0) {
+            return false;
+        }
+    }
+#endif
+
+    for (; i < size; i += sizeof(word)) {
+        uint32_t cur;
+        std::memcpy(&cur, data + i, sizeof(cur));
+        if (cur != word) {
+            return false;
+        }
+    }
+
+    value = word;
+    return true;
+}
+
+/*!
+ * \class SparseWriter
+ *
+ * \brief Write Android sparse file image.
+ *
+ * SparseWriter is a streaming encoder that converts raw data into a sparse
+ * image. Each block of input is classified as it is written:
+ *
+ * * Blocks consisting of a single repeated 32-bit word (including all-zero
+ *   blocks, unless set_discard_zero_blocks() is enabled) are stored as fill
+ *   chunks
+ * * Regions that are skipped over with seek() are stored as "don't care"
+ *   chunks
+ * * All other blocks are stored as raw chunks
+ *
+ * Adjacent blocks of the same kind are merged into a single chunk.
+ */
+
+/*!
+ * \brief Construct unbound SparseWriter.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+SparseWriter::SparseWriter()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open sparse file for writing from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, uint32_t)
+ *
+ * \param file File to open
+ * \param block_size Block size of the sparse image
+ */
+SparseWriter::SparseWriter(File *file, uint32_t block_size)
+    : SparseWriter()
+{
+    (void) open(file, block_size);
+}
+
+SparseWriter::~SparseWriter()
+{
+    (void) close();
+}
+
+SparseWriter::SparseWriter(SparseWriter &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_header_offset, other.m_header_offset);
+    std::swap(m_block_size, other.m_block_size);
+    std::swap(m_block, other.m_block);
+    std::swap(m_block_used, other.m_block_used);
+    std::swap(m_blocks, other.m_blocks);
+    std::swap(m_chunks, other.m_chunks);
+    std::swap(m_chunk_type, other.m_chunk_type);
+    std::swap(m_chunk_blocks, other.m_chunk_blocks);
+    std::swap(m_chunk_fill_val, other.m_chunk_fill_val);
+    std::swap(m_chunk_data, other.m_chunk_data);
+    std::swap(m_discard_zero_blocks, other.m_discard_zero_blocks);
+    std::swap(m_write_crc32, other.m_write_crc32);
+    std::swap(m_crc32, other.m_crc32);
+}
+
+SparseWriter & SparseWriter::operator=(SparseWriter &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_header_offset, rhs.m_header_offset);
+        std::swap(m_block_size, rhs.m_block_size);
+        std::swap(m_block, rhs.m_block);
+        std::swap(m_block_used, rhs.m_block_used);
+        std::swap(m_blocks, rhs.m_blocks);
+        std::swap(m_chunks, rhs.m_chunks);
+        std::swap(m_chunk_type, rhs.m_chunk_type);
+        std::swap(m_chunk_blocks, rhs.m_chunk_blocks);
+        std::swap(m_chunk_fill_val, rhs.m_chunk_fill_val);
+        std::swap(m_chunk_data, rhs.m_chunk_data);
+        std::swap(m_discard_zero_blocks, rhs.m_discard_zero_blocks);
+        std::swap(m_write_crc32, rhs.m_write_crc32);
+        std::swap(m_crc32, rhs.m_crc32);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Open sparse file for writing
+ *
+ * \note The SparseWriter will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * The sparse header is written when the sparse file is closed, so \p file must
+ * support seeking. Other than that, only sequential writes are performed.
+ *
+ * \pre The caller should position the file at the location where the sparse
+ *      file data should begin.
+ *
+ * \param file File to write the sparse image to
+ * \param block_size Block size of the sparse image. Must be a non-zero
+ *                   multiple of 4 and no larger than 4 MiB.
+ *
+ * \return
+ *   * Nothing if the sparse file is successfully opened
+ *   * FileError::ArgumentOutOfRange if \p block_size is invalid
+ *   * Otherwise, the error code
+ */
+oc::result<void> SparseWriter::open(File *file, uint32_t block_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (block_size == 0 || block_size % sizeof(uint32_t) != 0
+            || block_size > MAX_RAW_CHUNK_SIZE) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(header_offset, file->seek(0, SEEK_CUR));
+
+    // Reserve space for the header
+    auto shdr = make_sparse_header(block_size, 0, 0, 0);
+    OUTCOME_TRYV(file_write_exact(*file, &shdr, sizeof(shdr)));
+
+    m_file = file;
+    m_header_offset = header_offset;
+    m_block_size = block_size;
+    m_block.resize(block_size);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish writing the sparse file and close it
+ *
+ * If the amount of data written is not a multiple of the block size, the last
+ * block is padded with zeros. The pending chunk and the final sparse header are
+ * then written to the underlying file.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Nothing if the sparse file is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_block_used > 0) {
+        std::fill(m_block.begin() + static_cast<ptrdiff_t>(m_block_used),
+                  m_block.end(), 0);
+        OUTCOME_TRYV(process_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    OUTCOME_TRYV(flush_chunk());
+
+    if (m_write_crc32) {
+        OUTCOME_TRYV(write_crc32_chunk());
+    }
+
+    OUTCOME_TRY(end_offset, m_file->seek(0, SEEK_CUR));
+
+    auto shdr = make_sparse_header(m_block_size,
+                                   static_cast<uint32_t>(m_blocks), m_chunks,
+                                   m_write_crc32 ? m_crc32 : 0);
+
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(m_header_offset), SEEK_SET));
+    OUTCOME_TRYV(file_write_exact(*m_file, &shdr, sizeof(shdr)));
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(end_offset), SEEK_SET));
+
+    return oc::success();
+}
+
+/*!
+ * \brief Not supported
+ *
+ * \param buf Buffer to read into
+ * \param size Buffer size
+ *
+ * \return FileError::UnsupportedRead
+ */
+oc::result<size_t> SparseWriter::read(void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedRead;
+}
+
+/*!
+ * \brief Write data to sparse file
+ *
+ * Complete blocks are encoded immediately. Any remaining partial block is kept
+ * until more data is written or the file is closed. If an error occurs, then
+ * the sparse image should be considered invalid.
+ *
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return Number of bytes written (always \p size) if the data is successfully
+ *         written. Otherwise, the error code.
+ */
+oc::result<size_t> SparseWriter::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto data = static_cast<const unsigned char *>(buf);
+    auto remain = size;
+
+    if (m_block_used > 0) {
+        auto n = std::min(remain, m_block_size - m_block_used);
+        std::memcpy(m_block.data() + m_block_used, data, n);
+        m_block_used += n;
+        data += n;
+        remain -= n;
+
+        if (m_block_used < m_block_size) {
+            return size;
+        }
+
+        OUTCOME_TRYV(process_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    // Encode directly from the caller's buffer when possible
+    for (; remain >= m_block_size; data += m_block_size,
+            remain -= m_block_size) {
+        OUTCOME_TRYV(process_block(data));
+    }
+
+    std::memcpy(m_block.data(), data, remain);
+    m_block_used = remain;
+
+    return size;
+}
+
+/*!
+ * \brief Seek sparse file
+ *
+ * Only forward seeks are supported. The skipped region is stored as a "don't
+ * care" chunk, except for the parts that share a block with written data, which
+ * are filled with zeros. Because data is never written before the current
+ * position, \a SEEK_END behaves the same as \a SEEK_CUR.
+ *
+ * \param offset Offset to seek
+ * \param whence \a SEEK_SET, \a SEEK_CUR, or \a SEEK_END
+ *
+ * \return
+ *   * New offset if the seeking was successful
+ *   * FileError::UnsupportedSeek if the new offset is before the current
+ *     position
+ *   * Otherwise, the error code
+ */
+oc::result<uint64_t> SparseWriter::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t cur_offset = m_blocks * m_block_size + m_block_used;
+    uint64_t new_offset;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        new_offset = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+    case SEEK_END:
+        if (offset < 0) {
+            return FileError::UnsupportedSeek;
+        } else if (cur_offset > UINT64_MAX - static_cast<uint64_t>(offset)) {
+            return FileError::IntegerOverflow;
+        }
+        new_offset = cur_offset + static_cast<uint64_t>(offset);
+        break;
+    default:
+        MB_UNREACHABLE("Invalid seek whence: %d", whence);
+    }
+
+    if (new_offset < cur_offset) {
+        return FileError::UnsupportedSeek;
+    }
+
+    OUTCOME_TRYV(skip_bytes(new_offset - cur_offset));
+
+    return new_offset;
+}
+
+/*!
+ * \brief Not supported
+ *
+ * \param size New size of file
+ *
+ * \return FileError::UnsupportedTruncate
+ */
+oc::result<void> SparseWriter::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+bool SparseWriter::is_open()
+{
+    return m_file;
+}
+
+/*!
+ * \brief Get the block size of the sparse image
+ *
+ * \return Block size. The return value is undefined if the sparse file is not
+ *         opened.
+ */
+uint32_t SparseWriter::block_size() noexcept
+{
+    return m_block_size;
+}
+
+/*!
+ * \brief Get the number of chunks in the sparse image so far
+ *
+ * \note This includes the pending chunk, which has not been written to the
+ *       underlying file yet.
+ *
+ * \return Number of chunks. The return value is undefined if the sparse file is
+ *         not opened.
+ */
+uint32_t SparseWriter::chunk_count() noexcept
+{
+    return m_chunks + (m_chunk_blocks > 0 ? 1 : 0);
+}
+
+/*!
+ * \brief Store all-zero blocks as "don't care" chunks
+ *
+ * By default, all-zero blocks are stored as fill chunks so that the region is
+ * explicitly zeroed when the image is flashed. If the consumer of the image
+ * does not rely on the contents of unused regions (eg. a filesystem image that
+ * is flashed to a partition that is discarded beforehand), storing them as
+ * "don't care" chunks allows the region to be skipped entirely.
+ *
+ * This can be changed at any time while the sparse file is open and affects
+ * blocks that are completed afterwards.
+ *
+ * \param discard Whether to discard all-zero blocks
+ *
+ * \return Nothing if the option is set. FileError::InvalidState if the sparse
+ *         file is not opened.
+ */
+oc::result<void> SparseWriter::set_discard_zero_blocks(bool discard)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    m_discard_zero_blocks = discard;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write a CRC32 checksum of the image data
+ *
+ * If enabled, a CRC32 chunk covering the entire image is appended when the
+ * sparse file is closed and the checksum is also stored in the sparse header.
+ * "Don't care" regions are included in the checksum as zeros.
+ *
+ * \param write Whether to write the checksum
+ *
+ * \return
+ *   * Nothing if the option is set
+ *   * FileError::InvalidState if the sparse file is not opened or if data has
+ *     already been written
+ */
+oc::result<void> SparseWriter::set_write_crc32(bool write)
+{
+    if (!is_open() || m_blocks > 0 || m_block_used > 0) {
+        return FileError::InvalidState;
+    }
+
+    m_write_crc32 = write;
+
+    return oc::success();
+}
+
+void SparseWriter::clear() noexcept
+{
+    m_file = nullptr;
+    m_header_offset = 0;
+    m_block_size = 0;
+    m_block.clear();
+    m_block_used = 0;
+    m_blocks = 0;
+    m_chunks = 0;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_data.clear();
+    m_discard_zero_blocks = false;
+    m_write_crc32 = false;
+    m_crc32 = 0;
+}
+
+/*!
+ * \brief Skip over a region of the output image
+ *
+ * \param bytes Number of bytes to skip
+ *
+ * \return Nothing if the bytes are successfully skipped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::skip_bytes(uint64_t bytes) noexcept
+{
+    if (bytes == 0) {
+        return oc::success();
+    }
+
+    // Zero-fill the rest of the partial block
+    if (m_block_used > 0) {
+        auto n = static_cast<size_t>(
+                std::min<uint64_t>(bytes, m_block_size - m_block_used));
+        std::memset(m_block.data() + m_block_used, 0, n);
+        m_block_used += n;
+        bytes -= n;
+
+        if (m_block_used < m_block_size) {
+            return oc::success();
+        }
+
+        OUTCOME_TRYV(process_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    auto blocks = bytes / m_block_size;
+
+    if (m_write_crc32) {
+        update_crc32_zeros(blocks * m_block_size);
+    }
+
+    OUTCOME_TRYV(add_blocks(CHUNK_TYPE_DONT_CARE, 0, nullptr, blocks));
+
+    m_block_used = static_cast<size_t>(bytes % m_block_size);
+    std::memset(m_block.data(), 0, m_block_used);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Encode a complete block of data
+ *
+ * \param data Block data (must be `m_block_size` bytes)
+ *
+ * \return Nothing if the block is successfully encoded. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::process_block(const unsigned char *data) noexcept
+{
+    uint32_t word;
+
+    if (m_write_crc32) {
+        m_crc32 = crc32_update(m_crc32, data, m_block_size);
+    }
+
+    if (is_uniform_block(data, m_block_size, word)) {
+        if (word == 0 && m_discard_zero_blocks) {
+            return add_blocks(CHUNK_TYPE_DONT_CARE, 0, nullptr, 1);
+        }
+        return add_blocks(CHUNK_TYPE_FILL, mb_le32toh(word), nullptr, 1);
+    } else {
+        return add_blocks(CHUNK_TYPE_RAW, 0, data, 1);
+    }
+}
+
+/*!
+ * \brief Append blocks to the pending chunk
+ *
+ * If the blocks cannot be merged into the pending chunk, the pending chunk is
+ * written out first.
+ *
+ * \param type Chunk type
+ * \param fill_val [CHUNK_TYPE_FILL only] Filler value for the blocks
+ * \param data [CHUNK_TYPE_RAW only] Block data
+ * \param count Number of blocks (must be 1 for CHUNK_TYPE_RAW)
+ *
+ * \return Nothing if the blocks are successfully added. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::add_blocks(uint16_t type, uint32_t fill_val,
+                                          const unsigned char *data,
+                                          uint64_t count) noexcept
+{
+    if (count > UINT32_MAX - m_blocks) {
+        return FileError::IntegerOverflow;
+    }
+
+    while (count > 0) {
+        if (m_chunk_blocks > 0 && (m_chunk_type != type
+                || (type == CHUNK_TYPE_FILL && m_chunk_fill_val != fill_val)
+                || m_chunk_blocks == UINT32_MAX
+                || (type == CHUNK_TYPE_RAW && m_chunk_data.size()
+                        + m_block_size > MAX_RAW_CHUNK_SIZE))) {
+            OUTCOME_TRYV(flush_chunk());
+        }
+
+        m_chunk_type = type;
+        m_chunk_fill_val = fill_val;
+
+        auto n = static_cast<uint32_t>(
+                std::min<uint64_t>(count, UINT32_MAX - m_chunk_blocks));
+
+        if (type == CHUNK_TYPE_RAW) {
+            m_chunk_data.insert(m_chunk_data.end(), data, data + m_block_size);
+        }
+
+        m_chunk_blocks += n;
+        m_blocks += n;
+        count -= n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write the pending chunk to the underlying file
+ *
+ * \return Nothing if the chunk is successfully written or there is no pending
+ *         chunk. Otherwise, the error code.
+ */
+oc::result<void> SparseWriter::flush_chunk() noexcept
+{
+    if (m_chunk_blocks == 0) {
+        return oc::success();
+    } else if (m_chunks == UINT32_MAX) {
+        return FileError::IntegerOverflow;
+    }
+
+    uint32_t fill_val = mb_htole32(m_chunk_fill_val);
+    const void *payload = nullptr;
+    size_t payload_size = 0;
+
+    switch (m_chunk_type) {
+    case CHUNK_TYPE_RAW:
+        payload = m_chunk_data.data();
+        payload_size = m_chunk_data.size();
+        break;
+    case CHUNK_TYPE_FILL:
+        payload = &fill_val;
+        payload_size = sizeof(fill_val);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        break;
+    default:
+        MB_UNREACHABLE("Invalid chunk type: 0x%04x", m_chunk_type);
+    }
+
+    ChunkHeader chdr = {};
+    chdr.chunk_type = mb_htole16(m_chunk_type);
+    chdr.reserved1 = mb_htole16(0);
+    chdr.chunk_sz = mb_htole32(m_chunk_blocks);
+    chdr.total_sz = mb_htole32(
+            static_cast<uint32_t>(sizeof(chdr) + payload_size));
+
+    OUTCOME_TRYV(file_write_exact(*m_file, &chdr, sizeof(chdr)));
+    if (payload_size > 0) {
+        OUTCOME_TRYV(file_write_exact(*m_file, payload, payload_size));
+    }
+
+    ++m_chunks;
+    m_chunk_blocks = 0;
+    m_chunk_data.clear();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Update the image checksum with zeros
+ *
+ * \param size Number of zero bytes
+ */
+void SparseWriter::update_crc32_zeros(uint64_t size) noexcept
+{
+    static constexpr unsigned char zero = 0;
+
+    m_crc32 = crc32_update_repeat(m_crc32, &zero, 1, size);
+}
+
+/*!
+ * \brief Write a CRC32 chunk containing the checksum of the image so far
+ *
+ * \pre The pending chunk must have been flushed
+ *
+ * \return Nothing if the chunk is successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::write_crc32_chunk() noexcept
+{
+    if (m_chunks == UINT32_MAX) {
+        return FileError::IntegerOverflow;
+    }
+
+    uint32_t crc32 = mb_htole32(m_crc32);
+
+    ChunkHeader chdr = {};
+    chdr.chunk_type = mb_htole16(CHUNK_TYPE_CRC32);
+    chdr.reserved1 = mb_htole16(0);
+    chdr.chunk_sz = mb_htole32(0);
+    chdr.total_sz = mb_htole32(
+            static_cast<uint32_t>(sizeof(chdr) + sizeof(crc32)));
+
+    OUTCOME_TRYV(file_write_exact(*m_file, &chdr, sizeof(chdr)));
+    OUTCOME_TRYV(file_write_exact(*m_file, &crc32, sizeof(crc32)));
+
+    ++m_chunks;
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Throughput benchmarks for SparseFile. This is not run as part of the test
+// suite. Run `mbsparse_bench --help` for the available options.
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/integer.h"
+
+#include "mbsparse/sparse.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions
+{
+    uint64_t size = 256 * 1024 * 1024;
+    uint32_t block_size = 4096;
+    uint32_t max_chunk_blocks = 256;
+    unsigned int raw_weight = 60;
+    unsigned int fill_weight = 20;
+    unsigned int skip_weight = 20;
+    size_t buffer_size = 1024 * 1024;
+    size_t random_read_size = 4096;
+    uint64_t random_reads = 100000;
+    unsigned int iterations = 3;
+    uint32_t seed = 0;
+};
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [option...]\n"
+                    "\n"
+                    "Options:\n"
+                    "  -s, --size <bytes>\n"
+                    "                  Size of the unsparsed image\n"
+                    "  -b, --block-size <bytes>\n"
+                    "                  Block size of the sparse image\n"
+                    "  -c, --max-chunk-blocks <blocks>\n"
+                    "                  Maximum number of blocks per chunk\n"
+                    "  --raw <weight>  Relative frequency of raw chunks\n"
+                    "  --fill <weight> Relative frequency of fill chunks\n"
+                    "  --skip <weight> Relative frequency of \"don't care\""
+                    " chunks\n"
+                    "  --buffer-size <bytes>\n"
+                    "                  Buffer size for sequential reads\n"
+                    "  --random-read-size <bytes>\n"
+                    "                  Size of each random read\n"
+                    "  --random-reads <count>\n"
+                    "                  Number of random reads\n"
+                    "  -n, --iterations <count>\n"
+                    "                  Number of times to run each benchmark\n"
+                    "  --seed <seed>   Random seed for the generated image\n",
+                    prog_name);
+}
+
+static void append(std::string &image, const void *data, size_t size)
+{
+    image.append(static_cast<const char *>(data), size);
+}
+
+static void append_chunk(std::string &image, uint16_t type, uint32_t blocks,
+                         uint32_t data_size)
+{
+    ChunkHeader chdr = {};
+    chdr.chunk_type = mb_htole16(type);
+    chdr.chunk_sz = mb_htole32(blocks);
+    chdr.total_sz = mb_htole32(
+            static_cast<uint32_t>(sizeof(chdr)) + data_size);
+    append(image, &chdr, sizeof(chdr));
+}
+
+/*!
+ * \brief Generate a sparse image with a random mix of chunks
+ *
+ * Chunk types are picked according to the weights in \p options. Adjacent
+ * chunks may have the same type, as is common in images produced by other
+ * tools.
+ */
+static std::string generate_image(const BenchOptions &options)
+{
+    std::mt19937 gen(options.seed);
+    std::discrete_distribution<int> type_dist{
+        static_cast<double>(options.raw_weight),
+        static_cast<double>(options.fill_weight),
+        static_cast<double>(options.skip_weight),
+    };
+    std::uniform_int_distribution<uint32_t> blocks_dist(
+            1, options.max_chunk_blocks);
+
+    uint64_t total_blocks = options.size / options.block_size;
+    uint64_t blocks_left = total_blocks;
+    uint32_t chunks = 0;
+
+    std::string image(sizeof(SparseHeader), '\0');
+    std::vector<uint32_t> words;
+
+    while (blocks_left > 0) {
+        auto blocks = static_cast<uint32_t>(
+                std::min<uint64_t>(blocks_dist(gen), blocks_left));
+
+        switch (type_dist(gen)) {
+        case 0: {
+            auto data_size = blocks * options.block_size;
+            append_chunk(image, CHUNK_TYPE_RAW, blocks, data_size);
+
+            words.resize(data_size / sizeof(uint32_t));
+            for (auto &w : words) {
+                w = static_cast<uint32_t>(gen());
+            }
+            append(image, words.data(), data_size);
+            break;
+        }
+        case 1: {
+            auto fill_val = mb_htole32(static_cast<uint32_t>(gen()));
+            append_chunk(image, CHUNK_TYPE_FILL, blocks, sizeof(fill_val));
+            append(image, &fill_val, sizeof(fill_val));
+            break;
+        }
+        default:
+            append_chunk(image, CHUNK_TYPE_DONT_CARE, blocks, 0);
+            break;
+        }
+
+        blocks_left -= blocks;
+        ++chunks;
+    }
+
+    SparseHeader shdr = {};
+    shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+    shdr.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+    shdr.minor_version = mb_htole16(0);
+    shdr.file_hdr_sz = mb_htole16(sizeof(SparseHeader));
+    shdr.chunk_hdr_sz = mb_htole16(sizeof(ChunkHeader));
+    shdr.blk_sz = mb_htole32(options.block_size);
+    shdr.total_blks = mb_htole32(static_cast<uint32_t>(total_blocks));
+    shdr.total_chunks = mb_htole32(chunks);
+    std::memcpy(image.data(), &shdr, sizeof(shdr));
+
+    printf("Generated image: %" PRIu64 " bytes unsparsed, %zu bytes sparse,"
+           " %" PRIu32 " chunks\n",
+           total_blocks * options.block_size, image.size(), chunks);
+
+    return image;
+}
+
+/*!
+ * \brief Read the entire image sequentially
+ *
+ * \return Number of bytes read
+ */
+static oc::result<uint64_t> bench_sequential(std::string &image,
+                                             const BenchOptions &options)
+{
+    MemoryFile input(image.data(), image.size());
+    SparseFile file;
+    std::vector<unsigned char> buf(options.buffer_size);
+    uint64_t total = 0;
+
+    OUTCOME_TRYV(file.open(&input));
+
+    while (true) {
+        OUTCOME_TRY(n, file_read_retry(file, buf.data(), buf.size()));
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Seek to random offsets and read from each
+ *
+ * \return Number of bytes read
+ */
+static oc::result<uint64_t> bench_random(std::string &image,
+                                         const BenchOptions &options)
+{
+    MemoryFile input(image.data(), image.size());
+    SparseFile file;
+    std::vector<unsigned char> buf(options.random_read_size);
+    std::mt19937_64 gen(options.seed);
+    uint64_t total = 0;
+
+    OUTCOME_TRYV(file.open(&input));
+
+    uint64_t max_offset = file.size() > buf.size() ? file.size() - buf.size() : 0;
+    std::uniform_int_distribution<uint64_t> offset_dist(0, max_offset);
+
+    for (uint64_t i = 0; i < options.random_reads; ++i) {
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset_dist(gen)),
+                               SEEK_SET));
+        OUTCOME_TRY(n, file_read_retry(file, buf.data(), buf.size()));
+        total += n;
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Extract the image to a raw buffer using the chunk map
+ *
+ * This follows the same approach as the updater: data extents are copied, fill
+ * extents are generated, and "don't care" extents are skipped.
+ *
+ * \return Number of bytes in the extracted image
+ */
+static oc::result<uint64_t> bench_extract(std::string &image,
+                                          std::vector<unsigned char> &output)
+{
+    MemoryFile input(image.data(), image.size());
+    SparseFile file;
+
+    OUTCOME_TRYV(file.open(&input));
+
+    output.resize(static_cast<size_t>(file.size()));
+
+    for (uint64_t offset = 0;;) {
+        OUTCOME_TRY(extent, file.extent_at(offset));
+        if (!extent) {
+            break;
+        }
+
+        auto out = output.data() + extent->begin;
+        auto size = static_cast<size_t>(extent->end - extent->begin);
+
+        switch (extent->type) {
+        case ExtentType::Data: {
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(extent->begin),
+                                   SEEK_SET));
+            OUTCOME_TRYV(file_read_exact(file, out, size));
+            break;
+        }
+        case ExtentType::Fill: {
+            auto fill_val = mb_htole32(extent->fill_val);
+            for (size_t i = 0; i < size; i += sizeof(fill_val)) {
+                std::memcpy(out + i, &fill_val, sizeof(fill_val));
+            }
+            break;
+        }
+        case ExtentType::Hole:
+            break;
+        }
+
+        offset = extent->end;
+    }
+
+    return file.size();
+}
+
+template<typename Fn>
+static bool run(const char *name, const BenchOptions &options, Fn &&fn)
+{
+    double best = 0;
+
+    for (unsigned int i = 0; i < options.iterations; ++i) {
+        auto start = Clock::now();
+        auto bytes = fn();
+        auto end = Clock::now();
+
+        if (!bytes) {
+            fprintf(stderr, "%s: %s\n", name, bytes.error().message().c_str());
+            return false;
+        }
+
+        std::chrono::duration<double> elapsed = end - start;
+        double mib_per_sec = static_cast<double>(bytes.value())
+                / (1024.0 * 1024.0) / elapsed.count();
+
+        printf("%-12s run %u: %10.1f MiB/s (%.3f s)\n",
+               name, i + 1, mib_per_sec, elapsed.count());
+
+        best = std::max(best, mib_per_sec);
+    }
+
+    printf("%-12s best:  %10.1f MiB/s\n", name, best);
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions options;
+
+    int opt;
+
+    // Arguments with no short options
+    enum : int
+    {
+        OPT_RAW                  = CHAR_MAX + 1,
+        OPT_FILL                 = CHAR_MAX + 2,
+        OPT_SKIP                 = CHAR_MAX + 3,
+        OPT_BUFFER_SIZE          = CHAR_MAX + 4,
+        OPT_RANDOM_READ_SIZE     = CHAR_MAX + 5,
+        OPT_RANDOM_READS         = CHAR_MAX + 6,
+        OPT_SEED                 = CHAR_MAX + 7,
+    };
+
+    static const char short_options[] = "b:c:hn:s:";
+
+    static struct option long_options[] = {
+        // Arguments with short versions
+        {"block-size",       required_argument, nullptr, 'b'},
+        {"max-chunk-blocks", required_argument, nullptr, 'c'},
+        {"help",             no_argument,       nullptr, 'h'},
+        {"iterations",       required_argument, nullptr, 'n'},
+        {"size",             required_argument, nullptr, 's'},
+        // Arguments without short versions
+        {"raw",              required_argument, nullptr, OPT_RAW},
+        {"fill",             required_argument, nullptr, OPT_FILL},
+        {"skip",             required_argument, nullptr, OPT_SKIP},
+        {"buffer-size",      required_argument, nullptr, OPT_BUFFER_SIZE},
+        {"random-read-size", required_argument, nullptr, OPT_RANDOM_READ_SIZE},
+        {"random-reads",     required_argument, nullptr, OPT_RANDOM_READS},
+        {"seed",             required_argument, nullptr, OPT_SEED},
+        {nullptr,            0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+    bool valid = true;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'b':
+            valid = str_to_num(optarg, 0, options.block_size);
+            break;
+        case 'c':
+            valid = str_to_num(optarg, 0, options.max_chunk_blocks);
+            break;
+        case 'n':
+            valid = str_to_num(optarg, 0, options.iterations);
+            break;
+        case 's':
+            valid = str_to_num(optarg, 0, options.size);
+            break;
+        case OPT_RAW:
+            valid = str_to_num(optarg, 0, options.raw_weight);
+            break;
+        case OPT_FILL:
+            valid = str_to_num(optarg, 0, options.fill_weight);
+            break;
+        case OPT_SKIP:
+            valid = str_to_num(optarg, 0, options.skip_weight);
+            break;
+        case OPT_BUFFER_SIZE:
+            valid = str_to_num(optarg, 0, options.buffer_size);
+            break;
+        case OPT_RANDOM_READ_SIZE:
+            valid = str_to_num(optarg, 0, options.random_read_size);
+            break;
+        case OPT_RANDOM_READS:
+            valid = str_to_num(optarg, 0, options.random_reads);
+            break;
+        case OPT_SEED:
+            valid = str_to_num(optarg, 0, options.seed);
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "Invalid value for %s: %s\n",
+                    argv[optind - 1], optarg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.block_size == 0 || options.block_size % 4 != 0
+            || options.max_chunk_blocks == 0
+            || options.buffer_size == 0 || options.random_read_size == 0
+            || options.raw_weight + options.fill_weight
+                    + options.skip_weight == 0
+            || options.size / options.block_size > UINT32_MAX) {
+        fprintf(stderr, "Invalid benchmark parameters\n");
+        return EXIT_FAILURE;
+    }
+
+    auto image = generate_image(options);
+    std::vector<unsigned char> output;
+
+    if (!run("sequential", options, [&] {
+        return bench_sequential(image, options);
+    }) || !run("random", options, [&] {
+        return bench_random(image, options);
+    }) || !run("extract", options, [&] {
+        return bench_extract(image, output);
+    })) {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -21,6 +21,7 @@
 
 #include "mbsparse/sparse.h"
 
+#include "mbcommon/crc32.h"
 #include "mbcommon/endian.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
@@ -87,7 +88,8 @@ struct SparseTest : testing::Test
         ASSERT_TRUE(_source_file.open(&_data, &_size));
     }
 
-    void build_valid_data(bool oversized)
+    void build_valid_data(bool oversized, uint32_t crc32 = 0,
+                          uint32_t image_checksum = 0)
     {
         SparseHeader shdr = {};
         shdr.magic = SPARSE_HEADER_MAGIC;
@@ -98,7 +100,7 @@ struct SparseTest : testing::Test
         shdr.blk_sz = 4;
         shdr.total_blks = 12;
         shdr.total_chunks = 4;
-        shdr.image_checksum = 0;
+        shdr.image_checksum = image_checksum;
         fix_sparse_header_byte_order(shdr);
 
         ASSERT_TRUE(_source_file.write(&shdr, sizeof(shdr)));
@@ -161,7 +163,8 @@ struct SparseTest : testing::Test
         if (oversized) {
             ASSERT_TRUE(_source_file.write("\xaa\xbb\xcc\xdd", 4));
         }
-        ASSERT_TRUE(_source_file.write("\x00\x00\x00\x00", 4));
+        crc32 = mb_htole32(crc32);
+        ASSERT_TRUE(_source_file.write(&crc32, sizeof(crc32)));
 
         // Move back to beginning of the file
         ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
@@ -729,3 +732,277 @@ TEST_F(SparseTest, ReadValidDataWithUnseekableFile)
 
     ASSERT_TRUE(_file.close());
 }
+
+TEST_F(SparseTest, VerifyCrc32Chunk)
+{
+    char buf[1024];
+    build_valid_data(false, crc32_update(0, expected_valid_data,
+                                         sizeof(expected_valid_data)));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(SparseTest, VerifyCrc32ChunkMismatchFailure)
+{
+    char buf[1024];
+    build_valid_data(false, 0x12345678);
+
+    // Mismatch is ignored unless verification is enabled
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_TRUE(_file.close());
+
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::failure(SparseFileError::Crc32Mismatch));
+}
+
+TEST_F(SparseTest, VerifyImageChecksum)
+{
+    char buf[1024];
+    auto crc32 = crc32_update(0, expected_valid_data,
+                              sizeof(expected_valid_data));
+    build_valid_data(false, crc32, crc32);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(SparseTest, VerifyImageChecksumMismatchFailure)
+{
+    char buf[1024];
+    auto crc32 = crc32_update(0, expected_valid_data,
+                              sizeof(expected_valid_data));
+    build_valid_data(false, crc32, ~crc32);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::failure(SparseFileError::Crc32Mismatch));
+}
+
+TEST_F(SparseTest, VerifyCrc32ChunkInMiddleOfFile)
+{
+    SparseHeader shdr = {};
+    shdr.magic = SPARSE_HEADER_MAGIC;
+    shdr.major_version = SPARSE_HEADER_MAJOR_VER;
+    shdr.file_hdr_sz = sizeof(SparseHeader);
+    shdr.chunk_hdr_sz = sizeof(ChunkHeader);
+    shdr.blk_sz = 4;
+    shdr.total_blks = 2;
+    shdr.total_chunks = 3;
+    fix_sparse_header_byte_order(shdr);
+    ASSERT_TRUE(_source_file.write(&shdr, sizeof(shdr)));
+
+    ChunkHeader chdr = {};
+    chdr.chunk_type = CHUNK_TYPE_RAW;
+    chdr.chunk_sz = 1;
+    chdr.total_sz = sizeof(ChunkHeader) + 4;
+    fix_chunk_header_byte_order(chdr);
+    ASSERT_TRUE(_source_file.write(&chdr, sizeof(chdr)));
+    ASSERT_TRUE(_source_file.write("abcd", 4));
+
+    chdr = {};
+    chdr.chunk_type = CHUNK_TYPE_CRC32;
+    chdr.total_sz = sizeof(ChunkHeader) + 4;
+    fix_chunk_header_byte_order(chdr);
+    uint32_t crc32 = mb_htole32(crc32_update(0, "abcd", 4));
+    ASSERT_TRUE(_source_file.write(&chdr, sizeof(chdr)));
+    ASSERT_TRUE(_source_file.write(&crc32, sizeof(crc32)));
+
+    chdr = {};
+    chdr.chunk_type = CHUNK_TYPE_RAW;
+    chdr.chunk_sz = 1;
+    chdr.total_sz = sizeof(ChunkHeader) + 4;
+    fix_chunk_header_byte_order(chdr);
+    ASSERT_TRUE(_source_file.write(&chdr, sizeof(chdr)));
+    ASSERT_TRUE(_source_file.write("efgh", 4));
+
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+
+    char buf[16];
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(8u));
+    ASSERT_EQ(memcmp(buf, "abcdefgh", 8), 0);
+}
+
+TEST_F(SparseTest, VerifyCrc32RequiresSequentialReads)
+{
+    char buf[8];
+    build_valid_data(false);
+
+    ASSERT_EQ(_file.set_verify_crc32(true),
+              oc::failure(FileError::InvalidState));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+    ASSERT_EQ(_file.set_verify_crc32(false),
+              oc::failure(FileError::InvalidState));
+    ASSERT_EQ(_file.seek(0, SEEK_CUR), oc::success(8u));
+    ASSERT_EQ(_file.seek(0, SEEK_SET),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(SparseTest, VerifyCrc32WithForwardSeek)
+{
+    char buf[1024];
+    build_valid_data(false, crc32_update(0, expected_valid_data,
+                                         sizeof(expected_valid_data)));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+
+    ASSERT_EQ(_file.seek(20, SEEK_SET), oc::success(20u));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data) - 20));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 20,
+                     sizeof(expected_valid_data) - 20), 0);
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(SparseTest, VerifyCrc32WithSeekOverFillAndHole)
+{
+    char buf[1024];
+    auto crc32 = crc32_update(0, expected_valid_data,
+                              sizeof(expected_valid_data));
+    build_valid_data(false, crc32, crc32);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+
+    // Unaligned offsets within the fill and hole chunks
+    ASSERT_EQ(_file.read(buf, 2), oc::success(2u));
+    ASSERT_EQ(_file.seek(18, SEEK_SET), oc::success(18u));
+    ASSERT_EQ(_file.read(buf, 3), oc::success(3u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 18, 3), 0);
+    ASSERT_EQ(_file.seek(35, SEEK_SET), oc::success(35u));
+    ASSERT_EQ(_file.seek(0, SEEK_END),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(0u));
+}
+
+TEST_F(SparseTest, VerifyCrc32WithSeekOverFillAndHoleMismatchFailure)
+{
+    char buf[1024];
+    auto crc32 = crc32_update(0, expected_valid_data,
+                              sizeof(expected_valid_data));
+    build_valid_data(false, crc32, ~crc32);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.set_verify_crc32(true));
+
+    ASSERT_EQ(_file.seek(0, SEEK_END),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::failure(SparseFileError::Crc32Mismatch));
+}
+
+TEST_F(SparseTest, SeekForwardWithUnseekableFile)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    ASSERT_EQ(_file.seek(4, SEEK_SET), oc::success(4u));
+    ASSERT_EQ(_file.read(buf, 4), oc::success(4u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 4, 4), 0);
+
+    ASSERT_EQ(_file.seek(20, SEEK_CUR), oc::success(28u));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(20u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 28, 20), 0);
+
+    ASSERT_EQ(_file.seek(0, SEEK_SET), oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(SparseTest, GetExtents)
+{
+    build_valid_data(true);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto extents = _file.extents();
+    ASSERT_TRUE(extents);
+    ASSERT_EQ(extents.value().size(), 3u);
+
+    ASSERT_EQ(extents.value()[0].type, ExtentType::Data);
+    ASSERT_EQ(extents.value()[0].begin, 0u);
+    ASSERT_EQ(extents.value()[0].end, 16u);
+    // Oversized sparse header (32 bytes) and chunk header (16 bytes)
+    ASSERT_EQ(extents.value()[0].src_offset, 48u);
+    ASSERT_EQ(extents.value()[1].type, ExtentType::Fill);
+    ASSERT_EQ(extents.value()[1].begin, 16u);
+    ASSERT_EQ(extents.value()[1].end, 32u);
+    ASSERT_EQ(extents.value()[1].fill_val, 0x12345678u);
+    ASSERT_EQ(extents.value()[2].type, ExtentType::Hole);
+    ASSERT_EQ(extents.value()[2].begin, 32u);
+    ASSERT_EQ(extents.value()[2].end, 48u);
+
+    // The file position is unchanged
+    char buf[1024];
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+}
+
+TEST_F(SparseTest, GetExtentsWithUnseekableFileFailure)
+{
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanSkip);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    ASSERT_EQ(_file.extents(), oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(SparseTest, ExtractByExtentWithUnseekableFile)
+{
+    char buf[1024];
+    std::vector<ExtentType> types;
+    build_valid_data(true);
+
+    _source_file.set_seekability(Seekability::CanRead);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Read data and skip holes sequentially
+    uint64_t offset = 0;
+    while (true) {
+        auto extent = _file.extent_at(offset);
+        ASSERT_TRUE(extent);
+        if (!extent.value()) {
+            break;
+        }
+
+        types.push_back(extent.value()->type);
+        auto size = static_cast<size_t>(extent.value()->end - offset);
+
+        if (extent.value()->type == ExtentType::Hole) {
+            ASSERT_EQ(_file.seek(static_cast<int64_t>(size), SEEK_CUR),
+                      oc::success(extent.value()->end));
+        } else {
+            ASSERT_EQ(_file.read(buf + offset, size), oc::success(size));
+        }
+
+        offset = extent.value()->end;
+    }
+
+    ASSERT_EQ(types, (std::vector<ExtentType>{
+        ExtentType::Data, ExtentType::Fill, ExtentType::Hole
+    }));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, 32), 0);
+    ASSERT_EQ(offset, sizeof(expected_valid_data));
+}
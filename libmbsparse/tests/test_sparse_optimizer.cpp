@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_optimizer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+struct SparseOptimizerTest : testing::Test
+{
+    std::string _input;
+    void *_data = nullptr;
+    size_t _size = 0;
+
+    virtual ~SparseOptimizerTest()
+    {
+        free(_data);
+    }
+
+    void add_chunk(uint16_t type, uint32_t blocks, const void *payload,
+                   size_t payload_size)
+    {
+        ChunkHeader chdr = {};
+        chdr.chunk_type = mb_htole16(type);
+        chdr.chunk_sz = mb_htole32(blocks);
+        chdr.total_sz = mb_htole32(
+                static_cast<uint32_t>(sizeof(chdr) + payload_size));
+
+        _input.append(reinterpret_cast<const char *>(&chdr), sizeof(chdr));
+        _input.append(static_cast<const char *>(payload), payload_size);
+    }
+
+    // Build a badly chunked image with 8-byte blocks
+    void build_input()
+    {
+        SparseHeader shdr = {};
+        shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+        shdr.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+        shdr.file_hdr_sz = mb_htole16(sizeof(SparseHeader));
+        shdr.chunk_hdr_sz = mb_htole16(sizeof(ChunkHeader));
+        shdr.blk_sz = mb_htole32(8);
+        shdr.total_blks = mb_htole32(10);
+        shdr.total_chunks = mb_htole32(8);
+
+        _input.assign(reinterpret_cast<const char *>(&shdr), sizeof(shdr));
+
+        uint32_t zero = 0;
+        uint32_t crc32 = mb_htole32(0x12345678);
+
+        add_chunk(CHUNK_TYPE_RAW, 1, "abcdefgh", 8);
+        add_chunk(CHUNK_TYPE_RAW, 1, "ijklmnop", 8);
+        add_chunk(CHUNK_TYPE_CRC32, 0, &crc32, sizeof(crc32));
+        add_chunk(CHUNK_TYPE_RAW, 2, "\0\0\0\0\0\0\0\0xxxxxxxx", 16);
+        add_chunk(CHUNK_TYPE_DONT_CARE, 2, nullptr, 0);
+        add_chunk(CHUNK_TYPE_FILL, 1, &zero, sizeof(zero));
+        add_chunk(CHUNK_TYPE_RAW, 2, "qrstuvwx\0\0\0\0\0\0\0\0", 16);
+        add_chunk(CHUNK_TYPE_RAW, 1, "yz012345", 8);
+    }
+
+    // Get the types of the chunks in the output file
+    std::vector<uint16_t> chunk_types()
+    {
+        std::vector<uint16_t> types;
+
+        auto ptr = static_cast<const unsigned char *>(_data);
+        SparseHeader shdr;
+        memcpy(&shdr, ptr, sizeof(shdr));
+
+        size_t offset = sizeof(shdr);
+
+        for (uint32_t i = 0; i < mb_le32toh(shdr.total_chunks); ++i) {
+            ChunkHeader chdr;
+            memcpy(&chdr, ptr + offset, sizeof(chdr));
+
+            types.push_back(mb_le16toh(chdr.chunk_type));
+            offset += mb_le32toh(chdr.total_sz);
+        }
+
+        EXPECT_EQ(offset, _size);
+
+        return types;
+    }
+
+    // Decode a sparse image
+    static std::string decode(void *data, size_t size)
+    {
+        std::string result;
+        MemoryFile input_file(data, size);
+        SparseFile sparse_file;
+
+        EXPECT_TRUE(sparse_file.open(&input_file));
+
+        result.resize(static_cast<size_t>(sparse_file.size()));
+        EXPECT_EQ(sparse_file.read(result.data(), result.size()),
+                  oc::success(result.size()));
+
+        return result;
+    }
+
+    void optimize(const OptimizeOptions &options)
+    {
+        MemoryFile input_file(_input.data(), _input.size());
+        MemoryFile output_file(&_data, &_size);
+        SparseFile sparse_file;
+
+        ASSERT_TRUE(sparse_file.open(&input_file));
+        ASSERT_TRUE(optimize_sparse_file(sparse_file, output_file, options));
+    }
+};
+
+TEST_F(SparseOptimizerTest, MergeAndDiscardZeroBlocks)
+{
+    OptimizeOptions options;
+    options.discard_zero_blocks = true;
+
+    build_input();
+    optimize(options);
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_RAW,
+    }));
+    ASSERT_EQ(decode(_data, _size), decode(_input.data(), _input.size()));
+}
+
+TEST_F(SparseOptimizerTest, KeepZeroBlocksByDefault)
+{
+    build_input();
+    optimize({});
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_RAW,
+    }));
+    ASSERT_EQ(decode(_data, _size), decode(_input.data(), _input.size()));
+}
+
+TEST_F(SparseOptimizerTest, RecomputeCrc32)
+{
+    OptimizeOptions options;
+    options.write_crc32 = true;
+
+    build_input();
+    optimize(options);
+
+    ASSERT_EQ(chunk_types().back(), CHUNK_TYPE_CRC32);
+
+    MemoryFile input_file(_data, _size);
+    SparseFile sparse_file;
+    char buf[128];
+
+    ASSERT_TRUE(sparse_file.open(&input_file));
+    ASSERT_TRUE(sparse_file.set_verify_crc32(true));
+    ASSERT_EQ(sparse_file.read(buf, sizeof(buf)), oc::success(80u));
+    ASSERT_EQ(sparse_file.read(buf, sizeof(buf)), oc::success(0u));
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+struct SparseWriterTest : testing::Test
+{
+    MemoryFile _output_file;
+    SparseWriter _writer;
+    void *_data = nullptr;
+    size_t _size = 0;
+
+    virtual ~SparseWriterTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_output_file.open(&_data, &_size));
+    }
+
+    // Get the types of the chunks in the output file
+    std::vector<uint16_t> chunk_types()
+    {
+        std::vector<uint16_t> types;
+
+        auto ptr = static_cast<const unsigned char *>(_data);
+        SparseHeader shdr;
+        memcpy(&shdr, ptr, sizeof(shdr));
+
+        size_t offset = sizeof(shdr);
+
+        for (uint32_t i = 0; i < mb_le32toh(shdr.total_chunks); ++i) {
+            ChunkHeader chdr;
+            memcpy(&chdr, ptr + offset, sizeof(chdr));
+
+            types.push_back(mb_le16toh(chdr.chunk_type));
+            offset += mb_le32toh(chdr.total_sz);
+        }
+
+        EXPECT_EQ(offset, _size);
+
+        return types;
+    }
+
+    // Decode the output file
+    std::vector<unsigned char> decode()
+    {
+        std::vector<unsigned char> result;
+        MemoryFile input_file(_data, _size);
+        SparseFile sparse_file;
+
+        EXPECT_TRUE(sparse_file.open(&input_file));
+
+        result.resize(static_cast<size_t>(sparse_file.size()));
+        EXPECT_EQ(sparse_file.read(result.data(), result.size()),
+                  oc::success(result.size()));
+
+        return result;
+    }
+};
+
+TEST_F(SparseWriterTest, CheckInvalidStates)
+{
+    ASSERT_EQ(_writer.close(), oc::failure(FileError::InvalidState));
+    ASSERT_EQ(_writer.write("x", 1), oc::failure(FileError::InvalidState));
+    ASSERT_EQ(_writer.seek(0, SEEK_SET), oc::failure(FileError::InvalidState));
+}
+
+TEST_F(SparseWriterTest, CheckUnsupportedReadTruncate)
+{
+    char c;
+    ASSERT_TRUE(_writer.open(&_output_file));
+    ASSERT_EQ(_writer.read(&c, 1), oc::failure(FileError::UnsupportedRead));
+    ASSERT_EQ(_writer.truncate(1), oc::failure(FileError::UnsupportedTruncate));
+}
+
+TEST_F(SparseWriterTest, CheckInvalidBlockSizeFailure)
+{
+    ASSERT_EQ(_writer.open(&_output_file, 0),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_EQ(_writer.open(&_output_file, 6),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_FALSE(_writer.is_open());
+}
+
+TEST_F(SparseWriterTest, CheckBackwardsSeekFailure)
+{
+    ASSERT_TRUE(_writer.open(&_output_file, 4));
+    ASSERT_TRUE(_writer.write("abcdefgh", 8));
+    ASSERT_EQ(_writer.seek(4, SEEK_SET),
+              oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(_writer.seek(-1, SEEK_CUR),
+              oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(_writer.seek(0, SEEK_CUR), oc::success(8u));
+}
+
+TEST_F(SparseWriterTest, WriteEmptyImage)
+{
+    ASSERT_TRUE(_writer.open(&_output_file));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(_size, sizeof(SparseHeader));
+    ASSERT_TRUE(chunk_types().empty());
+    ASSERT_TRUE(decode().empty());
+}
+
+TEST_F(SparseWriterTest, WriteMixedBlocks)
+{
+    std::vector<unsigned char> expected;
+
+    // Raw block
+    for (int i = 0; i < 64; ++i) {
+        expected.push_back(static_cast<unsigned char>(i));
+    }
+    // Zero blocks
+    expected.insert(expected.end(), 128, 0);
+    // Fill block
+    for (int i = 0; i < 16; ++i) {
+        expected.insert(expected.end(), { 0x78, 0x56, 0x34, 0x12 });
+    }
+
+    ASSERT_TRUE(_writer.open(&_output_file, 64));
+    ASSERT_EQ(_writer.block_size(), 64u);
+
+    // Write in pieces that are not aligned to the block size
+    ASSERT_TRUE(_writer.write(expected.data(), 10));
+    ASSERT_TRUE(_writer.write(expected.data() + 10, 100));
+    ASSERT_TRUE(_writer.write(expected.data() + 110, expected.size() - 110));
+
+    // Skip two blocks
+    ASSERT_EQ(_writer.seek(128, SEEK_CUR), oc::success(384u));
+    expected.insert(expected.end(), 128, 0);
+
+    // Partial raw block
+    ASSERT_TRUE(_writer.write("abc", 3));
+    expected.insert(expected.end(), { 'a', 'b', 'c' });
+    expected.insert(expected.end(), 61, 0);
+
+    ASSERT_EQ(_writer.chunk_count(), 4u);
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_RAW,
+    }));
+    ASSERT_EQ(decode(), expected);
+}
+
+TEST_F(SparseWriterTest, SkipWithinPartialBlockFillsZeros)
+{
+    ASSERT_TRUE(_writer.open(&_output_file, 8));
+    ASSERT_TRUE(_writer.write("ab", 2));
+    ASSERT_EQ(_writer.seek(4, SEEK_SET), oc::success(4u));
+    ASSERT_TRUE(_writer.write("cd", 2));
+    ASSERT_EQ(_writer.seek(0, SEEK_END), oc::success(6u));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(chunk_types(), std::vector<uint16_t>{CHUNK_TYPE_RAW});
+    ASSERT_EQ(decode(), (std::vector<unsigned char>{
+        'a', 'b', 0, 0, 'c', 'd', 0, 0
+    }));
+}
+
+TEST_F(SparseWriterTest, LargeRawRegionIsSplit)
+{
+    std::vector<unsigned char> expected(5 * 1024 * 1024);
+    std::mt19937 gen(1234);
+    for (auto &b : expected) {
+        b = static_cast<unsigned char>(gen());
+    }
+
+    ASSERT_TRUE(_writer.open(&_output_file));
+    ASSERT_TRUE(_writer.write(expected.data(), expected.size()));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_RAW,
+    }));
+    ASSERT_EQ(decode(), expected);
+}
+
+TEST_F(SparseWriterTest, WriteAtNonZeroOffset)
+{
+    ASSERT_TRUE(_output_file.write("prefix", 6));
+
+    ASSERT_TRUE(_writer.open(&_output_file, 4));
+    ASSERT_TRUE(_writer.write("\0\0\0\0abcd", 8));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(memcmp(_data, "prefix", 6), 0);
+
+    MemoryFile input_file(_data, _size);
+    SparseFile sparse_file;
+    char buf[16];
+
+    ASSERT_TRUE(input_file.seek(6, SEEK_SET));
+    ASSERT_TRUE(sparse_file.open(&input_file));
+    ASSERT_EQ(sparse_file.read(buf, sizeof(buf)), oc::success(8u));
+    ASSERT_EQ(memcmp(buf, "\0\0\0\0abcd", 8), 0);
+}
+
+TEST_F(SparseWriterTest, DiscardZeroBlocks)
+{
+    ASSERT_TRUE(_writer.open(&_output_file, 8));
+    ASSERT_TRUE(_writer.set_discard_zero_blocks(true));
+    ASSERT_TRUE(_writer.write("abcdefgh\0\0\0\0\0\0\0\0", 16));
+    ASSERT_EQ(_writer.seek(8, SEEK_CUR), oc::success(24u));
+    ASSERT_TRUE(_writer.write("\0\0\0\0\0\0\0\0ijklmnop", 16));
+    ASSERT_TRUE(_writer.close());
+
+    std::vector<unsigned char> expected{
+        'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'
+    };
+    expected.insert(expected.end(), 24, 0);
+    expected.insert(expected.end(), { 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p' });
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_RAW,
+    }));
+    ASSERT_EQ(decode(), expected);
+}
+
+TEST_F(SparseWriterTest, CheckSetWriteCrc32AfterWriteFailure)
+{
+    ASSERT_EQ(_writer.set_write_crc32(true),
+              oc::failure(FileError::InvalidState));
+    ASSERT_TRUE(_writer.open(&_output_file, 8));
+    ASSERT_TRUE(_writer.write("ab", 2));
+    ASSERT_EQ(_writer.set_write_crc32(true),
+              oc::failure(FileError::InvalidState));
+    ASSERT_TRUE(_writer.close());
+}
+
+TEST_F(SparseWriterTest, WriteCrc32)
+{
+    ASSERT_TRUE(_writer.open(&_output_file, 8));
+    ASSERT_TRUE(_writer.set_write_crc32(true));
+    ASSERT_TRUE(_writer.write("abcdefghxxxxxxxx", 16));
+    ASSERT_EQ(_writer.seek(8, SEEK_CUR), oc::success(24u));
+    ASSERT_TRUE(_writer.write("ef", 2));
+    ASSERT_TRUE(_writer.close());
+
+    ASSERT_EQ(chunk_types(), (std::vector<uint16_t>{
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_FILL,
+        CHUNK_TYPE_DONT_CARE,
+        CHUNK_TYPE_RAW,
+        CHUNK_TYPE_CRC32,
+    }));
+
+    // CRC32 of the data, with the skipped region and padding as zeros
+    SparseHeader shdr;
+    memcpy(&shdr, _data, sizeof(shdr));
+    ASSERT_EQ(mb_le32toh(shdr.image_checksum), 0x91faeb57u);
+
+    MemoryFile input_file(_data, _size);
+    SparseFile sparse_file;
+    char buf[64];
+
+    ASSERT_TRUE(sparse_file.open(&input_file));
+    ASSERT_TRUE(sparse_file.set_verify_crc32(true));
+    ASSERT_EQ(sparse_file.read(buf, sizeof(buf)), oc::success(32u));
+    ASSERT_EQ(sparse_file.read(buf, sizeof(buf)), oc::success(0u));
+}
@@ -19,12 +19,17 @@
 
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/hash.h"
+
+#include "mbutil/compress.h"
+
 namespace mb::util
 {
 
@@ -40,29 +45,37 @@ struct ExistsInfo
     bool exists;
 };
 
-enum class CompressionType : uint8_t
-{
-    None,
-    Lz4,
-    Gzip,
-    Xz,
-};
+using TarFilterFn = std::function<bool(archive_entry *entry)>;
+using TarDigestFn = std::function<void(archive_entry *entry,
+                                       const HashDigest &digest)>;
+using TarDataFn = std::function<bool(const void *data, size_t size)>;
+using TarContentFn = std::function<bool(archive *in, archive_entry *entry,
+                                        std::string &content)>;
+using TarExtractFn = std::function<bool(archive *in, archive *out,
+                                        archive_entry *entry)>;
 
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry);
 bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
-                                          archive_entry *entry);
+                                          archive_entry *entry,
+                                          Hasher *hasher = nullptr);
+bool libarchive_read_data_disk(archive *in, archive_entry *entry,
+                               const TarDataFn &data_fn);
 int libarchive_copy_header_and_data(archive *in, archive *out,
                                     archive_entry *entry);
 bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
                             CompressionType compression,
-                            bool is_split);
+                            bool is_split,
+                            const TarExtractFn &extract_fn = nullptr);
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
-                           CompressionType compression,
-                           uint64_t split_archive_size);
+                           const CompressionOptions &compression,
+                           uint64_t split_archive_size,
+                           const TarFilterFn &filter = nullptr,
+                           const TarDigestFn &digest_fn = nullptr,
+                           const TarContentFn &content_fn = nullptr);
 
 bool extract_archive(const std::string &filename, const std::string &target);
 bool extract_files(const std::string &filename, const std::string &target,
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+class StandardFile;
+}
+
+namespace mb::util
+{
+
+//! SHA-256 digest identifying a chunk
+using ChunkDigest = std::array<unsigned char, 32>;
+
+struct ChunkDigestHash
+{
+    size_t operator()(const ChunkDigest &digest) const noexcept;
+};
+
+struct ChunkStoreStats
+{
+    // Chunks (and their uncompressed size) written to the store
+    uint64_t new_chunks = 0;
+    uint64_t new_bytes = 0;
+    // Chunks (and their uncompressed size) that were already present
+    uint64_t dedup_chunks = 0;
+    uint64_t dedup_bytes = 0;
+    // Size of the new chunks after compression
+    uint64_t stored_bytes = 0;
+};
+
+/*!
+ * \brief Content-addressed chunk storage
+ *
+ * Chunks are identified by the SHA-256 digest of their contents and are only
+ * stored once. New chunks are LZ4-compressed (unless incompressible) and
+ * appended to a pack file. When a pack is committed, a sorted index of the
+ * pack's chunks is written next to it. A pack only becomes visible once its
+ * index has been renamed into place, so an interrupted backup leaves behind
+ * at most an unreferenced temporary pack.
+ *
+ * Layout:
+ *
+ *     <store>/packs/<id>.pack
+ *     <store>/packs/<id>.idx
+ *
+ * All member functions are thread-safe.
+ */
+class ChunkStore final
+{
+public:
+    ChunkStore();
+    ~ChunkStore();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ChunkStore)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ChunkStore)
+
+    oc::result<void> open(const std::string &path);
+    oc::result<void> close();
+    bool is_open() const;
+
+    oc::result<ChunkDigest> add(const void *data, size_t size);
+    oc::result<void> read(const ChunkDigest &digest,
+                          std::vector<unsigned char> &data);
+    bool contains(const ChunkDigest &digest) const;
+
+    oc::result<void> commit();
+
+    ChunkStoreStats stats() const;
+
+private:
+    struct Location
+    {
+        // Index into m_packs
+        uint32_t pack;
+        uint32_t stored_size;
+        uint32_t size;
+        uint64_t offset;
+    };
+
+    struct Pack
+    {
+        // Path to the pack file
+        std::string path;
+        // Opened lazily for reading
+        std::unique_ptr<StandardFile> file;
+    };
+
+    oc::result<void> load_index(const std::string &name);
+    oc::result<void> begin_pack();
+    oc::result<void> commit_locked();
+    void discard_pending();
+    oc::result<StandardFile *> pack_file(uint32_t pack);
+
+    mutable std::mutex m_mutex;
+
+    // Path to the store directory
+    std::string m_path;
+    bool m_open;
+
+    // Location of every chunk, including those in the uncommitted pack
+    std::unordered_map<ChunkDigest, Location, ChunkDigestHash> m_index;
+    std::vector<Pack> m_packs;
+
+    // Path of the pack being written (if any). It is the last pack in
+    // m_packs.
+    std::string m_pending_path;
+    uint64_t m_pending_size;
+    // Chunks in the pack being written
+    std::vector<std::pair<ChunkDigest, Location>> m_pending;
+
+    ChunkStoreStats m_stats;
+};
+
+}
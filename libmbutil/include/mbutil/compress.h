@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+enum class CompressionType : uint8_t
+{
+    None,
+    Lz4,
+    Gzip,
+    Xz,
+    Zstd,
+};
+
+struct CompressionOptions
+{
+    CompressionType type = CompressionType::None;
+    // Compression level (format's default if unset)
+    std::optional<int> level;
+    // Number of compression threads. If 0, one per CPU is used, but no more
+    // than 4 and no more than fit in a 256 MiB budget. Each thread needs the
+    // encoder state plus the input and output buffers of two blocks:
+    // - gzip: ~4 MiB
+    // - lz4: ~16 MiB
+    // - xz: ~126 MiB at level 6 (94 MiB encoder) and ~705 MiB at level 9
+    // - zstd: depends on the level and long-distance matching (libzstd
+    //   manages its own buffers)
+    unsigned int threads = 0;
+    // Use long-distance matching (zstd only)
+    bool long_distance = false;
+};
+
+bool compression_supported(CompressionType type);
+std::pair<int, int> compression_level_range(CompressionType type);
+unsigned int compression_threads(const CompressionOptions &options);
+
+namespace detail
+{
+
+struct CompressJob;
+struct CompressFormat;
+struct CompressStream;
+struct DecompressStream;
+
+}
+
+class ParallelCompressor final
+{
+public:
+    using WriteFn = std::function<oc::result<void>(const void *, size_t)>;
+
+    ParallelCompressor(const CompressionOptions &options, WriteFn write_fn);
+    ~ParallelCompressor();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelCompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelCompressor)
+
+    oc::result<void> write(const void *data, size_t size);
+    oc::result<void> finish();
+
+    void set_block_size(size_t size);
+    size_t block_size() const;
+    unsigned int threads() const;
+
+private:
+    oc::result<void> write_impl(const void *data, size_t size);
+    oc::result<void> finish_impl();
+    oc::result<void> write_header_if_needed();
+    oc::result<void> submit_block(bool last);
+    oc::result<void> write_completed(bool wait_all);
+
+    void worker_loop();
+    void stop_workers();
+
+    // Output format (framing and block encoder)
+    std::unique_ptr<detail::CompressFormat> m_format;
+    // Encoder for formats that handle threading internally (zstd)
+    std::unique_ptr<detail::CompressStream> m_stream;
+    // Callback for writing the compressed stream, in order
+    WriteFn m_write_fn;
+    // Uncompressed size of each independently compressed block
+    size_t m_block_size;
+    // Number of worker threads
+    unsigned int m_threads;
+    // Maximum number of blocks being compressed or waiting to be written
+    size_t m_max_in_flight;
+
+    // Block currently being filled by write()
+    std::vector<unsigned char> m_buf;
+    // Whether the stream header has been written
+    bool m_started;
+    // Whether finish() has been called
+    bool m_finished;
+    // First error encountered. The stream is unusable after an error.
+    std::error_code m_error;
+
+    // Blocks in stream order. Owned here; workers only see raw pointers.
+    std::deque<std::unique_ptr<detail::CompressJob>> m_jobs;
+    // Blocks waiting for a worker
+    std::deque<detail::CompressJob *> m_queue;
+    std::mutex m_mutex;
+    // Signalled when a block is queued or the workers should exit
+    std::condition_variable m_queue_cv;
+    // Signalled when a worker finishes a block
+    std::condition_variable m_done_cv;
+    bool m_stop;
+    std::vector<std::thread> m_workers;
+};
+
+class Decompressor final
+{
+public:
+    using ReadFn = std::function<oc::result<size_t>(void *, size_t)>;
+
+    Decompressor(CompressionType type, ReadFn read_fn);
+    ~Decompressor();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Decompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Decompressor)
+
+    oc::result<size_t> read(void *buf, size_t size);
+
+private:
+    // Decoder state
+    std::unique_ptr<detail::DecompressStream> m_stream;
+    // Callback for reading the compressed stream
+    ReadFn m_read_fn;
+    // First error encountered
+    std::error_code m_error;
+};
+
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+/*!
+ * \brief FastCDC content-defined chunking
+ *
+ * Chunk boundaries are chosen by a gear-based rolling hash of the data rather
+ * than by offset, so inserting or removing bytes only changes the chunks
+ * around the modification. Normalized chunking (two masks on either side of
+ * the average size) keeps the chunk size distribution narrow.
+ */
+class FastCdc final
+{
+public:
+    static constexpr size_t DEFAULT_MIN_SIZE = 16 * 1024;
+    static constexpr size_t DEFAULT_AVG_SIZE = 64 * 1024;
+    static constexpr size_t DEFAULT_MAX_SIZE = 256 * 1024;
+
+    FastCdc(size_t min_size = DEFAULT_MIN_SIZE,
+            size_t avg_size = DEFAULT_AVG_SIZE,
+            size_t max_size = DEFAULT_MAX_SIZE);
+
+    size_t min_size() const;
+    size_t avg_size() const;
+    size_t max_size() const;
+
+    size_t cut(const void *data, size_t size) const;
+
+private:
+    size_t m_min_size;
+    size_t m_avg_size;
+    size_t m_max_size;
+    // Stricter mask used before reaching the average size
+    uint64_t m_mask_s;
+    // Looser mask used after reaching the average size
+    uint64_t m_mask_l;
+};
+
+/*!
+ * \brief Split a stream into content-defined chunks
+ *
+ * Data passed to write() is buffered until a chunk boundary is found. Each
+ * chunk is passed to the callback in order. finish() emits the remaining
+ * data as the final chunk.
+ */
+class FastCdcChunker final
+{
+public:
+    using ChunkFn = std::function<oc::result<void>(const void *, size_t)>;
+
+    FastCdcChunker(const FastCdc &cdc, ChunkFn chunk_fn);
+
+    oc::result<void> write(const void *data, size_t size);
+    oc::result<void> finish();
+
+private:
+    oc::result<void> emit_chunks(bool last);
+
+    FastCdc m_cdc;
+    ChunkFn m_chunk_fn;
+    // Data not yet assigned to a chunk
+    std::vector<unsigned char> m_buf;
+    size_t m_buf_size;
+};
+
+}
@@ -22,6 +22,8 @@
 #include <algorithm>
 #include <array>
 #include <memory>
+#include <optional>
+
 #include <cerrno>
 #include <cstring>
 
@@ -84,10 +86,17 @@ int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
 /*!
  * \brief Copy sparse file on disk to an archive
  *
+ * \param in Disk reader
+ * \param out Archive writer
+ * \param entry Entry being copied
+ * \param hasher If not null, the file contents (including holes) are passed to
+ *               this hasher as they are copied
+ *
  * \see tar/write.c from libarchive's source code
  */
 bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
-                                          archive_entry *entry)
+                                          archive_entry *entry,
+                                          Hasher *hasher)
 {
     size_t bytes_read;
     ssize_t bytes_written;
@@ -122,6 +131,15 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
                     return false;
                 }
 
+                if (hasher) {
+                    if (auto r = hasher->update(null_buf, ns); !r) {
+                        LOGE("%s: Failed to update hash: %s",
+                             archive_entry_pathname(entry),
+                             r.error().message().c_str());
+                        return false;
+                    }
+                }
+
                 progress += bytes_written;
                 sparse -= bytes_written;
             }
@@ -139,6 +157,15 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
             return false;
         }
 
+        if (hasher) {
+            if (auto r = hasher->update(buf, bytes_read); !r) {
+                LOGE("%s: Failed to update hash: %s",
+                     archive_entry_pathname(entry),
+                     r.error().message().c_str());
+                return false;
+            }
+        }
+
         progress += bytes_written;
     }
 
@@ -150,6 +177,54 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
     return true;
 }
 
+/*!
+ * \brief Read contents of a (possibly sparse) file on disk
+ *
+ * \param in Disk reader
+ * \param entry Entry being read
+ * \param data_fn Callback for the file contents. Holes, including one at the
+ *                end of the file, are passed as blocks of zeros.
+ *
+ * \return Whether the file was read and \p data_fn succeeded for every block
+ */
+bool libarchive_read_data_disk(archive *in, archive_entry *entry,
+                               const TarDataFn &data_fn)
+{
+    size_t bytes_read;
+    int64_t offset;
+    int64_t progress = 0;
+    static constexpr char null_buf[64 * 1024] = {};
+    const void *buf;
+    int ret;
+
+    auto fill_zeros = [&](int64_t end) {
+        while (progress < end) {
+            auto n = static_cast<size_t>(std::min<int64_t>(
+                    end - progress, sizeof(null_buf)));
+            if (!data_fn(null_buf, n)) {
+                return false;
+            }
+            progress += static_cast<int64_t>(n);
+        }
+        return true;
+    };
+
+    while ((ret = archive_read_data_block(
+            in, &buf, &bytes_read, &offset)) == ARCHIVE_OK) {
+        if (!fill_zeros(offset) || !data_fn(buf, bytes_read)) {
+            return false;
+        }
+        progress += static_cast<int64_t>(bytes_read);
+    }
+
+    if (ret != ARCHIVE_EOF) {
+        LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(in));
+        return false;
+    }
+
+    return fill_zeros(archive_entry_size(entry));
+}
+
 int libarchive_copy_header_and_data(archive *in, archive *out,
                                     archive_entry *entry)
 {
@@ -245,35 +320,88 @@ struct SplitReaderCtx : SplitCtx
     {
     }
 
-    static la_ssize_t la_read_cb(archive *a, void *userdata,
-                                 const void **buffer)
+    oc::result<size_t> read(void *data, size_t size)
     {
-        auto *ctx = static_cast<SplitReaderCtx *>(userdata);
-
         while (true) {
-            if (auto r = ctx->open_if_needed(FileOpenMode::ReadOnly); !r) {
+            if (auto r = open_if_needed(FileOpenMode::ReadOnly); !r) {
                 if (r.error() == std::errc::no_such_file_or_directory) {
                     return 0;
                 } else {
-                    set_archive_error(a, r.error());
-                    return -1;
+                    return r.as_failure();
                 }
             }
 
-            auto n = ctx->file.read(ctx->buf.data(), ctx->buf.size());
-            if (!n) {
-                set_archive_error(a, n.error());
-                return -1;
-            }
+            OUTCOME_TRY(n, file.read(data, size));
 
-            if (n.value() == 0 && ctx->is_split()) {
-                ctx->move_to_next();
+            if (n == 0 && is_split()) {
+                move_to_next();
                 continue;
             }
 
-            *buffer = ctx->buf.data();
-            return static_cast<la_ssize_t>(n.value());
+            return n;
+        }
+    }
+
+    static la_ssize_t la_read_cb(archive *a, void *userdata,
+                                 const void **buffer)
+    {
+        auto *ctx = static_cast<SplitReaderCtx *>(userdata);
+
+        auto n = ctx->read(ctx->buf.data(), ctx->buf.size());
+        if (!n) {
+            set_archive_error(a, n.error());
+            return -1;
         }
+
+        *buffer = ctx->buf.data();
+        return static_cast<la_ssize_t>(n.value());
+    }
+
+    int archive_open(archive *a)
+    {
+        return archive_read_open(a, this, nullptr, &la_read_cb, &la_close_cb);
+    }
+};
+
+/*!
+ * \brief Reader that decompresses data from a SplitReaderCtx for formats that
+ *        libarchive cannot decompress itself
+ */
+struct DecompressingReaderCtx
+{
+    SplitReaderCtx &split;
+    Decompressor decompressor;
+    // Read buffer
+    std::vector<char> buf;
+
+    DecompressingReaderCtx(SplitReaderCtx &split, CompressionType compression)
+        : split(split)
+        , decompressor(compression, [&split](void *data, size_t size) {
+            return split.read(data, size);
+        })
+        , buf(128 * 1024)
+    {
+    }
+
+    static la_ssize_t la_read_cb(archive *a, void *userdata,
+                                 const void **buffer)
+    {
+        auto *ctx = static_cast<DecompressingReaderCtx *>(userdata);
+
+        auto n = ctx->decompressor.read(ctx->buf.data(), ctx->buf.size());
+        if (!n) {
+            SplitCtx::set_archive_error(a, n.error());
+            return -1;
+        }
+
+        *buffer = ctx->buf.data();
+        return static_cast<la_ssize_t>(n.value());
+    }
+
+    static int la_close_cb(archive *a, void *userdata)
+    {
+        auto *ctx = static_cast<DecompressingReaderCtx *>(userdata);
+        return SplitCtx::la_close_cb(a, &ctx->split);
     }
 
     int archive_open(archive *a)
@@ -296,42 +424,43 @@ struct SplitWriterCtx : SplitCtx
     {
     }
 
-    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
-                                  size_t size)
+    oc::result<void> write(const void *data, size_t size)
     {
-        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
-
         const char *ptr = static_cast<const char *>(data);
         size_t remain = size;
 
         while (remain > 0) {
-            if (auto r = ctx->open_if_needed(FileOpenMode::WriteOnly); !r) {
-                set_archive_error(a, r.error());
-                return -1;
-            }
+            OUTCOME_TRYV(open_if_needed(FileOpenMode::WriteOnly));
 
             auto to_write = static_cast<size_t>(std::min<uint64_t>(
                     remain,
-                    ctx->is_split()
-                    ? (ctx->max_size - ctx->bytes_written)
-                    : remain));
-
-            auto n = ctx->file.write(ptr, to_write);
-            if (!n) {
-                set_archive_error(a, n.error());
-                return -1;
-            }
+                    is_split() ? (max_size - bytes_written) : remain));
+
+            OUTCOME_TRY(n, file.write(ptr, to_write));
 
-            ctx->bytes_written += n.value();
-            ptr += n.value();
-            remain -= n.value();
+            bytes_written += n;
+            ptr += n;
+            remain -= n;
 
-            if (ctx->is_split() && ctx->bytes_written == ctx->max_size) {
-                ctx->bytes_written = 0;
-                ctx->move_to_next();
+            if (is_split() && bytes_written == max_size) {
+                bytes_written = 0;
+                move_to_next();
             }
         }
 
+        return oc::success();
+    }
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+
+        if (auto r = ctx->write(data, size); !r) {
+            set_archive_error(a, r.error());
+            return -1;
+        }
+
         return static_cast<la_ssize_t>(size);
     }
 
@@ -341,6 +470,56 @@ struct SplitWriterCtx : SplitCtx
     }
 };
 
+/*!
+ * \brief Writer that compresses the tar stream on multiple threads before
+ *        passing it to a SplitWriterCtx
+ */
+struct ParallelWriterCtx
+{
+    SplitWriterCtx &split;
+    ParallelCompressor compressor;
+
+    ParallelWriterCtx(SplitWriterCtx &split,
+                      const CompressionOptions &compression)
+        : split(split)
+        , compressor(compression, [&split](const void *data, size_t size) {
+            return split.write(data, size);
+        })
+    {
+    }
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<ParallelWriterCtx *>(userdata);
+
+        if (auto r = ctx->compressor.write(data, size); !r) {
+            SplitCtx::set_archive_error(a, r.error());
+            return -1;
+        }
+
+        return static_cast<la_ssize_t>(size);
+    }
+
+    static int la_close_cb(archive *a, void *userdata)
+    {
+        auto *ctx = static_cast<ParallelWriterCtx *>(userdata);
+
+        if (auto r = ctx->compressor.finish(); !r) {
+            SplitCtx::set_archive_error(a, r.error());
+            SplitCtx::la_close_cb(a, &ctx->split);
+            return ARCHIVE_FATAL;
+        }
+
+        return SplitCtx::la_close_cb(a, &ctx->split);
+    }
+
+    int archive_open(archive *a)
+    {
+        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
+    }
+};
+
 /*
  * The following libarchive functions are based on code from bsdtar. The main
  * difference is that they will not try to extract/add as many files as possible
@@ -352,13 +531,19 @@ bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
                             CompressionType compression,
-                            bool is_split)
+                            bool is_split,
+                            const TarExtractFn &extract_fn)
 {
     if (target.empty()) {
         LOGE("%s: Invalid target path for extraction", target.c_str());
         return false;
     }
 
+    // These must outlive the archive reader because freeing it invokes the
+    // close callback
+    SplitReaderCtx ctx(filename, is_split);
+    std::optional<DecompressingReaderCtx> decompress_ctx;
+
     ScopedArchive matcher(archive_match_new(), archive_match_free);
     if (!matcher) {
         LOGE("%s: Out of memory when creating matcher", __FUNCTION__);
@@ -400,6 +585,16 @@ bool libarchive_tar_extract(const std::string &filename,
     case CompressionType::Xz:
         archive_read_support_filter_xz(in.get());
         break;
+    case CompressionType::Zstd:
+        // Decompressed by us since libarchive's zstd filter is only available
+        // when libarchive itself is built against libzstd
+        if (!compression_supported(compression)) {
+            LOGE("%s: Zstandard support is not enabled in this build",
+                 filename.c_str());
+            return false;
+        }
+        decompress_ctx.emplace(ctx, compression);
+        break;
     default:
         LOGE("Invalid compression type");
         return false;
@@ -409,8 +604,8 @@ bool libarchive_tar_extract(const std::string &filename,
     archive_write_disk_set_standard_lookup(out.get());
     archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
 
-    SplitReaderCtx ctx(filename, is_split);
-    if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
+    if ((decompress_ctx ? decompress_ctx->archive_open(in.get())
+            : ctx.archive_open(in.get())) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              filename.c_str(), archive_error_string(in.get()));
         return false;
@@ -450,12 +645,40 @@ bool libarchive_tar_extract(const std::string &filename,
 
         archive_entry_set_pathname(entry, target_path.c_str());
 
+        // Hard link targets are relative to the archive root too
+        const char *hardlink = archive_entry_hardlink(entry);
+        if (hardlink && *hardlink) {
+            target_path = target;
+            if (target_path.back() != '/' && *hardlink != '/') {
+                target_path += '/';
+            }
+            target_path += hardlink;
+
+            archive_entry_set_hardlink(entry, target_path.c_str());
+        }
+
         // Check pattern matches
         if (archive_match_excluded(matcher.get(), entry)) {
             continue;
         }
 
         // Extract file
+        if (extract_fn && archive_entry_filetype(entry) == AE_IFREG
+                && !archive_entry_hardlink(entry)) {
+            if (!extract_fn(in.get(), out.get(), entry)) {
+                return false;
+            }
+
+            ret = archive_write_finish_entry(out.get());
+            if (ret != ARCHIVE_OK) {
+                LOGE("%s: %s", archive_entry_pathname(entry),
+                     archive_error_string(out.get()));
+                return false;
+            }
+
+            continue;
+        }
+
         ret = archive_read_extract2(in.get(), entry, out.get());
         if (ret != ARCHIVE_OK) {
             LOGE("%s: %s", archive_entry_pathname(entry),
@@ -483,20 +706,86 @@ bool libarchive_tar_extract(const std::string &filename,
     return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
 }
 
-static bool write_file(archive *in, archive *out, archive_entry *entry)
+static bool write_replaced_file(archive *in, archive *out,
+                                archive_entry *entry,
+                                const TarContentFn &content_fn)
+{
+    std::string content;
+
+    if (!content_fn(in, entry, content)) {
+        return false;
+    }
+
+    // The replacement content is not sparse
+    archive_entry_sparse_clear(entry);
+    archive_entry_set_size(entry, static_cast<la_int64_t>(content.size()));
+
+    int ret = archive_write_header(out, entry);
+    if (ret != ARCHIVE_OK) {
+        LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
+        return false;
+    }
+
+    auto n = archive_write_data(out, content.data(), content.size());
+    if (n < 0) {
+        LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
+        return false;
+    } else if (static_cast<size_t>(n) != content.size()) {
+        LOGE("%s: Truncated write", archive_entry_pathname(entry));
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_file(archive *in, archive *out, archive_entry *entry,
+                       const TarDigestFn &digest_fn,
+                       const TarContentFn &content_fn)
 {
     int ret;
 
+    if (content_fn && archive_entry_filetype(entry) == AE_IFREG
+            && !archive_entry_hardlink(entry)) {
+        return write_replaced_file(in, out, entry, content_fn);
+    }
+
     ret = archive_write_header(out, entry);
     if (ret != ARCHIVE_OK) {
         LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
         return false;
     }
 
-    if (archive_entry_size(entry) > 0) {
-        return libarchive_copy_data_disk_to_archive(in, out, entry);
+    // Hard links to a file that was already written have no data of their own
+    if (!digest_fn || archive_entry_filetype(entry) != AE_IFREG
+            || archive_entry_hardlink(entry)) {
+        if (archive_entry_size(entry) > 0) {
+            return libarchive_copy_data_disk_to_archive(in, out, entry);
+        }
+        return true;
+    }
+
+    Hasher hasher;
+
+    if (auto r = hasher.init(HashAlgorithm::Sha256); !r) {
+        LOGE("%s: Failed to initialize hasher: %s",
+             archive_entry_pathname(entry), r.error().message().c_str());
+        return false;
+    }
+
+    if (archive_entry_size(entry) > 0
+            && !libarchive_copy_data_disk_to_archive(in, out, entry, &hasher)) {
+        return false;
+    }
+
+    auto digest = hasher.finish();
+    if (!digest) {
+        LOGE("%s: Failed to compute hash: %s",
+             archive_entry_pathname(entry), digest.error().message().c_str());
+        return false;
     }
 
+    digest_fn(entry, digest.value());
+
     return true;
 }
 
@@ -517,20 +806,44 @@ static int metadata_filter(archive *a, void *data, archive_entry *entry)
  * \param filename Target archive path
  * \param base_dir Base directory for \a paths
  * \param paths List of paths to add to the archive
+ * \param compression Compression options. The tar stream is compressed by
+ *                    ParallelCompressor instead of by libarchive's filters.
+ * \param split_archive_size Max size for each split file (0 to disable)
+ * \param filter If not null, this is called for every entry found on disk
+ *               (with the pathname relative to \a base_dir) and the entry is
+ *               only added to the archive if it returns true. Directories are
+ *               traversed regardless of whether they are added.
+ * \param digest_fn If not null, this is called with the SHA-256 digest of the
+ *                  contents of every regular file written to the archive,
+ *                  except for hard links to files that were already written
+ * \param content_fn If not null, this is called for every regular file that
+ *                   is not a hard link to a file that was already written. The
+ *                   file's contents are read from the disk reader by the
+ *                   callback (eg. with libarchive_read_data_disk()) and the
+ *                   returned content is stored in the archive instead.
+ *                   \p digest_fn is not called for these files.
  *
  * \return Whether the archive creation was successful
  */
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
-                           CompressionType compression,
-                           uint64_t split_archive_size)
+                           const CompressionOptions &compression,
+                           uint64_t split_archive_size,
+                           const TarFilterFn &filter,
+                           const TarDigestFn &digest_fn,
+                           const TarContentFn &content_fn)
 {
     if (base_dir.empty() && paths.empty()) {
         LOGE("%s: No base directory or paths specified", filename.c_str());
         return false;
     }
 
+    // These must outlive the archive writer because freeing it invokes the
+    // close callback
+    SplitWriterCtx ctx(filename, split_archive_size);
+    std::optional<ParallelWriterCtx> parallel_ctx;
+
     ScopedArchive in(archive_read_disk_new(), archive_read_free);
     if (!in) {
         LOGE("%s: Out of memory when creating disk reader", __FUNCTION__);
@@ -569,30 +882,34 @@ bool libarchive_tar_create(const std::string &filename,
     archive_write_set_format_pax_restricted(out.get());
     archive_write_set_bytes_per_block(out.get(), 10240);
 
-    switch (compression) {
-    case CompressionType::None:
-        break;
-    case CompressionType::Lz4:
-        archive_write_add_filter_lz4(out.get());
-        break;
-    case CompressionType::Gzip:
-        archive_write_add_filter_gzip(out.get());
-        break;
-    case CompressionType::Xz:
-        archive_write_add_filter_xz(out.get());
-        break;
-    default:
-        LOGE("Invalid compression type");
+    if (!compression_supported(compression.type)) {
+        LOGE("%s: Compression type is not supported in this build",
+             filename.c_str());
         return false;
     }
 
+    if (compression.level) {
+        auto [min_level, max_level] = compression_level_range(compression.type);
+        if (*compression.level < min_level || *compression.level > max_level) {
+            LOGE("%s: Compression level %d is not in range [%d, %d]",
+                 filename.c_str(), *compression.level, min_level, max_level);
+            return false;
+        }
+    }
+
     // Set up link resolver parameters
     archive_entry_linkresolver_set_strategy(resolver.get(),
                                             archive_format(out.get()));
 
     // Open output file
-    SplitWriterCtx ctx(filename, split_archive_size);
-    if (ctx.archive_open(out.get()) != ARCHIVE_OK) {
+    if (compression.type != CompressionType::None) {
+        parallel_ctx.emplace(ctx, compression);
+        LOGD("%s: Compressing with %u threads", filename.c_str(),
+             parallel_ctx->compressor.threads());
+    }
+
+    if ((parallel_ctx ? parallel_ctx->archive_open(out.get())
+            : ctx.archive_open(out.get())) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              filename.c_str(), archive_error_string(out.get()));
         return false;
@@ -671,14 +988,20 @@ bool libarchive_tar_create(const std::string &filename,
                 LOGW("%s: Skipping socket", archive_entry_pathname(entry));
                 continue;
             default:
-                LOGV("%s", archive_entry_pathname(entry));
                 break;
             }
 
+            if (filter && !filter(entry)) {
+                continue;
+            }
+
+            LOGV("%s", archive_entry_pathname(entry));
+
             archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
 
             if (entry) {
-                if (!write_file(in.get(), out.get(), entry)) {
+                if (!write_file(in.get(), out.get(), entry, digest_fn,
+                                content_fn)) {
                     archive_entry_free(entry);
                     return false;
                 }
@@ -686,7 +1009,8 @@ bool libarchive_tar_create(const std::string &filename,
                 entry = nullptr;
             }
             if (sparse_entry) {
-                if (!write_file(in.get(), out.get(), sparse_entry)) {
+                if (!write_file(in.get(), out.get(), sparse_entry,
+                                digest_fn, content_fn)) {
                     archive_entry_free(sparse_entry);
                     return false;
                 }
@@ -730,7 +1054,7 @@ bool libarchive_tar_create(const std::string &filename,
             return false;
         }
 
-        if (!write_file(in.get(), out.get(), entry)) {
+        if (!write_file(in.get(), out.get(), entry, digest_fn, content_fn)) {
             archive_entry_free(entry);
             return false;
         }
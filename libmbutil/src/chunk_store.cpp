@@ -0,0 +1,628 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/chunk_store.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lz4.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/hash.h"
+#include "mbcommon/string.h"
+
+#include "mbutil/directory.h"
+#include "mbutil/string.h"
+
+namespace mb::util
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+static constexpr char PACKS_DIR[] = "/packs";
+static constexpr char PACK_SUFFIX[] = ".pack";
+static constexpr char INDEX_SUFFIX[] = ".idx";
+
+static constexpr char INDEX_MAGIC[8] = {'M', 'B', 'C', 'I', 'D', 'X', '0', '1'};
+// Magic + chunk count
+static constexpr size_t INDEX_HEADER_SIZE = 16;
+// Digest + offset + stored size + size
+static constexpr size_t INDEX_ENTRY_SIZE = 48;
+// SHA-256 of everything before it
+static constexpr size_t INDEX_TRAILER_SIZE = 32;
+
+// Keep packs well below the FAT32 file size limit
+static constexpr uint64_t MAX_PACK_SIZE = 512 * 1024 * 1024;
+
+static std::atomic_uint g_pending_counter{0};
+
+static oc::result<ChunkDigest> sha256(const void *data, size_t size)
+{
+    Hasher hasher;
+    OUTCOME_TRYV(hasher.init(HashAlgorithm::Sha256));
+    OUTCOME_TRYV(hasher.update(data, size));
+    OUTCOME_TRY(result, hasher.finish());
+
+    ChunkDigest digest{};
+    std::copy(result.begin(), result.end(), digest.begin());
+    return digest;
+}
+
+static void put_le32(unsigned char *p, uint32_t value)
+{
+    value = mb_htole32(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static void put_le64(unsigned char *p, uint64_t value)
+{
+    value = mb_htole64(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static uint64_t get_le64(const unsigned char *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return mb_le64toh(value);
+}
+
+static bool ends_with(const std::string &str, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return str.size() > n && str.compare(str.size() - n, n, suffix) == 0;
+}
+
+// Flush a file or directory to storage
+static oc::result<void> sync_path(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fsync(fd) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+size_t ChunkDigestHash::operator()(const ChunkDigest &digest) const noexcept
+{
+    // The digest is already uniformly distributed
+    size_t value;
+    memcpy(&value, digest.data(), sizeof(value));
+    return value;
+}
+
+ChunkStore::ChunkStore()
+    : m_open(false)
+    , m_pending_size(0)
+{
+}
+
+/*!
+ * \brief Destroy the store
+ *
+ * Chunks that were not committed with commit() or close() are discarded.
+ */
+ChunkStore::~ChunkStore()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    discard_pending();
+}
+
+/*!
+ * \brief Open (and create if needed) a chunk store
+ *
+ * \param path Path to store directory
+ *
+ * \return Nothing if the store was successfully opened or an error if the
+ *         directory could not be created or an index could not be loaded
+ */
+oc::result<void> ChunkStore::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (m_open) {
+        return std::errc::invalid_argument;
+    }
+
+    OUTCOME_TRYV(mkdir_recursive(path + PACKS_DIR, 0755));
+
+    ScopedDIR dp(opendir((path + PACKS_DIR).c_str()), closedir);
+    if (!dp) {
+        return ec_from_errno();
+    }
+
+    m_path = path;
+
+    auto fail = finally([&] {
+        if (!m_open) {
+            m_index.clear();
+            m_packs.clear();
+        }
+    });
+
+    std::vector<std::string> names;
+
+    while (auto ent = readdir(dp.get())) {
+        std::string name(ent->d_name);
+        if (ends_with(name, INDEX_SUFFIX)) {
+            names.push_back(name.substr(0, name.size() - strlen(INDEX_SUFFIX)));
+        }
+    }
+
+    // Make pack numbering independent of the directory order
+    std::sort(names.begin(), names.end());
+
+    for (auto const &name : names) {
+        OUTCOME_TRYV(load_index(name));
+    }
+
+    m_stats = {};
+    m_open = true;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Commit pending chunks and close the store
+ */
+oc::result<void> ChunkStore::close()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) {
+        return oc::success();
+    }
+
+    auto ret = commit_locked();
+    if (!ret) {
+        discard_pending();
+    }
+
+    m_index.clear();
+    m_packs.clear();
+    m_open = false;
+
+    return ret;
+}
+
+bool ChunkStore::is_open() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_open;
+}
+
+oc::result<void> ChunkStore::load_index(const std::string &name)
+{
+    auto base = m_path + PACKS_DIR + "/" + name;
+    auto index_path = base + INDEX_SUFFIX;
+    auto pack_path = base + PACK_SUFFIX;
+
+    StandardFile file;
+    OUTCOME_TRYV(file.open(index_path, FileOpenMode::ReadOnly));
+    OUTCOME_TRY(file_size, file.seek(0, SEEK_END));
+    OUTCOME_TRYV(file.seek(0, SEEK_SET));
+
+    if (file_size < INDEX_HEADER_SIZE + INDEX_TRAILER_SIZE
+            || (file_size - INDEX_HEADER_SIZE - INDEX_TRAILER_SIZE)
+                    % INDEX_ENTRY_SIZE != 0) {
+        return std::errc::io_error;
+    }
+
+    std::vector<unsigned char> buf(static_cast<size_t>(file_size));
+    OUTCOME_TRYV(file_read_exact(file, buf.data(), buf.size()));
+
+    size_t body_size = buf.size() - INDEX_TRAILER_SIZE;
+    size_t count = (body_size - INDEX_HEADER_SIZE) / INDEX_ENTRY_SIZE;
+
+    OUTCOME_TRY(checksum, sha256(buf.data(), body_size));
+
+    if (memcmp(buf.data(), INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+            || get_le64(buf.data() + sizeof(INDEX_MAGIC)) != count
+            || memcmp(buf.data() + body_size, checksum.data(),
+                      checksum.size()) != 0) {
+        return std::errc::io_error;
+    }
+
+    struct stat sb;
+    if (stat(pack_path.c_str(), &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (m_packs.size() >= UINT32_MAX) {
+        return std::errc::value_too_large;
+    }
+
+    auto pack = static_cast<uint32_t>(m_packs.size());
+    m_packs.push_back({std::move(pack_path), nullptr});
+
+    for (size_t i = 0; i < count; ++i) {
+        auto p = buf.data() + INDEX_HEADER_SIZE + i * INDEX_ENTRY_SIZE;
+
+        ChunkDigest digest;
+        std::copy_n(p, digest.size(), digest.begin());
+
+        Location loc;
+        loc.pack = pack;
+        loc.offset = get_le64(p + 32);
+        loc.stored_size = get_le32(p + 40);
+        loc.size = get_le32(p + 44);
+
+        if (loc.offset + loc.stored_size > static_cast<uint64_t>(sb.st_size)) {
+            return std::errc::io_error;
+        }
+
+        // Duplicates across packs (eg. from concurrent writers) are harmless
+        m_index.emplace(digest, loc);
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ChunkStore::begin_pack()
+{
+    if (m_packs.size() >= UINT32_MAX) {
+        return std::errc::value_too_large;
+    }
+
+    // Unique among processes and among stores in this process
+    auto path = format("%s%s/tmp-%d-%u%s", m_path.c_str(), PACKS_DIR,
+                       getpid(), g_pending_counter++, PACK_SUFFIX);
+
+    auto file = std::make_unique<StandardFile>();
+    OUTCOME_TRYV(file->open(path, FileOpenMode::ReadWriteTrunc));
+
+    m_packs.push_back({path, std::move(file)});
+    m_pending_path = std::move(path);
+    m_pending_size = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add chunk to the store
+ *
+ * If a chunk with the same contents already exists, nothing is written.
+ *
+ * \param data Chunk data
+ * \param size Size of \p data
+ *
+ * \return Digest of the chunk if it was successfully added. Otherwise, the
+ *         error code.
+ */
+oc::result<ChunkDigest> ChunkStore::add(const void *data, size_t size)
+{
+    if (size > LZ4_MAX_INPUT_SIZE) {
+        return std::errc::invalid_argument;
+    }
+
+    OUTCOME_TRY(digest, sha256(data, size));
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_open) {
+            return std::errc::bad_file_descriptor;
+        } else if (m_index.find(digest) != m_index.end()) {
+            ++m_stats.dedup_chunks;
+            m_stats.dedup_bytes += size;
+            return digest;
+        }
+    }
+
+    // Compress without holding the lock
+    auto in_size = static_cast<int>(size);
+    std::vector<char> compressed(
+            static_cast<size_t>(LZ4_compressBound(in_size)));
+    int out_size = LZ4_compress_default(static_cast<const char *>(data),
+                                        compressed.data(), in_size,
+                                        static_cast<int>(compressed.size()));
+
+    const void *stored = compressed.data();
+    auto stored_size = static_cast<uint32_t>(out_size);
+
+    // Store incompressible chunks as is
+    if (out_size <= 0 || static_cast<size_t>(out_size) >= size) {
+        stored = data;
+        stored_size = static_cast<uint32_t>(size);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) {
+        return std::errc::bad_file_descriptor;
+    } else if (m_index.find(digest) != m_index.end()) {
+        // Added by another thread in the meantime
+        ++m_stats.dedup_chunks;
+        m_stats.dedup_bytes += size;
+        return digest;
+    }
+
+    if (!m_pending_path.empty()
+            && m_pending_size + stored_size > MAX_PACK_SIZE) {
+        OUTCOME_TRYV(commit_locked());
+    }
+    if (m_pending_path.empty()) {
+        OUTCOME_TRYV(begin_pack());
+    }
+
+    Location loc;
+    loc.pack = static_cast<uint32_t>(m_packs.size() - 1);
+    loc.offset = m_pending_size;
+    loc.stored_size = stored_size;
+    loc.size = static_cast<uint32_t>(size);
+
+    // A partially written chunk would corrupt the offsets of later chunks
+    if (auto r = file_write_exact(*m_packs.back().file, stored, stored_size);
+            !r) {
+        discard_pending();
+        return r.as_failure();
+    }
+
+    m_pending_size += stored_size;
+    m_pending.emplace_back(digest, loc);
+    m_index.emplace(digest, loc);
+
+    ++m_stats.new_chunks;
+    m_stats.new_bytes += size;
+    m_stats.stored_bytes += stored_size;
+
+    return digest;
+}
+
+oc::result<StandardFile *> ChunkStore::pack_file(uint32_t pack)
+{
+    auto &p = m_packs[pack];
+
+    if (!p.file) {
+        auto file = std::make_unique<StandardFile>();
+        OUTCOME_TRYV(file->open(p.path, FileOpenMode::ReadOnly));
+        p.file = std::move(file);
+    }
+
+    return p.file.get();
+}
+
+/*!
+ * \brief Read chunk from the store
+ *
+ * The chunk's contents are verified against its digest.
+ *
+ * \param[in] digest Digest of chunk
+ * \param[out] data Buffer to store the chunk's contents
+ *
+ * \return Nothing if the chunk was successfully read. Otherwise, the error
+ *         code. `std::errc::no_such_file_or_directory` is returned if the chunk
+ *         does not exist and `std::errc::io_error` is returned if the chunk
+ *         is corrupt.
+ */
+oc::result<void> ChunkStore::read(const ChunkDigest &digest,
+                                  std::vector<unsigned char> &data)
+{
+    std::vector<char> stored;
+    Location loc;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_open) {
+            return std::errc::bad_file_descriptor;
+        }
+
+        auto it = m_index.find(digest);
+        if (it == m_index.end()) {
+            return std::errc::no_such_file_or_directory;
+        }
+        loc = it->second;
+
+        OUTCOME_TRY(file, pack_file(loc.pack));
+
+        stored.resize(loc.stored_size);
+
+        size_t n = 0;
+        while (n < stored.size()) {
+            OUTCOME_TRY(r, file->read_at(loc.offset + n, stored.data() + n,
+                                         stored.size() - n));
+            if (r == 0) {
+                return std::errc::io_error;
+            }
+            n += r;
+        }
+    }
+
+    data.resize(loc.size);
+
+    if (loc.stored_size == loc.size) {
+        std::copy(stored.begin(), stored.end(), data.begin());
+    } else {
+        int n = LZ4_decompress_safe(stored.data(),
+                                    reinterpret_cast<char *>(data.data()),
+                                    static_cast<int>(stored.size()),
+                                    static_cast<int>(data.size()));
+        if (n < 0 || static_cast<size_t>(n) != data.size()) {
+            return std::errc::io_error;
+        }
+    }
+
+    OUTCOME_TRY(actual, sha256(data.data(), data.size()));
+    if (actual != digest) {
+        return std::errc::io_error;
+    }
+
+    return oc::success();
+}
+
+bool ChunkStore::contains(const ChunkDigest &digest) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index.find(digest) != m_index.end();
+}
+
+/*!
+ * \brief Make all chunks added so far visible to future readers
+ *
+ * The pending pack is named after the digest of its index and the index is
+ * renamed into place last. Both files are synced to storage before they are
+ * renamed and the packs directory is synced afterwards, so after a crash, an
+ * index never refers to a pack that is missing or incomplete.
+ *
+ * If the commit fails, the pending chunks are discarded.
+ */
+oc::result<void> ChunkStore::commit()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) {
+        return std::errc::bad_file_descriptor;
+    }
+
+    return commit_locked();
+}
+
+oc::result<void> ChunkStore::commit_locked()
+{
+    if (m_pending_path.empty()) {
+        return oc::success();
+    }
+
+    std::sort(m_pending.begin(), m_pending.end(),
+              [](auto const &a, auto const &b) { return a.first < b.first; });
+
+    std::vector<unsigned char> buf(INDEX_HEADER_SIZE
+            + m_pending.size() * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE);
+    auto p = buf.data();
+
+    memcpy(p, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put_le64(p + sizeof(INDEX_MAGIC), m_pending.size());
+    p += INDEX_HEADER_SIZE;
+
+    for (auto const &[digest, loc] : m_pending) {
+        std::copy(digest.begin(), digest.end(), p);
+        put_le64(p + 32, loc.offset);
+        put_le32(p + 40, loc.stored_size);
+        put_le32(p + 44, loc.size);
+        p += INDEX_ENTRY_SIZE;
+    }
+
+    OUTCOME_TRY(checksum, sha256(buf.data(), buf.size() - INDEX_TRAILER_SIZE));
+    std::copy(checksum.begin(), checksum.end(), p);
+
+    auto packs_dir = m_path + PACKS_DIR;
+    auto base = packs_dir + "/" + hex_string(checksum.data(), 16);
+    auto pack_path = base + PACK_SUFFIX;
+    auto index_path = base + INDEX_SUFFIX;
+    auto temp_index_path = m_pending_path + ".tmp";
+
+    // The pack can no longer be appended to once it is closed, so any failure
+    // from here on discards the pending chunks
+    auto fail = finally([&] {
+        if (!m_pending_path.empty()) {
+            unlink(temp_index_path.c_str());
+            discard_pending();
+        }
+    });
+
+    // Closing the pack flushes any buffered writes. It is reopened lazily if
+    // chunks are read from it.
+    OUTCOME_TRYV(m_packs.back().file->close());
+    m_packs.back().file.reset();
+    OUTCOME_TRYV(sync_path(m_pending_path));
+
+    {
+        StandardFile file;
+        OUTCOME_TRYV(file.open(temp_index_path, FileOpenMode::WriteOnly));
+        OUTCOME_TRYV(file_write_exact(file, buf.data(), buf.size()));
+        OUTCOME_TRYV(file.close());
+    }
+    OUTCOME_TRYV(sync_path(temp_index_path));
+
+    if (rename(m_pending_path.c_str(), pack_path.c_str()) < 0) {
+        return ec_from_errno();
+    }
+    if (rename(temp_index_path.c_str(), index_path.c_str()) < 0) {
+        auto ec = ec_from_errno();
+        // Don't leave behind a pack that no index refers to
+        unlink(pack_path.c_str());
+        return ec;
+    }
+
+    OUTCOME_TRYV(sync_path(packs_dir));
+
+    m_packs.back().path = std::move(pack_path);
+    m_pending_path.clear();
+    m_pending_size = 0;
+    m_pending.clear();
+
+    return oc::success();
+}
+
+void ChunkStore::discard_pending()
+{
+    if (m_pending_path.empty()) {
+        return;
+    }
+
+    for (auto const &item : m_pending) {
+        m_index.erase(item.first);
+    }
+
+    m_packs.pop_back();
+    unlink(m_pending_path.c_str());
+
+    m_pending_path.clear();
+    m_pending_size = 0;
+    m_pending.clear();
+}
+
+ChunkStoreStats ChunkStore::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+}
@@ -0,0 +1,1251 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/compress.h"
+
+#include <algorithm>
+
+#include <cstdint>
+#include <cstring>
+
+#include <lz4.h>
+#include <lz4frame.h>
+#include <lz4hc.h>
+#include <lzma.h>
+#include <zlib.h>
+#ifdef MBUTIL_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+
+namespace mb::util
+{
+
+namespace detail
+{
+
+//! Block sizes. gzip uses pigz's approach of carrying a 32 KiB dictionary
+//! across blocks, so it can use smaller blocks without losing much ratio.
+constexpr size_t GZIP_BLOCK_SIZE = 1024 * 1024;
+//! Largest block size allowed by the LZ4 frame format
+constexpr size_t LZ4_BLOCK_SIZE = 4 * 1024 * 1024;
+//! Matches the dictionary size of the default xz preset
+constexpr size_t XZ_BLOCK_SIZE = 8 * 1024 * 1024;
+
+constexpr size_t GZIP_DICT_SIZE = 32 * 1024;
+
+//! Default levels (same as libarchive's filters and the command-line tools)
+constexpr int GZIP_DEFAULT_LEVEL = 6;
+constexpr int LZ4_DEFAULT_LEVEL = 1;
+constexpr int XZ_DEFAULT_LEVEL = 6;
+constexpr int ZSTD_DEFAULT_LEVEL = 3;
+
+//! LZ4 levels below this use the fast compressor instead of LZ4HC
+constexpr int LZ4_MIN_HC_LEVEL = 3;
+
+//! Bit set in an LZ4 block size field if the block is stored uncompressed
+constexpr uint32_t LZ4_BLOCK_UNCOMPRESSED = 0x80000000u;
+
+//! Memory the workers may use when the number of threads is chosen
+//! automatically. This leaves room for the rest of the system on phones.
+constexpr uint64_t DEFAULT_THREAD_MEMORY_BUDGET = 256 * 1024 * 1024;
+//! Upper bound for the automatically chosen number of threads
+constexpr unsigned int DEFAULT_MAX_THREADS = 4;
+
+struct CompressJob
+{
+    // Uncompressed data
+    std::vector<unsigned char> input;
+    // Data preceding this block (for formats that carry a dictionary)
+    std::vector<unsigned char> dict;
+    // Whether this is the final block of the stream
+    bool last = false;
+
+    // Compressed block, ready to be written
+    std::vector<unsigned char> output;
+    // CRC32 of the uncompressed data (gzip only)
+    uint32_t crc32 = 0;
+    // Size of the xz block without padding (xz only)
+    uint64_t unpadded_size = 0;
+
+    std::error_code ec;
+    bool done = false;
+};
+
+static inline void write_le32(unsigned char *p, uint32_t value)
+{
+    p[0] = static_cast<unsigned char>(value);
+    p[1] = static_cast<unsigned char>(value >> 8);
+    p[2] = static_cast<unsigned char>(value >> 16);
+    p[3] = static_cast<unsigned char>(value >> 24);
+}
+
+/*!
+ * \brief Per-thread block encoder
+ *
+ * Each worker thread owns one encoder so codec state (hash tables, match
+ * finders) is allocated once per thread instead of once per block.
+ */
+struct BlockEncoder
+{
+    virtual ~BlockEncoder() = default;
+
+    virtual oc::result<void> encode(CompressJob &job) = 0;
+};
+
+/*!
+ * \brief Container framing for a stream of independently compressed blocks
+ *
+ * All functions except new_encoder() are called from the thread that owns the
+ * ParallelCompressor, with blocks passed to block_written() in stream order.
+ */
+struct CompressFormat
+{
+    virtual ~CompressFormat() = default;
+
+    virtual size_t block_size() const = 0;
+    virtual size_t max_block_size() const
+    {
+        return SIZE_MAX;
+    }
+
+    virtual oc::result<void> header(std::vector<unsigned char> &out) = 0;
+    virtual void prepare(CompressJob &job) { (void) job; }
+    virtual oc::result<std::unique_ptr<BlockEncoder>> new_encoder() const = 0;
+    virtual oc::result<void> block_written(const CompressJob &job)
+    {
+        (void) job;
+        return oc::success();
+    }
+    virtual oc::result<void> trailer(std::vector<unsigned char> &out) = 0;
+};
+
+// gzip: a single member made up of raw deflate blocks that each end on a byte
+// boundary (Z_SYNC_FLUSH). This is the same layout pigz produces.
+
+struct GzipEncoder : BlockEncoder
+{
+    int level;
+    z_stream strm = {};
+
+    explicit GzipEncoder(int level_) : level(level_)
+    {
+    }
+
+    ~GzipEncoder() override
+    {
+        deflateEnd(&strm);
+    }
+
+    oc::result<void> init()
+    {
+        switch (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                             Z_DEFAULT_STRATEGY)) {
+        case Z_OK:
+            return oc::success();
+        case Z_MEM_ERROR:
+            return std::errc::not_enough_memory;
+        default:
+            return std::errc::io_error;
+        }
+    }
+
+    oc::result<void> encode(CompressJob &job) override
+    {
+        if (deflateReset(&strm) != Z_OK) {
+            return std::errc::io_error;
+        }
+
+        if (!job.dict.empty() && deflateSetDictionary(
+                &strm, job.dict.data(),
+                static_cast<uInt>(job.dict.size())) != Z_OK) {
+            return std::errc::io_error;
+        }
+
+        job.crc32 = static_cast<uint32_t>(crc32(
+                0, job.input.data(), static_cast<uInt>(job.input.size())));
+
+        // Leave room for the sync flush marker
+        job.output.resize(deflateBound(&strm, job.input.size()) + 16);
+
+        strm.next_in = job.input.data();
+        strm.avail_in = static_cast<uInt>(job.input.size());
+
+        size_t out_pos = 0;
+        const int flush = job.last ? Z_FINISH : Z_SYNC_FLUSH;
+
+        while (true) {
+            if (out_pos == job.output.size()) {
+                job.output.resize(job.output.size() * 2);
+            }
+
+            strm.next_out = job.output.data() + out_pos;
+            strm.avail_out = static_cast<uInt>(job.output.size() - out_pos);
+
+            int ret = deflate(&strm, flush);
+
+            out_pos = job.output.size() - strm.avail_out;
+
+            if (ret == Z_STREAM_END
+                    || (ret == Z_OK && flush == Z_SYNC_FLUSH
+                            && strm.avail_in == 0 && strm.avail_out > 0)) {
+                break;
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                return std::errc::io_error;
+            }
+        }
+
+        job.output.resize(out_pos);
+
+        return oc::success();
+    }
+};
+
+struct GzipFormat : CompressFormat
+{
+    int level;
+    // Last GZIP_DICT_SIZE bytes of the previous block
+    std::vector<unsigned char> tail;
+    // Running CRC32 and size of the uncompressed stream
+    uint32_t crc = 0;
+    uint64_t size = 0;
+
+    size_t block_size() const override
+    {
+        return GZIP_BLOCK_SIZE;
+    }
+
+    oc::result<void> header(std::vector<unsigned char> &out) override
+    {
+        // No file name or timestamp, OS = Unix
+        out.assign({ 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00,
+                     0x00, 0x03 });
+        return oc::success();
+    }
+
+    void prepare(CompressJob &job) override
+    {
+        job.dict = std::move(tail);
+
+        auto n = std::min(job.input.size(), GZIP_DICT_SIZE);
+        tail.assign(job.input.end() - static_cast<ptrdiff_t>(n),
+                    job.input.end());
+    }
+
+    oc::result<std::unique_ptr<BlockEncoder>> new_encoder() const override
+    {
+        auto encoder = std::make_unique<GzipEncoder>(level);
+        OUTCOME_TRYV(encoder->init());
+        return std::move(encoder);
+    }
+
+    oc::result<void> block_written(const CompressJob &job) override
+    {
+        crc = static_cast<uint32_t>(crc32_combine(
+                crc, job.crc32, static_cast<z_off_t>(job.input.size())));
+        size += job.input.size();
+        return oc::success();
+    }
+
+    oc::result<void> trailer(std::vector<unsigned char> &out) override
+    {
+        out.resize(8);
+        write_le32(out.data(), crc);
+        write_le32(out.data() + 4, static_cast<uint32_t>(size));
+        return oc::success();
+    }
+};
+
+// lz4: a single frame with independent blocks. Blocks that don't compress are
+// stored as-is, as the frame format allows.
+
+struct Lz4Encoder : BlockEncoder
+{
+    int level;
+
+    explicit Lz4Encoder(int level_) : level(level_)
+    {
+    }
+
+    oc::result<void> encode(CompressJob &job) override
+    {
+        if (job.input.empty()) {
+            // A zero-sized block would be read as the end mark
+            job.output.clear();
+            return oc::success();
+        }
+
+        auto in_size = static_cast<int>(job.input.size());
+        int bound = LZ4_compressBound(in_size);
+
+        job.output.resize(4 + static_cast<size_t>(bound));
+
+        auto src = reinterpret_cast<const char *>(job.input.data());
+        auto dst = reinterpret_cast<char *>(job.output.data() + 4);
+
+        int n = level >= LZ4_MIN_HC_LEVEL
+                ? LZ4_compress_HC(src, dst, in_size, bound, level)
+                : LZ4_compress_default(src, dst, in_size, bound);
+
+        if (n > 0 && n < in_size) {
+            write_le32(job.output.data(), static_cast<uint32_t>(n));
+            job.output.resize(4 + static_cast<size_t>(n));
+        } else {
+            write_le32(job.output.data(), static_cast<uint32_t>(in_size)
+                    | LZ4_BLOCK_UNCOMPRESSED);
+            memcpy(job.output.data() + 4, job.input.data(), job.input.size());
+            job.output.resize(4 + job.input.size());
+        }
+
+        return oc::success();
+    }
+};
+
+struct Lz4Format : CompressFormat
+{
+    int level;
+    size_t block_size() const override
+    {
+        return LZ4_BLOCK_SIZE;
+    }
+
+    size_t max_block_size() const override
+    {
+        return LZ4_BLOCK_SIZE;
+    }
+
+    oc::result<void> header(std::vector<unsigned char> &out) override
+    {
+        LZ4F_compressionContext_t cctx;
+        if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+            return std::errc::not_enough_memory;
+        }
+
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+        prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+        prefs.compressionLevel = level;
+
+        out.resize(LZ4F_HEADER_SIZE_MAX);
+
+        size_t n = LZ4F_compressBegin(cctx, out.data(), out.size(), &prefs);
+        LZ4F_freeCompressionContext(cctx);
+
+        if (LZ4F_isError(n)) {
+            return std::errc::io_error;
+        }
+
+        out.resize(n);
+        return oc::success();
+    }
+
+    oc::result<std::unique_ptr<BlockEncoder>> new_encoder() const override
+    {
+        return std::make_unique<Lz4Encoder>(level);
+    }
+
+    oc::result<void> trailer(std::vector<unsigned char> &out) override
+    {
+        // End mark
+        out.assign(4, 0);
+        return oc::success();
+    }
+};
+
+// xz: a single stream with one block per job and an index built from the
+// block sizes, as xz -T produces.
+
+static std::error_code lzma_error(lzma_ret ret)
+{
+    switch (ret) {
+    case LZMA_MEM_ERROR:
+        return std::make_error_code(std::errc::not_enough_memory);
+    case LZMA_OPTIONS_ERROR:
+    case LZMA_PROG_ERROR:
+        return std::make_error_code(std::errc::invalid_argument);
+    default:
+        return std::make_error_code(std::errc::io_error);
+    }
+}
+
+struct XzEncoder : BlockEncoder
+{
+    lzma_options_lzma options;
+    lzma_filter filters[2];
+    lzma_stream strm = LZMA_STREAM_INIT;
+
+    explicit XzEncoder(int level)
+    {
+        lzma_lzma_preset(&options, static_cast<uint32_t>(level));
+
+        filters[0].id = LZMA_FILTER_LZMA2;
+        filters[0].options = &options;
+        filters[1].id = LZMA_VLI_UNKNOWN;
+        filters[1].options = nullptr;
+    }
+
+    ~XzEncoder() override
+    {
+        lzma_end(&strm);
+    }
+
+    oc::result<void> encode(CompressJob &job) override
+    {
+        if (job.input.empty()) {
+            job.output.clear();
+            return oc::success();
+        }
+
+        lzma_block block = {};
+        block.version = 0;
+        block.check = LZMA_CHECK_CRC64;
+        block.filters = filters;
+        block.compressed_size = LZMA_VLI_UNKNOWN;
+        block.uncompressed_size = LZMA_VLI_UNKNOWN;
+
+        if (auto ret = lzma_block_header_size(&block); ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        job.output.resize(block.header_size
+                + lzma_block_buffer_bound(job.input.size()));
+
+        if (auto ret = lzma_block_header_encode(&block, job.output.data());
+                ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        // Reinitializing the same lzma_stream reuses the encoder's buffers
+        if (auto ret = lzma_block_encoder(&strm, &block); ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        strm.next_in = job.input.data();
+        strm.avail_in = job.input.size();
+        strm.next_out = job.output.data() + block.header_size;
+        strm.avail_out = job.output.size() - block.header_size;
+
+        lzma_ret ret;
+        do {
+            ret = lzma_code(&strm, LZMA_FINISH);
+        } while (ret == LZMA_OK && strm.avail_out > 0);
+
+        if (ret != LZMA_STREAM_END) {
+            return lzma_error(ret == LZMA_OK ? LZMA_BUF_ERROR : ret);
+        }
+
+        job.output.resize(job.output.size() - strm.avail_out);
+        job.unpadded_size = lzma_block_unpadded_size(&block);
+
+        return oc::success();
+    }
+};
+
+struct XzFormat : CompressFormat
+{
+    int level;
+    lzma_index *index = nullptr;
+
+    ~XzFormat() override
+    {
+        lzma_index_end(index, nullptr);
+    }
+
+    size_t block_size() const override
+    {
+        return XZ_BLOCK_SIZE;
+    }
+
+    static lzma_stream_flags stream_flags()
+    {
+        lzma_stream_flags flags = {};
+        flags.version = 0;
+        flags.check = LZMA_CHECK_CRC64;
+        return flags;
+    }
+
+    oc::result<void> header(std::vector<unsigned char> &out) override
+    {
+        index = lzma_index_init(nullptr);
+        if (!index) {
+            return std::errc::not_enough_memory;
+        }
+
+        auto flags = stream_flags();
+
+        out.resize(LZMA_STREAM_HEADER_SIZE);
+
+        if (auto ret = lzma_stream_header_encode(&flags, out.data());
+                ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        return oc::success();
+    }
+
+    oc::result<std::unique_ptr<BlockEncoder>> new_encoder() const override
+    {
+        return std::make_unique<XzEncoder>(level);
+    }
+
+    oc::result<void> block_written(const CompressJob &job) override
+    {
+        if (job.input.empty()) {
+            return oc::success();
+        }
+
+        if (auto ret = lzma_index_append(index, nullptr, job.unpadded_size,
+                                         job.input.size()); ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> trailer(std::vector<unsigned char> &out) override
+    {
+        auto index_size = static_cast<size_t>(lzma_index_size(index));
+        size_t pos = 0;
+
+        out.resize(index_size + LZMA_STREAM_HEADER_SIZE);
+
+        if (auto ret = lzma_index_buffer_encode(index, out.data(), &pos,
+                                                index_size); ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        auto flags = stream_flags();
+        flags.backward_size = lzma_index_size(index);
+
+        if (auto ret = lzma_stream_footer_encode(&flags, out.data() + pos);
+                ret != LZMA_OK) {
+            return lzma_error(ret);
+        }
+
+        return oc::success();
+    }
+};
+
+template<typename T>
+static std::unique_ptr<CompressFormat> make_format(int level)
+{
+    auto format = std::make_unique<T>();
+    format->level = level;
+    return std::move(format);
+}
+
+static std::unique_ptr<CompressFormat> new_format(CompressionType type,
+                                                  int level)
+{
+    switch (type) {
+    case CompressionType::Lz4:
+        return make_format<Lz4Format>(level);
+    case CompressionType::Gzip:
+        return make_format<GzipFormat>(level);
+    case CompressionType::Xz:
+        return make_format<XzFormat>(level);
+    default:
+        return nullptr;
+    }
+}
+
+// zstd: libzstd splits the input into jobs for its own worker threads and
+// keeps the long-distance matcher's history across them, so the stream is
+// encoded as a whole instead of as independent blocks.
+
+struct CompressStream
+{
+#ifdef MBUTIL_HAVE_ZSTD
+    ZSTD_CCtx *cctx = nullptr;
+    std::vector<unsigned char> buf;
+
+    ~CompressStream()
+    {
+        ZSTD_freeCCtx(cctx);
+    }
+
+    oc::result<void> init(int level, unsigned int threads, bool long_distance)
+    {
+        cctx = ZSTD_createCCtx();
+        if (!cctx) {
+            return std::errc::not_enough_memory;
+        }
+
+        if (ZSTD_isError(ZSTD_CCtx_setParameter(
+                cctx, ZSTD_c_compressionLevel, level))
+                || ZSTD_isError(ZSTD_CCtx_setParameter(
+                        cctx, ZSTD_c_enableLongDistanceMatching,
+                        long_distance))) {
+            return std::errc::invalid_argument;
+        }
+
+        // This fails if libzstd was built without multithreading support, in
+        // which case the stream is just compressed on the calling thread
+        if (threads > 1) {
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers,
+                                   static_cast<int>(threads));
+        }
+
+        buf.resize(ZSTD_CStreamOutSize());
+
+        return oc::success();
+    }
+
+    oc::result<void> compress(const void *data, size_t size, bool end,
+                              const ParallelCompressor::WriteFn &write_fn)
+    {
+        ZSTD_inBuffer in = { data, size, 0 };
+        size_t remain;
+
+        do {
+            ZSTD_outBuffer out = { buf.data(), buf.size(), 0 };
+
+            remain = ZSTD_compressStream2(
+                    cctx, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remain)) {
+                return std::errc::io_error;
+            }
+
+            if (out.pos > 0) {
+                OUTCOME_TRYV(write_fn(buf.data(), out.pos));
+            }
+        } while (end ? remain != 0 : in.pos < in.size);
+
+        return oc::success();
+    }
+#else
+    oc::result<void> init(int, unsigned int, bool)
+    {
+        return std::errc::function_not_supported;
+    }
+
+    oc::result<void> compress(const void *, size_t, bool,
+                              const ParallelCompressor::WriteFn &)
+    {
+        return std::errc::function_not_supported;
+    }
+#endif
+};
+
+struct DecompressStream
+{
+#ifdef MBUTIL_HAVE_ZSTD
+    ZSTD_DCtx *dctx = nullptr;
+    std::vector<unsigned char> buf;
+    ZSTD_inBuffer in = { nullptr, 0, 0 };
+    // Return value of the last ZSTD_decompressStream() call. Non-zero if a
+    // frame is incomplete.
+    size_t hint = 0;
+    bool eof = false;
+
+    ~DecompressStream()
+    {
+        ZSTD_freeDCtx(dctx);
+    }
+
+    oc::result<void> init()
+    {
+        dctx = ZSTD_createDCtx();
+        if (!dctx) {
+            return std::errc::not_enough_memory;
+        }
+
+        buf.resize(ZSTD_DStreamInSize());
+        in.src = buf.data();
+
+        return oc::success();
+    }
+
+    oc::result<size_t> decompress(void *data, size_t size,
+                                  const Decompressor::ReadFn &read_fn)
+    {
+        ZSTD_outBuffer out = { data, size, 0 };
+
+        while (out.pos == 0 && size > 0) {
+            if (in.pos == in.size) {
+                if (eof) {
+                    break;
+                }
+
+                OUTCOME_TRY(n, read_fn(buf.data(), buf.size()));
+                if (n == 0) {
+                    eof = true;
+                    // An empty stream or complete frames are fine
+                    if (hint != 0) {
+                        return std::errc::io_error;
+                    }
+                    break;
+                }
+
+                in.size = n;
+                in.pos = 0;
+            }
+
+            hint = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(hint)) {
+                return std::errc::io_error;
+            }
+        }
+
+        return out.pos;
+    }
+#else
+    oc::result<void> init()
+    {
+        return std::errc::function_not_supported;
+    }
+
+    oc::result<size_t> decompress(void *, size_t, const Decompressor::ReadFn &)
+    {
+        return std::errc::function_not_supported;
+    }
+#endif
+};
+
+}
+
+/*!
+ * \brief Check whether a compression type is available in this build
+ *
+ * Zstandard support requires building with `MBP_ENABLE_ZSTD`.
+ */
+bool compression_supported(CompressionType type)
+{
+    switch (type) {
+    case CompressionType::None:
+    case CompressionType::Lz4:
+    case CompressionType::Gzip:
+    case CompressionType::Xz:
+        return true;
+    case CompressionType::Zstd:
+#ifdef MBUTIL_HAVE_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \brief Get range of valid compression levels
+ *
+ * \return Minimum and maximum level (both inclusive). For lz4, levels 3 and
+ *         higher select the LZ4HC compressor.
+ */
+std::pair<int, int> compression_level_range(CompressionType type)
+{
+    switch (type) {
+    case CompressionType::Lz4:
+        return { 1, LZ4HC_CLEVEL_MAX };
+    case CompressionType::Gzip:
+        return { 1, 9 };
+    case CompressionType::Xz:
+        return { 0, 9 };
+    case CompressionType::Zstd:
+#ifdef MBUTIL_HAVE_ZSTD
+        return { 1, ZSTD_maxCLevel() };
+#else
+        return { 1, 22 };
+#endif
+    case CompressionType::None:
+    default:
+        return { 0, 0 };
+    }
+}
+
+static int default_level(CompressionType type)
+{
+    switch (type) {
+    case CompressionType::Lz4:
+        return detail::LZ4_DEFAULT_LEVEL;
+    case CompressionType::Gzip:
+        return detail::GZIP_DEFAULT_LEVEL;
+    case CompressionType::Xz:
+        return detail::XZ_DEFAULT_LEVEL;
+    case CompressionType::Zstd:
+        return detail::ZSTD_DEFAULT_LEVEL;
+    case CompressionType::None:
+    default:
+        return 0;
+    }
+}
+
+/*!
+ * \brief Estimate memory used by each compression thread
+ *
+ * For the block formats, this includes the encoder state and the input and
+ * output buffers of the two blocks each thread may have in flight. libzstd
+ * does not expose its memory estimates in the stable API, so 0 (unknown) is
+ * returned for zstd.
+ */
+static uint64_t thread_memory_usage(CompressionType type, int level)
+{
+    switch (type) {
+    case CompressionType::Lz4:
+        return 4 * detail::LZ4_BLOCK_SIZE
+                + static_cast<uint64_t>(LZ4_sizeofStateHC());
+    case CompressionType::Gzip:
+        // deflate state is 256 KiB with windowBits = 15 and memLevel = 8
+        return 4 * detail::GZIP_BLOCK_SIZE + 256 * 1024;
+    case CompressionType::Xz: {
+        // UINT64_MAX for invalid levels, which are rejected later anyway
+        auto usage = lzma_easy_encoder_memusage(static_cast<uint32_t>(level));
+        return usage == UINT64_MAX ? usage : usage + 4 * detail::XZ_BLOCK_SIZE;
+    }
+    case CompressionType::Zstd:
+    case CompressionType::None:
+    default:
+        return 0;
+    }
+}
+
+/*!
+ * \brief Get number of threads ParallelCompressor uses for some options
+ *
+ * If `options.threads` is 0, this is one per CPU, but at most
+ * DEFAULT_MAX_THREADS and no more than fit in DEFAULT_THREAD_MEMORY_BUDGET. At
+ * least one thread is always used, even if it alone exceeds the budget.
+ * Otherwise, `options.threads` is returned as is.
+ */
+unsigned int compression_threads(const CompressionOptions &options)
+{
+    if (options.threads != 0) {
+        return options.threads;
+    }
+
+    auto level = options.level.value_or(default_level(options.type));
+    auto threads = std::clamp(std::thread::hardware_concurrency(), 1u,
+                              detail::DEFAULT_MAX_THREADS);
+
+    if (auto usage = thread_memory_usage(options.type, level); usage > 0) {
+        auto fit = std::max<uint64_t>(
+                detail::DEFAULT_THREAD_MEMORY_BUDGET / usage, 1);
+        threads = static_cast<unsigned int>(std::min<uint64_t>(fit, threads));
+    }
+
+    return threads;
+}
+
+/*!
+ * \class ParallelCompressor
+ *
+ * \brief Compress a stream on multiple threads
+ *
+ * The input is cut into fixed-size blocks that are compressed independently on
+ * a pool of worker threads. The compressed blocks are passed to the write
+ * callback in their original order, on the thread calling write() or finish(),
+ * so the callback does not need to be thread-safe.
+ *
+ * The output is a standard single stream that any decoder for the format can
+ * read:
+ *
+ * - gzip: one member made up of byte-aligned deflate blocks, each primed with
+ *   the last 32 KiB of the previous block (same as pigz)
+ * - lz4: one frame with independent 4 MiB blocks
+ * - xz: one stream with an 8 MiB block per job and an index (same as xz -T)
+ *
+ * zstd is the exception: the stream is passed to libzstd, which uses its own
+ * worker threads. This keeps long-distance matching effective across the whole
+ * stream.
+ *
+ * With CompressionType::None, data is passed through to the write callback.
+ *
+ * At most `2 * threads` blocks are buffered at any time.
+ */
+
+/*!
+ * \brief Construct compressor and start worker threads
+ *
+ * If the options are invalid or the compression type is not supported by this
+ * build, the error is returned by the first call to write() or finish().
+ *
+ * \param options Compression options. If `options.threads` is 0, the number of
+ *                threads is chosen based on the number of CPUs and the memory
+ *                needed by each thread (see CompressionOptions::threads).
+ * \param write_fn Callback for writing the compressed stream
+ */
+ParallelCompressor::ParallelCompressor(const CompressionOptions &options,
+                                       WriteFn write_fn)
+    : m_write_fn(std::move(write_fn))
+    , m_block_size(0)
+    , m_threads(compression_threads(options))
+    , m_max_in_flight(2 * m_threads)
+    , m_started(false)
+    , m_finished(false)
+    , m_stop(false)
+{
+    auto level = options.level.value_or(default_level(options.type));
+    auto [min_level, max_level] = compression_level_range(options.type);
+
+    if (!compression_supported(options.type)) {
+        m_error = std::make_error_code(std::errc::function_not_supported);
+        return;
+    } else if (options.type != CompressionType::None
+            && (level < min_level || level > max_level)) {
+        m_error = std::make_error_code(std::errc::invalid_argument);
+        return;
+    }
+
+    if (options.type == CompressionType::Zstd) {
+        m_stream = std::make_unique<detail::CompressStream>();
+        if (auto r = m_stream->init(level, m_threads, options.long_distance);
+                !r) {
+            m_error = r.error();
+        }
+        return;
+    }
+
+    m_format = detail::new_format(options.type, level);
+
+    if (m_format) {
+        m_block_size = m_format->block_size();
+        m_buf.reserve(m_block_size);
+
+        m_workers.reserve(m_threads);
+        for (unsigned int i = 0; i < m_threads; ++i) {
+            m_workers.emplace_back(&ParallelCompressor::worker_loop, this);
+        }
+    }
+}
+
+/*!
+ * \brief Stop worker threads
+ *
+ * Any data not yet flushed by finish() is discarded.
+ */
+ParallelCompressor::~ParallelCompressor()
+{
+    stop_workers();
+}
+
+/*!
+ * \brief Compress data
+ *
+ * Complete blocks are queued for compression. This may block if too many
+ * blocks are already in flight.
+ *
+ * \return Nothing on success or the error code on failure. The compressor is
+ *         unusable after a failure.
+ */
+oc::result<void> ParallelCompressor::write(const void *data, size_t size)
+{
+    if (m_error) {
+        return m_error;
+    } else if (m_finished) {
+        return std::errc::invalid_argument;
+    }
+
+    auto ret = write_impl(data, size);
+    if (!ret) {
+        m_error = ret.error();
+    }
+    return ret;
+}
+
+/*!
+ * \brief Flush remaining data and write the stream trailer
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> ParallelCompressor::finish()
+{
+    if (m_error) {
+        return m_error;
+    } else if (m_finished) {
+        return std::errc::invalid_argument;
+    }
+
+    auto ret = finish_impl();
+    if (!ret) {
+        m_error = ret.error();
+    }
+    m_finished = true;
+    stop_workers();
+    return ret;
+}
+
+/*!
+ * \brief Set uncompressed size of each block
+ *
+ * Smaller blocks allow more parallelism for small inputs at the cost of
+ * compression ratio. The size is capped to the maximum supported by the format.
+ * This has no effect with CompressionType::None or CompressionType::Zstd, or
+ * after the first write().
+ *
+ * \param size Block size (must be non-zero)
+ */
+void ParallelCompressor::set_block_size(size_t size)
+{
+    if (m_format && !m_started && size > 0) {
+        m_block_size = std::min(size, m_format->max_block_size());
+        m_buf.reserve(m_block_size);
+    }
+}
+
+//! Uncompressed size of each block (0 if the stream is not split into blocks)
+size_t ParallelCompressor::block_size() const
+{
+    return m_block_size;
+}
+
+//! Number of worker threads
+unsigned int ParallelCompressor::threads() const
+{
+    return m_threads;
+}
+
+oc::result<void> ParallelCompressor::write_impl(const void *data, size_t size)
+{
+    if (m_stream) {
+        return m_stream->compress(data, size, false, m_write_fn);
+    } else if (!m_format) {
+        return m_write_fn(data, size);
+    }
+
+    OUTCOME_TRYV(write_header_if_needed());
+
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        auto n = std::min(size, m_block_size - m_buf.size());
+        m_buf.insert(m_buf.end(), ptr, ptr + n);
+        ptr += n;
+        size -= n;
+
+        if (m_buf.size() == m_block_size) {
+            OUTCOME_TRYV(submit_block(false));
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ParallelCompressor::finish_impl()
+{
+    if (m_stream) {
+        return m_stream->compress(nullptr, 0, true, m_write_fn);
+    } else if (!m_format) {
+        return oc::success();
+    }
+
+    OUTCOME_TRYV(write_header_if_needed());
+
+    // Always submit a final block, even if empty, so that formats that need to
+    // terminate the last block (eg. deflate's final block bit) can do so
+    OUTCOME_TRYV(submit_block(true));
+    OUTCOME_TRYV(write_completed(true));
+
+    std::vector<unsigned char> trailer;
+    OUTCOME_TRYV(m_format->trailer(trailer));
+    OUTCOME_TRYV(m_write_fn(trailer.data(), trailer.size()));
+
+    return oc::success();
+}
+
+oc::result<void> ParallelCompressor::write_header_if_needed()
+{
+    if (!m_started) {
+        std::vector<unsigned char> header;
+        OUTCOME_TRYV(m_format->header(header));
+        OUTCOME_TRYV(m_write_fn(header.data(), header.size()));
+        m_started = true;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ParallelCompressor::submit_block(bool last)
+{
+    auto job = std::make_unique<detail::CompressJob>();
+    job->input.swap(m_buf);
+    job->last = last;
+
+    if (!last) {
+        m_buf.reserve(m_block_size);
+    }
+
+    m_format->prepare(*job);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(job.get());
+        m_jobs.push_back(std::move(job));
+    }
+    m_queue_cv.notify_one();
+
+    return write_completed(false);
+}
+
+/*!
+ * \brief Write compressed blocks in stream order
+ *
+ * \param wait_all Wait for all queued blocks. Otherwise, only wait if the limit
+ *                 of in-flight blocks has been reached.
+ */
+oc::result<void> ParallelCompressor::write_completed(bool wait_all)
+{
+    while (true) {
+        std::unique_ptr<detail::CompressJob> job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (m_jobs.empty()) {
+                break;
+            }
+
+            auto *front = m_jobs.front().get();
+
+            if (!front->done) {
+                if (!wait_all && m_jobs.size() < m_max_in_flight) {
+                    break;
+                }
+
+                m_done_cv.wait(lock, [front] { return front->done; });
+            }
+
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        if (job->ec) {
+            return job->ec;
+        }
+
+        OUTCOME_TRYV(m_format->block_written(*job));
+
+        if (!job->output.empty()) {
+            OUTCOME_TRYV(m_write_fn(job->output.data(), job->output.size()));
+        }
+    }
+
+    return oc::success();
+}
+
+void ParallelCompressor::worker_loop()
+{
+    auto encoder = m_format->new_encoder();
+
+    while (true) {
+        detail::CompressJob *job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_queue_cv.wait(lock, [this] {
+                return m_stop || !m_queue.empty();
+            });
+
+            if (m_stop) {
+                return;
+            }
+
+            job = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        std::error_code ec;
+
+        if (!encoder) {
+            ec = encoder.error();
+        } else if (auto r = encoder.value()->encode(*job); !r) {
+            ec = r.error();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            job->ec = ec;
+            job->done = true;
+        }
+        m_done_cv.notify_all();
+    }
+}
+
+void ParallelCompressor::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_queue_cv.notify_all();
+
+    for (auto &t : m_workers) {
+        t.join();
+    }
+    m_workers.clear();
+
+    m_queue.clear();
+    m_jobs.clear();
+}
+
+/*!
+ * \class Decompressor
+ *
+ * \brief Decompress a stream that libarchive cannot read by itself
+ *
+ * Only CompressionType::Zstd is supported. The other formats are read by
+ * libarchive's filters. Concatenated frames are decoded as one stream.
+ */
+
+/*!
+ * \brief Construct decompressor
+ *
+ * If the compression type is not supported, the error is returned by the first
+ * call to read().
+ *
+ * \param type Compression type
+ * \param read_fn Callback for reading the compressed stream
+ */
+Decompressor::Decompressor(CompressionType type, ReadFn read_fn)
+    : m_read_fn(std::move(read_fn))
+{
+    if (type != CompressionType::Zstd) {
+        m_error = std::make_error_code(std::errc::function_not_supported);
+        return;
+    }
+
+    m_stream = std::make_unique<detail::DecompressStream>();
+    if (auto r = m_stream->init(); !r) {
+        m_error = r.error();
+    }
+}
+
+Decompressor::~Decompressor() = default;
+
+/*!
+ * \brief Read decompressed data
+ *
+ * \return Number of bytes read (0 at the end of the stream) or the error code
+ *         on failure. A truncated stream results in std::errc::io_error.
+ */
+oc::result<size_t> Decompressor::read(void *buf, size_t size)
+{
+    if (m_error) {
+        return m_error;
+    }
+
+    auto n = m_stream->decompress(buf, size, m_read_fn);
+    if (!n) {
+        m_error = n.error();
+    }
+    return n;
+}
+
+}
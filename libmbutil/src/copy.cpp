@@ -24,11 +24,15 @@
 #include <cstring>
 #include <fcntl.h>
 #include <fts.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
@@ -44,33 +48,53 @@
 namespace mb::util
 {
 
+/*!
+ * \brief Copy data from one file descriptor to another
+ *
+ * Data is copied from the current file position of \p fd_source until EOF is
+ * reached. The copy is offloaded to the kernel with `copy_file_range()`,
+ * `sendfile()`, or `splice()` if possible. Otherwise, the data is copied
+ * through a large userspace buffer. See mb::file_copy_range().
+ *
+ * \param fd_source Source file descriptor
+ * \param fd_target Target file descriptor
+ *
+ * \return Nothing if the data is successfully copied. Otherwise, the error
+ *         code.
+ */
 oc::result<void> copy_data_fd(int fd_source, int fd_target)
 {
-    char buf[10240];
-    ssize_t nread;
+    FdFile source;
+    FdFile target;
 
-    while ((nread = read(fd_source, buf, sizeof(buf))) > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+    OUTCOME_TRYV(source.open(fd_source, false));
+    OUTCOME_TRYV(target.open(fd_target, false));
 
-        do {
-            if ((nwritten = write(fd_target, out_ptr,
-                                  static_cast<size_t>(nread))) < 0) {
-                return ec_from_errno();
-            }
-
-            nread -= nwritten;
-            out_ptr += nwritten;
-        } while (nread > 0);
-    }
-
-    if (nread < 0) {
-        return ec_from_errno();
-    }
+    OUTCOME_TRYV(file_copy_range(source, target, UINT64_MAX));
 
     return oc::success();
 }
 
+/*!
+ * \brief Try to share the source file's extents with the target
+ *
+ * This only works if both files are on the same filesystem and the filesystem
+ * supports reflinks (eg. btrfs, xfs, f2fs in some kernels). \p fd_target must
+ * refer to an empty file.
+ *
+ * \return Whether the target file now has the same contents as the source
+ */
+static bool clone_data_fd(int fd_source, int fd_target)
+{
+#ifdef FICLONE
+    return ioctl(fd_target, FICLONE, fd_source) == 0;
+#else
+    (void) fd_source;
+    (void) fd_target;
+    return false;
+#endif
+}
+
 static FileOpResult<void> copy_data(const std::string &source,
                                     const std::string &target)
 {
@@ -93,9 +117,11 @@ static FileOpResult<void> copy_data(const std::string &source,
         close(fd_target);
     });
 
-    if (auto r = copy_data_fd(fd_source, fd_target); !r) {
-        // TODO: OR SOURCE?
-        return FileOpErrorInfo{target, r.error()};
+    if (!clone_data_fd(fd_source, fd_target)) {
+        if (auto r = copy_data_fd(fd_source, fd_target); !r) {
+            // TODO: OR SOURCE?
+            return FileOpErrorInfo{target, r.error()};
+        }
     }
 
     close_target_fd.dismiss();
@@ -204,9 +230,11 @@ FileOpResult<void> copy_contents(const std::string &source,
         close(fd_target);
     });
 
-    if (auto r = copy_data_fd(fd_source, fd_target); !r) {
-        // TODO: OR SOURCE?
-        return FileOpErrorInfo{target, ec_from_errno()};
+    if (!clone_data_fd(fd_source, fd_target)) {
+        if (auto r = copy_data_fd(fd_source, fd_target); !r) {
+            // TODO: OR SOURCE?
+            return FileOpErrorInfo{target, r.error()};
+        }
     }
 
     return oc::success();
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/fastcdc.h"
+
+#include <algorithm>
+#include <array>
+
+#include <cstring>
+
+namespace mb::util
+{
+
+/*! Smallest chunk size accepted by FastCdc */
+static constexpr size_t MIN_CHUNK_SIZE = 64;
+
+static constexpr uint64_t splitmix64(uint64_t &state)
+{
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static constexpr std::array<uint64_t, 256> generate_gear_table()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0;
+
+    for (auto &value : table) {
+        value = splitmix64(state);
+    }
+
+    return table;
+}
+
+/*!
+ * Random values for the gear hash. The table must never change since it
+ * determines the chunk boundaries of data that has already been stored.
+ */
+static constexpr std::array<uint64_t, 256> GEAR = generate_gear_table();
+
+/*! Mask with the \p bits most significant bits set */
+static constexpr uint64_t high_bits_mask(unsigned int bits)
+{
+    return bits == 0 ? 0 : ~uint64_t(0) << (64 - std::min(bits, 64u));
+}
+
+static unsigned int log2_floor(size_t n)
+{
+    unsigned int bits = 0;
+    while (n >>= 1) {
+        ++bits;
+    }
+    return bits;
+}
+
+/*!
+ * \brief Construct chunker with the given size parameters
+ *
+ * The sizes are adjusted so that `64 <= min_size <= avg_size <= max_size`.
+ * \p avg_size is only approximate. The masks are based on the largest power
+ * of two not exceeding it.
+ */
+FastCdc::FastCdc(size_t min_size, size_t avg_size, size_t max_size)
+    : m_min_size(std::max(min_size, MIN_CHUNK_SIZE))
+    , m_avg_size(std::max(avg_size, m_min_size))
+    , m_max_size(std::max(max_size, m_avg_size))
+{
+    auto bits = log2_floor(m_avg_size);
+
+    m_mask_s = high_bits_mask(bits + 2);
+    m_mask_l = high_bits_mask(bits - 2);
+}
+
+size_t FastCdc::min_size() const
+{
+    return m_min_size;
+}
+
+size_t FastCdc::avg_size() const
+{
+    return m_avg_size;
+}
+
+size_t FastCdc::max_size() const
+{
+    return m_max_size;
+}
+
+/*!
+ * \brief Find the end of the first chunk in a buffer
+ *
+ * \param data Data to chunk
+ * \param size Size of \p data. If this is smaller than max_size(), \p data is
+ *             assumed to contain the rest of the stream.
+ *
+ * \return Size of the first chunk
+ */
+size_t FastCdc::cut(const void *data, size_t size) const
+{
+    if (size <= m_min_size) {
+        return size;
+    }
+
+    auto p = static_cast<const unsigned char *>(data);
+    size_t n = std::min(size, m_max_size);
+    size_t normal = std::min(m_avg_size, n);
+    uint64_t fp = 0;
+    size_t i = m_min_size;
+
+    for (; i < normal; ++i) {
+        fp = (fp << 1) + GEAR[p[i]];
+        if (!(fp & m_mask_s)) {
+            return i + 1;
+        }
+    }
+
+    for (; i < n; ++i) {
+        fp = (fp << 1) + GEAR[p[i]];
+        if (!(fp & m_mask_l)) {
+            return i + 1;
+        }
+    }
+
+    return n;
+}
+
+FastCdcChunker::FastCdcChunker(const FastCdc &cdc, ChunkFn chunk_fn)
+    : m_cdc(cdc)
+    , m_chunk_fn(std::move(chunk_fn))
+    , m_buf(cdc.max_size() * 4)
+    , m_buf_size(0)
+{
+}
+
+oc::result<void> FastCdcChunker::write(const void *data, size_t size)
+{
+    auto p = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        size_t n = std::min(size, m_buf.size() - m_buf_size);
+
+        memcpy(m_buf.data() + m_buf_size, p, n);
+        m_buf_size += n;
+        p += n;
+        size -= n;
+
+        if (m_buf_size == m_buf.size()) {
+            OUTCOME_TRYV(emit_chunks(false));
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> FastCdcChunker::finish()
+{
+    return emit_chunks(true);
+}
+
+/*!
+ * \brief Pass all chunks with known boundaries to the callback
+ *
+ * Unless \p last is true, data is only chunked while at least max_size()
+ * bytes are buffered since a shorter buffer would be treated as the end of the
+ * stream.
+ */
+oc::result<void> FastCdcChunker::emit_chunks(bool last)
+{
+    size_t offset = 0;
+
+    while (m_buf_size - offset >= m_cdc.max_size()
+            || (last && m_buf_size > offset)) {
+        size_t n = m_cdc.cut(m_buf.data() + offset, m_buf_size - offset);
+
+        OUTCOME_TRYV(m_chunk_fn(m_buf.data() + offset, n));
+        offset += n;
+    }
+
+    memmove(m_buf.data(), m_buf.data() + offset, m_buf_size - offset);
+    m_buf_size -= offset;
+
+    return oc::success();
+}
+
+}
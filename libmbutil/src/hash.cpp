@@ -19,11 +19,13 @@
 
 #include "mbutil/hash.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <cstdio>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/hash.h"
 
 
 namespace mb::util
@@ -48,15 +50,11 @@ oc::result<Sha512Digest> sha512_hash(const std::string &path)
     std::array<unsigned char, 10240> buf;
     size_t n;
 
-    SHA512_CTX ctx;
-    if (!SHA512_Init(&ctx)) {
-        return std::errc::io_error;
-    }
+    Hasher hasher;
+    OUTCOME_TRYV(hasher.init(HashAlgorithm::Sha512));
 
     while ((n = fread(buf.data(), 1, buf.size(), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf.data(), n)) {
-            return std::errc::io_error;
-        }
+        OUTCOME_TRYV(hasher.update(buf.data(), n));
         if (n < buf.size()) {
             break;
         }
@@ -66,11 +64,10 @@ oc::result<Sha512Digest> sha512_hash(const std::string &path)
         return ec_from_errno();
     }
 
-    Sha512Digest digest;
+    OUTCOME_TRY(result, hasher.finish());
 
-    if (!SHA512_Final(digest.data(), &ctx)) {
-        return std::errc::io_error;
-    }
+    Sha512Digest digest;
+    std::copy(result.begin(), result.end(), digest.begin());
 
     return std::move(digest);
 }
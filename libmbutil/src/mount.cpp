@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
@@ -50,6 +51,7 @@ namespace mb::util
 {
 
 static constexpr int MAX_UNMOUNT_TRIES = 5;
+static constexpr int MAX_LOOPDEV_TRIES = 5;
 
 static constexpr char PROC_MOUNTS[] = "/proc/mounts";
 static constexpr char PROC_MOUNTINFO[] = "/proc/self/mountinfo";
@@ -365,6 +367,37 @@ oc::result<void> unmount_all(const std::string &dir)
     return ec;
 }
 
+//! Serializes finding and claiming free loop devices in this process
+static std::mutex g_loopdev_mutex;
+
+/*!
+ * \brief Associate a file with an unused loop device
+ *
+ * Threads in this process cannot pick the same loop device because they are
+ * serialized by a mutex. Another process may still claim the device between
+ * loopdev_find_unused() and loopdev_set_up_device(). In that case, LOOP_SET_FD
+ * fails with EBUSY and another free device is tried.
+ *
+ * \return Path of the loop device or the error code on failure
+ */
+static oc::result<std::string> set_up_unused_loopdev(const std::string &file,
+                                                     bool ro)
+{
+    std::lock_guard<std::mutex> lock(g_loopdev_mutex);
+
+    for (int tries = 1; ; ++tries) {
+        OUTCOME_TRY(loopdev, loopdev_find_unused());
+
+        auto r = loopdev_set_up_device(loopdev, file, 0, ro);
+        if (r) {
+            return std::move(loopdev);
+        } else if (r.error() != std::errc::device_or_resource_busy
+                || tries == MAX_LOOPDEV_TRIES) {
+            return r.as_failure();
+        }
+    }
+}
+
 /*!
  * \brief Mount filesystem
  *
@@ -414,9 +447,8 @@ oc::result<void> mount(const std::string &source, const std::string &target,
     }
 
     if (need_loopdev) {
-        OUTCOME_TRY(loopdev, loopdev_find_unused());
-        OUTCOME_TRYV(loopdev_set_up_device(loopdev, source, 0,
-                                           mount_flags & MS_RDONLY));
+        OUTCOME_TRY(loopdev, set_up_unused_loopdev(
+                source, mount_flags & MS_RDONLY));
 
         if (::mount(loopdev.c_str(), target.c_str(), fstype_real.c_str(),
                     mount_flags, data.c_str()) < 0) {
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <dirent.h>
+
+#include "mbutil/chunk_store.h"
+#include "mbutil/delete.h"
+
+using namespace mb;
+using namespace mb::util;
+
+static std::vector<unsigned char> generate_data(size_t size, uint32_t seed,
+                                                bool compressible)
+{
+    std::vector<unsigned char> data;
+    data.reserve(size);
+
+    uint32_t state = seed;
+    while (data.size() < size) {
+        state = state * 1103515245u + 12345u;
+        data.push_back(static_cast<unsigned char>(
+                compressible ? 'a' + (state >> 16) % 4 : state >> 24));
+    }
+
+    return data;
+}
+
+struct ChunkStoreTest : testing::Test
+{
+    std::string m_dir;
+
+    void SetUp() override
+    {
+        char tmpl[] = "/tmp/mbutil_chunk_store_XXXXXX";
+        ASSERT_TRUE(mkdtemp(tmpl));
+        m_dir = tmpl;
+    }
+
+    void TearDown() override
+    {
+        (void) delete_recursive(m_dir);
+    }
+
+    std::vector<std::string> list_packs_dir()
+    {
+        std::vector<std::string> names;
+
+        if (DIR *dp = opendir((m_dir + "/packs").c_str())) {
+            while (auto ent = readdir(dp)) {
+                if (ent->d_name[0] != '.') {
+                    names.emplace_back(ent->d_name);
+                }
+            }
+            closedir(dp);
+        }
+
+        return names;
+    }
+};
+
+TEST_F(ChunkStoreTest, AddAndReadChunks)
+{
+    auto compressible = generate_data(100000, 1, true);
+    auto random = generate_data(100000, 2, false);
+    std::vector<unsigned char> empty;
+    std::vector<unsigned char> buf;
+
+    ChunkDigest d1, d2, d3;
+
+    {
+        ChunkStore store;
+        ASSERT_TRUE(store.open(m_dir));
+
+        auto r1 = store.add(compressible.data(), compressible.size());
+        ASSERT_TRUE(r1);
+        d1 = r1.value();
+        auto r2 = store.add(random.data(), random.size());
+        ASSERT_TRUE(r2);
+        d2 = r2.value();
+        auto r3 = store.add(empty.data(), empty.size());
+        ASSERT_TRUE(r3);
+        d3 = r3.value();
+
+        // Uncommitted chunks are readable
+        ASSERT_TRUE(store.read(d1, buf));
+        ASSERT_EQ(buf, compressible);
+
+        auto stats = store.stats();
+        ASSERT_EQ(stats.new_chunks, 3u);
+        ASSERT_EQ(stats.new_bytes, 200000u);
+        ASSERT_LT(stats.stored_bytes, stats.new_bytes);
+
+        ASSERT_TRUE(store.close());
+    }
+
+    ASSERT_EQ(list_packs_dir().size(), 2u);
+
+    ChunkStore store;
+    ASSERT_TRUE(store.open(m_dir));
+
+    ASSERT_TRUE(store.read(d1, buf));
+    ASSERT_EQ(buf, compressible);
+    ASSERT_TRUE(store.read(d2, buf));
+    ASSERT_EQ(buf, random);
+    ASSERT_TRUE(store.read(d3, buf));
+    ASSERT_EQ(buf, empty);
+}
+
+TEST_F(ChunkStoreTest, DuplicateChunksAreStoredOnce)
+{
+    auto data = generate_data(50000, 3, true);
+
+    {
+        ChunkStore store;
+        ASSERT_TRUE(store.open(m_dir));
+        ASSERT_TRUE(store.add(data.data(), data.size()));
+        ASSERT_TRUE(store.add(data.data(), data.size()));
+
+        auto stats = store.stats();
+        ASSERT_EQ(stats.new_chunks, 1u);
+        ASSERT_EQ(stats.dedup_chunks, 1u);
+        ASSERT_EQ(stats.dedup_bytes, data.size());
+
+        ASSERT_TRUE(store.close());
+    }
+
+    ChunkStore store;
+    ASSERT_TRUE(store.open(m_dir));
+    ASSERT_TRUE(store.add(data.data(), data.size()));
+    ASSERT_EQ(store.stats().new_chunks, 0u);
+    ASSERT_TRUE(store.close());
+
+    // Nothing new was written, so no new pack should exist
+    ASSERT_EQ(list_packs_dir().size(), 2u);
+}
+
+TEST_F(ChunkStoreTest, UncommittedChunksAreDiscarded)
+{
+    auto data = generate_data(1000, 4, true);
+    ChunkDigest digest;
+
+    {
+        ChunkStore store;
+        ASSERT_TRUE(store.open(m_dir));
+        auto r = store.add(data.data(), data.size());
+        ASSERT_TRUE(r);
+        digest = r.value();
+    }
+
+    ASSERT_TRUE(list_packs_dir().empty());
+
+    ChunkStore store;
+    ASSERT_TRUE(store.open(m_dir));
+    ASSERT_FALSE(store.contains(digest));
+
+    std::vector<unsigned char> buf;
+    auto ret = store.read(digest, buf);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::no_such_file_or_directory);
+}
+
+TEST_F(ChunkStoreTest, CorruptChunkFailure)
+{
+    auto data = generate_data(1000, 5, false);
+    ChunkDigest digest;
+
+    {
+        ChunkStore store;
+        ASSERT_TRUE(store.open(m_dir));
+        auto r = store.add(data.data(), data.size());
+        ASSERT_TRUE(r);
+        digest = r.value();
+        ASSERT_TRUE(store.close());
+    }
+
+    std::string pack_path;
+    for (auto const &name : list_packs_dir()) {
+        if (name.size() > 5 && name.substr(name.size() - 5) == ".pack") {
+            pack_path = m_dir + "/packs/" + name;
+        }
+    }
+    ASSERT_FALSE(pack_path.empty());
+
+    FILE *fp = fopen(pack_path.c_str(), "r+b");
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(fseek(fp, 500, SEEK_SET), 0);
+    ASSERT_EQ(fputc(data[500] ^ 0xff, fp), data[500] ^ 0xff);
+    ASSERT_EQ(fclose(fp), 0);
+
+    ChunkStore store;
+    ASSERT_TRUE(store.open(m_dir));
+
+    std::vector<unsigned char> buf;
+    auto ret = store.read(digest, buf);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+}
+
+TEST_F(ChunkStoreTest, CorruptIndexFailure)
+{
+    auto data = generate_data(1000, 6, true);
+
+    {
+        ChunkStore store;
+        ASSERT_TRUE(store.open(m_dir));
+        ASSERT_TRUE(store.add(data.data(), data.size()));
+        ASSERT_TRUE(store.close());
+    }
+
+    for (auto const &name : list_packs_dir()) {
+        if (name.size() > 4 && name.substr(name.size() - 4) == ".idx") {
+            FILE *fp = fopen((m_dir + "/packs/" + name).c_str(), "r+b");
+            ASSERT_TRUE(fp);
+            ASSERT_EQ(fseek(fp, 20, SEEK_SET), 0);
+            ASSERT_NE(fputc(0, fp), EOF);
+            ASSERT_EQ(fclose(fp), 0);
+        }
+    }
+
+    ChunkStore store;
+    auto ret = store.open(m_dir);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+    ASSERT_FALSE(store.is_open());
+}
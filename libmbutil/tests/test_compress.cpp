@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstring>
+
+#include "mbutil/archive.h"
+#include "mbutil/compress.h"
+
+using namespace mb;
+using namespace mb::util;
+
+using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
+
+static std::string generate_data(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+
+    // Compressible, but not trivially so
+    uint32_t state = 1;
+    while (data.size() < size) {
+        state = state * 1103515245u + 12345u;
+        data += "line ";
+        data += std::to_string((state >> 16) % 1000);
+        data += '\n';
+    }
+
+    data.resize(size);
+    return data;
+}
+
+static std::string compress(CompressionType type, unsigned int threads,
+                            const std::string &data, size_t chunk_size,
+                            size_t block_size = 0)
+{
+    std::string output;
+
+    CompressionOptions options;
+    options.type = type;
+    options.threads = threads;
+
+    ParallelCompressor compressor(options,
+            [&](const void *buf, size_t size) -> oc::result<void> {
+        output.append(static_cast<const char *>(buf), size);
+        return oc::success();
+    });
+    if (block_size > 0) {
+        compressor.set_block_size(block_size);
+    }
+
+    for (size_t i = 0; i < data.size(); i += chunk_size) {
+        auto n = std::min(chunk_size, data.size() - i);
+        EXPECT_TRUE(compressor.write(data.data() + i, n));
+    }
+    EXPECT_TRUE(compressor.finish());
+
+    return output;
+}
+
+static std::string decompress(const std::string &data)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    EXPECT_TRUE(a);
+
+    archive_read_support_filter_gzip(a.get());
+    archive_read_support_filter_lz4(a.get());
+    archive_read_support_filter_xz(a.get());
+    archive_read_support_format_empty(a.get());
+    archive_read_support_format_raw(a.get());
+
+    EXPECT_EQ(archive_read_open_memory(a.get(), data.data(), data.size()),
+              ARCHIVE_OK) << archive_error_string(a.get());
+
+    std::string output;
+
+    archive_entry *entry;
+    int ret = archive_read_next_header(a.get(), &entry);
+    if (ret == ARCHIVE_EOF) {
+        // Empty format matched after decompression
+        return output;
+    }
+    EXPECT_EQ(ret, ARCHIVE_OK) << archive_error_string(a.get());
+
+    char buf[65536];
+    la_ssize_t n;
+
+    while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+        output.append(buf, static_cast<size_t>(n));
+    }
+    EXPECT_EQ(n, 0) << archive_error_string(a.get());
+
+    return output;
+}
+
+static void check_round_trip(CompressionType type)
+{
+    constexpr size_t block_size = 64 * 1024;
+
+    // Span many blocks and end with a partial block
+    auto data = generate_data(20 * block_size + 12345);
+
+    auto compressed = compress(type, 4, data, 100000, block_size);
+    ASSERT_LT(compressed.size(), data.size());
+    ASSERT_EQ(decompress(compressed), data);
+
+    // Output must not depend on the number of threads or write sizes
+    ASSERT_EQ(compress(type, 1, data, 4096, block_size), compressed);
+}
+
+TEST(CompressTest, DefaultBlockSizes)
+{
+    ParallelCompressor gzip({ CompressionType::Gzip, {}, 1, false }, nullptr);
+    ASSERT_EQ(gzip.block_size(), 1024u * 1024u);
+
+    ParallelCompressor lz4({ CompressionType::Lz4, {}, 1, false }, nullptr);
+    ASSERT_EQ(lz4.block_size(), 4u * 1024u * 1024u);
+
+    // LZ4 frames cannot have blocks larger than 4 MiB
+    lz4.set_block_size(8 * 1024 * 1024);
+    ASSERT_EQ(lz4.block_size(), 4u * 1024u * 1024u);
+
+    ParallelCompressor xz({ CompressionType::Xz, {}, 1, false }, nullptr);
+    ASSERT_EQ(xz.block_size(), 8u * 1024u * 1024u);
+}
+
+TEST(CompressTest, DefaultThreadsAreBounded)
+{
+    ParallelCompressor gzip({ CompressionType::Gzip, {}, 0, false }, nullptr);
+    ASSERT_GE(gzip.threads(), 1u);
+    ASSERT_LE(gzip.threads(), 4u);
+
+    // ~125 MiB per thread fits twice in the budget
+    ParallelCompressor xz6({ CompressionType::Xz, 6, 0, false }, nullptr);
+    ASSERT_GE(xz6.threads(), 1u);
+    ASSERT_LE(xz6.threads(), 2u);
+
+    // A single thread is still used if it exceeds the budget
+    ParallelCompressor xz9({ CompressionType::Xz, 9, 0, false }, nullptr);
+    ASSERT_EQ(xz9.threads(), 1u);
+
+    // Explicit thread counts are not limited
+    ParallelCompressor gzip8({ CompressionType::Gzip, {}, 8, false }, nullptr);
+    ASSERT_EQ(gzip8.threads(), 8u);
+}
+
+TEST(CompressTest, GzipRoundTrip)
+{
+    check_round_trip(CompressionType::Gzip);
+}
+
+TEST(CompressTest, Lz4RoundTrip)
+{
+    check_round_trip(CompressionType::Lz4);
+}
+
+TEST(CompressTest, XzRoundTrip)
+{
+    check_round_trip(CompressionType::Xz);
+}
+
+TEST(CompressTest, EmptyInput)
+{
+    for (auto type : { CompressionType::Gzip, CompressionType::Lz4,
+                       CompressionType::Xz }) {
+        auto compressed = compress(type, 2, {}, 1);
+        ASSERT_FALSE(compressed.empty());
+        ASSERT_EQ(decompress(compressed), "");
+    }
+}
+
+TEST(CompressTest, IncompressibleLz4BlocksAreStored)
+{
+    std::string data(100000, '\0');
+    uint32_t state = 1;
+    for (auto &c : data) {
+        state = state * 1103515245u + 12345u;
+        c = static_cast<char>(state >> 24);
+    }
+
+    auto compressed = compress(CompressionType::Lz4, 2, data, data.size());
+    ASSERT_EQ(decompress(compressed), data);
+}
+
+TEST(CompressTest, NoneIsPassthrough)
+{
+    auto data = generate_data(1000);
+    ASSERT_EQ(compress(CompressionType::None, 4, data, 7), data);
+}
+
+TEST(CompressTest, WriteErrorIsReturned)
+{
+    ParallelCompressor compressor({ CompressionType::Gzip, {}, 2, false },
+            [](const void *, size_t) -> oc::result<void> {
+        return std::errc::no_space_on_device;
+    });
+
+    compressor.set_block_size(4096);
+
+    auto data = generate_data(20 * compressor.block_size());
+
+    auto r = compressor.write(data.data(), data.size());
+    if (r) {
+        r = compressor.finish();
+    }
+    ASSERT_FALSE(r);
+    ASSERT_EQ(r.error(), std::errc::no_space_on_device);
+
+    // Compressor is unusable after an error
+    ASSERT_EQ(compressor.write("x", 1).error(), std::errc::no_space_on_device);
+    ASSERT_EQ(compressor.finish().error(), std::errc::no_space_on_device);
+}
+
+TEST(CompressTest, LevelsAreApplied)
+{
+    auto data = generate_data(256 * 1024);
+
+    for (auto type : { CompressionType::Gzip, CompressionType::Lz4,
+                       CompressionType::Xz }) {
+        auto [min_level, max_level] = compression_level_range(type);
+
+        std::string output[2];
+        int levels[2] = { min_level, max_level };
+
+        for (size_t i = 0; i < 2; ++i) {
+            ParallelCompressor compressor({ type, levels[i], 2, false },
+                    [&](const void *buf, size_t size) -> oc::result<void> {
+                output[i].append(static_cast<const char *>(buf), size);
+                return oc::success();
+            });
+            compressor.set_block_size(64 * 1024);
+
+            ASSERT_TRUE(compressor.write(data.data(), data.size()));
+            ASSERT_TRUE(compressor.finish());
+            ASSERT_EQ(decompress(output[i]), data);
+        }
+
+        ASSERT_LT(output[1].size(), output[0].size());
+    }
+}
+
+TEST(CompressTest, InvalidLevelFailure)
+{
+    for (auto type : { CompressionType::Gzip, CompressionType::Lz4,
+                       CompressionType::Xz }) {
+        auto [min_level, max_level] = compression_level_range(type);
+
+        for (int level : { min_level - 1, max_level + 1 }) {
+            ParallelCompressor compressor({ type, level, 1, false },
+                    [](const void *, size_t) -> oc::result<void> {
+                return oc::success();
+            });
+
+            ASSERT_EQ(compressor.write("x", 1).error(),
+                      std::errc::invalid_argument);
+            ASSERT_EQ(compressor.finish().error(),
+                      std::errc::invalid_argument);
+        }
+    }
+}
+
+static std::string zstd_decompress(const std::string &data)
+{
+    size_t pos = 0;
+
+    Decompressor decompressor(CompressionType::Zstd,
+            [&](void *buf, size_t size) -> oc::result<size_t> {
+        auto n = std::min(size, data.size() - pos);
+        memcpy(buf, data.data() + pos, n);
+        pos += n;
+        return n;
+    });
+
+    std::string output;
+    char buf[16384];
+
+    while (true) {
+        auto n = decompressor.read(buf, sizeof(buf));
+        EXPECT_TRUE(n) << n.error().message();
+        if (!n || n.value() == 0) {
+            break;
+        }
+        output.append(buf, n.value());
+    }
+
+    return output;
+}
+
+TEST(CompressTest, ZstdRoundTrip)
+{
+    if (!compression_supported(CompressionType::Zstd)) {
+        ParallelCompressor compressor({ CompressionType::Zstd, {}, 1, false },
+                nullptr);
+        ASSERT_EQ(compressor.finish().error(),
+                  std::errc::function_not_supported);
+
+        Decompressor decompressor(CompressionType::Zstd, nullptr);
+        char c;
+        ASSERT_EQ(decompressor.read(&c, 1).error(),
+                  std::errc::function_not_supported);
+        return;
+    }
+
+    auto data = generate_data(1024 * 1024 + 12345);
+
+    for (bool long_distance : { false, true }) {
+        std::string output;
+
+        ParallelCompressor compressor(
+                { CompressionType::Zstd, 19, 2, long_distance },
+                [&](const void *buf, size_t size) -> oc::result<void> {
+            output.append(static_cast<const char *>(buf), size);
+            return oc::success();
+        });
+
+        for (size_t i = 0; i < data.size(); i += 100000) {
+            auto n = std::min<size_t>(100000, data.size() - i);
+            ASSERT_TRUE(compressor.write(data.data() + i, n));
+        }
+        ASSERT_TRUE(compressor.finish());
+
+        ASSERT_LT(output.size(), data.size());
+        ASSERT_EQ(zstd_decompress(output), data);
+    }
+}
+
+TEST(CompressTest, ZstdTruncatedStreamFailure)
+{
+    if (!compression_supported(CompressionType::Zstd)) {
+        return;
+    }
+
+    auto data = generate_data(100000);
+    std::string output;
+
+    ParallelCompressor compressor({ CompressionType::Zstd, {}, 1, false },
+            [&](const void *buf, size_t size) -> oc::result<void> {
+        output.append(static_cast<const char *>(buf), size);
+        return oc::success();
+    });
+    ASSERT_TRUE(compressor.write(data.data(), data.size()));
+    ASSERT_TRUE(compressor.finish());
+
+    output.resize(output.size() / 2);
+    size_t pos = 0;
+
+    Decompressor decompressor(CompressionType::Zstd,
+            [&](void *buf, size_t size) -> oc::result<size_t> {
+        auto n = std::min(size, output.size() - pos);
+        memcpy(buf, output.data() + pos, n);
+        pos += n;
+        return n;
+    });
+
+    char buf[16384];
+    oc::result<size_t> n = oc::success(size_t(0));
+    do {
+        n = decompressor.read(buf, sizeof(buf));
+    } while (n && n.value() > 0);
+
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mbutil/fastcdc.h"
+
+using namespace mb;
+using namespace mb::util;
+
+static std::string generate_random(size_t size, uint32_t seed)
+{
+    std::string data;
+    data.reserve(size);
+
+    uint32_t state = seed;
+    while (data.size() < size) {
+        state = state * 1103515245u + 12345u;
+        data += static_cast<char>(state >> 24);
+    }
+
+    return data;
+}
+
+static std::vector<std::string> chunk(const FastCdc &cdc,
+                                      const std::string &data,
+                                      size_t write_size)
+{
+    std::vector<std::string> chunks;
+
+    FastCdcChunker chunker(cdc, [&](const void *buf, size_t size)
+            -> oc::result<void> {
+        chunks.emplace_back(static_cast<const char *>(buf), size);
+        return oc::success();
+    });
+
+    for (size_t i = 0; i < data.size(); i += write_size) {
+        auto n = std::min(write_size, data.size() - i);
+        EXPECT_TRUE(chunker.write(data.data() + i, n));
+    }
+    EXPECT_TRUE(chunker.finish());
+
+    return chunks;
+}
+
+TEST(FastCdcTest, SizesAreNormalized)
+{
+    FastCdc cdc(1, 0, 0);
+    ASSERT_EQ(cdc.min_size(), 64u);
+    ASSERT_EQ(cdc.avg_size(), 64u);
+    ASSERT_EQ(cdc.max_size(), 64u);
+}
+
+TEST(FastCdcTest, ChunkSizesAreBounded)
+{
+    FastCdc cdc(256, 1024, 4096);
+    auto data = generate_random(1024 * 1024, 1);
+
+    auto chunks = chunk(cdc, data, 1000);
+    ASSERT_GT(chunks.size(), 1u);
+
+    std::string joined;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (i != chunks.size() - 1) {
+            ASSERT_GE(chunks[i].size(), cdc.min_size());
+        }
+        ASSERT_LE(chunks[i].size(), cdc.max_size());
+        joined += chunks[i];
+    }
+    ASSERT_EQ(joined, data);
+
+    // Normalized chunking should keep the mean close to the average size
+    auto mean = data.size() / chunks.size();
+    ASSERT_GT(mean, cdc.avg_size() / 2);
+    ASSERT_LT(mean, cdc.avg_size() * 2);
+}
+
+TEST(FastCdcTest, ChunksDoNotDependOnWriteSize)
+{
+    FastCdc cdc(256, 1024, 4096);
+    auto data = generate_random(256 * 1024, 2);
+
+    auto expected = chunk(cdc, data, data.size());
+    ASSERT_EQ(chunk(cdc, data, 1), expected);
+    ASSERT_EQ(chunk(cdc, data, 4097), expected);
+}
+
+TEST(FastCdcTest, BoundariesResynchronizeAfterInsertion)
+{
+    FastCdc cdc(256, 1024, 4096);
+    auto data = generate_random(256 * 1024, 3);
+
+    auto modified = data;
+    modified.insert(data.size() / 2, "inserted bytes");
+
+    auto original_chunks = chunk(cdc, data, data.size());
+    auto modified_chunks = chunk(cdc, modified, modified.size());
+
+    size_t shared = 0;
+    for (auto const &c : modified_chunks) {
+        if (std::find(original_chunks.begin(), original_chunks.end(), c)
+                != original_chunks.end()) {
+            ++shared;
+        }
+    }
+
+    // Only the chunks around the insertion point should differ
+    ASSERT_GE(shared + 3, original_chunks.size());
+}
+
+TEST(FastCdcTest, EmptyStreamHasNoChunks)
+{
+    FastCdc cdc;
+    ASSERT_TRUE(chunk(cdc, {}, 1).empty());
+}
+
+TEST(FastCdcTest, CallbackErrorIsPropagated)
+{
+    FastCdc cdc(64, 64, 64);
+    auto data = generate_random(1024, 4);
+
+    FastCdcChunker chunker(cdc, [](const void *, size_t) -> oc::result<void> {
+        return std::make_error_code(std::errc::io_error);
+    });
+
+    auto ret = chunker.write(data.data(), data.size());
+    if (ret) {
+        ret = chunker.finish();
+    }
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+struct archive;
+struct archive_entry;
+
+namespace mb
+{
+
+class Hasher;
+
+namespace util
+{
+class ChunkStore;
+}
+
+bool cdc_store_file(util::ChunkStore &store, archive *in, archive_entry *entry,
+                    std::string &content, Hasher *hasher);
+bool cdc_restore_file(util::ChunkStore &store, archive *in, archive *out,
+                      archive_entry *entry);
+
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+struct archive_entry;
+
+namespace mb
+{
+
+struct BackupManifestEntry
+{
+    // Path relative to the root of the backed up tree
+    std::string path;
+    // File type and permissions
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    // Size of the file contents (0 for anything but regular files)
+    uint64_t size;
+    int64_t mtime_sec;
+    long mtime_nsec;
+    uint64_t inode;
+    // CRC32 of the sorted extended attribute names and values
+    uint32_t xattrs_crc32;
+    // Hex-encoded SHA-256 of the contents (empty if not a regular file)
+    std::string sha256;
+
+    bool same_metadata(const BackupManifestEntry &other) const;
+};
+
+struct BackupManifest
+{
+    // Backup that this backup is an increment of (empty for full backups).
+    // Relative paths are relative to the directory of this backup.
+    std::string parent;
+    std::unordered_map<std::string, BackupManifestEntry> entries;
+
+    bool load_file(const std::string &path, bool header_only = false);
+    bool save_file(const std::string &path) const;
+};
+
+bool manifest_entry_from_archive_entry(archive_entry *entry,
+                                       BackupManifestEntry &out);
+
+std::vector<std::string> manifest_deleted_paths(const BackupManifest &parent,
+                                                const BackupManifest &current);
+
+bool load_path_list(const std::string &path, std::vector<std::string> &out);
+bool save_path_list(const std::string &path,
+                    const std::vector<std::string> &paths);
+
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Run backup tasks concurrently
+ *
+ * Tasks run on at most `jobs` threads. Tasks with the same non-empty resource
+ * key (eg. the device they read from) never run at the same time and start in
+ * the order they were added.
+ *
+ * Log output is kept in the order the tasks were added. The earliest
+ * unfinished task logs directly, while the output of later tasks is buffered
+ * until all tasks before them have finished.
+ */
+class BackupScheduler final
+{
+public:
+    using TaskFn = std::function<bool()>;
+
+    explicit BackupScheduler(unsigned int jobs);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BackupScheduler)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(BackupScheduler)
+
+    void add(std::string resource, TaskFn fn);
+
+    bool run();
+
+private:
+    struct Task
+    {
+        std::string resource;
+        TaskFn fn;
+    };
+
+    unsigned int m_jobs;
+    std::vector<Task> m_tasks;
+};
+
+}
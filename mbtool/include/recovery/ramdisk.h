@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+struct RamdiskEntry
+{
+    // Path relative to the root of the ramdisk (no leading slash)
+    std::string path;
+    // File type and permission bits
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    time_t mtime;
+    dev_t rdev;
+    // Contents of regular files
+    std::string data;
+    // Target of symlinks
+    std::string symlink;
+};
+
+/*!
+ * \brief In-memory representation of a cpio ramdisk
+ *
+ * The archive is decompressed and parsed directly from a stream and written
+ * back out with the same format and compression filters, so patching a
+ * ramdisk never has to extract it to storage. Entries are kept in their
+ * original order. Hard links are stored as independent copies of their
+ * targets.
+ */
+class Ramdisk
+{
+public:
+    //! Read up to `size` bytes. Returns 0 at the end of the stream.
+    using ReadFn = oc::result<size_t>(void *buf, size_t size);
+    //! Write exactly `size` bytes
+    using WriteFn = oc::result<void>(const void *buf, size_t size);
+
+    Ramdisk();
+
+    bool load(const std::function<ReadFn> &reader);
+    bool load(const void *data, size_t size);
+    bool save(const std::function<WriteFn> &writer) const;
+    bool save(std::string &out) const;
+
+    RamdiskEntry * find(const std::string &path);
+    bool exists(const std::string &path) const;
+
+    RamdiskEntry & add_file(const std::string &path, std::string data,
+                            mode_t perm);
+    RamdiskEntry & add_symlink(const std::string &path,
+                               const std::string &target);
+    bool remove(const std::string &path);
+    bool rename(const std::string &from, const std::string &to);
+
+    const std::vector<RamdiskEntry> & entries() const;
+
+private:
+    RamdiskEntry & add_entry(const std::string &path);
+
+    std::vector<RamdiskEntry> m_entries;
+    int m_format;
+    std::vector<int> m_filters;
+};
+
+}
@@ -25,7 +25,9 @@
 namespace mb
 {
 
-using RamdiskPatcherFn = bool(const std::string &dir);
+class Ramdisk;
+
+using RamdiskPatcherFn = bool(Ramdisk &ramdisk);
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
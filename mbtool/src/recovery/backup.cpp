@@ -20,10 +20,13 @@
 #include "recovery/backup.h"
 
 #include <algorithm>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <dirent.h>
@@ -37,6 +40,7 @@
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/archive.h"
+#include "mbutil/chunk_store.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
@@ -46,6 +50,9 @@
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "recovery/backup_cdc.h"
+#include "recovery/backup_manifest.h"
+#include "recovery/backup_scheduler.h"
 #include "recovery/installer_util.h"
 #include "recovery/image.h"
 #include "util/multiboot.h"
@@ -70,6 +77,17 @@ enum class BackupTarget : uint8_t
 MB_DECLARE_FLAGS(BackupTargets, BackupTarget)
 MB_DECLARE_OPERATORS_FOR_FLAGS(BackupTargets)
 
+enum class BackupFormat : uint8_t
+{
+    // Archives containing the file contents
+    Tar,
+    // Archives whose file contents are replaced by lists of chunks in a
+    // deduplicating chunk store
+    Cdc,
+};
+
+// Images are mounted at <BACKUP_MNT_DIR>-<backup name> so that targets can be
+// processed concurrently
 constexpr char BACKUP_MNT_DIR[]            = "/mb_mnt";
 
 constexpr char BACKUP_NAME_PREFIX_SYSTEM[] = "system";
@@ -78,6 +96,14 @@ constexpr char BACKUP_NAME_PREFIX_DATA[]   = "data";
 constexpr char BACKUP_NAME_BOOT_IMAGE[]    = "boot.img";
 constexpr char BACKUP_NAME_CONFIG[]        = "config.json";
 constexpr char BACKUP_NAME_THUMBNAIL[]     = "thumbnail.webp";
+constexpr char BACKUP_NAME_CHUNK_STORE[]   = "chunk_store";
+
+constexpr char BACKUP_SUFFIX_MANIFEST[]    = ".manifest";
+constexpr char BACKUP_SUFFIX_DELETED[]     = ".deleted";
+constexpr char BACKUP_SUFFIX_CDC[]         = ".cdc";
+
+// Default chunk store, relative to the directory containing the backups
+constexpr char DEFAULT_CHUNK_STORE_NAME[]  = ".chunks";
 
 // Max file size for FAT32
 constexpr uint64_t DEFAULT_ARCHIVE_SPLIT_SIZE = UINT32_MAX - 1;
@@ -92,6 +118,20 @@ enum class Result
     BootImageUnpatched,
 };
 
+// One archive to extract when restoring a partition. A full backup has a
+// single step, while an incremental backup has one step for each backup in
+// its chain, starting with the full backup.
+struct RestoreStep
+{
+    std::string archive;
+    util::CompressionType compression;
+    bool is_split;
+    // Paths to delete before extracting the archive
+    std::vector<std::string> deleted_paths;
+    // Chunk store for CDC archives (empty for tar archives)
+    std::string chunk_store;
+};
+
 static struct CompressionMap
 {
     util::CompressionType type;
@@ -102,6 +142,7 @@ static struct CompressionMap
     { util::CompressionType::Lz4,  "lz4",   ".tar.lz4" },
     { util::CompressionType::Gzip, "gzip",  ".tar.gz" },
     { util::CompressionType::Xz,   "xz",    ".tar.xz" },
+    { util::CompressionType::Zstd, "zstd",  ".tar.zst" },
     { util::CompressionType::None, nullptr, nullptr }
 };
 
@@ -184,11 +225,53 @@ static std::string find_compressed_backup(const std::string &backup_dir,
     return {};
 }
 
+/*!
+ * \brief Fill in digests of hard links whose data was written for another path
+ */
+static void fill_hard_link_digests(BackupManifest &manifest)
+{
+    std::unordered_map<uint64_t, std::string> digests;
+
+    for (auto const &[_, entry] : manifest.entries) {
+        if (S_ISREG(entry.mode) && !entry.sha256.empty()) {
+            digests.emplace(entry.inode, entry.sha256);
+        }
+    }
+
+    for (auto &[_, entry] : manifest.entries) {
+        if (S_ISREG(entry.mode) && entry.sha256.empty()) {
+            if (auto it = digests.find(entry.inode); it != digests.end()) {
+                entry.sha256 = it->second;
+            }
+        }
+    }
+}
+
+/*!
+ * \brief Backup directory to an archive
+ *
+ * \param output_file Output archive
+ * \param directory Directory to backup
+ * \param exclusions List of top-level directories to exclude from the backup
+ * \param compression Compression options
+ * \param split_archive_size Max size for each split file
+ * \param chunk_store If not null, file contents are stored in this chunk store
+ *                    and the archive only contains the lists of chunks
+ * \param parent_manifest If not null, only paths that are new or have
+ *                        different metadata compared to this manifest are
+ *                        added to the archive
+ * \param manifest Manifest to fill in with all paths under \a directory
+ *
+ * \return Whether the backup was successful
+ */
 static bool backup_directory(const std::string &output_file,
                              const std::string &directory,
                              const std::vector<std::string> &exclusions,
-                             util::CompressionType compression,
-                             uint64_t split_archive_size)
+                             const util::CompressionOptions &compression,
+                             uint64_t split_archive_size,
+                             util::ChunkStore *chunk_store,
+                             const BackupManifest *parent_manifest,
+                             BackupManifest &manifest)
 {
     ScopedDIR dp(opendir(directory.c_str()), closedir);
     if (!dp) {
@@ -217,66 +300,211 @@ static bool backup_directory(const std::string &output_file,
         return false;
     }
 
-    return util::libarchive_tar_create(output_file, directory, contents,
-                                       compression, split_archive_size);
+    size_t changed = 0;
+
+    auto filter = [&](archive_entry *entry) {
+        BackupManifestEntry item;
+        if (!manifest_entry_from_archive_entry(entry, item)) {
+            return true;
+        }
+
+        bool include = true;
+
+        if (parent_manifest) {
+            auto it = parent_manifest->entries.find(item.path);
+            if (it != parent_manifest->entries.end()
+                    && it->second.same_metadata(item)) {
+                item.sha256 = it->second.sha256;
+                include = false;
+            }
+        }
+
+        if (include) {
+            ++changed;
+        }
+
+        auto key = item.path;
+        manifest.entries.insert_or_assign(std::move(key), std::move(item));
+
+        return include;
+    };
+
+    auto digest_fn = [&](archive_entry *entry, const HashDigest &digest) {
+        auto it = manifest.entries.find(archive_entry_pathname(entry));
+        if (it != manifest.entries.end()) {
+            it->second.sha256 = util::hex_string(digest.data(), digest.size());
+        }
+    };
+
+    util::TarContentFn content_fn;
+
+    if (chunk_store) {
+        content_fn = [&](archive *in, archive_entry *entry,
+                         std::string &content) {
+            Hasher hasher;
+
+            if (auto r = hasher.init(HashAlgorithm::Sha256); !r) {
+                LOGE("%s: Failed to initialize hasher: %s",
+                     archive_entry_pathname(entry),
+                     r.error().message().c_str());
+                return false;
+            }
+
+            if (!cdc_store_file(*chunk_store, in, entry, content, &hasher)) {
+                return false;
+            }
+
+            auto digest = hasher.finish();
+            if (!digest) {
+                LOGE("%s: Failed to compute hash: %s",
+                     archive_entry_pathname(entry),
+                     digest.error().message().c_str());
+                return false;
+            }
+
+            digest_fn(entry, digest.value());
+
+            return true;
+        };
+    }
+
+    if (!util::libarchive_tar_create(output_file, directory, contents,
+                                     compression, split_archive_size,
+                                     filter, digest_fn, content_fn)) {
+        return false;
+    }
+
+    fill_hard_link_digests(manifest);
+
+    if (parent_manifest) {
+        LOGI("%s: Archived %zu of %zu paths", output_file.c_str(),
+             changed, manifest.entries.size());
+    }
+
+    return true;
+}
+
+static bool is_safe_relative_path(const std::string &path)
+{
+    if (path.empty() || path[0] == '/') {
+        return false;
+    }
+
+    for (auto const &component : split_sv(path, '/')) {
+        if (component == "..") {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-static bool restore_directory(const std::string &input_file,
+static bool restore_directory(const std::vector<RestoreStep> &steps,
                               const std::string &directory,
-                              const std::vector<std::string> &exclusions,
-                              util::CompressionType compression,
-                              bool is_split)
+                              const std::vector<std::string> &exclusions)
 {
     if (!wipe_directory(directory, exclusions)) {
         return false;
     }
 
-    return util::libarchive_tar_extract(input_file, directory, {}, compression,
-                                        is_split);
+    for (auto const &step : steps) {
+        for (auto const &path : step.deleted_paths) {
+            if (!is_safe_relative_path(path)) {
+                LOGE("%s: Refusing to delete unsafe path: %s",
+                     step.archive.c_str(), path.c_str());
+                return false;
+            }
+
+            std::string full_path(directory);
+            full_path += '/';
+            full_path += path;
+
+            if (auto r = util::delete_recursive(full_path); !r) {
+                LOGE("%s: Failed to delete: %s",
+                     full_path.c_str(), r.error().message().c_str());
+                return false;
+            }
+        }
+
+        util::ChunkStore chunk_store;
+        util::TarExtractFn extract_fn;
+
+        if (!step.chunk_store.empty()) {
+            if (auto r = chunk_store.open(step.chunk_store); !r) {
+                LOGE("%s: Failed to open chunk store: %s",
+                     step.chunk_store.c_str(), r.error().message().c_str());
+                return false;
+            }
+
+            extract_fn = [&](archive *in, archive *out, archive_entry *entry) {
+                return cdc_restore_file(chunk_store, in, out, entry);
+            };
+        }
+
+        if (!util::libarchive_tar_extract(step.archive, directory, {},
+                                          step.compression, step.is_split,
+                                          extract_fn)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static std::string image_mount_point(const std::string &name)
+{
+    std::string mount_point(BACKUP_MNT_DIR);
+    mount_point += '-';
+    mount_point += name;
+    return mount_point;
 }
 
 static bool backup_image(const std::string &output_file,
                          const std::string &image,
+                         const std::string &mount_point,
                          const std::vector<std::string> &exclusions,
-                         util::CompressionType compression,
-                         uint64_t split_archive_size)
+                         const util::CompressionOptions &compression,
+                         uint64_t split_archive_size,
+                         util::ChunkStore *chunk_store,
+                         const BackupManifest *parent_manifest,
+                         BackupManifest &manifest)
 {
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    if (auto r = util::mkdir_recursive(mount_point, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_point.c_str(), r.error().message().c_str());
         return false;
     }
 
     fsck_ext4_image(image);
 
     if (auto ret = util::mount(
-            image, BACKUP_MNT_DIR, "ext4", MS_RDONLY, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
-             ret.error().message().c_str());
+            image, mount_point, "ext4", MS_RDONLY, ""); !ret) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(),
+             mount_point.c_str(), ret.error().message().c_str());
         return false;
     }
 
-    bool ret = backup_directory(output_file, BACKUP_MNT_DIR, exclusions,
-                                compression, split_archive_size);
+    bool ret = backup_directory(output_file, mount_point, exclusions,
+                                compression, split_archive_size, chunk_store,
+                                parent_manifest, manifest);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_point); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_point.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
-    rmdir(BACKUP_MNT_DIR);
+    rmdir(mount_point.c_str());
 
     return ret;
 }
 
-static bool restore_image(const std::string &input_file,
+static bool restore_image(const std::vector<RestoreStep> &steps,
                           const std::string &image,
+                          const std::string &mount_point,
                           uint64_t size,
-                          const std::vector<std::string> &exclusions,
-                          util::CompressionType compression,
-                          bool is_split)
+                          const std::vector<std::string> &exclusions)
 {
     if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
         LOGE("%s: Failed to create parent directory: %s",
@@ -297,31 +525,30 @@ static bool restore_image(const std::string &input_file,
         }
     }
 
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    if (auto r = util::mkdir_recursive(mount_point, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_point.c_str(), r.error().message().c_str());
         return false;
     }
 
     fsck_ext4_image(image);
 
-    if (auto ret = util::mount(image, BACKUP_MNT_DIR, "ext4", 0, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
-             ret.error().message().c_str());
+    if (auto ret = util::mount(image, mount_point, "ext4", 0, ""); !ret) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(),
+             mount_point.c_str(), ret.error().message().c_str());
         return false;
     }
 
-    bool ret = restore_directory(input_file, BACKUP_MNT_DIR, exclusions,
-                                 compression, is_split);
+    bool ret = restore_directory(steps, mount_point, exclusions);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_point); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_point.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
-    rmdir(BACKUP_MNT_DIR);
+    rmdir(mount_point.c_str());
 
     return ret;
 }
@@ -504,13 +731,23 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
 /*!
  * \brief Backup a partition for a ROM
  *
+ * Along with the archive, a manifest of all paths in the partition is written
+ * to `<name>.manifest`. If \a parent_dir is not empty and contains a manifest
+ * for the partition, only paths that changed since that backup are archived
+ * and the paths that were deleted are written to `<name>.deleted`.
+ *
  * \param path Path to mountpoint/directory or image
  * \param backup_dir Backup directory
- * \param archive_name Backup archive name
+ * \param name Backup name (without the archive extension)
  * \param is_image Whether \a path is an ext4 image
  * \param exclusions List of top-level directories to exclude from the backup
- * \param compression Compression type
+ * \param compression Compression options
  * \param split_archive_size Max size for each split file
+ * \param chunk_store If not null, back up to a CDC archive (`<name>.cdc.*`)
+ *                    with the file contents stored in this chunk store
+ * \param parent_dir Backup directory to make an incremental backup from (or
+ *                   empty for a full backup)
+ * \param parent_ref Reference to \a parent_dir to store in the manifest
  *
  * \return Result::Succeeded if the directory/image was successfully backed up
  *         Result::Failed if an error occured
@@ -518,80 +755,132 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
  */
 static Result backup_partition(const std::string &path,
                                const std::string &backup_dir,
-                               const std::string &archive_name,
+                               const std::string &name,
                                bool is_image,
                                const std::vector<std::string> &exclusions,
-                               util::CompressionType compression,
-                               uint64_t split_archive_size)
+                               const util::CompressionOptions &compression,
+                               uint64_t split_archive_size,
+                               util::ChunkStore *chunk_store,
+                               const std::string &parent_dir,
+                               const std::string &parent_ref)
 {
     std::string archive(backup_dir);
     archive += '/';
-    archive += archive_name;
+    archive += get_compressed_backup_name(
+            chunk_store ? name + BACKUP_SUFFIX_CDC : name, compression.type);
 
-    bool ret = false;
+    std::string manifest_path(backup_dir);
+    manifest_path += '/';
+    manifest_path += name;
+    manifest_path += BACKUP_SUFFIX_MANIFEST;
 
     struct stat sb;
-    if (stat(path.c_str(), &sb) == 0) {
-        LOGI("=== Backing up %s ===", path.c_str());
-        if (is_image) {
-            ret = backup_image(archive, path, exclusions, compression,
-                               split_archive_size);
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGW("=== %s does not exist ===", path.c_str());
+        return Result::FilesMissing;
+    }
+
+    LOGI("=== Backing up %s ===", path.c_str());
+
+    BackupManifest parent_manifest;
+    bool incremental = false;
+
+    if (!parent_dir.empty()) {
+        std::string parent_manifest_path(parent_dir);
+        parent_manifest_path += '/';
+        parent_manifest_path += name;
+        parent_manifest_path += BACKUP_SUFFIX_MANIFEST;
+
+        if (stat(parent_manifest_path.c_str(), &sb) == 0) {
+            if (!parent_manifest.load_file(parent_manifest_path)) {
+                return Result::Failed;
+            }
+            incremental = true;
         } else {
-            ret = backup_directory(archive, path, exclusions, compression,
-                                   split_archive_size);
+            LOGW("%s: No manifest in parent backup; backing up all files",
+                 parent_manifest_path.c_str());
         }
+    }
+
+    BackupManifest manifest;
+    if (incremental) {
+        manifest.parent = parent_ref;
+    }
+
+    bool ret;
+
+    if (is_image) {
+        ret = backup_image(archive, path, image_mount_point(name), exclusions,
+                           compression, split_archive_size, chunk_store,
+                           incremental ? &parent_manifest : nullptr, manifest);
     } else {
-        LOGW("=== %s does not exist ===", path.c_str());
-        return Result::FilesMissing;
+        ret = backup_directory(archive, path, exclusions, compression,
+                               split_archive_size, chunk_store,
+                               incremental ? &parent_manifest : nullptr,
+                               manifest);
     }
 
-    return ret ? Result::Succeeded : Result::Failed;
+    if (!ret || !manifest.save_file(manifest_path)) {
+        return Result::Failed;
+    }
+
+    if (incremental) {
+        std::string deleted_path(backup_dir);
+        deleted_path += '/';
+        deleted_path += name;
+        deleted_path += BACKUP_SUFFIX_DELETED;
+
+        auto deleted = manifest_deleted_paths(parent_manifest, manifest);
+        if (!save_path_list(deleted_path, deleted)) {
+            return Result::Failed;
+        }
+
+        LOGI("%s: %zu paths deleted since parent backup",
+             archive.c_str(), deleted.size());
+    }
+
+    return Result::Succeeded;
 }
 
 /*!
  * \brief Restore a partition for a ROM
  *
  * \param path Path to mountpoint/directory or image
- * \param backup_dir Backup directory
- * \param archive_name Backup archive name
+ * \param name Backup name (without the archive extension)
+ * \param steps Archives to extract, as returned by find_backup_chain()
  * \param is_image Whether \a path is an ext4 image
  * \param exclusions List of top-level directories to exclude from the wipe
  *                   process before restoring
- * \param compression Compression type
- * \param is_split Whether the archive is split into multiple chunks
  *
  * \return Result::Succeeded if the directory/image was successfully restored
  *         Result::Failed if an error occured
- *         Result::FilesMissing if \a archive_name does not exist in
- *         \a backup_dir
+ *         Result::FilesMissing if the first archive does not exist
  */
 static Result restore_partition(const std::string &path,
-                                const std::string &backup_dir,
-                                const std::string &archive_name,
+                                const std::string &name,
+                                const std::vector<RestoreStep> &steps,
                                 bool is_image,
                                 uint64_t image_size,
-                                const std::vector<std::string> &exclusions,
-                                util::CompressionType compression,
-                                bool is_split)
+                                const std::vector<std::string> &exclusions)
 {
-    std::string archive(backup_dir);
-    archive += '/';
-    archive += archive_name;
-
-    std::string split_archive(archive);
-    split_archive += ".0";
+    std::string archive(steps.front().archive);
+    if (steps.front().is_split) {
+        archive += ".0";
+    }
 
     bool ret = false;
 
     struct stat sb;
-    if (stat(is_split ? split_archive.c_str() : archive.c_str(), &sb) == 0) {
+    if (stat(archive.c_str(), &sb) == 0) {
         LOGI("=== Restoring to %s ===", path.c_str());
+        if (steps.size() > 1) {
+            LOGI("Replaying %zu incremental backups", steps.size() - 1);
+        }
         if (is_image) {
-            ret = restore_image(archive, path, image_size, exclusions,
-                                compression, is_split);
+            ret = restore_image(steps, path, image_mount_point(name),
+                                image_size, exclusions);
         } else {
-            ret = restore_directory(archive, path, exclusions, compression,
-                                    is_split);
+            ret = restore_directory(steps, path, exclusions);
         }
     } else {
         LOGW("=== %s does not exist ===", archive.c_str());
@@ -601,10 +890,169 @@ static Result restore_partition(const std::string &path,
     return ret ? Result::Succeeded : Result::Failed;
 }
 
+/*!
+ * \brief Find the chunk store used by the CDC archives in a backup
+ *
+ * \param backup_dir Backup directory
+ * \param chunk_store Output path to chunk store
+ *
+ * \return Whether the chunk store was found
+ */
+static bool find_chunk_store(const std::string &backup_dir,
+                             std::string &chunk_store)
+{
+    std::string ref_path(backup_dir);
+    ref_path += '/';
+    ref_path += BACKUP_NAME_CHUNK_STORE;
+
+    auto ref = util::file_first_line(ref_path);
+    if (!ref) {
+        LOGE("%s: Failed to read chunk store location: %s",
+             ref_path.c_str(), ref.error().message().c_str());
+        return false;
+    } else if (ref.value().empty()) {
+        LOGE("%s: Chunk store location is empty", ref_path.c_str());
+        return false;
+    }
+
+    // Relative paths are relative to the backup directory
+    if (ref.value()[0] == '/') {
+        chunk_store = std::move(ref.value());
+    } else {
+        chunk_store = backup_dir;
+        chunk_store += '/';
+        chunk_store += ref.value();
+    }
+
+    struct stat sb;
+    if (stat(chunk_store.c_str(), &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        LOGE("%s: Chunk store not found", chunk_store.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Find archives needed to restore a partition
+ *
+ * If the backup is incremental, the chain of parent backups is followed until
+ * a full backup is found.
+ *
+ * \param backup_dir Backup directory
+ * \param name Backup name (without the archive extension)
+ * \param steps Output list of archives, starting with the full backup
+ *
+ * \return Whether all backups in the chain were found
+ */
+static bool find_backup_chain(const std::string &backup_dir,
+                              const std::string &name,
+                              std::vector<RestoreStep> &steps)
+{
+    std::unordered_set<std::string> visited;
+    std::string dir(backup_dir);
+
+    steps.clear();
+
+    while (true) {
+        auto real_dir = util::real_path(dir);
+        if (!real_dir) {
+            LOGE("%s: Failed to resolve path: %s",
+                 dir.c_str(), real_dir.error().message().c_str());
+            return false;
+        } else if (!visited.insert(real_dir.value()).second) {
+            LOGE("%s: Backup chain contains a loop", dir.c_str());
+            return false;
+        }
+
+        RestoreStep step;
+
+        std::string archive_name = find_compressed_backup(
+                dir, name, step.compression, step.is_split);
+        if (archive_name.empty()) {
+            archive_name = find_compressed_backup(
+                    dir, name + BACKUP_SUFFIX_CDC, step.compression,
+                    step.is_split);
+            if (archive_name.empty()) {
+                LOGE("%s: Backup of %s not found", dir.c_str(), name.c_str());
+                return false;
+            } else if (!find_chunk_store(dir, step.chunk_store)) {
+                return false;
+            }
+        }
+
+        step.archive = dir;
+        step.archive += '/';
+        step.archive += archive_name;
+
+        std::string manifest_path(dir);
+        manifest_path += '/';
+        manifest_path += name;
+        manifest_path += BACKUP_SUFFIX_MANIFEST;
+
+        // Backups without a manifest are always full backups
+        BackupManifest manifest;
+        struct stat sb;
+        if (stat(manifest_path.c_str(), &sb) == 0
+                && !manifest.load_file(manifest_path, true)) {
+            return false;
+        }
+
+        if (!manifest.parent.empty()) {
+            std::string deleted_path(dir);
+            deleted_path += '/';
+            deleted_path += name;
+            deleted_path += BACKUP_SUFFIX_DELETED;
+
+            if (!load_path_list(deleted_path, step.deleted_paths)) {
+                return false;
+            }
+        }
+
+        steps.push_back(std::move(step));
+
+        if (manifest.parent.empty()) {
+            break;
+        } else if (manifest.parent[0] == '/') {
+            dir = manifest.parent;
+        } else {
+            dir += '/';
+            dir += manifest.parent;
+        }
+    }
+
+    std::reverse(steps.begin(), steps.end());
+
+    return true;
+}
+
+/*!
+ * \brief Get key identifying the device that a path is stored on
+ *
+ * Backup targets on the same device are not backed up concurrently since that
+ * would only add seeking.
+ *
+ * \return Device ID or an empty string if \a path does not exist
+ */
+static std::string device_key(const std::string &path)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return {};
+    }
+
+    return format("%ju", static_cast<uintmax_t>(sb.st_dev));
+}
+
 static bool backup_rom(const std::shared_ptr<Rom> &rom,
                        const std::string &output_dir, BackupTargets targets,
-                       util::CompressionType compression,
-                       uint64_t split_archive_size)
+                       const util::CompressionOptions &compression,
+                       uint64_t split_archive_size,
+                       unsigned int jobs,
+                       const std::string &chunk_store_dir,
+                       const std::string &chunk_store_ref,
+                       const std::string &parent_dir,
+                       const std::string &parent_ref)
 {
     if (!targets) {
         LOGE("No backup targets specified");
@@ -638,13 +1086,38 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
         LOGI("             %s", thumbnail_path.c_str());
     }
     LOGI("- Backup directory: %s", output_dir.c_str());
+    if (jobs > 1) {
+        LOGI("- Concurrent targets: %u", jobs);
+    }
+    if (!chunk_store_dir.empty()) {
+        LOGI("- Chunk store: %s", chunk_store_dir.c_str());
+    }
+    if (!parent_dir.empty()) {
+        LOGI("- Incremental from: %s", parent_dir.c_str());
+    }
 
-    std::string output_system = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_SYSTEM, compression);
-    std::string output_cache = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_CACHE, compression);
-    std::string output_data = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_DATA, compression);
+    util::ChunkStore chunk_store;
+
+    if (!chunk_store_dir.empty()) {
+        if (auto r = chunk_store.open(chunk_store_dir); !r) {
+            LOGE("%s: Failed to open chunk store: %s",
+                 chunk_store_dir.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        std::string ref_path(output_dir);
+        ref_path += '/';
+        ref_path += BACKUP_NAME_CHUNK_STORE;
+
+        if (auto r = util::file_write_string(ref_path, chunk_store_ref + '\n');
+                !r) {
+            LOGE("%s: Failed to write file: %s",
+                 ref_path.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    util::ChunkStore *store = chunk_store_dir.empty() ? nullptr : &chunk_store;
 
     // Backup boot image
     if (targets & BackupTarget::Boot
@@ -658,37 +1131,67 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
         return false;
     }
 
+    // Split the compression threads between the targets that may run at the
+    // same time so that concurrent jobs don't multiply the CPU and memory use
+    util::CompressionOptions job_compression(compression);
+    if (jobs > 1) {
+        job_compression.threads =
+                std::max(1u, util::compression_threads(compression) / jobs);
+    }
+
+    // Partitions on different devices are backed up concurrently
+    BackupScheduler scheduler(jobs);
+
     // Backup system
     if (targets & BackupTarget::System) {
-        Result ret = backup_partition(
-                system_path, output_dir, output_system,
-                rom->system_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        scheduler.add(device_key(system_path), [&] {
+            Result ret = backup_partition(
+                    system_path, output_dir, BACKUP_NAME_PREFIX_SYSTEM,
+                    rom->system_is_image, { "multiboot" }, job_compression,
+                    split_archive_size, store, parent_dir, parent_ref);
+            return ret != Result::Failed;
+        });
     }
 
     // Backup cache
     if (targets & BackupTarget::Cache) {
-        Result ret = backup_partition(
-                cache_path, output_dir, output_cache,
-                rom->cache_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        scheduler.add(device_key(cache_path), [&] {
+            Result ret = backup_partition(
+                    cache_path, output_dir, BACKUP_NAME_PREFIX_CACHE,
+                    rom->cache_is_image, { "multiboot" }, job_compression,
+                    split_archive_size, store, parent_dir, parent_ref);
+            return ret != Result::Failed;
+        });
     }
 
     // Backup data
     if (targets & BackupTarget::Data) {
-        Result ret = backup_partition(
-                data_path, output_dir, output_data,
-                rom->data_is_image, { "media", "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
+        scheduler.add(device_key(data_path), [&] {
+            Result ret = backup_partition(
+                    data_path, output_dir, BACKUP_NAME_PREFIX_DATA,
+                    rom->data_is_image, { "media", "multiboot" },
+                    job_compression, split_archive_size, store, parent_dir,
+                    parent_ref);
+            return ret != Result::Failed;
+        });
+    }
+
+    if (!scheduler.run()) {
+        return false;
+    }
+
+    if (store) {
+        if (auto r = chunk_store.close(); !r) {
+            LOGE("%s: Failed to commit chunk store: %s",
+                 chunk_store_dir.c_str(), r.error().message().c_str());
             return false;
         }
+
+        auto stats = chunk_store.stats();
+        LOGI("Chunk store: %" PRIu64 " new chunks (%" PRIu64 " bytes, %"
+             PRIu64 " bytes compressed), %" PRIu64 " duplicate chunks (%"
+             PRIu64 " bytes)", stats.new_chunks, stats.new_bytes,
+             stats.stored_bytes, stats.dedup_chunks, stats.dedup_bytes);
     }
 
     return true;
@@ -762,19 +1265,16 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
             return false;
         }
 
-        util::CompressionType compression;
-        bool is_split;
+        std::vector<RestoreStep> steps;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_SYSTEM, compression, is_split);
-        if (path.empty()) {
+        if (!find_backup_chain(input_dir, BACKUP_NAME_PREFIX_SYSTEM, steps)) {
             LOGE("Backup of /system not found");
             return false;
         }
 
         Result ret = restore_partition(
-                system_path, input_dir, path, rom->system_is_image,
-                image_size.value(), {}, compression, is_split);
+                system_path, BACKUP_NAME_PREFIX_SYSTEM, steps,
+                rom->system_is_image, image_size.value(), {});
         if (ret == Result::Failed) {
             return false;
         }
@@ -782,19 +1282,16 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     // Restore cache
     if (targets & BackupTarget::Cache) {
-        util::CompressionType compression;
-        bool is_split;
+        std::vector<RestoreStep> steps;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_CACHE, compression, is_split);
-        if (path.empty()) {
+        if (!find_backup_chain(input_dir, BACKUP_NAME_PREFIX_CACHE, steps)) {
             LOGE("Backup of /cache not found");
             return false;
         }
 
         Result ret = restore_partition(
-                cache_path, input_dir, path, rom->cache_is_image,
-                DEFAULT_IMAGE_SIZE, {}, compression, is_split);
+                cache_path, BACKUP_NAME_PREFIX_CACHE, steps,
+                rom->cache_is_image, DEFAULT_IMAGE_SIZE, {});
         if (ret == Result::Failed) {
             return false;
         }
@@ -802,19 +1299,16 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     // Restore data
     if (targets & BackupTarget::Data) {
-        util::CompressionType compression;
-        bool is_split;
+        std::vector<RestoreStep> steps;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_DATA, compression, is_split);
-        if (path.empty()) {
+        if (!find_backup_chain(input_dir, BACKUP_NAME_PREFIX_DATA, steps)) {
             LOGE("Backup of /data not found");
             return false;
         }
 
         Result ret = restore_partition(
-                data_path, input_dir, path, rom->data_is_image,
-                DEFAULT_IMAGE_SIZE, { "media" }, compression, is_split);
+                data_path, BACKUP_NAME_PREFIX_DATA, steps,
+                rom->data_is_image, DEFAULT_IMAGE_SIZE, { "media" });
         if (ret == Result::Failed) {
             return false;
         }
@@ -910,6 +1404,23 @@ static void warn_selinux_context()
 
 static void backup_usage(FILE *stream)
 {
+    // Only list compression types available in this build. zstd is optional
+    // (MBP_ENABLE_ZSTD).
+    std::string compression_types;
+    for (auto it = g_compression_map; it->name; ++it) {
+        if (util::compression_supported(it->type)) {
+            if (!compression_types.empty()) {
+                compression_types += ", ";
+            }
+            compression_types += it->name;
+        }
+    }
+
+    const char *long_help =
+            util::compression_supported(util::CompressionType::Zstd)
+            ? "  --long           Use long-distance matching (zstd only)\n"
+            : "";
+
     fprintf(stream,
             "Usage: backup -r <romid> -t <targets> [OPTION...]\n\n"
             "Options:\n"
@@ -919,22 +1430,46 @@ static void backup_usage(FILE *stream)
             "                   Comma-separated list of targets to backup\n"
             "                   (Default: 'all')\n"
             "  -c, --compression <compression type>\n"
-            "                   Compression type (none, lz4, gzip, xz)\n"
+            "                   Compression type (%s)\n"
             "                   (Default: lz4)\n"
+            "  -l, --level <level>\n"
+            "                   Compression level (Default: depends on type)\n"
+            "%s"
             "  -s, --split-size <size>\n"
             "                   Split archive maximum size in bytes (0 to disable)\n"
             "                   (Default: %" PRIu64 " bytes)\n"
+            "  -T, --threads <count>\n"
+            "                   Number of compression threads (0 for one per CPU,\n"
+            "                   limited to 4 and by memory usage). The threads are\n"
+            "                   split between concurrent jobs.\n"
+            "                   (Default: 0)\n"
+            "  -j, --jobs <count>\n"
+            "                   Number of targets to back up at the same time\n"
+            "                   (Default: 1)\n"
             "  -d, --backupdir <directory>\n"
             "                   Directory to store backup\n"
+            "  --format <format>\n"
+            "                   Backup format (tar, cdc) (Default: tar)\n"
+            "  --chunk-store <directory>\n"
+            "                   Chunk store for the cdc format\n"
+            "                   (Default: %s in the backup's parent directory)\n"
+            "  --incremental-from <directory>\n"
+            "                   Only back up files that changed since an existing\n"
+            "                   backup\n"
             "  -f, --force      Allow overwriting old backup with the same name\n"
             "  -h, --help       Display this help message\n"
             "\n"
             "Valid backup targets: 'all' or some combination of the following:\n"
             "  system,cache,data,boot,config\n"
             "\n"
+            "The cdc format splits files into content-defined chunks and stores\n"
+            "each unique chunk only once in a chunk store that can be shared by\n"
+            "all backups. The archives only contain the lists of chunks.\n"
+            "\n"
             "NOTE: This tool is still in development and the arguments above\n"
             "have not yet been finalized.\n",
-            DEFAULT_ARCHIVE_SPLIT_SIZE);
+            compression_types.c_str(), long_help, DEFAULT_ARCHIVE_SPLIT_SIZE,
+            DEFAULT_CHUNK_STORE_NAME);
 }
 
 static void restore_usage(FILE *stream)
@@ -954,6 +1489,9 @@ static void restore_usage(FILE *stream)
             "Valid backup targets: 'all' or some combination of the following:\n"
             "  system,cache,data,boot,config\n"
             "\n"
+            "Restoring an incremental backup also requires all of the backups it\n"
+            "was based on. Restoring a cdc backup requires its chunk store.\n"
+            "\n"
             "NOTE: This tool is still in development and the arguments above\n"
             "have not yet been finalized.\n");
 }
@@ -962,15 +1500,29 @@ int backup_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:c:d:s:fh";
+    enum options : int {
+        OPTION_LONG             = CHAR_MAX + 1,
+        OPTION_INCREMENTAL_FROM = CHAR_MAX + 2,
+        OPTION_FORMAT           = CHAR_MAX + 3,
+        OPTION_CHUNK_STORE      = CHAR_MAX + 4,
+    };
+
+    static const char *short_options = "r:t:c:l:d:s:T:j:fh";
     static struct option long_options[] = {
-        {"romid",       required_argument, 0, 'r'},
-        {"targets",     required_argument, 0, 't'},
-        {"compression", required_argument, 0, 'c'},
-        {"backupdir",   required_argument, 0, 'd'},
-        {"split-size",  required_argument, 0, 's'},
-        {"force",       no_argument,       0, 'f'},
-        {"help",        no_argument,       0, 'h'},
+        {"romid",            required_argument, 0, 'r'},
+        {"targets",          required_argument, 0, 't'},
+        {"compression",      required_argument, 0, 'c'},
+        {"level",            required_argument, 0, 'l'},
+        {"long",             no_argument,       0, OPTION_LONG},
+        {"backupdir",        required_argument, 0, 'd'},
+        {"format",           required_argument, 0, OPTION_FORMAT},
+        {"chunk-store",      required_argument, 0, OPTION_CHUNK_STORE},
+        {"incremental-from", required_argument, 0, OPTION_INCREMENTAL_FROM},
+        {"split-size",       required_argument, 0, 's'},
+        {"threads",          required_argument, 0, 'T'},
+        {"jobs",             required_argument, 0, 'j'},
+        {"force",            no_argument,       0, 'f'},
+        {"help",             no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
@@ -979,8 +1531,13 @@ int backup_main(int argc, char *argv[])
     std::string romid;
     std::string targets_str("all");
     std::string backupdir;
-    util::CompressionType compression = util::CompressionType::Lz4;
+    std::string parent_dir;
+    std::string chunk_store_dir;
+    BackupFormat format = BackupFormat::Tar;
+    util::CompressionOptions compression;
+    compression.type = util::CompressionType::Lz4;
     uint64_t split_archive_size = DEFAULT_ARCHIVE_SPLIT_SIZE;
+    unsigned int jobs = 1;
     bool force = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
@@ -993,20 +1550,60 @@ int backup_main(int argc, char *argv[])
             targets_str = optarg;
             break;
         case 'c':
-            if (!parse_compression_type(optarg, compression)) {
+            if (!parse_compression_type(optarg, compression.type)) {
                 fprintf(stderr, "Invalid compression type: %s\n", optarg);
                 return EXIT_FAILURE;
             }
             break;
+        case 'l': {
+            int level;
+            if (!str_to_num(optarg, 10, level)) {
+                fprintf(stderr, "Invalid compression level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            compression.level = level;
+            break;
+        }
+        case OPTION_LONG:
+            compression.long_distance = true;
+            break;
         case 'd':
             backupdir = optarg;
             break;
+        case OPTION_FORMAT:
+            if (strcmp(optarg, "tar") == 0) {
+                format = BackupFormat::Tar;
+            } else if (strcmp(optarg, "cdc") == 0) {
+                format = BackupFormat::Cdc;
+            } else {
+                fprintf(stderr, "Invalid backup format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPTION_CHUNK_STORE:
+            chunk_store_dir = optarg;
+            break;
+        case OPTION_INCREMENTAL_FROM:
+            parent_dir = optarg;
+            break;
         case 's':
             if (!str_to_num(optarg, 10, split_archive_size)) {
                 fprintf(stderr, "Invalid split size: %s\n", optarg);
                 return EXIT_FAILURE;
             }
             break;
+        case 'T':
+            if (!str_to_num(optarg, 10, compression.threads)) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'j':
+            if (!str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid job count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'f':
             force = true;
             break;
@@ -1041,6 +1638,32 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (!util::compression_supported(compression.type)) {
+        fprintf(stderr, "Compression type is not supported by this build\n");
+        return EXIT_FAILURE;
+    }
+
+    if (compression.level) {
+        auto [min_level, max_level] =
+                util::compression_level_range(compression.type);
+        if (*compression.level < min_level || *compression.level > max_level) {
+            fprintf(stderr, "Compression level must be between %d and %d\n",
+                    min_level, max_level);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (compression.long_distance
+            && compression.type != util::CompressionType::Zstd) {
+        fprintf(stderr, "--long is only supported for zstd compression\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!chunk_store_dir.empty() && format != BackupFormat::Cdc) {
+        fprintf(stderr, "--chunk-store is only supported for the cdc format\n");
+        return EXIT_FAILURE;
+    }
+
     warn_selinux_context();
 
     if (!unshare_mount_namespace()) {
@@ -1073,8 +1696,90 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    std::string chunk_store_ref;
+
+    if (format == BackupFormat::Cdc) {
+        auto real_backupdir = util::real_path(backupdir);
+        if (!real_backupdir) {
+            fprintf(stderr, "%s: Failed to resolve path: %s\n",
+                    backupdir.c_str(),
+                    real_backupdir.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (chunk_store_dir.empty()) {
+            chunk_store_dir = util::dir_name(real_backupdir.value());
+            chunk_store_dir += '/';
+            chunk_store_dir += DEFAULT_CHUNK_STORE_NAME;
+        }
+
+        if (auto r = util::mkdir_recursive(chunk_store_dir, 0755); !r) {
+            fprintf(stderr, "%s: Failed to create directory: %s\n",
+                    chunk_store_dir.c_str(), r.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        auto real_chunk_store_dir = util::real_path(chunk_store_dir);
+        if (!real_chunk_store_dir) {
+            fprintf(stderr, "%s: Failed to resolve path: %s\n",
+                    chunk_store_dir.c_str(),
+                    real_chunk_store_dir.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        // Like parent backups, a chunk store next to the backup is referenced
+        // by a relative path
+        if (util::dir_name(real_chunk_store_dir.value())
+                == util::dir_name(real_backupdir.value())) {
+            chunk_store_ref = "../";
+            chunk_store_ref += util::base_name(real_chunk_store_dir.value());
+        } else {
+            chunk_store_ref = real_chunk_store_dir.value();
+        }
+
+        chunk_store_dir = std::move(real_chunk_store_dir.value());
+    }
+
+    std::string parent_ref;
+
+    if (!parent_dir.empty()) {
+        auto real_parent_dir = util::real_path(parent_dir);
+        if (!real_parent_dir) {
+            fprintf(stderr, "%s: Failed to resolve path: %s\n",
+                    parent_dir.c_str(),
+                    real_parent_dir.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+        auto real_backupdir = util::real_path(backupdir);
+        if (!real_backupdir) {
+            fprintf(stderr, "%s: Failed to resolve path: %s\n",
+                    backupdir.c_str(),
+                    real_backupdir.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        if (real_parent_dir.value() == real_backupdir.value()) {
+            fprintf(stderr, "Cannot make an incremental backup of the same "
+                    "directory\n");
+            return EXIT_FAILURE;
+        }
+
+        // Reference sibling backups by a relative path so that the whole
+        // backups directory can be moved
+        if (util::dir_name(real_parent_dir.value())
+                == util::dir_name(real_backupdir.value())) {
+            parent_ref = "../";
+            parent_ref += util::base_name(real_parent_dir.value());
+        } else {
+            parent_ref = real_parent_dir.value();
+        }
+
+        parent_dir = std::move(real_parent_dir.value());
+    }
+
     bool ret = backup_rom(rom, backupdir, targets, compression,
-                          split_archive_size);
+                          split_archive_size, jobs, chunk_store_dir,
+                          chunk_store_ref, parent_dir, parent_ref);
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/backup_cdc.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cinttypes>
+#include <cstring>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/hash.h"
+#include "mblog/logging.h"
+#include "mbutil/archive.h"
+#include "mbutil/chunk_store.h"
+#include "mbutil/fastcdc.h"
+
+#define LOG_TAG "mbtool/recovery/backup_cdc"
+
+namespace mb
+{
+
+/*
+ * In a CDC backup, the archive stores all metadata as usual, but the contents
+ * of each regular file are replaced by an index into the chunk store:
+ *
+ *     <u64 LE: file size><32 bytes: SHA-256 of chunk 0><...>
+ *
+ * Holes in sparse files are chunked as zeros. Since all-zero chunks are
+ * deduplicated, this costs little space and they are turned back into holes
+ * when restoring.
+ */
+
+constexpr size_t INDEX_SIZE_FIELD = sizeof(uint64_t);
+
+/*!
+ * \brief Store file contents in a chunk store
+ *
+ * \param store Chunk store
+ * \param in Disk reader positioned at \p entry
+ * \param entry Regular file being backed up
+ * \param[out] content Index to store in the archive instead of the contents
+ * \param hasher If not null, the file contents are passed to this hasher
+ *
+ * \return Whether all chunks were stored
+ */
+bool cdc_store_file(util::ChunkStore &store, archive *in, archive_entry *entry,
+                    std::string &content, Hasher *hasher)
+{
+    const char *path = archive_entry_pathname(entry);
+    uint64_t size = 0;
+
+    content.assign(INDEX_SIZE_FIELD, '\0');
+
+    util::FastCdcChunker chunker(util::FastCdc(), [&](const void *data,
+                                                      size_t n)
+            -> oc::result<void> {
+        OUTCOME_TRY(digest, store.add(data, n));
+        content.append(reinterpret_cast<const char *>(digest.data()),
+                       digest.size());
+        return oc::success();
+    });
+
+    auto data_fn = [&](const void *data, size_t n) {
+        if (hasher) {
+            if (auto r = hasher->update(data, n); !r) {
+                LOGE("%s: Failed to update hash: %s",
+                     path, r.error().message().c_str());
+                return false;
+            }
+        }
+
+        if (auto r = chunker.write(data, n); !r) {
+            LOGE("%s: Failed to store chunk: %s",
+                 path, r.error().message().c_str());
+            return false;
+        }
+
+        size += n;
+        return true;
+    };
+
+    if (!util::libarchive_read_data_disk(in, entry, data_fn)) {
+        return false;
+    }
+
+    if (auto r = chunker.finish(); !r) {
+        LOGE("%s: Failed to store chunk: %s",
+             path, r.error().message().c_str());
+        return false;
+    }
+
+    auto size_le = mb_htole64(size);
+    memcpy(content.data(), &size_le, sizeof(size_le));
+
+    return true;
+}
+
+static bool read_index(archive *in, archive_entry *entry, std::string &index)
+{
+    const char *path = archive_entry_pathname(entry);
+    la_int64_t size = archive_entry_size(entry);
+
+    if (size < static_cast<la_int64_t>(INDEX_SIZE_FIELD)
+            || (static_cast<uint64_t>(size) - INDEX_SIZE_FIELD)
+                    % std::tuple_size_v<util::ChunkDigest> != 0) {
+        LOGE("%s: Invalid chunk index size: %" PRId64,
+             path, static_cast<int64_t>(size));
+        return false;
+    }
+
+    index.resize(static_cast<size_t>(size));
+
+    size_t offset = 0;
+    while (offset < index.size()) {
+        auto n = archive_read_data(in, index.data() + offset,
+                                   index.size() - offset);
+        if (n < 0) {
+            LOGE("%s: %s", path, archive_error_string(in));
+            return false;
+        } else if (n == 0) {
+            LOGE("%s: Chunk index is truncated", path);
+            return false;
+        }
+        offset += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Restore file contents from a chunk store
+ *
+ * \param store Chunk store
+ * \param in Archive reader positioned at \p entry
+ * \param out Disk writer
+ * \param entry Regular file being restored. Its size is changed to the size of
+ *              the original file before the header is written to \p out.
+ *
+ * \return Whether the header and all chunks were written
+ */
+bool cdc_restore_file(util::ChunkStore &store, archive *in, archive *out,
+                      archive_entry *entry)
+{
+    const char *path = archive_entry_pathname(entry);
+    std::string index;
+
+    if (!read_index(in, entry, index)) {
+        return false;
+    }
+
+    uint64_t size;
+    memcpy(&size, index.data(), sizeof(size));
+    size = mb_le64toh(size);
+
+    if (size > INT64_MAX) {
+        LOGE("%s: Invalid file size: %" PRIu64, path, size);
+        return false;
+    }
+
+    archive_entry_set_size(entry, static_cast<la_int64_t>(size));
+
+    if (archive_write_header(out, entry) != ARCHIVE_OK) {
+        LOGE("%s: %s", path, archive_error_string(out));
+        return false;
+    }
+
+    std::vector<unsigned char> buf;
+    util::ChunkDigest digest;
+    uint64_t offset = 0;
+
+    for (size_t i = INDEX_SIZE_FIELD; i < index.size(); i += digest.size()) {
+        memcpy(digest.data(), index.data() + i, digest.size());
+
+        if (auto r = store.read(digest, buf); !r) {
+            LOGE("%s: Failed to read chunk: %s",
+                 path, r.error().message().c_str());
+            return false;
+        }
+
+        if (buf.size() > size - offset) {
+            LOGE("%s: Chunks exceed file size", path);
+            return false;
+        }
+
+        // Leave holes for zero chunks. The disk writer extends the file to its
+        // full size when the entry is finished.
+        bool is_zero = std::all_of(buf.begin(), buf.end(),
+                                   [](unsigned char c) { return c == 0; });
+
+        if (!is_zero) {
+            auto n = archive_write_data_block(
+                    out, buf.data(), buf.size(),
+                    static_cast<la_int64_t>(offset));
+            if (n < ARCHIVE_OK) {
+                LOGE("%s: %s", path, archive_error_string(out));
+                return false;
+            }
+        }
+
+        offset += buf.size();
+    }
+
+    if (offset != size) {
+        LOGE("%s: Chunks do not match file size", path);
+        return false;
+    }
+
+    return true;
+}
+
+}
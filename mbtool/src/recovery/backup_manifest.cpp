@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/backup_manifest.h"
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/crc32.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/recovery/backup_manifest"
+
+namespace mb
+{
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+/*
+ * Manifest format:
+ *
+ *     mbtool-backup-manifest 1
+ *     parent<TAB>[path to parent backup]
+ *     <path><TAB><mode><TAB><uid><TAB><gid><TAB><size><TAB><mtime sec>
+ *         <TAB><mtime nsec><TAB><inode><TAB><xattrs crc32><TAB><sha256>
+ *     ...
+ *
+ * The mode is in octal, the xattrs CRC32 is 8 hex digits, and the SHA-256 is
+ * '-' for anything but regular files. Backslashes, tabs, and newlines in paths
+ * are escaped as '\\', '\t', and '\n'. The same escaping is used for path
+ * lists, which contain one path per line.
+ */
+
+constexpr char MANIFEST_MAGIC[] = "mbtool-backup-manifest 1";
+constexpr char MANIFEST_KEY_PARENT[] = "parent";
+constexpr size_t MANIFEST_FIELDS = 10;
+
+static std::string escape_path(std::string_view path)
+{
+    std::string result;
+    result.reserve(path.size());
+
+    for (char c : path) {
+        switch (c) {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            result += c;
+            break;
+        }
+    }
+
+    return result;
+}
+
+static bool unescape_path(std::string_view str, std::string &out)
+{
+    out.clear();
+    out.reserve(str.size());
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] != '\\') {
+            out += str[i];
+            continue;
+        }
+
+        if (++i == str.size()) {
+            return false;
+        }
+
+        switch (str[i]) {
+        case '\\':
+            out += '\\';
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+template<typename IntType>
+static bool parse_field(std::string_view str, int base, IntType &out)
+{
+    // str_to_num() needs a NULL-terminated string
+    std::string temp(str);
+    return str_to_num(temp.c_str(), base, out);
+}
+
+static bool parse_entry(std::string_view line, BackupManifestEntry &entry)
+{
+    auto fields = split_sv(line, '\t');
+    if (fields.size() != MANIFEST_FIELDS) {
+        return false;
+    }
+
+    if (!unescape_path(fields[0], entry.path)
+            || !parse_field(fields[1], 8, entry.mode)
+            || !parse_field(fields[2], 10, entry.uid)
+            || !parse_field(fields[3], 10, entry.gid)
+            || !parse_field(fields[4], 10, entry.size)
+            || !parse_field(fields[5], 10, entry.mtime_sec)
+            || !parse_field(fields[6], 10, entry.mtime_nsec)
+            || !parse_field(fields[7], 10, entry.inode)
+            || !parse_field(fields[8], 16, entry.xattrs_crc32)) {
+        return false;
+    }
+
+    if (fields[9] == "-") {
+        entry.sha256.clear();
+    } else {
+        entry.sha256 = fields[9];
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Read lines from a file without the trailing newline
+ *
+ * \param path File to read
+ * \param max_lines Maximum number of lines to read
+ * \param fn Callback for each line. Returning false stops the reading.
+ *
+ * \return Whether the file was successfully read and all lines were accepted
+ */
+template<typename Fn>
+static bool read_lines(const std::string &path, size_t max_lines, Fn fn)
+{
+    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char *line = nullptr;
+    size_t len = 0;
+    ssize_t read = 0;
+    size_t line_num = 0;
+
+    auto free_line = finally([&]{
+        free(line);
+    });
+
+    while (line_num < max_lines
+            && (read = getline(&line, &len, fp.get())) >= 0) {
+        ++line_num;
+
+        std::string_view view(line, static_cast<size_t>(read));
+        if (!view.empty() && view.back() == '\n') {
+            view.remove_suffix(1);
+        }
+
+        if (!fn(line_num, view)) {
+            LOGE("%s:%zu: Invalid line", path.c_str(), line_num);
+            return false;
+        }
+    }
+
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool close_written_file(const std::string &path, ScopedFILE &fp)
+{
+    bool failed = ferror(fp.get());
+
+    if (fclose(fp.release()) != 0 || failed) {
+        LOGE("%s: Failed to write file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check if the metadata of two entries match
+ *
+ * If the metadata matches, the file is assumed to be unchanged without
+ * comparing the contents.
+ */
+bool BackupManifestEntry::same_metadata(const BackupManifestEntry &other) const
+{
+    return mode == other.mode
+            && uid == other.uid
+            && gid == other.gid
+            && size == other.size
+            && mtime_sec == other.mtime_sec
+            && mtime_nsec == other.mtime_nsec
+            && inode == other.inode
+            && xattrs_crc32 == other.xattrs_crc32;
+}
+
+/*!
+ * \brief Load manifest from a file
+ *
+ * \param path Manifest file
+ * \param header_only Only load the header (eg. the parent backup) and skip
+ *                    the entries
+ */
+bool BackupManifest::load_file(const std::string &path, bool header_only)
+{
+    parent.clear();
+    entries.clear();
+
+    size_t lines = 0;
+
+    bool ret = read_lines(path, header_only ? 2 : SIZE_MAX,
+                          [&](size_t line_num, std::string_view line) {
+        lines = line_num;
+
+        if (line_num == 1) {
+            return line == MANIFEST_MAGIC;
+        } else if (line_num == 2) {
+            auto pieces = split_sv(line, '\t');
+            return pieces.size() == 2 && pieces[0] == MANIFEST_KEY_PARENT
+                    && unescape_path(pieces[1], parent);
+        }
+
+        BackupManifestEntry entry;
+        if (!parse_entry(line, entry)) {
+            return false;
+        }
+
+        auto key = entry.path;
+        return entries.emplace(std::move(key), std::move(entry)).second;
+    });
+
+    if (ret && lines < 2) {
+        LOGE("%s: Missing manifest header", path.c_str());
+        return false;
+    }
+
+    return ret;
+}
+
+bool BackupManifest::save_file(const std::string &path) const
+{
+    ScopedFILE fp(fopen(path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Sort the entries so the output is deterministic
+    std::vector<const BackupManifestEntry *> sorted;
+    sorted.reserve(entries.size());
+    for (auto const &[_, entry] : entries) {
+        sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+        return a->path < b->path;
+    });
+
+    fprintf(fp.get(), "%s\n%s\t%s\n", MANIFEST_MAGIC, MANIFEST_KEY_PARENT,
+            escape_path(parent).c_str());
+
+    for (auto const *entry : sorted) {
+        fprintf(fp.get(), "%s\t%o\t%u\t%u\t%" PRIu64 "\t%" PRId64 "\t%ld"
+                "\t%" PRIu64 "\t%08" PRIx32 "\t%s\n",
+                escape_path(entry->path).c_str(),
+                static_cast<unsigned int>(entry->mode),
+                static_cast<unsigned int>(entry->uid),
+                static_cast<unsigned int>(entry->gid),
+                entry->size, entry->mtime_sec, entry->mtime_nsec,
+                entry->inode, entry->xattrs_crc32,
+                entry->sha256.empty() ? "-" : entry->sha256.c_str());
+    }
+
+    return close_written_file(path, fp);
+}
+
+/*!
+ * \brief Fill in manifest entry from the metadata of a libarchive entry
+ *
+ * The SHA-256 digest is not filled in because it requires reading the file.
+ *
+ * \return Whether the entry has a path
+ */
+bool manifest_entry_from_archive_entry(archive_entry *entry,
+                                       BackupManifestEntry &out)
+{
+    const char *path = archive_entry_pathname(entry);
+    if (!path) {
+        return false;
+    }
+
+    out.path = path;
+    out.mode = archive_entry_mode(entry);
+    out.uid = static_cast<uid_t>(archive_entry_uid(entry));
+    out.gid = static_cast<gid_t>(archive_entry_gid(entry));
+    out.size = archive_entry_filetype(entry) == AE_IFREG
+            ? static_cast<uint64_t>(archive_entry_size(entry)) : 0;
+    out.mtime_sec = archive_entry_mtime(entry);
+    out.mtime_nsec = archive_entry_mtime_nsec(entry);
+    out.inode = static_cast<uint64_t>(archive_entry_ino64(entry));
+    out.sha256.clear();
+
+    // The order returned by listxattr() is not guaranteed to be stable
+    std::vector<std::pair<std::string, std::string>> xattrs;
+    const char *name;
+    const void *value;
+    size_t size;
+
+    archive_entry_xattr_reset(entry);
+    while (archive_entry_xattr_next(entry, &name, &value, &size)
+            == ARCHIVE_OK) {
+        xattrs.emplace_back(name, std::string(
+                static_cast<const char *>(value), size));
+    }
+
+    std::sort(xattrs.begin(), xattrs.end());
+
+    out.xattrs_crc32 = 0;
+    for (auto const &[xattr_name, xattr_value] : xattrs) {
+        // Include the NULL terminator to separate the name from the value
+        out.xattrs_crc32 = crc32_update(out.xattrs_crc32, xattr_name.c_str(),
+                                        xattr_name.size() + 1);
+        out.xattrs_crc32 = crc32_update(out.xattrs_crc32, xattr_value.data(),
+                                        xattr_value.size());
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compute paths that must be deleted to go from one tree to another
+ *
+ * A path is deleted if it no longer exists in \a current or if its file type
+ * changed. Paths under a deleted directory are not listed individually.
+ *
+ * \return Sorted list of paths
+ */
+std::vector<std::string> manifest_deleted_paths(const BackupManifest &parent,
+                                                const BackupManifest &current)
+{
+    std::vector<std::string> candidates;
+
+    for (auto const &[path, entry] : parent.entries) {
+        auto it = current.entries.find(path);
+        if (it == current.entries.end()
+                || (it->second.mode & S_IFMT) != (entry.mode & S_IFMT)) {
+            candidates.push_back(path);
+        }
+    }
+
+    std::unordered_set<std::string_view> deleted(
+            candidates.begin(), candidates.end());
+    std::vector<std::string> result;
+
+    for (auto const &path : candidates) {
+        bool ancestor_deleted = false;
+
+        for (auto pos = path.rfind('/'); pos != std::string::npos && pos > 0;
+                pos = path.rfind('/', pos - 1)) {
+            if (deleted.find(std::string_view(path).substr(0, pos))
+                    != deleted.end()) {
+                ancestor_deleted = true;
+                break;
+            }
+        }
+
+        if (!ancestor_deleted) {
+            result.push_back(path);
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+bool load_path_list(const std::string &path, std::vector<std::string> &out)
+{
+    out.clear();
+
+    return read_lines(path, SIZE_MAX, [&](size_t, std::string_view line) {
+        std::string item;
+        if (!unescape_path(line, item) || item.empty()) {
+            return false;
+        }
+        out.push_back(std::move(item));
+        return true;
+    });
+}
+
+bool save_path_list(const std::string &path,
+                    const std::vector<std::string> &paths)
+{
+    ScopedFILE fp(fopen(path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (auto const &item : paths) {
+        fprintf(fp.get(), "%s\n", escape_path(item).c_str());
+    }
+
+    return close_written_file(path, fp);
+}
+
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/backup_scheduler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+#include "mblog/base_logger.h"
+#include "mblog/logging.h"
+#include "mblog/stdio_logger.h"
+
+#define LOG_TAG "mbtool/recovery/backup_scheduler"
+
+namespace mb
+{
+
+// Index of the task running on the current thread
+static thread_local std::optional<size_t> t_task_index;
+
+/*!
+ * \brief Logger that keeps the output of concurrent tasks in order
+ *
+ * Messages logged by the head task (the earliest unfinished one) and by
+ * threads that are not running a task are passed through. Messages from other
+ * tasks are held back until the task becomes the head.
+ */
+class OrderedLogger final : public log::BaseLogger
+{
+public:
+    OrderedLogger(std::shared_ptr<log::BaseLogger> logger, size_t tasks)
+        : m_logger(std::move(logger))
+        , m_buffers(tasks)
+        , m_done(tasks)
+        , m_head(0)
+    {
+    }
+
+    void log(const log::LogRecord &rec) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (t_task_index && *t_task_index != m_head) {
+            m_buffers[*t_task_index].push_back(rec);
+        } else {
+            m_logger->log(rec);
+        }
+    }
+
+    bool formatted() override
+    {
+        return m_logger->formatted();
+    }
+
+    void task_finished(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_done[index] = true;
+
+        while (m_head < m_done.size() && m_done[m_head]) {
+            ++m_head;
+
+            if (m_head < m_buffers.size()) {
+                for (auto const &rec : m_buffers[m_head]) {
+                    m_logger->log(rec);
+                }
+                m_buffers[m_head].clear();
+                m_buffers[m_head].shrink_to_fit();
+            }
+        }
+    }
+
+private:
+    std::mutex m_mutex;
+    std::shared_ptr<log::BaseLogger> m_logger;
+    std::vector<std::vector<log::LogRecord>> m_buffers;
+    std::vector<bool> m_done;
+    size_t m_head;
+};
+
+/*!
+ * \brief Construct scheduler
+ *
+ * \param jobs Maximum number of tasks to run at the same time (0 is treated
+ *             as 1)
+ */
+BackupScheduler::BackupScheduler(unsigned int jobs)
+    : m_jobs(std::max(jobs, 1u))
+{
+}
+
+/*!
+ * \brief Add task to run
+ *
+ * \param resource Tasks with the same non-empty resource key run one at a time
+ * \param fn Task function returning whether it succeeded
+ */
+void BackupScheduler::add(std::string resource, TaskFn fn)
+{
+    m_tasks.push_back({std::move(resource), std::move(fn)});
+}
+
+/*!
+ * \brief Run all tasks and wait for them to finish
+ *
+ * Once a task fails, no more tasks are started.
+ *
+ * \return Whether all tasks succeeded
+ */
+bool BackupScheduler::run()
+{
+    if (m_tasks.empty()) {
+        return true;
+    }
+
+    auto prev_logger = log::logger();
+    if (!prev_logger) {
+        // Same default as mblog
+        prev_logger = std::make_shared<log::StdioLogger>(stdout);
+    }
+
+    auto logger = std::make_shared<OrderedLogger>(prev_logger, m_tasks.size());
+    log::set_logger(logger);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<bool> started(m_tasks.size());
+    std::unordered_set<std::string> busy;
+    bool failed = false;
+
+    // Find the first task whose resource is not in use. Returns the number of
+    // tasks if there is nothing left to run and nullopt if a task needs to
+    // wait for another to finish.
+    auto next_task = [&]() -> std::optional<size_t> {
+        bool waiting = false;
+
+        for (size_t i = 0; i < m_tasks.size(); ++i) {
+            if (started[i]) {
+                continue;
+            } else if (failed) {
+                // Skip remaining tasks, but keep the log order intact
+                started[i] = true;
+                logger->task_finished(i);
+            } else if (m_tasks[i].resource.empty()
+                    || busy.find(m_tasks[i].resource) == busy.end()) {
+                return i;
+            } else {
+                waiting = true;
+            }
+        }
+
+        if (waiting) {
+            return std::nullopt;
+        }
+        return m_tasks.size();
+    };
+
+    auto worker = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            std::optional<size_t> index;
+            cv.wait(lock, [&] { return (index = next_task()).has_value(); });
+
+            if (*index == m_tasks.size()) {
+                break;
+            }
+
+            auto &task = m_tasks[*index];
+            started[*index] = true;
+            if (!task.resource.empty()) {
+                busy.insert(task.resource);
+            }
+
+            lock.unlock();
+
+            t_task_index = *index;
+            bool ret = task.fn();
+            t_task_index.reset();
+
+            logger->task_finished(*index);
+
+            lock.lock();
+
+            if (!task.resource.empty()) {
+                busy.erase(task.resource);
+            }
+            if (!ret) {
+                failed = true;
+            }
+
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    auto n_threads = std::min<size_t>(m_jobs, m_tasks.size());
+
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    // Use the current thread as one of the workers
+    worker();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    log::set_logger(std::move(prev_logger));
+    m_tasks.clear();
+
+    return !failed;
+}
+
+}
@@ -27,6 +27,7 @@
 #include <sys/wait.h>
 
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_error.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/command.h"
@@ -68,6 +69,17 @@ static oc::result<void> truncate_file(const char *path, uint64_t size)
     return oc::success();
 }
 
+static oc::result<void> allocate_file(const char *path, uint64_t size)
+{
+    StandardFile file;
+
+    OUTCOME_TRYV(file.open(path, FileOpenMode::ReadWrite));
+    OUTCOME_TRYV(file.allocate(0, size));
+    OUTCOME_TRYV(file.close());
+
+    return oc::success();
+}
+
 static bool run_make_ext4fs(const char *path, uint64_t size)
 {
     char size_str[64];
@@ -115,6 +127,15 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
                 LOGE("%s: Failed to create image", path.c_str());
                 return CreateImageResult::Failed;
             }
+
+            // Reserve the space up front so the image can't run out of space
+            // later and doesn't get fragmented as it fills up
+            if (auto r = allocate_file(path.c_str(), size); !r
+                    && r.error() != FileErrorC::Unsupported) {
+                LOGW("%s: Failed to preallocate image: %s",
+                     path.c_str(), r.error().message().c_str());
+            }
+
             return CreateImageResult::Succeeded;
         }
     }
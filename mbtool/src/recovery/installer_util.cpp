@@ -19,316 +19,75 @@
 
 #include "recovery/installer_util.h"
 
-#include <memory>
-#include <optional>
+#include <algorithm>
+#include <iterator>
+#include <vector>
 
 #include <cerrno>
-#include <cstdio>
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
 
-#include <fcntl.h>
 #include <sys/stat.h>
-
-#include <archive.h>
-#include <archive_entry.h>
+#include <unistd.h>
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
 
-#include "mbcommon/file.h"
-#include "mbcommon/file_util.h"
-#include "mbcommon/file/standard.h"
-#include "mbcommon/finally.h"
-#include "mbcommon/string.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/tracing.h"
 
 #include "mblog/logging.h"
 
-#include "mbutil/delete.h"
-#include "mbutil/path.h"
-
 #include "recovery/bootimg_util.h"
+#include "recovery/ramdisk.h"
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/recovery/installer_util"
 
-using namespace mb::bootimg;
+#define BUF_SIZE    (1024 * 1024)
 
-typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
-typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
-typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
+using namespace mb::bootimg;
 
 namespace mb
 {
 
-bool InstallerUtil::unpack_ramdisk(const std::string &input_file,
-                                   const std::string &output_dir,
-                                   int &format_out,
-                                   std::vector<int> &filters_out)
-{
-    ScopedArchive ain(archive_read_new(), archive_read_free);
-    ScopedArchive aout(archive_write_disk_new(), archive_write_free);
-
-    if (!ain || !aout) {
-        LOGE("Failed to allocate archive reader or writer instance");
-        return false;
-    }
-
-    archive_read_support_filter_gzip(ain.get());
-    archive_read_support_filter_lz4(ain.get());
-    archive_read_support_filter_lzma(ain.get());
-    archive_read_support_filter_xz(ain.get());
-    archive_read_support_format_cpio(ain.get());
-
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(aout.get());
-    archive_write_disk_set_options(aout.get(),
-                                   ARCHIVE_EXTRACT_TIME
-                                 | ARCHIVE_EXTRACT_SECURE_SYMLINKS
-                                 | ARCHIVE_EXTRACT_SECURE_NODOTDOT
-                                 | ARCHIVE_EXTRACT_OWNER
-                                 | ARCHIVE_EXTRACT_PERM);
-
-    if (archive_read_open_filename(ain.get(), input_file.c_str(), 10240)
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    // Can't use O_PATH because we support devices running kernel <3.5
-    int cwd_fd = open(".", O_DIRECTORY | O_CLOEXEC);
-    if (cwd_fd < 0) {
-        LOGE("Failed to open current directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto close_cwd_fd = finally([&] {
-        if (fchdir(cwd_fd) < 0) {
-            LOGW("Failed to change back to previous directory: %s",
-                 strerror(errno));
-        }
-
-        close(cwd_fd);
-    });
-
-    if (chdir(output_dir.c_str()) < 0) {
-        LOGE("%s: Failed to change directory: %s",
-             output_dir.c_str(), strerror(errno));
-        return false;
-    }
-
-    while (true) {
-        archive_entry *entry;
-
-        int ret = archive_read_next_header(ain.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 input_file.c_str(), archive_error_string(ain.get()));
-            return false;
-        }
-
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", input_file.c_str());
-            return false;
-        }
-
-        // Don't allow absolute paths (libarchive will reject '..'s)
-        while (*path && *path == '/') {
-            ++path;
-        }
-
-        archive_entry_set_pathname(entry, path);
-
-        // Extract file
-        ret = archive_read_extract2(ain.get(), entry, aout.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to extract file: %s", path,
-                 archive_error_string(ain.get()));
-            return false;
-        }
-    }
-
-    // Save format
-    format_out = archive_format(ain.get());
-    filters_out.clear();
-    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
-        int code = archive_filter_code(ain.get(), i);
-        if (code != ARCHIVE_FILTER_NONE) {
-            filters_out.push_back(code);
-        }
-    }
-
-    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    return true;
-}
-
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
-{
-    (void) data;
-    (void) entry;
-
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
-    }
-    return 1;
-}
-
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
+/*!
+ * \brief Check whether I/O statistics should be collected and logged
+ *
+ * This is only meant for debugging and is enabled by setting the
+ * `MBTOOL_TRACE_IO` environment variable to `true`.
+ */
+static bool is_io_tracing_enabled()
 {
-    ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
-    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
-    std::string full_path;
-    int ret;
-
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
-        return false;
-    }
-
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(ain.get());
-    archive_read_disk_set_metadata_filter_callback(
-            ain.get(), metadata_filter, nullptr);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
-
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
-        return false;
-    }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
-        }
-    }
-
-    archive_write_set_bytes_per_block(aout.get(), 512);
-
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    ret = archive_read_disk_open(ain.get(), input_dir.c_str());
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        // libarchive doesn't clear the entry automatically
-        archive_entry_clear(entry.get());
-
-        ret = archive_read_next_header2(ain.get(), entry.get());
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read next header: %s", input_dir.c_str(),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-
-        if (archive_entry_filetype(entry.get()) != AE_IFREG) {
-            archive_entry_set_size(entry.get(), 0);
-        }
-
-        const char *curpath = archive_entry_pathname(entry.get());
-        if (curpath && !input_dir.empty()) {
-            auto relpath = util::relative_path(curpath, input_dir);
-            if (!relpath) {
-                LOGE("Failed to compute relative path of %s starting at %s: %s",
-                     curpath, input_dir.c_str(),
-                     relpath.error().message().c_str());
-                return false;
-            }
-            if (relpath.value().empty()) {
-                // If the relative path is empty, then the current path is
-                // the root of the directory tree. We don't need that, so
-                // skip it.
-                continue;
-            }
-            archive_entry_set_pathname(entry.get(), relpath.value().c_str());
-        }
-
-        ret = archive_write_header(aout.get(), entry.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
-            return false;
-        }
-
-        char buf[10240];
-        la_ssize_t n;
-
-        if (archive_entry_size(entry.get()) > 0) {
-            while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, static_cast<size_t>(n))
-                        != n) {
-                    LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
-                    return false;
-                }
-            }
-
-            if (n < 0) {
-                LOGE("Failed to read archive entry data: %s",
-                     archive_error_string(ain.get()));
-                return false;
-            }
-        }
-    }
-
-    archive_read_close(ain.get());
-
-    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    return true;
+    const char *value = getenv("MBTOOL_TRACE_IO");
+    return value && strcmp(value, "true") == 0;
 }
 
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
                                      const std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    // std::string is guaranteed to be contiguous in C++11
-    if (!mkdtemp(tmpdir.data())) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = finally([&]{
-        (void) util::delete_recursive(tmpdir);
-    });
-
+    // The files must outlive the reader and writer
+    FdFile in_file;
+    FdFile out_file;
+    TracingFile in_trace;
+    TracingFile out_trace;
+    File *in_ptr = &in_file;
+    File *out_ptr = &out_file;
     Reader reader;
     Writer writer;
 
+    bool trace_io = is_io_tracing_enabled();
+
+    auto log_trace = [](const TracingFile &f) {
+        LOGD("I/O statistics for %s", f.summary().c_str());
+    };
+    in_trace.set_report_callback(log_trace);
+    out_trace.set_report_callback(log_trace);
+
     // Debug
     LOGD("Patching boot image");
     LOGD("- Input: %s", input_file.c_str());
@@ -340,7 +99,20 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
              r.error().message().c_str());
         return false;
     }
-    if (auto r = reader.open_filename(input_file); !r) {
+    if (auto r = in_file.open(input_file, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open boot image for reading: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+    if (trace_io) {
+        if (auto r = in_trace.open(&in_file, input_file); !r) {
+            LOGE("%s: Failed to enable I/O tracing: %s",
+                 input_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+        in_ptr = &in_trace;
+    }
+    if (auto r = reader.open(in_ptr); !r) {
         LOGE("%s: Failed to open boot image for reading: %s",
              input_file.c_str(), r.error().message().c_str());
         return false;
@@ -352,7 +124,21 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
              r.error().message().c_str());
         return false;
     }
-    if (auto r = writer.open_filename(output_file); !r) {
+    if (auto r = out_file.open(output_file, FileOpenMode::ReadWriteTrunc);
+            !r) {
+        LOGE("%s: Failed to open boot image for writing: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+    if (trace_io) {
+        if (auto r = out_trace.open(&out_file, output_file); !r) {
+            LOGE("%s: Failed to enable I/O tracing: %s",
+                 output_file.c_str(), r.error().message().c_str());
+            return false;
+        }
+        out_ptr = &out_trace;
+    }
+    if (auto r = writer.open(out_ptr); !r) {
         LOGE("%s: Failed to open boot image for writing: %s",
              output_file.c_str(), r.error().message().c_str());
         return false;
@@ -423,49 +209,32 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
             if (type == EntryType::Ramdisk) {
                 LOGD("%s: Writing patched ramdisk", output_file.c_str());
 
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
+                // The ramdisk is decompressed straight from the input boot
+                // image and recompressed straight into the output boot image.
+                // Only the uncompressed cpio archive is kept in memory.
+                Ramdisk ramdisk;
 
-                auto delete_temp_files = finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, ramdisk_in)) {
+                if (!ramdisk.load([&](void *buf, size_t size) {
+                    return reader.read_data(buf, size);
+                })) {
                     return false;
                 }
 
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
+                if (!patch_ramdisk(ramdisk, 0, rps)) {
                     return false;
                 }
 
-                if (!bi_copy_file_to_data(ramdisk_out, writer)) {
+                if (!ramdisk.save([&](const void *buf, size_t size)
+                        -> oc::result<void> {
+                    OUTCOME_TRYV(writer.write_data(buf, size));
+                    return oc::success();
+                })) {
                     return false;
                 }
             } else if (type == EntryType::Kernel) {
                 LOGD("%s: Writing patched kernel", output_file.c_str());
 
-                std::string kernel_in(tmpdir);
-                kernel_in += "/kernel.in";
-                std::string kernel_out(tmpdir);
-                kernel_out += "/kernel.out";
-
-                auto delete_temp_files = finally([&]{
-                    unlink(kernel_in.c_str());
-                    unlink(kernel_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, kernel_in)) {
-                    return false;
-                }
-
-                if (!patch_kernel_rkp(kernel_in, kernel_out)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(kernel_out, writer)) {
+                if (!patch_kernel_rkp(reader, writer)) {
                     return false;
                 }
             } else {
@@ -485,11 +254,21 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
         return false;
     }
 
+    if (trace_io) {
+        // Only reports the statistics. The underlying file is closed below.
+        (void) out_trace.close();
+    }
+
+    if (auto r = out_file.close(); !r) {
+        LOGE("%s: Failed to close boot image: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
+bool InstallerUtil::patch_ramdisk(Ramdisk &ramdisk,
                                   unsigned int depth,
                                   const std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
@@ -498,50 +277,26 @@ bool InstallerUtil::patch_ramdisk(const std::string &input_file,
         return true;
     }
 
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    if (!mkdtemp(tmpdir.data())) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = finally([&]{
-        (void) util::delete_recursive(tmpdir);
-    });
+    // Patch nested ramdisk if it exists
+    RamdiskEntry *nested = ramdisk.find("sbin/ramdisk.cpio");
+    if (nested && S_ISREG(nested->mode)) {
+        Ramdisk nested_ramdisk;
 
-    int format;
-    std::vector<int> filters;
+        if (!nested_ramdisk.load(nested->data.data(), nested->data.size())) {
+            return false;
+        }
 
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
-        return false;
-    }
+        bool ret = patch_ramdisk(nested_ramdisk, depth + 1, rps);
 
-    // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
+        if (!nested_ramdisk.save(nested->data)) {
+            return false;
+        }
 
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
+        return ret;
     }
 
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
-        return false;
-    }
-
-    return ret;
-}
-
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      const std::vector<std::function<RamdiskPatcherFn>> &rps)
-{
     for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
+        if (!rp(ramdisk)) {
             return false;
         }
     }
@@ -549,8 +304,7 @@ bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
     return true;
 }
 
-bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
-                                     const std::string &output_file)
+bool InstallerUtil::patch_kernel_rkp(Reader &reader, Writer &writer)
 {
     // We'll use SuperSU's patch for negating the effects of
     // CONFIG_RKP_NS_PROT=y in newer Samsung kernels. This kernel feature
@@ -576,76 +330,64 @@ bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
         0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x81, 0x01, 0x00, 0x54,
     };
 
-    StandardFile fin;
-    StandardFile fout;
-    std::optional<uint64_t> offset;
-
-    // Open input file
-    auto open_ret = fin.open(input_file, FileOpenMode::ReadOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
-
-    // Open output file
-    open_ret = fout.open(output_file, FileOpenMode::WriteOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
-
-    FileSearcher searcher(&fin, source_pattern, sizeof(source_pattern));
-
-    if (auto r = searcher.next()) {
-        offset = r.value();
-    } else {
-        LOGE("%s: Error when searching for pattern: %s",
-             input_file.c_str(), r.error().message().c_str());
-        return false;
-    }
-
-    // Copy data
-    auto seek_ret = fin.seek(0, SEEK_SET);
-    if (!seek_ret) {
-        LOGE("%s: Failed to seek to beginning: %s",
-             input_file.c_str(), seek_ret.error().message().c_str());
-        return false;
-    }
+    // The pattern may straddle two reads, so the last (pattern size - 1)
+    // bytes are held back until the next read
+    constexpr size_t overlap = sizeof(source_pattern) - 1;
 
-    if (offset) {
-        LOGD("RKP pattern found at offset: 0x%" PRIx64, *offset);
+    std::vector<unsigned char> buf(BUF_SIZE + overlap);
+    size_t used = 0;
+    uint64_t offset = 0;
+    bool found = false;
 
-        if (!copy_file_to_file(fin, fout, *offset)) {
+    while (true) {
+        auto n_read = reader.read_data(buf.data() + used, buf.size() - used);
+        if (!n_read) {
+            LOGE("Failed to read kernel data: %s",
+                 n_read.error().message().c_str());
             return false;
         }
 
-        seek_ret = fin.seek(sizeof(source_pattern), SEEK_CUR);
-        if (!seek_ret) {
-            LOGE("%s: Failed to skip pattern: %s",
-                 input_file.c_str(), seek_ret.error().message().c_str());
-            return false;
+        bool eof = n_read.value() == 0;
+        used += n_read.value();
+
+        if (!found) {
+            auto end = buf.data() + used;
+            auto it = std::search(buf.data(), end,
+                                  std::begin(source_pattern),
+                                  std::end(source_pattern));
+            if (it != end) {
+                auto pos = static_cast<size_t>(it - buf.data());
+                LOGD("RKP pattern found at offset: 0x%" PRIx64, offset + pos);
+
+                memcpy(buf.data() + pos, target_pattern,
+                       sizeof(target_pattern));
+                found = true;
+            }
         }
 
-        auto ret = file_write_exact(fout, target_pattern,
-                                    sizeof(target_pattern));
-        if (!ret) {
-            LOGE("%s: Failed to write target pattern: %s",
-                 output_file.c_str(), ret.error().message().c_str());
-            return false;
+        size_t to_write;
+        if (found || eof) {
+            to_write = used;
+        } else {
+            to_write = used > overlap ? used - overlap : 0;
         }
-    }
 
-    if (!copy_file_to_file_eof(fin, fout)) {
-        return false;
-    }
+        if (to_write > 0) {
+            auto n_written = writer.write_data(buf.data(), to_write);
+            if (!n_written) {
+                LOGE("Failed to write kernel data: %s",
+                     n_written.error().message().c_str());
+                return false;
+            }
 
-    auto close_ret = fout.close();
-    if (!close_ret) {
-        LOGE("%s: Failed to close file: %s",
-             output_file.c_str(), close_ret.error().message().c_str());
-        return false;
+            memmove(buf.data(), buf.data() + to_write, used - to_write);
+            used -= to_write;
+            offset += to_write;
+        }
+
+        if (eof) {
+            break;
+        }
     }
 
     return true;
@@ -687,54 +429,4 @@ bool InstallerUtil::replace_file(const std::string &replace,
     return true;
 }
 
-bool InstallerUtil::copy_file_to_file(File &fin, File &fout, uint64_t to_copy)
-{
-    char buf[10240];
-
-    while (to_copy > 0) {
-        size_t to_read = static_cast<size_t>(
-                std::min<uint64_t>(to_copy, sizeof(buf)));
-
-        auto n = file_read_retry(fin, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to read data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        n = file_write_retry(fout, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to write data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        to_copy -= to_read;
-    }
-
-    return true;
-}
-
-bool InstallerUtil::copy_file_to_file_eof(File &fin, File &fout)
-{
-    char buf[10240];
-
-    while (true) {
-        auto n_read = file_read_retry(fin, buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read data: %s", n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        auto n_written = file_write_retry(fout, buf, n_read.value());
-        if (!n_written || n_written.value() != n_read.value()) {
-            LOGE("Failed to write data: %s",
-                 n_written.error().message().c_str());
-            return false;
-        }
-    }
-
-    return true;
-}
-
 }
@@ -0,0 +1,513 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/ramdisk.h"
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/recovery/ramdisk"
+
+#define BUF_SIZE    (256 * 1024)
+
+typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
+
+namespace mb
+{
+
+struct ReadContext
+{
+    const std::function<Ramdisk::ReadFn> *reader;
+    std::vector<char> buf;
+};
+
+struct WriteContext
+{
+    const std::function<Ramdisk::WriteFn> *writer;
+};
+
+static la_ssize_t la_read_cb(archive *a, void *userdata, const void **buffer)
+{
+    auto *ctx = static_cast<ReadContext *>(userdata);
+
+    auto n = (*ctx->reader)(ctx->buf.data(), ctx->buf.size());
+    if (!n) {
+        archive_set_error(a, EIO, "%s", n.error().message().c_str());
+        return -1;
+    }
+
+    *buffer = ctx->buf.data();
+    return static_cast<la_ssize_t>(n.value());
+}
+
+static la_ssize_t la_write_cb(archive *a, void *userdata, const void *buffer,
+                              size_t length)
+{
+    auto *ctx = static_cast<WriteContext *>(userdata);
+
+    if (auto r = (*ctx->writer)(buffer, length); !r) {
+        archive_set_error(a, EIO, "%s", r.error().message().c_str());
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(length);
+}
+
+static std::string normalize_path(const char *path)
+{
+    // Strip leading slashes and "./" components
+    while (true) {
+        if (*path == '/') {
+            ++path;
+        } else if (path[0] == '.' && path[1] == '/') {
+            path += 2;
+        } else {
+            break;
+        }
+    }
+
+    std::string result(path);
+
+    if (result == ".") {
+        result.clear();
+    }
+    while (!result.empty() && result.back() == '/') {
+        result.pop_back();
+    }
+
+    return result;
+}
+
+Ramdisk::Ramdisk()
+    : m_format(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC)
+{
+}
+
+/*!
+ * \brief Load cpio archive from a stream
+ *
+ * The archive may be compressed with gzip, lz4, lzma, or xz. The format and
+ * compression filters are remembered so that save() produces an archive of the
+ * same type.
+ *
+ * \param reader Function to read the next chunk of the (compressed) archive
+ *
+ * \return Whether the archive was successfully loaded
+ */
+bool Ramdisk::load(const std::function<ReadFn> &reader)
+{
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    if (!a) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    archive_read_support_filter_gzip(a.get());
+    archive_read_support_filter_lz4(a.get());
+    archive_read_support_filter_lzma(a.get());
+    archive_read_support_filter_xz(a.get());
+    archive_read_support_format_cpio(a.get());
+
+    ReadContext ctx;
+    ctx.reader = &reader;
+    ctx.buf.resize(BUF_SIZE);
+
+    if (archive_read_open(a.get(), &ctx, nullptr, la_read_cb, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for reading: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    m_entries.clear();
+
+    // Hard link target -> paths of the other members of the link set
+    std::unordered_map<std::string, std::vector<std::string>> hardlinks;
+
+    archive_entry *entry;
+    char buf[10240];
+    la_ssize_t n;
+
+    while (true) {
+        int ret = archive_read_next_header(a.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("Failed to read ramdisk header: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+
+        const char *raw_path = archive_entry_pathname(entry);
+        if (!raw_path || !*raw_path) {
+            LOGE("Ramdisk header has null or empty filename");
+            return false;
+        }
+
+        auto path = normalize_path(raw_path);
+        if (path.empty()) {
+            // Root of the archive
+            continue;
+        }
+
+        // Later entries replace earlier ones, as they would when extracted
+        RamdiskEntry &e = add_entry(path);
+        e.mode = archive_entry_mode(entry);
+        e.uid = static_cast<uid_t>(archive_entry_uid(entry));
+        e.gid = static_cast<gid_t>(archive_entry_gid(entry));
+        e.mtime = archive_entry_mtime(entry);
+        e.rdev = archive_entry_rdev(entry);
+
+        if (S_ISLNK(e.mode)) {
+            if (const char *target = archive_entry_symlink(entry)) {
+                e.symlink = target;
+            }
+        } else if (S_ISREG(e.mode)) {
+            if (archive_entry_size_is_set(entry)) {
+                e.data.reserve(static_cast<size_t>(
+                        archive_entry_size(entry)));
+            }
+
+            while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
+                e.data.append(buf, static_cast<size_t>(n));
+            }
+
+            if (n < 0) {
+                LOGE("%s: Failed to read ramdisk entry data: %s",
+                     path.c_str(), archive_error_string(a.get()));
+                return false;
+            }
+
+            if (const char *hardlink = archive_entry_hardlink(entry)) {
+                auto target = normalize_path(hardlink);
+                if (target != path) {
+                    hardlinks[target].push_back(path);
+                }
+            }
+        }
+    }
+
+    // Members of a hard link set share the same data, but only one of them
+    // carries it in the archive. newc stores it in the last member and odc in
+    // the first, so the link sets can only be resolved once everything has
+    // been read.
+    for (auto const &[target, links] : hardlinks) {
+        std::vector<RamdiskEntry *> members;
+
+        if (RamdiskEntry *t = find(target)) {
+            members.push_back(t);
+        }
+        for (auto const &link : links) {
+            if (RamdiskEntry *l = find(link)) {
+                members.push_back(l);
+            }
+        }
+
+        auto source = std::find_if(members.begin(), members.end(),
+                                   [](RamdiskEntry *m) {
+            return S_ISREG(m->mode) && !m->data.empty();
+        });
+        if (source == members.end()) {
+            continue;
+        }
+
+        for (RamdiskEntry *m : members) {
+            if (m != *source && S_ISREG(m->mode) && m->data.empty()) {
+                m->data = (*source)->data;
+            }
+        }
+    }
+
+    m_format = archive_format(a.get());
+    m_filters.clear();
+    for (int i = 0; i < archive_filter_count(a.get()); ++i) {
+        int code = archive_filter_code(a.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            m_filters.push_back(code);
+        }
+    }
+
+    if (archive_read_close(a.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close ramdisk: %s", archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Load cpio archive from memory
+ *
+ * \param data Buffer containing the (compressed) archive
+ * \param size Size of \p data
+ *
+ * \return Whether the archive was successfully loaded
+ */
+bool Ramdisk::load(const void *data, size_t size)
+{
+    auto ptr = static_cast<const char *>(data);
+    size_t remain = size;
+
+    return load([&](void *buf, size_t n) -> oc::result<size_t> {
+        n = std::min(n, remain);
+        memcpy(buf, ptr, n);
+        ptr += n;
+        remain -= n;
+        return n;
+    });
+}
+
+/*!
+ * \brief Write cpio archive to a stream
+ *
+ * The archive is written with the format and compression filters of the
+ * archive that was loaded. If nothing was loaded, an uncompressed newc archive
+ * is written.
+ *
+ * \param writer Function to write the next chunk of the (compressed) archive
+ *
+ * \return Whether the archive was successfully written
+ */
+bool Ramdisk::save(const std::function<WriteFn> &writer) const
+{
+    ScopedArchive a(archive_write_new(), archive_write_free);
+    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+
+    if (!a || !entry) {
+        LOGE("Failed to allocate archive writer or entry instance");
+        return false;
+    }
+
+    if (archive_write_set_format(a.get(), m_format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+    for (const int &filter : m_filters) {
+        if (archive_write_add_filter(a.get(), filter) != ARCHIVE_OK) {
+            LOGE("Failed to add output archive filter: %s",
+                 archive_error_string(a.get()));
+            return false;
+        }
+    }
+
+    archive_write_set_bytes_per_block(a.get(), 512);
+
+    WriteContext ctx;
+    ctx.writer = &writer;
+
+    if (archive_write_open(a.get(), &ctx, nullptr, la_write_cb, nullptr)
+            != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk for writing: %s",
+             archive_error_string(a.get()));
+        return false;
+    }
+
+    for (auto const &e : m_entries) {
+        archive_entry_clear(entry.get());
+
+        archive_entry_set_pathname(entry.get(), e.path.c_str());
+        archive_entry_set_mode(entry.get(), e.mode);
+        archive_entry_set_uid(entry.get(), e.uid);
+        archive_entry_set_gid(entry.get(), e.gid);
+        archive_entry_set_mtime(entry.get(), e.mtime, 0);
+        archive_entry_set_rdev(entry.get(), e.rdev);
+        archive_entry_set_nlink(entry.get(), 1);
+
+        if (S_ISLNK(e.mode)) {
+            archive_entry_set_symlink(entry.get(), e.symlink.c_str());
+        }
+
+        if (S_ISREG(e.mode)) {
+            archive_entry_set_size(entry.get(),
+                                   static_cast<la_int64_t>(e.data.size()));
+        } else {
+            archive_entry_set_size(entry.get(), 0);
+        }
+
+        if (archive_write_header(a.get(), entry.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to write ramdisk header: %s",
+                 e.path.c_str(), archive_error_string(a.get()));
+            return false;
+        }
+
+        if (S_ISREG(e.mode) && !e.data.empty()) {
+            auto n = archive_write_data(a.get(), e.data.data(), e.data.size());
+            if (n < 0 || static_cast<size_t>(n) != e.data.size()) {
+                LOGE("%s: Failed to write ramdisk entry data: %s",
+                     e.path.c_str(), archive_error_string(a.get()));
+                return false;
+            }
+        }
+    }
+
+    if (archive_write_close(a.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close ramdisk: %s", archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write cpio archive to memory
+ *
+ * \param[out] out String to store the (compressed) archive
+ *
+ * \return Whether the archive was successfully written
+ */
+bool Ramdisk::save(std::string &out) const
+{
+    out.clear();
+
+    return save([&](const void *buf, size_t size) -> oc::result<void> {
+        out.append(static_cast<const char *>(buf), size);
+        return oc::success();
+    });
+}
+
+RamdiskEntry * Ramdisk::find(const std::string &path)
+{
+    auto normalized = normalize_path(path.c_str());
+
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [&](const RamdiskEntry &e) {
+        return e.path == normalized;
+    });
+
+    return it == m_entries.end() ? nullptr : &*it;
+}
+
+bool Ramdisk::exists(const std::string &path) const
+{
+    return const_cast<Ramdisk *>(this)->find(path) != nullptr;
+}
+
+/*!
+ * \brief Add or replace regular file
+ *
+ * \note The parent directory must already exist in the ramdisk.
+ */
+RamdiskEntry & Ramdisk::add_file(const std::string &path, std::string data,
+                                 mode_t perm)
+{
+    RamdiskEntry &e = add_entry(path);
+    e.mode = S_IFREG | (perm & 07777);
+    e.data = std::move(data);
+    return e;
+}
+
+/*!
+ * \brief Add or replace symlink
+ *
+ * \note The parent directory must already exist in the ramdisk.
+ */
+RamdiskEntry & Ramdisk::add_symlink(const std::string &path,
+                                    const std::string &target)
+{
+    RamdiskEntry &e = add_entry(path);
+    e.mode = S_IFLNK | 0777;
+    e.symlink = target;
+    return e;
+}
+
+bool Ramdisk::remove(const std::string &path)
+{
+    auto normalized = normalize_path(path.c_str());
+
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [&](const RamdiskEntry &e) {
+        return e.path == normalized;
+    });
+    if (it == m_entries.end()) {
+        return false;
+    }
+
+    m_entries.erase(it);
+    return true;
+}
+
+/*!
+ * \brief Rename entry
+ *
+ * Like rename(2), an existing entry at \p to is replaced.
+ *
+ * \return Whether \p from exists
+ */
+bool Ramdisk::rename(const std::string &from, const std::string &to)
+{
+    RamdiskEntry *e = find(from);
+    if (!e) {
+        return false;
+    }
+
+    auto normalized = normalize_path(to.c_str());
+    if (e->path == normalized) {
+        return true;
+    }
+
+    // Find the source again after removing the target since erasing
+    // invalidates the pointer
+    remove(normalized);
+    find(from)->path = std::move(normalized);
+
+    return true;
+}
+
+const std::vector<RamdiskEntry> & Ramdisk::entries() const
+{
+    return m_entries;
+}
+
+RamdiskEntry & Ramdisk::add_entry(const std::string &path)
+{
+    RamdiskEntry *e = find(path);
+
+    if (!e) {
+        e = &m_entries.emplace_back();
+        e->path = normalize_path(path.c_str());
+    }
+
+    e->mode = 0;
+    e->uid = 0;
+    e->gid = 0;
+    e->mtime = time(nullptr);
+    e->rdev = 0;
+    e->data.clear();
+    e->symlink.clear();
+
+    return *e;
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "recovery/ramdisk.h"
+
+using namespace mb;
+
+// Build a newc archive where "a" and "b" are hard links to the same inode.
+// Like cpio and libarchive's link resolver, only the last member of the link
+// set carries the data.
+static std::string build_hardlink_archive(const std::string &data)
+{
+    std::string out;
+    out.resize(64 * 1024);
+    size_t used = 0;
+
+    archive *a = archive_write_new();
+    archive_entry *entry = archive_entry_new();
+
+    EXPECT_EQ(archive_write_set_format_cpio_newc(a), ARCHIVE_OK);
+    EXPECT_EQ(archive_write_open_memory(a, out.data(), out.size(), &used),
+              ARCHIVE_OK);
+
+    for (auto const &path : { "a", "b" }) {
+        bool last = path[0] == 'b';
+
+        archive_entry_clear(entry);
+        archive_entry_set_pathname(entry, path);
+        archive_entry_set_mode(entry, S_IFREG | 0644);
+        archive_entry_set_ino(entry, 42);
+        archive_entry_set_nlink(entry, 2);
+        archive_entry_set_size(entry, last
+                ? static_cast<la_int64_t>(data.size()) : 0);
+
+        EXPECT_EQ(archive_write_header(a, entry), ARCHIVE_OK);
+        if (last) {
+            EXPECT_EQ(archive_write_data(a, data.data(), data.size()),
+                      static_cast<la_ssize_t>(data.size()));
+        }
+    }
+
+    EXPECT_EQ(archive_write_close(a), ARCHIVE_OK);
+
+    archive_entry_free(entry);
+    archive_write_free(a);
+
+    out.resize(used);
+    return out;
+}
+
+TEST(RamdiskTest, HardLinkSetKeepsData)
+{
+    auto archive = build_hardlink_archive("hello");
+
+    Ramdisk ramdisk;
+    ASSERT_TRUE(ramdisk.load(archive.data(), archive.size()));
+
+    ASSERT_TRUE(ramdisk.find("a"));
+    ASSERT_TRUE(ramdisk.find("b"));
+    ASSERT_EQ(ramdisk.find("a")->data, "hello");
+    ASSERT_EQ(ramdisk.find("b")->data, "hello");
+
+    // Both members must survive a round trip
+    std::string saved;
+    ASSERT_TRUE(ramdisk.save(saved));
+
+    Ramdisk reloaded;
+    ASSERT_TRUE(reloaded.load(saved.data(), saved.size()));
+    ASSERT_TRUE(reloaded.find("a"));
+    ASSERT_TRUE(reloaded.find("b"));
+    ASSERT_EQ(reloaded.find("a")->data, "hello");
+    ASSERT_EQ(reloaded.find("b")->data, "hello");
+}
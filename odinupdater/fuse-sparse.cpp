@@ -19,9 +19,14 @@
 
 #define FUSE_USE_VERSION 26
 
+#include <algorithm>
+#include <array>
+#include <list>
+#include <memory>
 #include <mutex>
-#include <new>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -57,8 +62,10 @@
 #endif
 
 // libmbcommon
+#include "mbcommon/endian.h"
 #include "mbcommon/file.h"
-#include "mbcommon/file/standard.h"
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/fd.h"
 
 // libmbsparse
 #include "mbsparse/sparse.h"
@@ -69,16 +76,79 @@
 #define OFF_T off_t
 #endif
 
-static char source_fd_path[50];
-static uint64_t sparse_size;
+// Size of the blocks of raw source data kept in the cache
+constexpr size_t CACHE_BLOCK_SIZE = 64 * 1024;
+// The cache is split into shards, each with its own lock, so that concurrent
+// reads rarely contend. The total cache size is 4 MiB.
+constexpr size_t CACHE_SHARDS = 8;
+constexpr size_t CACHE_BLOCKS_PER_SHARD = 8;
 
-struct context
+/*!
+ * \brief LRU cache of raw source data blocks
+ *
+ * Blocks are immutable once inserted, so they are handed out as shared
+ * pointers and copied outside of the lock.
+ */
+class BlockCache
 {
-    mb::StandardFile source_file;
-    mb::sparse::SparseFile sparse_file;
-    std::mutex mutex;
+public:
+    using Block = std::shared_ptr<const std::vector<unsigned char>>;
+
+    Block get(uint64_t index)
+    {
+        auto &shard = m_shards[index % CACHE_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.map.find(index);
+        if (it == shard.map.end()) {
+            return nullptr;
+        }
+
+        // Mark as most recently used
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+
+        return it->second->second;
+    }
+
+    void put(uint64_t index, Block block)
+    {
+        auto &shard = m_shards[index % CACHE_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        // Another thread may have read the same block concurrently
+        if (auto it = shard.map.find(index); it != shard.map.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            return;
+        }
+
+        shard.lru.emplace_front(index, std::move(block));
+        shard.map.emplace(index, shard.lru.begin());
+
+        if (shard.lru.size() > CACHE_BLOCKS_PER_SHARD) {
+            shard.map.erase(shard.lru.back().first);
+            shard.lru.pop_back();
+        }
+    }
+
+private:
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<std::pair<uint64_t, Block>> lru;
+        std::unordered_map<uint64_t, decltype(lru)::iterator> map;
+    };
+
+    std::array<Shard, CACHE_SHARDS> m_shards;
 };
 
+// These are initialized before fuse starts and are read-only afterwards. The
+// source file is only accessed with positional reads, which are thread safe.
+static mb::FdFile source_file;
+static uint64_t sparse_size;
+static std::vector<mb::sparse::Extent> extents;
+
+static BlockCache cache;
+
 static std::optional<int> extract_errno(std::error_code ec)
 {
     if (ec.category() == std::generic_category()
@@ -100,80 +170,154 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -EROFS;
     }
 
-    context *ctx = new(std::nothrow) context();
-    if (!ctx) {
-        return -ENOMEM;
-    }
+    return 0;
+}
 
-    auto ret = ctx->source_file.open(source_fd_path,
-                                     mb::FileOpenMode::ReadOnly);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
+/*!
+ * \brief Get a block of raw source data from the cache or the source file
+ */
+static int get_source_block(uint64_t index, BlockCache::Block &block)
+{
+    block = cache.get(index);
+    if (block) {
+        return 0;
     }
 
-    ret = ctx->sparse_file.open(&ctx->source_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open sparse file: %s\n",
-                source_fd_path, ret.error().message().c_str());
-        delete ctx;
-        return -extract_errno(ret.error()).value_or(EIO);
+    auto data = std::make_shared<std::vector<unsigned char>>(CACHE_BLOCK_SIZE);
+    size_t total = 0;
+
+    // The last block may be short
+    while (total < data->size()) {
+        auto n = source_file.read_at(index * CACHE_BLOCK_SIZE + total,
+                                     data->data() + total,
+                                     data->size() - total);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            return -extract_errno(n.error()).value_or(EIO);
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        total += n.value();
     }
 
-    fi->fh = reinterpret_cast<uint64_t>(ctx);
+    data->resize(total);
+
+    block = data;
+    cache.put(index, block);
 
     return 0;
 }
 
 /*!
- * \brief Release callback for fuse
+ * \brief Read raw data from the source file through the block cache
  */
-static int fuse_release(const char *path, fuse_file_info *fi)
+static int read_source(uint64_t offset, char *buf, size_t size)
 {
-    (void) path;
+    while (size > 0) {
+        BlockCache::Block block;
+
+        auto index = offset / CACHE_BLOCK_SIZE;
+        auto block_offset = static_cast<size_t>(offset % CACHE_BLOCK_SIZE);
 
-    delete reinterpret_cast<context *>(fi->fh);
+        if (int ret = get_source_block(index, block); ret < 0) {
+            return ret;
+        } else if (block_offset >= block->size()) {
+            // Source file is truncated
+            return -EIO;
+        }
+
+        auto n = std::min(size, block->size() - block_offset);
+        memcpy(buf, block->data() + block_offset, n);
+
+        offset += n;
+        buf += n;
+        size -= n;
+    }
 
     return 0;
 }
 
 /*!
- * \brief Read from sparse file
+ * \brief Fill buffer with a repeated 32-bit value
  *
- * \warning Bad stuff will happen if \a ctx->mutex is not locked when this
- *          function is called
+ * \param shift Offset of \p buf relative to the start of the fill extent
  */
-static int fuse_read_locked(context *ctx, char *buf, size_t size,
-                            OFF_T offset)
+static void fill_pattern(char *buf, size_t size, uint32_t fill_val,
+                         uint64_t shift)
 {
-    // Seek to position
-    auto new_offset = ctx->sparse_file.seek(offset, SEEK_SET);
-    if (!new_offset) {
-        return -extract_errno(new_offset.error()).value_or(EIO);
-    }
+    unsigned char pattern[sizeof(uint32_t)];
+    uint32_t fill_val_le = mb_htole32(fill_val);
+    memcpy(pattern, &fill_val_le, sizeof(pattern));
 
-    auto n = ctx->sparse_file.read(buf, size);
-    if (!n) {
-        return -extract_errno(n.error()).value_or(EIO);
+    for (size_t i = 0; i < size; ++i) {
+        buf[i] = static_cast<char>(pattern[(shift + i) % sizeof(pattern)]);
     }
-
-    return static_cast<int>(n.value());
 }
 
 /*!
  * \brief Read callback for fuse
+ *
+ * Reads are served directly from the extent map, so any number of fuse worker
+ * threads can read concurrently. Fill and hole extents are synthesized without
+ * touching the source file.
  */
 static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
                      fuse_file_info *fi)
 {
     (void) path;
+    (void) fi;
+
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    auto pos = static_cast<uint64_t>(offset);
+    if (pos >= sparse_size) {
+        return 0;
+    }
+    size = static_cast<size_t>(std::min<uint64_t>(size, sparse_size - pos));
+
+    // Find the extent containing the offset. The extents are contiguous and
+    // cover the entire file (checked in load_sparse_file()).
+    auto it = std::upper_bound(extents.begin(), extents.end(), pos,
+                               [](uint64_t o, const mb::sparse::Extent &e) {
+        return o < e.begin;
+    });
+    if (it == extents.begin()) {
+        return -EIO;
+    }
+    --it;
+
+    size_t total = 0;
+
+    for (; total < size && it != extents.end(); ++it) {
+        auto n = static_cast<size_t>(
+                std::min<uint64_t>(size - total, it->end - pos));
+        auto extent_offset = pos - it->begin;
+
+        switch (it->type) {
+        case mb::sparse::ExtentType::Data:
+            if (int ret = read_source(it->src_offset + extent_offset,
+                                      buf + total, n); ret < 0) {
+                return ret;
+            }
+            break;
+        case mb::sparse::ExtentType::Fill:
+            fill_pattern(buf + total, n, it->fill_val, extent_offset);
+            break;
+        case mb::sparse::ExtentType::Hole:
+            memset(buf + total, 0, n);
+            break;
+        }
 
-    context *ctx = reinterpret_cast<context *>(fi->fh);
+        total += n;
+        pos += n;
+    }
 
-    std::lock_guard<std::mutex> lock(ctx->mutex);
-    return fuse_read_locked(ctx, buf, size, offset);
+    return static_cast<int>(total);
 }
 
 /*!
@@ -190,28 +334,53 @@ static int fuse_getattr(const char *path, struct stat *stbuf)
 }
 
 /*!
- * \brief Get size of sparse file (needed for fuse_getattr())
+ * \brief Load size and extent map of sparse file
  */
-static int get_sparse_file_size()
+static int load_sparse_file(const char *path)
 {
-    mb::StandardFile source_file;
+    mb::BufferedFile buffered_file;
     mb::sparse::SparseFile sparse_file;
 
-    auto ret = source_file.open(source_fd_path, mb::FileOpenMode::ReadOnly);
+    // Coalesces the small chunk header reads done by SparseFile
+    auto ret = buffered_file.open(&source_file);
     if (!ret) {
         fprintf(stderr, "%s: Failed to open file: %s\n",
-                source_fd_path, ret.error().message().c_str());
+                path, ret.error().message().c_str());
         return -extract_errno(ret.error()).value_or(EIO);
     }
 
-    ret = sparse_file.open(&source_file);
+    ret = sparse_file.open(&buffered_file);
     if (!ret) {
         fprintf(stderr, "%s: Failed to open sparse file: %s\n",
-                source_fd_path, ret.error().message().c_str());
+                path, ret.error().message().c_str());
         return -extract_errno(ret.error()).value_or(EIO);
     }
 
+    auto extents_ret = sparse_file.extents();
+    if (!extents_ret) {
+        fprintf(stderr, "%s: Failed to read sparse file chunks: %s\n",
+                path, extents_ret.error().message().c_str());
+        return -extract_errno(extents_ret.error()).value_or(EIO);
+    }
+
     sparse_size = sparse_file.size();
+    extents = std::move(extents_ret.value());
+
+    // fuse_read() relies on the extents covering the file with no gaps
+    uint64_t expected_begin = 0;
+    for (auto const &extent : extents) {
+        if (extent.begin != expected_begin || extent.end <= extent.begin) {
+            fprintf(stderr, "%s: Sparse file extents are not contiguous\n",
+                    path);
+            return -EIO;
+        }
+        expected_begin = extent.end;
+    }
+    if (expected_begin != sparse_size) {
+        fprintf(stderr, "%s: Sparse file extents do not cover the file\n",
+                path);
+        return -EIO;
+    }
 
     return 0;
 }
@@ -299,10 +468,15 @@ int main(int argc, char *argv[])
                     arg_ctx.source_file, strerror(errno));
             return EXIT_FAILURE;
         }
-        snprintf(source_fd_path, sizeof(source_fd_path),
-                 "/proc/self/fd/%d", fd);
 
-        if (get_sparse_file_size() < 0) {
+        if (auto r = source_file.open(fd, false); !r) {
+            fprintf(stderr, "%s: Failed to open: %s\n",
+                    arg_ctx.source_file, r.error().message().c_str());
+            close(fd);
+            return EXIT_FAILURE;
+        }
+
+        if (load_sparse_file(arg_ctx.source_file) < 0) {
             close(fd);
             return EXIT_FAILURE;
         }
@@ -312,7 +486,6 @@ int main(int argc, char *argv[])
     fuse_oper.getattr = fuse_getattr;
     fuse_oper.open    = fuse_open;
     fuse_oper.read    = fuse_read;
-    fuse_oper.release = fuse_release;
 
     int fuse_ret = fuse_main(args.argc, args.argv, &fuse_oper, nullptr);
 
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <future>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -30,6 +31,8 @@
 #include <cstring>
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -37,7 +40,10 @@
 // libmbcommon
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file/tracing.h"
+#include "mbcommon/file/uring.h"
 #include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
@@ -73,6 +79,8 @@
 #define TEMP_OMC_ZIP_FILE       TEMP_CACHE_MOUNT_DIR "/recovery/sec_omc.zip"
 #define TEMP_FUSE_SPARSE_FILE   "/tmp/fuse-sparse"
 
+#define EXTRACT_BUF_SIZE        (1024 * 1024)
+
 #define EFS_SALES_CODE_FILE     "/efs/imei/mps_code.dat"
 
 #define PROP_SYSTEM_DEV         "system"
@@ -387,15 +395,56 @@ private:
     archive *m_archive;
 };
 
+/*!
+ * \brief Clear a range of the output without writing to it
+ *
+ * For block devices, holes are discarded and zero-filled ranges are zeroed out
+ * by the device. For regular files, both are deallocated by punching a hole.
+ *
+ * \return Whether the range was handled. If false, the data must be written
+ *         normally.
+ */
+static bool clear_output_range(mb::FdFile &file, bool is_block_dev,
+                               mb::sparse::ExtentType type,
+                               uint64_t offset, uint64_t size)
+{
+    if (is_block_dev) {
+        uint64_t range[2] = { offset, size };
+
+        if (type == mb::sparse::ExtentType::Hole) {
+            // The contents of a hole don't matter, so it can be skipped even
+            // if the device does not support discard
+            (void) ioctl(file.native_fd(), BLKDISCARD, &range);
+            return true;
+        }
+
+        return ioctl(file.native_fd(), BLKZEROOUT, &range) == 0;
+    }
+
+    return !!file.punch_hole(offset, size);
+}
+
 static ExtractResult extract_sparse_file(const char *zip_filename,
                                          const char *out_filename)
 {
     using namespace std::placeholders;
 
+    // Double buffering: while one buffer is being written asynchronously, the
+    // next part of the sparse file is read into the other one. The buffers
+    // must outlive out_file, which waits for pending writes when destroyed.
+    std::vector<char> bufs[2] = {
+        std::vector<char>(EXTRACT_BUF_SIZE),
+        std::vector<char>(EXTRACT_BUF_SIZE),
+    };
+    size_t cur_buf = 0;
+    std::future<mb::oc::result<size_t>> pending_write;
+    size_t pending_size = 0;
+
     ScopedArchive a{archive_read_new(), &archive_read_free};
     LibArchiveEntryFile file(a.get());
+    mb::TracingFile traced_file(&file, zip_filename);
     mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
+    mb::UringFile out_file;
 
     if (!a) {
         error("Out of memory");
@@ -412,35 +461,66 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return r;
     }
 
-    if (auto r = sparse_file.open(&file); !r) {
+    traced_file.set_report_callback([](const mb::TracingFile &f) {
+        info("I/O statistics for %s", f.summary().c_str());
+    });
+
+    if (auto r = sparse_file.open(&traced_file); !r) {
         error("Failed to open sparse file: %s",
               r.error().message().c_str());
         return ExtractResult::Error;
     }
 
+    // The image is read sequentially, so the checksums can be verified without
+    // an extra pass. A mismatch is reported as a read error below.
+    if (auto r = sparse_file.set_verify_crc32(true); !r) {
+        error("Failed to enable sparse file verification: %s",
+              r.error().message().c_str());
+        return ExtractResult::Error;
+    }
+
     if (auto r = out_file.open(out_filename, mb::FileOpenMode::WriteOnly); !r) {
         error("%s: Failed to open for writing: %s",
               out_filename, r.error().message().c_str());
         return ExtractResult::Error;
     }
 
-    char buf[10240];
+    struct stat sb;
+    if (fstat(out_file.native_fd(), &sb) < 0) {
+        error("%s: Failed to stat: %s", out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+    bool is_block_dev = S_ISBLK(sb.st_mode);
+
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = sparse_file.size();
     uint64_t old_bytes = 0;
 
-    set_progress(0);
+    // Preallocate the output to avoid fragmentation. This is not supported for
+    // block devices, which is fine.
+    (void) out_file.allocate(0, max_bytes);
 
-    while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
+    auto finish_write = [&]() {
+        if (!pending_write.valid()) {
+            return true;
+        }
+
+        auto n = pending_write.get();
         if (!n) {
-            error("Failed to read sparse file %s: %s",
-                  zip_filename, n.error().message().c_str());
-            return ExtractResult::Error;
-        } else if (n.value() == 0) {
-            break;
+            error("%s: Failed to write file: %s",
+                  out_filename, n.error().message().c_str());
+            return false;
+        } else if (n.value() != pending_size) {
+            error("%s: Failed to write file: %s", out_filename,
+                  std::error_code(mb::FileError::UnexpectedEof)
+                          .message().c_str());
+            return false;
         }
 
+        return true;
+    };
+
+    auto update_progress = [&]() {
         // Rate limit: update progress only after difference exceeds 0.1%
         double old_ratio = static_cast<double>(old_bytes) / max_bytes;
         double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
@@ -448,20 +528,79 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             set_progress(new_ratio);
             old_bytes = cur_bytes;
         }
+    };
 
-        char *out_ptr = buf;
+    set_progress(0);
 
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
+    while (true) {
+        auto extent = sparse_file.extent_at(cur_bytes);
+        if (!extent) {
+            error("Failed to read sparse file %s: %s",
+                  zip_filename, extent.error().message().c_str());
+            return ExtractResult::Error;
+        }
+
+        // Skip writing holes and zero-filled extents if possible
+        if (auto const &e = extent.value(); e
+                && (e->type == mb::sparse::ExtentType::Hole
+                        || (e->type == mb::sparse::ExtentType::Fill
+                                && e->fill_val == 0))
+                && clear_output_range(out_file, is_block_dev, e->type,
+                                      cur_bytes, e->end - cur_bytes)) {
+            if (auto r = sparse_file.seek(static_cast<int64_t>(e->end),
+                                          SEEK_SET); !r) {
+                error("Failed to seek sparse file %s: %s",
+                      zip_filename, r.error().message().c_str());
                 return ExtractResult::Error;
             }
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
+            cur_bytes = e->end;
+            update_progress();
+            continue;
+        }
+
+        auto &buf = bufs[cur_buf];
+        size_t to_read = buf.size();
+        if (extent.value()) {
+            to_read = static_cast<size_t>(std::min<uint64_t>(
+                    to_read, extent.value()->end - cur_bytes));
+        }
+
+        auto n = mb::file_read_retry(sparse_file, buf.data(), to_read);
+        if (!n) {
+            error("Failed to read sparse file %s: %s",
+                  zip_filename, n.error().message().c_str());
+            return ExtractResult::Error;
+        }
+
+        if (!finish_write()) {
+            return ExtractResult::Error;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        pending_write = out_file.write_async(cur_bytes, buf.data(), n.value());
+        pending_size = n.value();
+
+        if (auto r = out_file.submit(); !r) {
+            error("%s: Failed to write file: %s",
+                  out_filename, r.error().message().c_str());
+            return ExtractResult::Error;
+        }
+
+        cur_bytes += n.value();
+        cur_buf ^= 1;
+
+        update_progress();
+    }
+
+    // Make sure the file has the right size if it ends with a hole and could
+    // not be preallocated
+    if (!is_block_dev) {
+        if (auto r = out_file.truncate(max_bytes); !r) {
+            error("%s: Failed to truncate file: %s",
+                  out_filename, r.error().message().c_str());
+            return ExtractResult::Error;
         }
     }
 